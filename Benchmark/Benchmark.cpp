@@ -0,0 +1,761 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Benchmark.cpp
+//
+// Purpose:    Benchmark harness for the kernels of the solution : vadd,
+//             pi_inte, the Monte Carlo hello and mandel, each over a sweep
+//             of problem sizes. The kernel sources are those of the targets
+//             themselves, shared through the *Kernel.h headers of Common.
+//
+//             Every case is built (build time is reported apart), launched
+//             -warmup times to leave JIT, first touch and clock ramp up
+//             behind, the first of those launches being reported as the
+//             cold run, then timed -repeat times with the profiling events.
+//             The report gives min / median / p95 / p99 / mean and a derived
+//             metric from the median : GB/s, GFLOP/s, Msamples/s or Mpixels/s.
+//
+//             -json writes every case with its raw samples, -csv one line per
+//             case, for regression tracking.
+//
+//             -compare reads two -json files and tests every case present in
+//             both : a two-sided Mann-Whitney U test on the samples, and a
+//             bootstrap confidence interval of the ratio of the medians. A
+//             case regresses when the test is significant and the whole
+//             interval is slower than the threshold ; the exit code is 1 when
+//             any case regresses, so the comparison can gate a change.
+//
+// Usage:      Benchmark [-cpu] [-quick] [-warmup n] [-repeat n]
+//                       [-filter kernel] [-json file] [-csv file]
+//             Benchmark -compare base.json new.json [-threshold percent]
+//                       [-alpha level]
+//
+//------------------------------------------------------------------------------
+
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#ifdef APPLE
+#include <OpenCL/opencl.h>
+#include <unistd.h>
+#else
+#include "CL/cl.h"
+#endif
+#include "../Common/Philox.h"
+#include "../Common/VaddKernel.h"
+#include "../Common/PiKernel.h"
+#include "../Common/MonteCarloKernel.h"
+#include "../Common/MandelKernel.h"
+
+//------------------------------------------------------------------------------
+
+#define WARMUP 3               // default warm up launches
+#define REPEAT 30              // default timed launches
+#define PI_NWORKITER 256       // pi_inte steps per work-item
+#define PI_LOCAL 64            // pi_inte work-group size
+#define HELLO_LOCAL 256        // hello work-group size
+#define MANDEL_LOCAL 16        // mandel work-group side
+#define THRESHOLD 5.0          // default relevant slow down, in percent
+#define ALPHA 0.01             // default significance level
+#define BOOTSTRAP 2000         // bootstrap resamples
+
+//------------------------------------------------------------------------------
+
+struct benchStats {
+    double min, median, p95, p99, mean, stddev;
+};
+
+struct benchResult {
+    std::string kernel;
+    std::string params;
+    std::string unit;              // unit of the derived metric
+    double work;                   // metric units per launch
+    double build_ms;
+    double cold_ms;                // first warm up launch
+    std::vector<double> samples;   // timed launches, ms
+    benchStats stats;
+    double metric;                 // work / median
+};
+
+struct benchContext {
+    cl_context context;
+    cl_device_id device;
+    cl_command_queue queue;
+    int warmup, repeat;
+    std::vector<benchResult> results;
+};
+
+// nearest rank percentile of sorted samples
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+static benchStats computeStats(const std::vector<double>& samples)
+{
+    std::vector<double> v(samples);
+    benchStats st;
+    size_t i, n = v.size();
+
+    std::sort(v.begin(), v.end());
+    st.min = v[0];
+    st.median = n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+    st.p95 = percentile(v, 95.0);
+    st.p99 = percentile(v, 99.0);
+    st.mean = 0.0;
+    for (i = 0; i < n; i++)
+        st.mean += v[i];
+    st.mean /= n;
+    st.stddev = 0.0;
+    for (i = 0; i < n; i++)
+        st.stddev += (v[i] - st.mean) * (v[i] - st.mean);
+    st.stddev = n > 1 ? sqrt(st.stddev / (n - 1)) : 0.0;
+    return st;
+}
+
+static cl_program buildProgram(benchContext& b, cl_uint nsources, const char** sources, const char* options, double* build_ms)
+{
+    cl_program program;
+    int err;
+    double rtime = clock();
+
+    program = clCreateProgramWithSource(b.context, nsources, sources, NULL, &err);
+    if (!program)
+    {
+        printf("Error: Failed to create compute program!\n");
+        exit(1);
+    }
+    err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build program executable!\n");
+        clGetProgramBuildInfo(program, b.device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        exit(1);
+    }
+    *build_ms = (clock() - rtime) * 1000.0 / CLOCKS_PER_SEC;
+    return program;
+}
+
+// one launch, device time in ms
+static double launch(benchContext& b, cl_kernel kernel, cl_uint dims, const size_t* global, const size_t* local)
+{
+    cl_event event;
+    cl_ulong ev_start_time = (cl_ulong)0;
+    cl_ulong ev_end_time = (cl_ulong)0;
+    int err;
+
+    err = clEnqueueNDRangeKernel(b.queue, kernel, dims, NULL, global, local, 0, NULL, &event);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to execute kernel! %d\n", err);
+        exit(1);
+    }
+    clWaitForEvents(1, &event);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+    clReleaseEvent(event);
+    return (double)(ev_end_time - ev_start_time) * 1.0e-6;
+}
+
+// warm up then timed launches, the result is printed and kept
+static void measure(benchContext& b, benchResult& r, cl_kernel kernel, cl_uint dims, const size_t* global, const size_t* local)
+{
+    int i;
+
+    r.cold_ms = 0.0;
+    for (i = 0; i < b.warmup; i++) {
+        double ms = launch(b, kernel, dims, global, local);
+        if (i == 0)
+            r.cold_ms = ms;
+    }
+    r.samples.clear();
+    for (i = 0; i < b.repeat; i++)
+        r.samples.push_back(launch(b, kernel, dims, global, local));
+
+    r.stats = computeStats(r.samples);
+    r.metric = r.work / (r.stats.median * 1.0e-3);
+    printf("%-8s %-22s : min %9.4f | med %9.4f | p95 %9.4f | p99 %9.4f ms | cold %9.4f | build %7.1f ms || %9.3f %s\n",
+        r.kernel.c_str(), r.params.c_str(), r.stats.min, r.stats.median, r.stats.p95, r.stats.p99,
+        r.cold_ms, r.build_ms, r.metric, r.unit.c_str());
+    b.results.push_back(r);
+}
+
+// work-group size : wanted, capped by the kernel and kept a divisor of the power of two global sizes
+static size_t fitLocal(benchContext& b, cl_kernel kernel, size_t wanted)
+{
+    size_t max_local = wanted;
+    clGetKernelWorkGroupInfo(kernel, b.device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_local), &max_local, NULL);
+    while (wanted > max_local)
+        wanted >>= 1;
+    return wanted;
+}
+
+//------------------------------------------------------------------------------
+
+static void benchVadd(benchContext& b, const std::vector<unsigned int>& sizes)
+{
+    benchResult r;
+    cl_program program = buildProgram(b, 1, &VaddSource, NULL, &r.build_ms);
+    cl_kernel kernel = clCreateKernel(program, "vadd", NULL);
+    size_t s;
+    unsigned int i;
+
+    for (s = 0; s < sizes.size(); s++)
+    {
+        unsigned int count = sizes[s];
+        size_t bytes = sizeof(float) * count;
+        std::vector<float> a_data(count), b_data(count), c_res(count);
+        for (i = 0; i < count; i++) {
+            a_data[i] = rand() / (float)RAND_MAX;
+            b_data[i] = rand() / (float)RAND_MAX;
+        }
+        cl_mem a_in = clCreateBuffer(b.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &a_data[0], NULL);
+        cl_mem b_in = clCreateBuffer(b.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &b_data[0], NULL);
+        cl_mem c_out = clCreateBuffer(b.context, CL_MEM_WRITE_ONLY, bytes, NULL, NULL);
+        if (!a_in || !b_in || !c_out)
+        {
+            printf("Error: Failed to allocate device memory!\n");
+            exit(1);
+        }
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_in);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in);
+        clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_out);
+        clSetKernelArg(kernel, 3, sizeof(unsigned int), &count);
+
+        size_t local = fitLocal(b, kernel, 256);
+        size_t global = ((count + local - 1) / local) * local;
+        char params[64];
+        sprintf(params, "n=%u", count);
+        r.kernel = "vadd";
+        r.params = params;
+        r.unit = "GB/s";
+        r.work = 3.0 * bytes * 1.0e-9;
+        measure(b, r, kernel, 1, &global, &local);
+        r.build_ms = 0.0;
+
+        clEnqueueReadBuffer(b.queue, c_out, CL_TRUE, 0, bytes, &c_res[0], 0, NULL, NULL);
+        for (i = 0; i < count && fabs(a_data[i] + b_data[i] - c_res[i]) < 1e-3; i++);
+        if (i < count)
+            printf("Warning: vadd n=%u wrong at element %u\n", count, i);
+
+        clReleaseMemObject(a_in);
+        clReleaseMemObject(b_in);
+        clReleaseMemObject(c_out);
+    }
+    clReleaseKernel(kernel);
+    clReleaseProgram(program);
+}
+
+static void benchPi(benchContext& b, const std::vector<unsigned int>& sizes)
+{
+    benchResult r;
+    cl_program program = buildProgram(b, 1, &PiSource, NULL, &r.build_ms);
+    cl_kernel kernel = clCreateKernel(program, "pi_inte", NULL);
+    size_t local = fitLocal(b, kernel, PI_LOCAL);
+    unsigned int nworkiter = PI_NWORKITER;
+    size_t s, g;
+
+    for (s = 0; s < sizes.size(); s++)
+    {
+        unsigned int steps = sizes[s];
+        size_t global = steps / nworkiter;
+        // whole work-groups : step follows the rounded up count, so the
+        // extra work-items stay within [0, 1]
+        global = global < local ? local : (global + local - 1) / local * local;
+        size_t ngroups = global / local;
+        double step = 1.0 / ((double)global * nworkiter);
+        std::vector<double> partial(2 * ngroups);
+        cl_mem ypartial = clCreateBuffer(b.context, CL_MEM_WRITE_ONLY, sizeof(double) * 2 * ngroups, NULL, NULL);
+        if (!ypartial)
+        {
+            printf("Error: Failed to allocate device memory!\n");
+            exit(1);
+        }
+        clSetKernelArg(kernel, 0, sizeof(double) * 2 * local, NULL);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), &ypartial);
+        clSetKernelArg(kernel, 2, sizeof(double), &step);
+        clSetKernelArg(kernel, 3, sizeof(unsigned int), &nworkiter);
+
+        char params[64];
+        sprintf(params, "steps=%lu", (unsigned long)(global * nworkiter));
+        r.kernel = "pi_inte";
+        r.params = params;
+        r.unit = "GFLOP/s";
+        // x = (i + 0.5) * step, 1 + x * x, 4 / ..., the sum : 6 flops per step
+        r.work = 6.0 * global * nworkiter * 1.0e-9;
+        measure(b, r, kernel, 1, &global, &local);
+        r.build_ms = 0.0;
+
+        clEnqueueReadBuffer(b.queue, ypartial, CL_TRUE, 0, sizeof(double) * 2 * ngroups, &partial[0], 0, NULL, NULL);
+        double pi = 0.0;
+        for (g = 0; g < ngroups; g++)
+            pi += partial[2 * g] + partial[2 * g + 1];
+        pi *= step;
+        if (fabs(pi - 3.14159265358979323846) > 1e-6)
+            printf("Warning: pi_inte %s gives %.12f\n", params, pi);
+
+        clReleaseMemObject(ypartial);
+    }
+    clReleaseKernel(kernel);
+    clReleaseProgram(program);
+}
+
+static void benchHello(benchContext& b, const std::vector<unsigned int>& sizes)
+{
+    benchResult r;
+    const char* sources[2] = { PhiloxSource, MonteCarloSource };
+    cl_program program = buildProgram(b, 2, sources, NULL, &r.build_ms);
+    cl_kernel kernel = clCreateKernel(program, "hello", NULL);
+    size_t local = fitLocal(b, kernel, HELLO_LOCAL);
+    unsigned int seed = 1234, iter = 0;
+    size_t s;
+
+    for (s = 0; s < sizes.size(); s++)
+    {
+        size_t global = sizes[s] < local ? local : sizes[s];
+        size_t ngroups = global / local;
+        cl_mem output = clCreateBuffer(b.context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * ngroups, NULL, NULL);
+        if (!output)
+        {
+            printf("Error: Failed to allocate device memory!\n");
+            exit(1);
+        }
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+        clSetKernelArg(kernel, 1, sizeof(cl_uint) * local, NULL);
+        clSetKernelArg(kernel, 2, sizeof(cl_uint), &seed);
+        clSetKernelArg(kernel, 3, sizeof(cl_uint), &iter);
+
+        char params[64];
+        sprintf(params, "items=%lu", (unsigned long)global);
+        r.kernel = "hello";
+        r.params = params;
+        r.unit = "Msamples/s";
+        r.work = 2.0 * global * 1.0e-6;
+        measure(b, r, kernel, 1, &global, &local);
+        r.build_ms = 0.0;
+
+        clReleaseMemObject(output);
+    }
+    clReleaseKernel(kernel);
+    clReleaseProgram(program);
+}
+
+static void benchMandel(benchContext& b, const std::vector<unsigned int>& sizes, const std::vector<unsigned int>& iters)
+{
+    benchResult r;
+    cl_program program = buildProgram(b, 1, &MandelSource, NULL, &r.build_ms);
+    cl_kernel kernel = clCreateKernel(program, "mandel", NULL);
+    size_t side = MANDEL_LOCAL;
+    size_t s;
+
+    while (side * side > fitLocal(b, kernel, 1024))
+        side >>= 1;
+
+    for (s = 0; s < sizes.size(); s++)
+    {
+        unsigned int width = sizes[s];
+        unsigned int maxIter = iters[s];
+        double x0 = -2.0, y0 = 1.25, stepsize = 2.5 / width;
+        cl_mem framebuffer = clCreateBuffer(b.context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * width * width, NULL, NULL);
+        if (!framebuffer)
+        {
+            printf("Error: Failed to allocate device memory!\n");
+            exit(1);
+        }
+        clSetKernelArg(kernel, 0, sizeof(double), &x0);
+        clSetKernelArg(kernel, 1, sizeof(double), &y0);
+        clSetKernelArg(kernel, 2, sizeof(double), &stepsize);
+        clSetKernelArg(kernel, 3, sizeof(unsigned int), &maxIter);
+        clSetKernelArg(kernel, 4, sizeof(cl_mem), &framebuffer);
+        clSetKernelArg(kernel, 5, sizeof(unsigned int), &width);
+        clSetKernelArg(kernel, 6, sizeof(unsigned int), &width);
+
+        // rounded up to whole work-groups, the kernel skips the pixels past the edges
+        size_t padded = (width + side - 1) / side * side;
+        size_t global[2] = { padded, padded };
+        size_t local[2] = { side, side };
+        char params[64];
+        sprintf(params, "%ux%u iter=%u", width, width, maxIter);
+        r.kernel = "mandel";
+        r.params = params;
+        r.unit = "Mpixels/s";
+        r.work = (double)width * width * 1.0e-6;
+        measure(b, r, kernel, 2, global, local);
+        r.build_ms = 0.0;
+
+        clReleaseMemObject(framebuffer);
+    }
+    clReleaseKernel(kernel);
+    clReleaseProgram(program);
+}
+
+//------------------------------------------------------------------------------
+
+static int writeJson(const benchContext& b, const char* device_name, const char* path)
+{
+    FILE* f = fopen(path, "w");
+    size_t i, k;
+    if (!f)
+    {
+        printf("Error: Failed to open %s!\n", path);
+        return 1;
+    }
+    fprintf(f, "{\n\"device\": \"%s\",\n\"warmup\": %d,\n\"repeat\": %d,\n\"results\": [", device_name, b.warmup, b.repeat);
+    for (i = 0; i < b.results.size(); i++) {
+        const benchResult& r = b.results[i];
+        fprintf(f, "%s\n{\"kernel\": \"%s\", \"params\": \"%s\", \"unit\": \"%s\", \"metric\": %.6g,"
+            " \"build_ms\": %.4f, \"cold_ms\": %.6f, \"min_ms\": %.6f, \"median_ms\": %.6f, \"p95_ms\": %.6f,"
+            " \"p99_ms\": %.6f, \"mean_ms\": %.6f, \"stddev_ms\": %.6f,\n \"samples_ms\": [",
+            i ? "," : "", r.kernel.c_str(), r.params.c_str(), r.unit.c_str(), r.metric, r.build_ms, r.cold_ms,
+            r.stats.min, r.stats.median, r.stats.p95, r.stats.p99, r.stats.mean, r.stats.stddev);
+        for (k = 0; k < r.samples.size(); k++)
+            fprintf(f, "%s%.6f", k ? ", " : "", r.samples[k]);
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n]\n}\n");
+    fclose(f);
+    return 0;
+}
+
+static int writeCsv(const benchContext& b, const char* path)
+{
+    FILE* f = fopen(path, "w");
+    size_t i;
+    if (!f)
+    {
+        printf("Error: Failed to open %s!\n", path);
+        return 1;
+    }
+    fprintf(f, "kernel,params,warmup,repeat,build_ms,cold_ms,min_ms,median_ms,p95_ms,p99_ms,mean_ms,stddev_ms,metric,unit\n");
+    for (i = 0; i < b.results.size(); i++) {
+        const benchResult& r = b.results[i];
+        fprintf(f, "%s,%s,%d,%d,%.4f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6g,%s\n",
+            r.kernel.c_str(), r.params.c_str(), b.warmup, b.repeat, r.build_ms, r.cold_ms, r.stats.min,
+            r.stats.median, r.stats.p95, r.stats.p99, r.stats.mean, r.stats.stddev, r.metric, r.unit.c_str());
+    }
+    fclose(f);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//
+// Comparison of two result files
+//
+
+// cases of a file written by writeJson, only what the comparison needs
+static int readJson(const char* path, std::vector<benchResult>& results)
+{
+    FILE* f = fopen(path, "rb");
+    std::string text;
+    char buffer[4096];
+    size_t n, pos = 0;
+
+    if (!f)
+    {
+        printf("Error: Failed to open %s!\n", path);
+        return 1;
+    }
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        text.append(buffer, n);
+    fclose(f);
+
+    while ((pos = text.find("{\"kernel\": \"", pos)) != std::string::npos)
+    {
+        benchResult r;
+        size_t end = text.find('}', pos);
+        size_t k, e;
+
+        pos += 12;
+        e = text.find('"', pos);
+        r.kernel = text.substr(pos, e - pos);
+        k = text.find("\"params\": \"", pos);
+        e = text.find('"', k + 11);
+        r.params = text.substr(k + 11, e - k - 11);
+        k = text.find("\"unit\": \"", pos);
+        e = text.find('"', k + 9);
+        r.unit = text.substr(k + 9, e - k - 9);
+
+        k = text.find("\"samples_ms\": [", pos);
+        if (k == std::string::npos || k > end)
+        {
+            printf("Error: %s : no samples for %s %s!\n", path, r.kernel.c_str(), r.params.c_str());
+            return 1;
+        }
+        const char* p = text.c_str() + k + 15;
+        while (*p && *p != ']') {
+            char* next;
+            double v = strtod(p, &next);
+            if (next == p)
+                break;
+            r.samples.push_back(v);
+            p = next;
+            while (*p == ',' || *p == ' ')
+                p++;
+        }
+        if (r.samples.empty())
+        {
+            printf("Error: %s : no samples for %s %s!\n", path, r.kernel.c_str(), r.params.c_str());
+            return 1;
+        }
+        r.stats = computeStats(r.samples);
+        results.push_back(r);
+        pos = end;
+    }
+    return 0;
+}
+
+// two-sided p value of the Mann-Whitney U test, normal approximation with tie correction
+static double mannWhitney(const std::vector<double>& a, const std::vector<double>& b)
+{
+    std::vector<std::pair<double, int> > all;
+    size_t i, j, n1 = a.size(), n2 = b.size(), n = n1 + n2;
+    double rank_a = 0.0, ties = 0.0;
+
+    for (i = 0; i < n1; i++)
+        all.push_back(std::make_pair(a[i], 0));
+    for (i = 0; i < n2; i++)
+        all.push_back(std::make_pair(b[i], 1));
+    std::sort(all.begin(), all.end());
+
+    // tied values share the mean of their ranks
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && all[j].first == all[i].first; j++);
+        double rank = 0.5 * (i + 1 + j);
+        double t = (double)(j - i);
+        ties += t * t * t - t;
+        for (size_t k = i; k < j; k++)
+            if (all[k].second == 0)
+                rank_a += rank;
+    }
+
+    double u = rank_a - n1 * (n1 + 1) / 2.0;
+    double mean = n1 * n2 / 2.0;
+    double var = n1 * n2 / 12.0 * ((n + 1) - ties / ((double)n * (n - 1)));
+    if (var <= 0.0)
+        return 1.0;
+    // continuity correction
+    double z = (fabs(u - mean) - 0.5) / sqrt(var);
+    if (z < 0.0)
+        z = 0.0;
+    return erfc(z / sqrt(2.0));
+}
+
+static double median(std::vector<double>& v)
+{
+    size_t n = v.size();
+    std::sort(v.begin(), v.end());
+    return n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+// 95% bootstrap interval of median(b) / median(a), same draws on every run
+static void bootstrapRatio(const std::vector<double>& a, const std::vector<double>& b, double* lo, double* hi)
+{
+    std::vector<double> ratios(BOOTSTRAP), ra(a.size()), rb(b.size());
+    unsigned int state = 2463534242u;
+    size_t i, k;
+
+    for (k = 0; k < BOOTSTRAP; k++) {
+        for (i = 0; i < ra.size(); i++) {
+            state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+            ra[i] = a[state % a.size()];
+        }
+        for (i = 0; i < rb.size(); i++) {
+            state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+            rb[i] = b[state % b.size()];
+        }
+        ratios[k] = median(rb) / median(ra);
+    }
+    std::sort(ratios.begin(), ratios.end());
+    *lo = percentile(ratios, 2.5);
+    *hi = percentile(ratios, 97.5);
+}
+
+static int runCompare(const char* base_path, const char* new_path, double threshold, double alpha)
+{
+    std::vector<benchResult> base, cur;
+    size_t i, j;
+    int regressions = 0, improvements = 0, missing = 0;
+
+    if (readJson(base_path, base) || readJson(new_path, cur))
+        return 2;
+    printf("Compare %s (base) with %s, threshold %.1f%%, alpha %g\n\n", base_path, new_path, threshold, alpha);
+    printf("%-8s %-22s   %12s %12s %8s   %-20s %9s   %s\n",
+        "kernel", "params", "base med ms", "new med ms", "delta", "95% CI", "p", "verdict");
+
+    for (i = 0; i < base.size(); i++)
+    {
+        const benchResult& a = base[i];
+        for (j = 0; j < cur.size() && !(cur[j].kernel == a.kernel && cur[j].params == a.params); j++);
+        if (j == cur.size()) {
+            printf("%-8s %-22s   missing from the new run\n", a.kernel.c_str(), a.params.c_str());
+            missing++;
+            continue;
+        }
+        const benchResult& b = cur[j];
+
+        double p = mannWhitney(a.samples, b.samples);
+        double lo, hi;
+        bootstrapRatio(a.samples, b.samples, &lo, &hi);
+        double delta = 100.0 * (b.stats.median / a.stats.median - 1.0);
+        double lo_pct = 100.0 * (lo - 1.0), hi_pct = 100.0 * (hi - 1.0);
+
+        // significant and the whole interval beyond the threshold
+        const char* verdict = "pass";
+        if (p < alpha && lo_pct > threshold) {
+            verdict = "REGRESSION";
+            regressions++;
+        }
+        else if (p < alpha && hi_pct < -threshold) {
+            verdict = "improved";
+            improvements++;
+        }
+        printf("%-8s %-22s   %12.4f %12.4f %+7.1f%%   [%+7.1f%%, %+7.1f%%] %9.2g   %s\n",
+            a.kernel.c_str(), a.params.c_str(), a.stats.median, b.stats.median, delta, lo_pct, hi_pct, p, verdict);
+    }
+    for (j = 0; j < cur.size(); j++) {
+        for (i = 0; i < base.size() && !(base[i].kernel == cur[j].kernel && base[i].params == cur[j].params); i++);
+        if (i == base.size())
+            printf("%-8s %-22s   new case, no base\n", cur[j].kernel.c_str(), cur[j].params.c_str());
+    }
+
+    printf("\n%s : %d regressions, %d improvements, %d cases missing\n",
+        regressions ? "FAIL" : "PASS", regressions, improvements, missing);
+    return regressions ? 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+
+
+int main(int argc, char** argv)
+{
+    int err;
+    int i;
+    cl_device_id device_id;
+    benchContext b;
+
+    cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+    const char* filter = NULL;
+    const char* json_path = NULL;
+    const char* csv_path = NULL;
+    const char* compare[2] = { NULL, NULL };
+    double threshold = THRESHOLD, alpha = ALPHA;
+    int quick = 0;
+    b.warmup = WARMUP;
+    b.repeat = REPEAT;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-cpu") == 0) device_type = CL_DEVICE_TYPE_CPU;
+        else if (strcmp(argv[i], "-quick") == 0) quick = 1;
+        else if (strcmp(argv[i], "-warmup") == 0 && i + 1 < argc) b.warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) b.repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-filter") == 0 && i + 1 < argc) filter = argv[++i];
+        else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "-csv") == 0 && i + 1 < argc) csv_path = argv[++i];
+        else if (strcmp(argv[i], "-compare") == 0 && i + 2 < argc) {
+            compare[0] = argv[++i];
+            compare[1] = argv[++i];
+        }
+        else if (strcmp(argv[i], "-threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "-alpha") == 0 && i + 1 < argc) alpha = atof(argv[++i]);
+        else
+        {
+            printf("Usage: Benchmark [-cpu] [-quick] [-warmup n] [-repeat n] [-filter kernel] [-json file] [-csv file]\n");
+            printf("       Benchmark -compare base.json new.json [-threshold percent] [-alpha level]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // no device needed to compare
+    if (compare[0])
+        return runCompare(compare[0], compare[1], threshold, alpha);
+    if (b.repeat < 1)
+        b.repeat = 1;
+
+    // use whichever one is "first"
+    cl_uint numPlatforms;
+    cl_platform_id firstPlatformId;
+
+    err = clGetPlatformIDs(1, &firstPlatformId, &numPlatforms);
+    if (err != CL_SUCCESS || numPlatforms <= 0)
+    {
+        printf("Error: Failed to find the platform!\n");
+        return EXIT_FAILURE;
+    }
+
+    err = clGetDeviceIDs(firstPlatformId, device_type, 1, &device_id, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create a device group!\n");
+        return EXIT_FAILURE;
+    }
+
+    char device_name[256] = "";
+    clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+
+    b.device = device_id;
+    b.context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+    if (!b.context)
+    {
+        printf("Error: Failed to create a compute context!\n");
+        return EXIT_FAILURE;
+    }
+
+    b.queue = clCreateCommandQueue(b.context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (!b.queue)
+    {
+        printf("Error: Failed to create a command commands!\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Device %s, %d warm up and %d timed launches per case\n", device_name, b.warmup, b.repeat);
+
+    // parameter sweeps, -quick keeps small sizes for slow devices
+    std::vector<unsigned int> vadd_sizes, pi_sizes, hello_sizes, mandel_sizes, mandel_iters;
+    if (quick) {
+        vadd_sizes.push_back(1 << 12); vadd_sizes.push_back(1 << 16);
+        pi_sizes.push_back(1 << 16); pi_sizes.push_back(1 << 18);
+        hello_sizes.push_back(1 << 12); hello_sizes.push_back(1 << 14);
+        mandel_sizes.push_back(128); mandel_iters.push_back(64);
+        mandel_sizes.push_back(256); mandel_iters.push_back(256);
+    }
+    else {
+        vadd_sizes.push_back(1 << 16); vadd_sizes.push_back(1 << 20); vadd_sizes.push_back(1 << 24);
+        pi_sizes.push_back(1 << 20); pi_sizes.push_back(1 << 24); pi_sizes.push_back(1 << 28);
+        hello_sizes.push_back(1 << 16); hello_sizes.push_back(1 << 20); hello_sizes.push_back(1 << 22);
+        mandel_sizes.push_back(512); mandel_iters.push_back(256);
+        mandel_sizes.push_back(1024); mandel_iters.push_back(256);
+        mandel_sizes.push_back(2048); mandel_iters.push_back(256);
+        mandel_sizes.push_back(1024); mandel_iters.push_back(4096);
+    }
+
+    if (!filter || strcmp(filter, "vadd") == 0)
+        benchVadd(b, vadd_sizes);
+    if (!filter || strcmp(filter, "pi_inte") == 0)
+        benchPi(b, pi_sizes);
+    if (!filter || strcmp(filter, "hello") == 0)
+        benchHello(b, hello_sizes);
+    if (!filter || strcmp(filter, "mandel") == 0)
+        benchMandel(b, mandel_sizes, mandel_iters);
+
+    err = 0;
+    if (json_path)
+        err |= writeJson(b, device_name, json_path);
+    if (csv_path)
+        err |= writeCsv(b, csv_path);
+
+    clReleaseCommandQueue(b.queue);
+    clReleaseContext(b.context);
+
+    return err ? EXIT_FAILURE : 0;
+}
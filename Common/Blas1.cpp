@@ -0,0 +1,278 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Blas1.cpp
+//
+// Purpose:    BLAS level 1 kernels, see Blas1.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "Blas1.h"
+
+//------------------------------------------------------------------------------
+//
+// BL_MAP(name, expr) instantiates z[i] = expr over the x, y, w inputs and the
+// scalar alpha, BL_REDUCE(name, term) the work-group sums of term.
+//
+
+const char* BlasSource = "\n" \
+"#ifdef BL_FP64                                                         \n" \
+"#pragma OPENCL EXTENSION cl_khr_fp64 : enable                          \n" \
+"#endif                                                                 \n" \
+"#define BL_MAP(name, expr)                                             \\\n" \
+"__kernel void name(                                                    \\\n" \
+"   const REAL alpha,                                                   \\\n" \
+"   __global const REAL* x,                                             \\\n" \
+"   __global const REAL* y,                                             \\\n" \
+"   __global const REAL* w,                                             \\\n" \
+"   __global REAL* z,                                                   \\\n" \
+"   const unsigned int count)                                           \\\n" \
+"{                                                                      \\\n" \
+"   size_t i;                                                           \\\n" \
+"   for (i = get_global_id(0); i < count; i += get_global_size(0))      \\\n" \
+"       z[i] = (expr);                                                  \\\n" \
+"}                                                                      \n" \
+"#define BL_REDUCE(name, term)                                          \\\n" \
+"__kernel void name(                                                    \\\n" \
+"   __global const REAL* x,                                             \\\n" \
+"   __global const REAL* y,                                             \\\n" \
+"   const unsigned int count,                                           \\\n" \
+"   __local REAL* scratch,                                              \\\n" \
+"   __global REAL* partial)                                             \\\n" \
+"{                                                                      \\\n" \
+"   size_t i, s;                                                        \\\n" \
+"   size_t lid = get_local_id(0);                                       \\\n" \
+"   REAL sum = 0;                                                       \\\n" \
+"   for (i = get_global_id(0); i < count; i += get_global_size(0))      \\\n" \
+"       sum += (term);                                                  \\\n" \
+"   scratch[lid] = sum;                                                 \\\n" \
+"   for (s = get_local_size(0) / 2; s > 0; s >>= 1) {                   \\\n" \
+"       barrier(CLK_LOCAL_MEM_FENCE);                                   \\\n" \
+"       if (lid < s)                                                    \\\n" \
+"           scratch[lid] += scratch[lid + s];                           \\\n" \
+"   }                                                                   \\\n" \
+"   if (lid == 0)                                                       \\\n" \
+"       partial[get_group_id(0)] = scratch[0];                          \\\n" \
+"}                                                                      \n" \
+"BL_MAP(bl_axpy, alpha * x[i] + y[i])                                   \n" \
+"BL_MAP(bl_scal, alpha * x[i])                                          \n" \
+"BL_MAP(bl_mul, x[i] * y[i])                                            \n" \
+"BL_MAP(bl_fma, fma(x[i], y[i], w[i]))                                  \n" \
+"BL_REDUCE(bl_dot, x[i] * y[i])                                         \n" \
+"BL_REDUCE(bl_nrm2, x[i] * x[i])                                        \n" \
+"\n";
+
+static const char* bl_op_names[BL_OPS] = { "axpy", "scal", "mul", "fma", "dot", "nrm2" };
+
+const char* blOpName(int op)
+{
+    return bl_op_names[op];
+}
+
+const char* blTypeName(int type)
+{
+    return type == BL_DOUBLE ? "double" : "float";
+}
+
+size_t blTypeSize(int type)
+{
+    return type == BL_DOUBLE ? sizeof(cl_double) : sizeof(cl_float);
+}
+
+size_t blBytes(int op, int type, unsigned int count)
+{
+    // vectors read plus vectors written
+    static const int vectors[BL_OPS] = { 3, 2, 3, 4, 2, 1 };
+    return vectors[op] * blTypeSize(type) * count;
+}
+
+cl_int blInit(blLib& lib, cl_context context, cl_device_id device)
+{
+    cl_device_fp_config fp64 = 0;
+    cl_uint comp_units = 1;
+    cl_int err;
+    int type, op;
+
+    lib.context = context;
+    lib.device = device;
+    for (type = 0; type < BL_TYPES; type++) {
+        lib.program[type] = NULL;
+        lib.partial[type] = NULL;
+        for (op = 0; op < BL_OPS; op++)
+            lib.kernel[type][op] = NULL;
+    }
+
+    clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &comp_units, NULL);
+    clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, NULL);
+    lib.groups = comp_units * BL_GROUPS_PER_CU;
+
+    for (type = 0; type < BL_TYPES; type++)
+    {
+        const char* options = type == BL_DOUBLE ? "-DREAL=double -DBL_FP64" : "-DREAL=float";
+        if (type == BL_DOUBLE && !fp64)
+            continue;
+
+        lib.program[type] = clCreateProgramWithSource(context, 1, &BlasSource, NULL, &err);
+        if (!lib.program[type])
+            return err;
+        err = clBuildProgram(lib.program[type], 0, NULL, options, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            size_t len;
+            char buffer[2048];
+
+            printf("Error: Failed to build the %s BLAS kernels!\n", blTypeName(type));
+            clGetProgramBuildInfo(lib.program[type], device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+            printf("%s\n", buffer);
+            return err;
+        }
+
+        // one work-group size for every kernel of the type, a power of two for the tree reduction
+        size_t local = BL_LOCAL;
+        for (op = 0; op < BL_OPS; op++) {
+            char name[32];
+            size_t max_local;
+            sprintf(name, "bl_%s", bl_op_names[op]);
+            lib.kernel[type][op] = clCreateKernel(lib.program[type], name, &err);
+            if (!lib.kernel[type][op])
+            {
+                printf("Error: Failed to create kernel %s!\n", name);
+                return err;
+            }
+            clGetKernelWorkGroupInfo(lib.kernel[type][op], device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_local), &max_local, NULL);
+            while (local > max_local)
+                local >>= 1;
+        }
+        lib.local[type] = local;
+
+        lib.partial[type] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, blTypeSize(type) * lib.groups, NULL, &err);
+        if (!lib.partial[type])
+            return err;
+    }
+    return CL_SUCCESS;
+}
+
+int blHasType(const blLib& lib, int type)
+{
+    return lib.program[type] != NULL;
+}
+
+void blRelease(blLib& lib)
+{
+    int type, op;
+    for (type = 0; type < BL_TYPES; type++) {
+        for (op = 0; op < BL_OPS; op++)
+            if (lib.kernel[type][op])
+                clReleaseKernel(lib.kernel[type][op]);
+        if (lib.partial[type])
+            clReleaseMemObject(lib.partial[type]);
+        if (lib.program[type])
+            clReleaseProgram(lib.program[type]);
+        lib.program[type] = NULL;
+        lib.partial[type] = NULL;
+    }
+}
+
+static cl_int blSetScalar(cl_kernel kernel, cl_uint index, int type, double value)
+{
+    cl_float f = (cl_float)value;
+    cl_double d = value;
+    if (type == BL_DOUBLE)
+        return clSetKernelArg(kernel, index, sizeof(cl_double), &d);
+    return clSetKernelArg(kernel, index, sizeof(cl_float), &f);
+}
+
+static cl_int blMap(blLib& lib, cl_command_queue commands, int type, int op, double alpha,
+    cl_mem x, cl_mem y, cl_mem w, cl_mem z, unsigned int count, cl_event* event)
+{
+    cl_kernel kernel = lib.kernel[type][op];
+    size_t local = lib.local[type];
+    size_t global = lib.groups * local;
+    cl_int err;
+
+    if (!kernel)
+        return CL_INVALID_KERNEL;
+    err = blSetScalar(kernel, 0, type, alpha);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &x);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &y);
+    err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &w);
+    err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &z);
+    err |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &count);
+    if (err != CL_SUCCESS)
+        return err;
+    return clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, event);
+}
+
+static cl_int blReduce(blLib& lib, cl_command_queue commands, int type, int op, cl_mem x, cl_mem y,
+    unsigned int count, double* result, cl_event* event)
+{
+    cl_kernel kernel = lib.kernel[type][op];
+    size_t local = lib.local[type];
+    size_t global = lib.groups * local;
+    std::vector<char> partial(blTypeSize(type) * lib.groups);
+    cl_int err;
+    size_t g;
+
+    if (!kernel)
+        return CL_INVALID_KERNEL;
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &x);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &y);
+    err |= clSetKernelArg(kernel, 2, sizeof(unsigned int), &count);
+    err |= clSetKernelArg(kernel, 3, blTypeSize(type) * local, NULL);
+    err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &lib.partial[type]);
+    if (err != CL_SUCCESS)
+        return err;
+    err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, event);
+    if (err != CL_SUCCESS)
+        return err;
+    err = clEnqueueReadBuffer(commands, lib.partial[type], CL_TRUE, 0, partial.size(), &partial[0], 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+        return err;
+
+    // the host adds the partial sums in double whatever the type
+    *result = 0.0;
+    for (g = 0; g < lib.groups; g++)
+        *result += type == BL_DOUBLE ? ((cl_double*)&partial[0])[g] : ((cl_float*)&partial[0])[g];
+    return CL_SUCCESS;
+}
+
+cl_int blAxpy(blLib& lib, cl_command_queue commands, int type, double alpha, cl_mem x, cl_mem y,
+    unsigned int count, cl_event* event)
+{
+    return blMap(lib, commands, type, BL_AXPY, alpha, x, y, y, y, count, event);
+}
+
+cl_int blScal(blLib& lib, cl_command_queue commands, int type, double alpha, cl_mem x,
+    unsigned int count, cl_event* event)
+{
+    return blMap(lib, commands, type, BL_SCAL, alpha, x, x, x, x, count, event);
+}
+
+cl_int blMul(blLib& lib, cl_command_queue commands, int type, cl_mem x, cl_mem y, cl_mem z,
+    unsigned int count, cl_event* event)
+{
+    return blMap(lib, commands, type, BL_MUL, 0.0, x, y, y, z, count, event);
+}
+
+cl_int blFma(blLib& lib, cl_command_queue commands, int type, cl_mem x, cl_mem y, cl_mem w, cl_mem z,
+    unsigned int count, cl_event* event)
+{
+    return blMap(lib, commands, type, BL_FMA, 0.0, x, y, w, z, count, event);
+}
+
+cl_int blDot(blLib& lib, cl_command_queue commands, int type, cl_mem x, cl_mem y,
+    unsigned int count, double* result, cl_event* event)
+{
+    return blReduce(lib, commands, type, BL_DOT, x, y, count, result, event);
+}
+
+cl_int blNrm2(blLib& lib, cl_command_queue commands, int type, cl_mem x,
+    unsigned int count, double* result, cl_event* event)
+{
+    cl_int err = blReduce(lib, commands, type, BL_NRM2, x, x, count, result, event);
+    if (err == CL_SUCCESS)
+        *result = sqrt(*result);
+    return err;
+}
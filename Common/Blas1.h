@@ -0,0 +1,74 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Blas1.h
+//
+// Purpose:    BLAS level 1 vector operations over float and double buffers.
+//
+//             Every kernel comes from one source, built once per type with
+//             -DREAL=float or -DREAL=double ; the element-wise operations are
+//             instances of one map kernel template, dot and nrm2 of one
+//             reduction template. All kernels use the same grid-stride launch,
+//             a fixed number of work-groups per compute unit, and the
+//             reductions leave one partial sum per work-group for the host.
+//
+//             blLib lib;
+//             blInit(lib, context, device);
+//             blAxpy(lib, commands, BL_FLOAT, 2.0, x_in, y_inout, count, NULL);
+//             blDot(lib, commands, BL_FLOAT, x_in, y_inout, count, &dot, NULL);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CL/cl.h"
+
+#define BL_LOCAL 256            // work-group size upper bound, a power of two
+#define BL_GROUPS_PER_CU 8      // work-groups per compute unit
+
+enum { BL_FLOAT, BL_DOUBLE, BL_TYPES };
+enum { BL_AXPY, BL_SCAL, BL_MUL, BL_FMA, BL_DOT, BL_NRM2, BL_OPS };
+
+struct blLib {
+    cl_context context;
+    cl_device_id device;
+    cl_program program[BL_TYPES];   // NULL when the device lacks the type
+    cl_kernel kernel[BL_TYPES][BL_OPS];
+    cl_mem partial[BL_TYPES];       // one partial sum per work-group
+    size_t local[BL_TYPES];
+    size_t groups;
+};
+
+// kernel names and element size, for reports
+const char* blOpName(int op);
+const char* blTypeName(int type);
+size_t blTypeSize(int type);
+
+// global memory traffic of one call over count elements
+size_t blBytes(int op, int type, unsigned int count);
+
+// builds both types, double only when the device supports cl_khr_fp64
+cl_int blInit(blLib& lib, cl_context context, cl_device_id device);
+int blHasType(const blLib& lib, int type);
+void blRelease(blLib& lib);
+
+// y = alpha * x + y
+cl_int blAxpy(blLib& lib, cl_command_queue commands, int type, double alpha, cl_mem x, cl_mem y,
+    unsigned int count, cl_event* event);
+
+// x = alpha * x
+cl_int blScal(blLib& lib, cl_command_queue commands, int type, double alpha, cl_mem x,
+    unsigned int count, cl_event* event);
+
+// z = x * y
+cl_int blMul(blLib& lib, cl_command_queue commands, int type, cl_mem x, cl_mem y, cl_mem z,
+    unsigned int count, cl_event* event);
+
+// z = x * y + w, with fma()
+cl_int blFma(blLib& lib, cl_command_queue commands, int type, cl_mem x, cl_mem y, cl_mem w, cl_mem z,
+    unsigned int count, cl_event* event);
+
+// reductions, blocking : the partial sums are read back and added on the host
+cl_int blDot(blLib& lib, cl_command_queue commands, int type, cl_mem x, cl_mem y,
+    unsigned int count, double* result, cl_event* event);
+cl_int blNrm2(blLib& lib, cl_command_queue commands, int type, cl_mem x,
+    unsigned int count, double* result, cl_event* event);
@@ -0,0 +1,318 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Bmp.cpp
+//
+// Purpose:    Memory mapped BMP files, see Bmp.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "Bmp.h"
+
+#define BM_FILE_HEADER 14
+#define BM_INFO_HEADER 40
+
+static unsigned int bmGet(const unsigned char* p, int bytes)
+{
+    unsigned int v = 0;
+    int i;
+    for (i = bytes - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void bmPut(unsigned char* p, int bytes, unsigned int v)
+{
+    int i;
+    for (i = 0; i < bytes; i++, v >>= 8)
+        p[i] = v & 0xFF;
+}
+
+static void bmReset(bmImage& img)
+{
+    memset(&img, 0, sizeof(img));
+    img.fd = -1;
+}
+
+// maps size bytes of path, creating the file at that size when size is not 0
+static int bmMap(bmImage& img, const char* path, size_t size)
+{
+#ifdef _WIN32
+    HANDLE file, mapping;
+    if (size)
+        file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    else
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return 1;
+    if (!size)
+    {
+        LARGE_INTEGER length;
+        GetFileSizeEx(file, &length);
+        size = (size_t)length.QuadPart;
+    }
+    if (size == 0)
+    {
+        CloseHandle(file);
+        return 1;
+    }
+    // the mapping of a new file sets its size
+    mapping = CreateFileMappingA(file, NULL, img.writable ? PAGE_READWRITE : PAGE_READONLY,
+        (DWORD)((unsigned long long)size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        return 1;
+    }
+    img.base = (unsigned char*)MapViewOfFile(mapping, img.writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    if (!img.base)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return 1;
+    }
+    img.file = file;
+    img.mapping = mapping;
+#else
+    int fd;
+    if (size)
+    {
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return 1;
+        if (ftruncate(fd, (off_t)size) != 0)
+        {
+            close(fd);
+            return 1;
+        }
+    }
+    else
+    {
+        struct stat st;
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return 1;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return 1;
+        }
+        size = (size_t)st.st_size;
+    }
+    void* base = mmap(NULL, size, img.writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return 1;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+    img.base = (unsigned char*)base;
+    img.fd = fd;
+#endif
+    img.size = size;
+    return 0;
+}
+
+void bmClose(bmImage& img)
+{
+    if (!img.base)
+        return;
+#ifdef _WIN32
+    if (img.writable)
+        FlushViewOfFile(img.base, 0);
+    UnmapViewOfFile(img.base);
+    CloseHandle((HANDLE)img.mapping);
+    CloseHandle((HANDLE)img.file);
+#else
+    if (img.writable)
+        msync(img.base, img.size, MS_SYNC);
+    munmap(img.base, img.size);
+    close(img.fd);
+#endif
+    bmReset(img);
+}
+
+int bmOpen(bmImage& img, const char* path)
+{
+    bmReset(img);
+    if (bmMap(img, path, 0))
+    {
+        printf("Error: Failed to map %s!\n", path);
+        return 1;
+    }
+    const unsigned char* h = img.base;
+    if (img.size < BM_FILE_HEADER + BM_INFO_HEADER || h[0] != 'B' || h[1] != 'M')
+    {
+        printf("Error: %s is not a BMP file!\n", path);
+        bmClose(img);
+        return 1;
+    }
+    unsigned int offset = bmGet(h + 10, 4);
+    unsigned int info = bmGet(h + 14, 4);
+    int width = (int)bmGet(h + 18, 4);
+    int height = (int)bmGet(h + 22, 4);
+    int bpp = (int)bmGet(h + 28, 2);
+    int compression = (int)bmGet(h + 30, 4);
+
+    // BI_BITFIELDS is read when the masks are the ones of BI_RGB
+    int plain = compression == 0;
+    if (compression == 3 && bpp == 32 && img.size >= BM_FILE_HEADER + BM_INFO_HEADER + 12)
+        plain = bmGet(h + 54, 4) == 0x00FF0000 && bmGet(h + 58, 4) == 0x0000FF00 && bmGet(h + 62, 4) == 0x000000FF;
+    if (info < BM_INFO_HEADER || (bpp != 24 && bpp != 32) || !plain || width <= 0 || height == 0)
+    {
+        printf("Error: %s : only uncompressed 24 and 32 bit BMP files are read!\n", path);
+        bmClose(img);
+        return 1;
+    }
+    img.top_down = height < 0;
+    img.width = width;
+    img.height = img.top_down ? -height : height;
+    img.bpp = bpp;
+    img.stride = ((size_t)width * (bpp / 8) + 3) & ~(size_t)3;
+    if (offset + img.stride * img.height > img.size)
+    {
+        printf("Error: %s is truncated!\n", path);
+        bmClose(img);
+        return 1;
+    }
+    img.pixels = img.base + offset;
+    return 0;
+}
+
+int bmCreate(bmImage& img, const char* path, int width, int height, int bpp)
+{
+    size_t stride = ((size_t)width * (bpp / 8) + 3) & ~(size_t)3;
+    size_t offset = BM_FILE_HEADER + BM_INFO_HEADER;
+    size_t size = offset + stride * height;
+
+    bmReset(img);
+    if ((bpp != 24 && bpp != 32) || width <= 0 || height <= 0 || size > 0xFFFFFFFFu)
+    {
+        printf("Error: Cannot write a %d x %d x %d BMP file!\n", width, height, bpp);
+        return 1;
+    }
+    img.writable = 1;
+    if (bmMap(img, path, size))
+    {
+        printf("Error: Failed to create %s!\n", path);
+        return 1;
+    }
+    unsigned char* h = img.base;
+    memset(h, 0, offset);
+    h[0] = 'B';
+    h[1] = 'M';
+    bmPut(h + 2, 4, (unsigned int)size);
+    bmPut(h + 10, 4, (unsigned int)offset);
+    bmPut(h + 14, 4, BM_INFO_HEADER);
+    bmPut(h + 18, 4, width);
+    bmPut(h + 22, 4, height);
+    bmPut(h + 26, 2, 1);
+    bmPut(h + 28, 2, bpp);
+    bmPut(h + 34, 4, (unsigned int)(stride * height));
+
+    img.width = width;
+    img.height = height;
+    img.bpp = bpp;
+    img.top_down = 0;
+    img.stride = stride;
+    img.pixels = img.base + offset;
+    return 0;
+}
+
+unsigned char* bmRow(const bmImage& img, int y)
+{
+    return img.pixels + img.stride * (img.top_down ? y : img.height - 1 - y);
+}
+
+void bmReadBand(const bmImage& img, int y0, int rows, unsigned int* out)
+{
+    int bytes = img.bpp / 8;
+    int x, y;
+    for (y = y0; y < y0 + rows; y++) {
+        const unsigned char* p = bmRow(img, y);
+        for (x = 0; x < img.width; x++, p += bytes)
+            *out++ = ((unsigned int)p[2] << 16) | ((unsigned int)p[1] << 8) | p[0];
+    }
+}
+
+void bmWriteBand(bmImage& img, int y0, int rows, const unsigned int* in)
+{
+    int bytes = img.bpp / 8;
+    int x, y;
+    for (y = y0; y < y0 + rows; y++) {
+        unsigned char* p = bmRow(img, y);
+        for (x = 0; x < img.width; x++, p += bytes, in++) {
+            p[0] = *in & 0xFF;
+            p[1] = (*in >> 8) & 0xFF;
+            p[2] = (*in >> 16) & 0xFF;
+            if (bytes == 4)
+                p[3] = 0xFF;
+        }
+    }
+}
+
+void bmDone(bmImage& img, int y0, int rows)
+{
+    // the stored rows are contiguous either way, only their order changes
+    int first = img.top_down ? y0 : img.height - y0 - rows;
+    size_t start = (size_t)(img.pixels - img.base) + img.stride * first;
+    size_t end = start + img.stride * rows;
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    size_t page = si.dwPageSize;
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    // whole pages inside the rows only, the neighbours may still be in use
+    start = (start + page - 1) / page * page;
+    end = end / page * page;
+    if (end <= start)
+        return;
+#ifdef _WIN32
+    if (img.writable)
+        FlushViewOfFile(img.base + start, end - start);
+    // unlocking pages that are not locked takes them out of the working set
+    VirtualUnlock(img.base + start, end - start);
+#else
+    if (img.writable)
+        msync(img.base + start, end - start, MS_ASYNC);
+    madvise(img.base + start, end - start, MADV_DONTNEED);
+#endif
+}
+
+int bmStream(bmImage& in, bmImage& out, int band_rows, int halo, bmFilter filter, void* user)
+{
+    std::vector<unsigned int> src, dst;
+    int y0, err = 0;
+
+    if (out.width != in.width || out.height != in.height || band_rows <= 0 || halo < 0)
+        return 1;
+    src.resize((size_t)in.width * (band_rows + 2 * halo));
+    dst.resize((size_t)in.width * band_rows);
+    for (y0 = 0; y0 < in.height && !err; y0 += band_rows) {
+        int rows = in.height - y0 < band_rows ? in.height - y0 : band_rows;
+        int in_y0 = y0 - halo < 0 ? 0 : y0 - halo;
+        int in_end = y0 + rows + halo > in.height ? in.height : y0 + rows + halo;
+
+        bmReadBand(in, in_y0, in_end - in_y0, &src[0]);
+        err = filter(user, &src[0], in_y0, in_end - in_y0, &dst[0], y0, rows, in.width);
+        bmWriteBand(out, y0, rows, &dst[0]);
+
+        // the next band still reads the halo above it
+        if (in_y0 < y0 + rows - halo)
+            bmDone(in, in_y0, y0 + rows - halo - in_y0);
+        bmDone(out, y0, rows);
+    }
+    return err;
+}
@@ -0,0 +1,71 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Bmp.h
+//
+// Purpose:    BMP files mapped in memory (CreateFileMapping on Windows, mmap
+//             elsewhere). The rows are used in place : bmRow gives the stored
+//             bytes of a row counted from the top whatever the layout of the
+//             file, bottom-up or top-down, 24 or 32 bit. Written files are
+//             created at their final size and mapped read-write, so nothing
+//             goes through stdio.
+//
+//             The band interface converts rows to and from pixels packed as
+//             0xRRGGBB, and bmStream runs a filter band by band with a halo of
+//             rows above and below, dropping the finished rows from memory, so
+//             images larger than the RAM go through a bounded working set (the
+//             format itself stops at 4 GB).
+//
+//             bmImage in, out;
+//             bmOpen(in, "big.bmp");
+//             bmCreate(out, "out.bmp", in.width, in.height, 24);
+//             bmStream(in, out, 256, 2, filter, &state);
+//             bmClose(out);
+//             bmClose(in);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <stddef.h>
+
+struct bmImage {
+    int width, height;
+    int bpp;                    // 24 or 32
+    int top_down;               // first stored row is the top one
+    int writable;
+    size_t stride;              // bytes per stored row, multiple of 4
+    unsigned char* pixels;      // first stored row
+    unsigned char* base;        // mapping of the whole file
+    size_t size;
+    void* file;                 // HANDLE of the file and of the mapping on Windows
+    void* mapping;
+    int fd;                     // elsewhere
+};
+
+// read-only mapping, 0 on success
+int bmOpen(bmImage& img, const char* path);
+
+// new file of the final size, bottom-up as most readers expect, 0 on success
+int bmCreate(bmImage& img, const char* path, int width, int height, int bpp);
+
+// flushes a written file and unmaps
+void bmClose(bmImage& img);
+
+// stored bytes of row y, 0 at the top, B G R (A) per pixel
+unsigned char* bmRow(const bmImage& img, int y);
+
+// rows [y0, y0 + rows) as 0xRRGGBB, top row first
+void bmReadBand(const bmImage& img, int y0, int rows, unsigned int* out);
+void bmWriteBand(bmImage& img, int y0, int rows, const unsigned int* in);
+
+// rows [y0, y0 + rows) are done with : written back and dropped from memory
+void bmDone(bmImage& img, int y0, int rows);
+
+// in[] holds the rows [in_y0, in_y0 + in_rows), out[] receives [y0, y0 + rows),
+// both width pixels wide ; returns 0 to go on
+typedef int (*bmFilter)(void* user, const unsigned int* in, int in_y0, int in_rows,
+    unsigned int* out, int y0, int rows, int width);
+
+// runs filter over in by bands of band_rows, each with up to halo rows more above
+// and below (fewer at the edges of the image) ; out has the size of in, 0 on success
+int bmStream(bmImage& in, bmImage& out, int band_rows, int halo, bmFilter filter, void* user);
@@ -0,0 +1,171 @@
+//------------------------------------------------------------------------------
+//
+// Name:       BufferPool.cpp
+//
+// Purpose:    Device buffer pool, see BufferPool.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "BufferPool.h"
+
+static double bpNowUs()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static size_t bpClassSize(int c)
+{
+    return (size_t)BP_MIN_CLASS << c;
+}
+
+static int bpClassOf(size_t bytes)
+{
+    int c = 0;
+    while (bpClassSize(c) < bytes && c < BP_CLASSES - 1)
+        c++;
+    return c;
+}
+
+cl_int bpInit(bpPool& pool, cl_context context, cl_device_id device)
+{
+    cl_uint align_bits = 0;
+    cl_int err;
+    int c;
+
+    pool.context = context;
+    for (c = 0; c < BP_CLASSES; c++) {
+        pool.slab_used[c] = 0;
+        pool.slab_of[c] = NULL;
+    }
+    memset(&pool.stats, 0, sizeof(pool.stats));
+
+    // CL_DEVICE_MEM_BASE_ADDR_ALIGN is given in bits
+    err = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &align_bits, NULL);
+    pool.align = err == CL_SUCCESS && align_bits >= 8 ? align_bits / 8 : 128;
+    return err;
+}
+
+// carves a block of class c out of the current slab of that class
+static cl_mem bpCarve(bpPool& pool, int c, cl_int* err)
+{
+    size_t block = bpClassSize(c);
+    cl_buffer_region region;
+    cl_mem sub;
+
+    if (block < pool.align)
+        block = pool.align;
+    block = (block + pool.align - 1) / pool.align * pool.align;
+
+    if (!pool.slab_of[c] || pool.slab_used[c] + block > BP_SLAB_SIZE) {
+        cl_mem slab = clCreateBuffer(pool.context, CL_MEM_READ_WRITE, BP_SLAB_SIZE, NULL, err);
+        if (!slab)
+            return NULL;
+        pool.slabs.push_back(slab);
+        pool.slab_of[c] = slab;
+        pool.slab_used[c] = 0;
+        pool.stats.slabs++;
+        pool.stats.reserved += BP_SLAB_SIZE;
+    }
+
+    region.origin = pool.slab_used[c];
+    region.size = bpClassSize(c);
+    sub = clCreateSubBuffer(pool.slab_of[c], CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region, err);
+    if (!sub)
+        return NULL;
+    pool.slab_used[c] += block;
+    pool.stats.sub_buffers++;
+    return sub;
+}
+
+cl_mem bpAlloc(bpPool& pool, size_t bytes, cl_int* err)
+{
+    double t0 = bpNowUs();
+    int c = bpClassOf(bytes);
+    cl_int status = CL_SUCCESS;
+    cl_mem buf;
+
+    pool.stats.requests++;
+    if (!pool.free_list[c].empty()) {
+        buf = pool.free_list[c].back();
+        pool.free_list[c].pop_back();
+        pool.owner[buf].free = 0;
+        pool.stats.hits++;
+        pool.stats.in_use += bpClassSize(c);
+        pool.stats.hit_us += bpNowUs() - t0;
+        if (err) *err = CL_SUCCESS;
+        return buf;
+    }
+
+    if (bpClassSize(c) <= BP_SLAB_MAX)
+        buf = bpCarve(pool, c, &status);
+    else {
+        buf = clCreateBuffer(pool.context, CL_MEM_READ_WRITE, bpClassSize(c), NULL, &status);
+        if (buf) {
+            pool.stats.dedicated++;
+            pool.stats.reserved += bpClassSize(c);
+        }
+    }
+    if (buf) {
+        bpBlock block = { c, 0 };
+        pool.owner[buf] = block;
+        pool.all.push_back(buf);
+        pool.stats.in_use += bpClassSize(c);
+    }
+    pool.stats.miss_us += bpNowUs() - t0;
+    if (err) *err = status;
+    return buf;
+}
+
+void bpFree(bpPool& pool, cl_mem buf)
+{
+    std::map<cl_mem, bpBlock>::iterator it = pool.owner.find(buf);
+    if (it == pool.owner.end())
+    {
+        printf("Error: buffer %p does not belong to the pool!\n", (void*)buf);
+        return;
+    }
+    if (it->second.free)
+    {
+        printf("Error: buffer %p is already free!\n", (void*)buf);
+        return;
+    }
+    it->second.free = 1;
+    pool.free_list[it->second.cls].push_back(buf);
+    pool.stats.in_use -= bpClassSize(it->second.cls);
+}
+
+void bpPrintStats(const bpPool& pool)
+{
+    const bpStats& s = pool.stats;
+    unsigned long misses = s.requests - s.hits;
+    double hit_avg = s.hits ? s.hit_us / s.hits : 0.0;
+    double miss_avg = misses ? s.miss_us / misses : 0.0;
+
+    printf("Pool : %lu requests, %lu hits (%.1f%%)\n", s.requests, s.hits, s.requests ? 100.0 * s.hits / s.requests : 0.0);
+    printf("       %lu slabs, %lu sub-buffers, %lu dedicated buffers, %.2f MB reserved, alignment %lu bytes\n",
+        s.slabs, s.sub_buffers, s.dedicated, s.reserved / (1024.0 * 1024.0), (unsigned long)pool.align);
+    printf("       hit %.3f us, miss %.3f us on average, about %.3f ms of allocation saved\n",
+        hit_avg, miss_avg, s.hits * (miss_avg - hit_avg) * 1.0e-3);
+}
+
+void bpRelease(bpPool& pool)
+{
+    size_t i;
+    int c;
+
+    // sub-buffers go before their slab
+    for (i = 0; i < pool.all.size(); i++)
+        clReleaseMemObject(pool.all[i]);
+    for (i = 0; i < pool.slabs.size(); i++)
+        clReleaseMemObject(pool.slabs[i]);
+    for (c = 0; c < BP_CLASSES; c++) {
+        pool.free_list[c].clear();
+        pool.slab_of[c] = NULL;
+    }
+    pool.all.clear();
+    pool.slabs.clear();
+    pool.owner.clear();
+}
@@ -0,0 +1,73 @@
+//------------------------------------------------------------------------------
+//
+// Name:       BufferPool.h
+//
+// Purpose:    Recycles device buffers between jobs instead of creating and
+//             releasing a cl_mem for every one of them.
+//
+//             Requests are rounded up to a power of two size class. Classes
+//             up to BP_SLAB_MAX are carved out of BP_SLAB_SIZE slabs with
+//             clCreateSubBuffer, blocks aligned on CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+//             larger classes get a buffer of their own. Released buffers go
+//             back to the free list of their class and are handed out again
+//             as they are, so a hit costs no OpenCL call at all.
+//
+//             All buffers are CL_MEM_READ_WRITE. A buffer may be released as
+//             soon as the last command using it is enqueued, as long as its
+//             next user is enqueued on the same in-order queue.
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include "CL/cl.h"
+
+#define BP_MIN_CLASS 256               // smallest block, in bytes
+#define BP_SLAB_MAX (64 * 1024)        // largest class served from slabs
+#define BP_SLAB_SIZE (4 * 1024 * 1024) // slab size
+#define BP_CLASSES 40
+
+struct bpBlock {
+    int cls;                        // size class
+    int free;                       // on the free list of its class
+};
+
+struct bpStats {
+    unsigned long requests;
+    unsigned long hits;
+    unsigned long slabs;            // slab buffers created
+    unsigned long sub_buffers;      // blocks carved out of slabs
+    unsigned long dedicated;        // buffers created for large classes
+    double hit_us;                  // total time spent in bpAlloc on hits
+    double miss_us;                 // and on misses
+    size_t reserved;                // device bytes held by the pool
+    size_t in_use;                  // bytes handed out, rounded to the class
+};
+
+struct bpPool {
+    cl_context context;
+    size_t align;                   // sub-buffer origin alignment, in bytes
+    std::vector<cl_mem> free_list[BP_CLASSES];
+    std::vector<cl_mem> slabs;
+    cl_mem slab_of[BP_CLASSES];     // slab currently carved, per slab class
+    size_t slab_used[BP_CLASSES];
+    std::map<cl_mem, bpBlock> owner;    // every buffer handed out or free
+    std::vector<cl_mem> all;        // every buffer and sub-buffer, for the release
+    bpStats stats;
+};
+
+cl_int bpInit(bpPool& pool, cl_context context, cl_device_id device);
+
+// buffer of at least bytes, NULL on failure
+cl_mem bpAlloc(bpPool& pool, size_t bytes, cl_int* err);
+
+// gives the buffer back to its class ; freeing it twice is an error, and
+// leaves the pool unchanged
+void bpFree(bpPool& pool, cl_mem buf);
+
+void bpPrintStats(const bpPool& pool);
+
+// releases every buffer, the pool must not be used afterwards
+void bpRelease(bpPool& pool);
@@ -0,0 +1,543 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Convolution.cpp
+//
+// Purpose:    Naive, tiled and separable 2-D convolution, see Convolution.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "Convolution.h"
+
+//------------------------------------------------------------------------------
+//
+// Built with -DRADIUS=r -DTILE=CV_TILE, launched on TILE x TILE work-groups.
+// The tiles are loaded with clamped coordinates, so the work-items past the
+// image still take part in the loads and only return after the barrier. With
+// an active mask, one byte per work-group, the inactive groups leave at once.
+// The image kernels, built with -DIMAGES, read through the texture cache
+// instead of local memory and leave the borders to the sampler.
+//
+
+const char* ConvSource = "\n" \
+"#define SIDE (2*RADIUS + 1)                                            \n" \
+"#define APRON (TILE + 2*RADIUS)                                        \n" \
+"#define PIX(img, x, y) img[clamp(y, 0, height-1)*width + clamp(x, 0, width-1)]\n" \
+"#define SKIP(active) (active && !active[get_group_id(1)*get_num_groups(0) + get_group_id(0)])\n" \
+"                                                                       \n" \
+"__kernel void cv_naive(__global const float* in, __global float* out,  \n" \
+"   __constant float* weights, const int width, const int height,       \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i, j;                                                           \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(SKIP(active) || x >= width || y >= height) return;               \n" \
+"   for(j = 0; j < SIDE; j++)                                           \n" \
+"       for(i = 0; i < SIDE; i++)                                       \n" \
+"           sum += weights[j*SIDE + i] * PIX(in, x+i-RADIUS, y+j-RADIUS);\n" \
+"   out[y*width + x] = sum;                                             \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void cv_tiled(__global const float* in, __global float* out,  \n" \
+"   __constant float* weights, const int width, const int height,       \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   __local float tile[APRON][APRON];                                   \n" \
+"   int lx = get_local_id(0), ly = get_local_id(1);                     \n" \
+"   int x0 = get_group_id(0)*TILE - RADIUS;                             \n" \
+"   int y0 = get_group_id(1)*TILE - RADIUS;                             \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i, j;                                                           \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(SKIP(active)) return;                                            \n" \
+"   for(j = ly; j < APRON; j += TILE)                                   \n" \
+"       for(i = lx; i < APRON; i += TILE)                               \n" \
+"           tile[j][i] = PIX(in, x0+i, y0+j);                           \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                                       \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   for(j = 0; j < SIDE; j++)                                           \n" \
+"       for(i = 0; i < SIDE; i++)                                       \n" \
+"           sum += weights[j*SIDE + i] * tile[ly+j][lx+i];              \n" \
+"   out[y*width + x] = sum;                                             \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void cv_rows(__global const float* in, __global float* out,   \n" \
+"   __constant float* row, const int width, const int height,           \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   __local float tile[TILE][APRON];                                    \n" \
+"   int lx = get_local_id(0), ly = get_local_id(1);                     \n" \
+"   int x0 = get_group_id(0)*TILE - RADIUS;                             \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i;                                                              \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(SKIP(active)) return;                                            \n" \
+"   for(i = lx; i < APRON; i += TILE)                                   \n" \
+"       tile[ly][i] = PIX(in, x0+i, y);                                 \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                                       \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   for(i = 0; i < SIDE; i++)                                           \n" \
+"       sum += row[i] * tile[ly][lx+i];                                 \n" \
+"   out[y*width + x] = sum;                                             \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void cv_cols(__global const float* in, __global float* out,   \n" \
+"   __constant float* col, const int width, const int height,           \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   __local float tile[APRON][TILE];                                    \n" \
+"   int lx = get_local_id(0), ly = get_local_id(1);                     \n" \
+"   int y0 = get_group_id(1)*TILE - RADIUS;                             \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int j;                                                              \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(SKIP(active)) return;                                            \n" \
+"   for(j = ly; j < APRON; j += TILE)                                   \n" \
+"       tile[j][lx] = PIX(in, x, y0+j);                                 \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                                       \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   for(j = 0; j < SIDE; j++)                                           \n" \
+"       sum += col[j] * tile[ly+j][lx];                                 \n" \
+"   out[y*width + x] = sum;                                             \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// the tiles the column pass reads, one above and one below the active ones\n" \
+"__kernel void cv_grow(__global const uchar* active, __global uchar* grown,\n" \
+"   const int tiles_x, const int tiles_y)                               \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   if(x >= tiles_x || y >= tiles_y) return;                            \n" \
+"   grown[y*tiles_x + x] = active[y*tiles_x + x]                        \n" \
+"       || (y > 0 && active[(y-1)*tiles_x + x])                         \n" \
+"       || (y < tiles_y-1 && active[(y+1)*tiles_x + x]);                \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"#ifdef IMAGES                                                          \n" \
+"__constant sampler_t CLAMP = CLK_NORMALIZED_COORDS_FALSE               \n" \
+"   | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;                   \n" \
+"#define TEX(img, x, y) read_imagef(img, CLAMP, (int2)(x, y)).x         \n" \
+"                                                                       \n" \
+"__kernel void cv_image(__read_only image2d_t in, __write_only image2d_t out,\n" \
+"   __constant float* weights, const int width, const int height,       \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i, j;                                                           \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(SKIP(active) || x >= width || y >= height) return;               \n" \
+"   for(j = 0; j < SIDE; j++)                                           \n" \
+"       for(i = 0; i < SIDE; i++)                                       \n" \
+"           sum += weights[j*SIDE + i] * TEX(in, x+i-RADIUS, y+j-RADIUS);\n" \
+"   write_imagef(out, (int2)(x, y), (float4)(sum, 0.0f, 0.0f, 1.0f));   \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void cv_image_rows(__read_only image2d_t in, __write_only image2d_t out,\n" \
+"   __constant float* row, const int width, const int height,           \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i;                                                              \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(SKIP(active) || x >= width || y >= height) return;               \n" \
+"   for(i = 0; i < SIDE; i++)                                           \n" \
+"       sum += row[i] * TEX(in, x+i-RADIUS, y);                         \n" \
+"   write_imagef(out, (int2)(x, y), (float4)(sum, 0.0f, 0.0f, 1.0f));   \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void cv_image_cols(__read_only image2d_t in, __write_only image2d_t out,\n" \
+"   __constant float* col, const int width, const int height,           \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int j;                                                              \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(SKIP(active) || x >= width || y >= height) return;               \n" \
+"   for(j = 0; j < SIDE; j++)                                           \n" \
+"       sum += col[j] * TEX(in, x, y+j-RADIUS);                         \n" \
+"   write_imagef(out, (int2)(x, y), (float4)(sum, 0.0f, 0.0f, 1.0f));   \n" \
+"}                                                                      \n" \
+"#endif                                                                 \n" \
+"\n";
+
+static const char* cv_mode_names[CV_MODES] = { "auto", "naive", "tiled", "separable" };
+
+const char* cvModeName(int mode)
+{
+    return cv_mode_names[mode];
+}
+
+int cvFactor(const float* weights, int radius, float* col, float* row)
+{
+    int side = 2 * radius + 1;
+    int i, j, p = 0, q = 0;
+    float pivot = 0.0f;
+
+    // the largest weight is the pivot, its row and column are the factors
+    for (j = 0; j < side; j++)
+        for (i = 0; i < side; i++)
+            if (fabsf(weights[j * side + i]) > fabsf(pivot)) {
+                pivot = weights[j * side + i];
+                p = j;
+                q = i;
+            }
+    if (pivot == 0.0f)
+        return 0;
+    for (i = 0; i < side; i++)
+        row[i] = weights[p * side + i];
+    for (j = 0; j < side; j++)
+        col[j] = weights[j * side + q] / pivot;
+
+    for (j = 0; j < side; j++)
+        for (i = 0; i < side; i++)
+            if (fabsf(weights[j * side + i] - col[j] * row[i]) > CV_RANK1_TOL * fabsf(pivot))
+                return 0;
+    return 1;
+}
+
+int cvImages(cl_context context, cl_device_id device)
+{
+    std::vector<cl_image_format> formats;
+    cl_bool images = CL_FALSE;
+    cl_uint i, n = 0;
+
+    clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT, sizeof(images), &images, NULL);
+    if (images != CL_TRUE)
+        return 0;
+    // OpenCL 1.2 only guarantees RGBA and BGRA, CL_R may be missing
+    if (clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, 0, NULL, &n) != CL_SUCCESS || n == 0)
+        return 0;
+    formats.resize(n);
+    if (clGetSupportedImageFormats(context, CL_MEM_READ_WRITE, CL_MEM_OBJECT_IMAGE2D, n, &formats[0], NULL) != CL_SUCCESS)
+        return 0;
+    for (i = 0; i < n; i++)
+        if (formats[i].image_channel_order == CL_R && formats[i].image_channel_data_type == CL_FLOAT)
+            return 1;
+    return 0;
+}
+
+void cvInit(cvConv& conv, cl_context context, cl_device_id device)
+{
+    conv.context = context;
+    conv.device = device;
+    conv.built.clear();
+    conv.radius = -1;
+    conv.separable = 0;
+    conv.weights = conv.row = conv.col = conv.tmp = conv.grown = conv.tmp_image = NULL;
+    conv.tmp_bytes = conv.grown_bytes = 0;
+    conv.tmp_width = conv.tmp_height = 0;
+    conv.images = cvImages(context, device);
+}
+
+static cl_int cvBuild(cvConv& conv, int radius)
+{
+    cvProgram p;
+    char options[80];
+    cl_int err;
+
+    if (conv.built.count(radius))
+        return CL_SUCCESS;
+
+    sprintf(options, "-DRADIUS=%d -DTILE=%d%s", radius, CV_TILE, conv.images ? " -DIMAGES" : "");
+    p.program = clCreateProgramWithSource(conv.context, 1, &ConvSource, NULL, &err);
+    if (!p.program)
+        return err;
+    err = clBuildProgram(p.program, 0, NULL, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build the convolution kernels of radius %d!\n", radius);
+        clGetProgramBuildInfo(p.program, conv.device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        clReleaseProgram(p.program);
+        return err;
+    }
+    // the image kernels last, only built with -DIMAGES
+    static const char* names[] = { "cv_naive", "cv_tiled", "cv_rows", "cv_cols", "cv_grow",
+        "cv_image", "cv_image_rows", "cv_image_cols" };
+    cl_kernel* kernels[] = { &p.naive, &p.tiled, &p.rows, &p.cols, &p.grow,
+        &p.image, &p.image_rows, &p.image_cols };
+    int k, all = sizeof(names) / sizeof(names[0]), n = conv.images ? all : all - 3;
+    for (k = 0; k < all; k++)
+        *kernels[k] = NULL;
+    for (k = 0; k < n; k++) {
+        *kernels[k] = clCreateKernel(p.program, names[k], &err);
+        if (!*kernels[k] || err != CL_SUCCESS)
+        {
+            printf("Error: Failed to create the convolution kernel %s! %d\n", names[k], err);
+            for (; k >= 0; k--)
+                if (*kernels[k])
+                    clReleaseKernel(*kernels[k]);
+            clReleaseProgram(p.program);
+            return err != CL_SUCCESS ? err : CL_INVALID_KERNEL;
+        }
+    }
+    conv.built[radius] = p;
+    return CL_SUCCESS;
+}
+
+cl_int cvSetWeights(cvConv& conv, const float* weights, int radius)
+{
+    int side = 2 * radius + 1;
+    std::vector<float> col(side), row(side);
+    cl_int err;
+
+    if (radius < 0 || radius > CV_MAX_RADIUS)
+    {
+        printf("Error: Convolution radius %d out of 0..%d!\n", radius, CV_MAX_RADIUS);
+        return CL_INVALID_VALUE;
+    }
+    err = cvBuild(conv, radius);
+    if (err != CL_SUCCESS)
+        return err;
+
+    if (conv.weights)
+        clReleaseMemObject(conv.weights);
+    if (conv.row)
+        clReleaseMemObject(conv.row);
+    if (conv.col)
+        clReleaseMemObject(conv.col);
+    conv.row = conv.col = NULL;
+
+    conv.radius = radius;
+    conv.weights = clCreateBuffer(conv.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+        sizeof(float) * side * side, (void*)weights, &err);
+    if (!conv.weights)
+        return err;
+    conv.separable = cvFactor(weights, radius, &col[0], &row[0]);
+    if (conv.separable)
+    {
+        conv.row = clCreateBuffer(conv.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * side, &row[0], &err);
+        conv.col = clCreateBuffer(conv.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * side, &col[0], &err);
+        if (!conv.row || !conv.col)
+            return err;
+    }
+    return CL_SUCCESS;
+}
+
+static cl_int cvPass(cl_command_queue commands, cl_kernel kernel, cl_mem in, cl_mem out, cl_mem weights,
+    int width, int height, cl_mem active, std::vector<cl_event>* events)
+{
+    size_t local[2] = { CV_TILE, CV_TILE };
+    size_t global[2] = {
+        ((size_t)width + CV_TILE - 1) / CV_TILE * CV_TILE,
+        ((size_t)height + CV_TILE - 1) / CV_TILE * CV_TILE };
+    cl_event event;
+    cl_int err;
+
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &out);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &weights);
+    err |= clSetKernelArg(kernel, 3, sizeof(int), &width);
+    err |= clSetKernelArg(kernel, 4, sizeof(int), &height);
+    err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), active ? &active : NULL);
+    if (err != CL_SUCCESS)
+        return err;
+    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, local, 0, NULL, events ? &event : NULL);
+    if (err == CL_SUCCESS && events)
+        events->push_back(event);
+    return err;
+}
+
+// grown = active and the tiles above and below it, where the row pass must run
+static cl_int cvGrow(cvConv& conv, cl_command_queue commands, cl_kernel kernel, cl_mem active,
+    int width, int height, std::vector<cl_event>* events)
+{
+    int tiles_x = (width + CV_TILE - 1) / CV_TILE;
+    int tiles_y = (height + CV_TILE - 1) / CV_TILE;
+    size_t global[2] = { (size_t)tiles_x, (size_t)tiles_y };
+    size_t bytes = (size_t)tiles_x * tiles_y;
+    cl_event event;
+    cl_int err;
+
+    if (conv.grown_bytes < bytes)
+    {
+        if (conv.grown)
+            clReleaseMemObject(conv.grown);
+        conv.grown = clCreateBuffer(conv.context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        if (!conv.grown)
+        {
+            conv.grown_bytes = 0;
+            return err;
+        }
+        conv.grown_bytes = bytes;
+    }
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &active);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &conv.grown);
+    err |= clSetKernelArg(kernel, 2, sizeof(int), &tiles_x);
+    err |= clSetKernelArg(kernel, 3, sizeof(int), &tiles_y);
+    if (err != CL_SUCCESS)
+        return err;
+    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, NULL, 0, NULL, events ? &event : NULL);
+    if (err == CL_SUCCESS && events)
+        events->push_back(event);
+    return err;
+}
+
+cl_int cvRun(cvConv& conv, cl_command_queue commands, int mode, cl_mem in, cl_mem out,
+    int width, int height, cl_mem active, std::vector<cl_event>* events)
+{
+    size_t bytes = sizeof(float) * width * height;
+    cl_int err;
+
+    if (conv.radius < 0)
+        return CL_INVALID_KERNEL;
+    cvProgram& p = conv.built[conv.radius];
+    if (mode == CV_AUTO)
+        mode = conv.separable ? CV_SEPARABLE : CV_TILED;
+    if (mode == CV_NAIVE)
+        return cvPass(commands, p.naive, in, out, conv.weights, width, height, active, events);
+    if (mode == CV_TILED || !conv.separable)
+        return cvPass(commands, p.tiled, in, out, conv.weights, width, height, active, events);
+
+    if (conv.tmp_bytes < bytes)
+    {
+        if (conv.tmp)
+            clReleaseMemObject(conv.tmp);
+        conv.tmp = clCreateBuffer(conv.context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        if (!conv.tmp)
+        {
+            conv.tmp_bytes = 0;
+            return err;
+        }
+        conv.tmp_bytes = bytes;
+    }
+    if (active)
+    {
+        err = cvGrow(conv, commands, p.grow, active, width, height, events);
+        if (err != CL_SUCCESS)
+            return err;
+    }
+    err = cvPass(commands, p.rows, in, conv.tmp, conv.row, width, height, active ? conv.grown : NULL, events);
+    if (err != CL_SUCCESS)
+        return err;
+    return cvPass(commands, p.cols, conv.tmp, out, conv.col, width, height, active, events);
+}
+
+cl_mem cvImage2D(cl_context context, int width, int height, cl_mem_flags flags, cl_int* err)
+{
+    cl_image_format format;
+    cl_image_desc desc;
+
+    format.image_channel_order = CL_R;
+    format.image_channel_data_type = CL_FLOAT;
+    memset(&desc, 0, sizeof(desc));
+    desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+    desc.image_width = width;
+    desc.image_height = height;
+    return clCreateImage(context, flags, &format, &desc, NULL, err);
+}
+
+cl_int cvRunImage(cvConv& conv, cl_command_queue commands, cl_mem in, cl_mem out,
+    int width, int height, cl_mem active, std::vector<cl_event>* events)
+{
+    cl_int err;
+
+    if (conv.radius < 0 || !conv.images)
+        return CL_INVALID_KERNEL;
+    cvProgram& p = conv.built[conv.radius];
+    if (!conv.separable)
+        return cvPass(commands, p.image, in, out, conv.weights, width, height, active, events);
+
+    if (conv.tmp_width != width || conv.tmp_height != height)
+    {
+        if (conv.tmp_image)
+            clReleaseMemObject(conv.tmp_image);
+        conv.tmp_width = conv.tmp_height = 0;
+        conv.tmp_image = cvImage2D(conv.context, width, height, CL_MEM_READ_WRITE, &err);
+        if (!conv.tmp_image)
+            return err;
+        conv.tmp_width = width;
+        conv.tmp_height = height;
+    }
+    if (active)
+    {
+        err = cvGrow(conv, commands, p.grow, active, width, height, events);
+        if (err != CL_SUCCESS)
+            return err;
+    }
+    err = cvPass(commands, p.image_rows, in, conv.tmp_image, conv.row, width, height, active ? conv.grown : NULL, events);
+    if (err != CL_SUCCESS)
+        return err;
+    return cvPass(commands, p.image_cols, conv.tmp_image, out, conv.col, width, height, active, events);
+}
+
+void cvRelease(cvConv& conv)
+{
+    std::map<int, cvProgram>::iterator it;
+    for (it = conv.built.begin(); it != conv.built.end(); ++it) {
+        clReleaseKernel(it->second.naive);
+        clReleaseKernel(it->second.tiled);
+        clReleaseKernel(it->second.rows);
+        clReleaseKernel(it->second.cols);
+        clReleaseKernel(it->second.grow);
+        if (it->second.image)
+        {
+            clReleaseKernel(it->second.image);
+            clReleaseKernel(it->second.image_rows);
+            clReleaseKernel(it->second.image_cols);
+        }
+        clReleaseProgram(it->second.program);
+    }
+    conv.built.clear();
+    if (conv.weights)
+        clReleaseMemObject(conv.weights);
+    if (conv.row)
+        clReleaseMemObject(conv.row);
+    if (conv.col)
+        clReleaseMemObject(conv.col);
+    if (conv.tmp)
+        clReleaseMemObject(conv.tmp);
+    if (conv.grown)
+        clReleaseMemObject(conv.grown);
+    if (conv.tmp_image)
+        clReleaseMemObject(conv.tmp_image);
+    conv.weights = conv.row = conv.col = conv.tmp = conv.grown = conv.tmp_image = NULL;
+    conv.tmp_bytes = conv.grown_bytes = 0;
+    conv.tmp_width = conv.tmp_height = 0;
+    conv.radius = -1;
+}
+
+static inline int cvClamp(int v, int n)
+{
+    return v < 0 ? 0 : (v > n - 1 ? n - 1 : v);
+}
+
+void cvReference(const float* in, float* out, int width, int height, const float* weights, int radius)
+{
+    int side = 2 * radius + 1;
+    std::vector<float> col(side), row(side);
+    int x, y, i, j;
+
+    if (cvFactor(weights, radius, &col[0], &row[0]))
+    {
+        std::vector<float> tmp((size_t)width * height);
+        for (y = 0; y < height; y++)
+            for (x = 0; x < width; x++) {
+                float sum = 0.0f;
+                for (i = 0; i < side; i++)
+                    sum += row[i] * in[y * width + cvClamp(x + i - radius, width)];
+                tmp[y * width + x] = sum;
+            }
+        for (y = 0; y < height; y++)
+            for (x = 0; x < width; x++) {
+                float sum = 0.0f;
+                for (j = 0; j < side; j++)
+                    sum += col[j] * tmp[cvClamp(y + j - radius, height) * width + x];
+                out[y * width + x] = sum;
+            }
+        return;
+    }
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++) {
+            float sum = 0.0f;
+            for (j = 0; j < side; j++)
+                for (i = 0; i < side; i++)
+                    sum += weights[j * side + i] * in[cvClamp(y + j - radius, height) * width + cvClamp(x + i - radius, width)];
+            out[y * width + x] = sum;
+        }
+}
@@ -0,0 +1,99 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Convolution.h
+//
+// Purpose:    2-D convolution of float images with a (2 radius + 1)^2 kernel,
+//             borders clamped to the edge.
+//
+//             The weights are factorised when they are rank 1 (Gaussian,
+//             box, Sobel...) : the image then goes through a row pass and a
+//             column pass, 2 (2 r + 1) products per pixel instead of
+//             (2 r + 1)^2. Both the 2-D and the 1-D kernels stage their tile
+//             of CV_TILE x CV_TILE pixels plus the apron of radius pixels in
+//             local memory, and are built once per radius with -DRADIUS so
+//             the loops have constant bounds. The naive kernel, straight from
+//             global memory, is kept as the baseline.
+//
+//             An optional active mask, one uchar per CV_TILE x CV_TILE tile
+//             in raster order, restricts the work to the tiles that are not
+//             0 ; the others keep whatever out held.
+//
+//             When the device has images, cvRunImage does the same between
+//             two CL_R / CL_FLOAT images (cvImage2D) : the kernels read with
+//             a clamp to edge sampler through the texture cache, with no
+//             local memory staging and no border arithmetic.
+//
+//             cvConv conv;
+//             cvInit(conv, context, device);
+//             cvSetWeights(conv, weights, radius);
+//             cvRun(conv, commands, CV_AUTO, in, out, width, height, NULL, NULL);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <map>
+#include <vector>
+#include "CL/cl.h"
+
+#define CV_TILE 16              // work-groups of CV_TILE x CV_TILE
+#define CV_MAX_RADIUS 16
+#define CV_RANK1_TOL 1.0e-5f    // relative to the largest weight
+
+// CV_AUTO is CV_SEPARABLE for rank 1 weights, else CV_TILED
+enum { CV_AUTO, CV_NAIVE, CV_TILED, CV_SEPARABLE, CV_MODES };
+
+struct cvProgram {
+    cl_program program;
+    cl_kernel naive, tiled, rows, cols, grow;
+    cl_kernel image, image_rows, image_cols;    // NULL without image support
+};
+
+struct cvConv {
+    cl_context context;
+    cl_device_id device;
+    std::map<int, cvProgram> built;     // by radius
+    int radius;
+    int separable;
+    cl_mem weights;                     // (2 radius + 1)^2, row major
+    cl_mem row, col;                    // factors when separable, weights = col x row
+    cl_mem tmp;                         // between the two passes
+    size_t tmp_bytes;
+    cl_mem grown;                       // active mask of the row pass
+    size_t grown_bytes;
+    int images;                         // the device has CL_R / CL_FLOAT images
+    cl_mem tmp_image;                   // between the two image passes
+    int tmp_width, tmp_height;
+};
+
+const char* cvModeName(int mode);
+
+// rank 1 factorisation, weights[j][i] = col[j] * row[i] ; 0 when not separable
+int cvFactor(const float* weights, int radius, float* col, float* row);
+
+// 1 when the device has images and CL_R / CL_FLOAT among their formats, which
+// the image path needs ; cvInit falls back to buffers otherwise
+int cvImages(cl_context context, cl_device_id device);
+
+void cvInit(cvConv& conv, cl_context context, cl_device_id device);
+
+// uploads the weights and builds the kernels for the radius if needed
+cl_int cvSetWeights(cvConv& conv, const float* weights, int radius);
+
+// out = in * weights on the tiles of active, all of them when NULL ; the events
+// of the passes are appended to events if not NULL
+cl_int cvRun(cvConv& conv, cl_command_queue commands, int mode, cl_mem in, cl_mem out,
+    int width, int height, cl_mem active, std::vector<cl_event>* events);
+
+// the same from image in to image out, both CL_R / CL_FLOAT ; CL_INVALID_KERNEL
+// when the device has no such images
+cl_int cvRunImage(cvConv& conv, cl_command_queue commands, cl_mem in, cl_mem out,
+    int width, int height, cl_mem active, std::vector<cl_event>* events);
+
+// a width x height CL_R / CL_FLOAT image
+cl_mem cvImage2D(cl_context context, int width, int height, cl_mem_flags flags, cl_int* err);
+
+void cvRelease(cvConv& conv);
+
+// the same on the host, with the two passes when the weights are separable
+void cvReference(const float* in, float* out, int width, int height, const float* weights, int radius);
@@ -0,0 +1,290 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Distance.cpp
+//
+// Purpose:    Euclidean distance transform on the device, see Distance.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <math.h>
+#include "Distance.h"
+
+//------------------------------------------------------------------------------
+//
+// The rows with no mask pixel stay INFINITY after the first pass and take no
+// part in the envelopes, which start with z = -INFINITY so that the first
+// parabola is never dropped. Squares are exact in float up to 4096 pixels,
+// hence DT_MAX_SIDE.
+//
+
+const char* DistanceSource = "\n" \
+"// one work-group per row, a tile of size pixels at a time : the       \n" \
+"// nearest mask pixel on the left is a running max of the indices, the \n" \
+"// one on the right a running min, both scanned in local memory        \n" \
+"__kernel void dt_rows(__global const uchar* mask, __global float* f,   \n" \
+"   const int width, const int height, __local int* tmp)                \n" \
+"{                                                                      \n" \
+"   int lid = get_local_id(0), size = get_local_size(0);                \n" \
+"   int y = get_group_id(0);                                            \n" \
+"   int base, s, x, last, t, carry = -1;                                \n" \
+"   if(y >= height) return;                                             \n" \
+"   __global const uchar* m = mask + y*width;                           \n" \
+"   __global float* o = f + y*width;                                    \n" \
+"   for(base = 0; base < width; base += size){                          \n" \
+"       x = base + lid;                                                 \n" \
+"       last = x < width && m[x] ? x : -1;                              \n" \
+"       tmp[lid] = last;                                                \n" \
+"       barrier(CLK_LOCAL_MEM_FENCE);                                   \n" \
+"       for(s = 1; s < size; s <<= 1){                                  \n" \
+"           t = lid >= s ? tmp[lid - s] : -1;                           \n" \
+"           barrier(CLK_LOCAL_MEM_FENCE);                               \n" \
+"           tmp[lid] = last = max(last, t);                             \n" \
+"           barrier(CLK_LOCAL_MEM_FENCE); }                             \n" \
+"       last = max(last, carry);                                        \n" \
+"       if(x < width) o[x] = last < 0 ? INFINITY : (float)(x - last);   \n" \
+"       carry = max(carry, tmp[size - 1]);                              \n" \
+"       barrier(CLK_LOCAL_MEM_FENCE);                                   \n" \
+"   }                                                                   \n" \
+"   carry = width;                                                      \n" \
+"   for(base = (width - 1)/size*size; base >= 0; base -= size){         \n" \
+"       x = base + lid;                                                 \n" \
+"       last = x < width && m[x] ? x : width;                           \n" \
+"       tmp[lid] = last;                                                \n" \
+"       barrier(CLK_LOCAL_MEM_FENCE);                                   \n" \
+"       for(s = 1; s < size; s <<= 1){                                  \n" \
+"           t = lid + s < size ? tmp[lid + s] : width;                  \n" \
+"           barrier(CLK_LOCAL_MEM_FENCE);                               \n" \
+"           tmp[lid] = last = min(last, t);                             \n" \
+"           barrier(CLK_LOCAL_MEM_FENCE); }                             \n" \
+"       last = min(last, carry);                                        \n" \
+"       if(x < width){                                                  \n" \
+"           float d = o[x];                                             \n" \
+"           if(last < width) d = min(d, (float)(last - x));             \n" \
+"           o[x] = d*d;                                                 \n" \
+"       }                                                               \n" \
+"       carry = min(carry, tmp[0]);                                     \n" \
+"       barrier(CLK_LOCAL_MEM_FENCE);                                   \n" \
+"   }                                                                   \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// v[k], z[k] of column x at [k*width + x]                             \n" \
+"__kernel void dt_cols(__global const float* f, __global int* v,        \n" \
+"   __global float* z, __global float* dist, const int width,           \n" \
+"   const int height)                                                   \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0);                                           \n" \
+"   int k = -1, q, j;                                                   \n" \
+"   if(x >= width) return;                                              \n" \
+"   for(q = 0; q < height; q++){                                        \n" \
+"       float fq = f[q*width + x], s;                                   \n" \
+"       if(isinf(fq)) continue;                                         \n" \
+"       if(k < 0){                                                      \n" \
+"           k = 0;                                                      \n" \
+"           v[x] = q;                                                   \n" \
+"           z[x] = -INFINITY;                                           \n" \
+"           continue;                                                   \n" \
+"       }                                                               \n" \
+"       for(;;){                                                        \n" \
+"           int p = v[k*width + x];                                     \n" \
+"           s = ((fq + (float)(q*q)) - (f[p*width + x] + (float)(p*p))) / (float)(2*q - 2*p);\n" \
+"           if(s > z[k*width + x]) break;                               \n" \
+"           k--;                                                        \n" \
+"       }                                                               \n" \
+"       k++;                                                            \n" \
+"       v[k*width + x] = q;                                             \n" \
+"       z[k*width + x] = s;                                             \n" \
+"   }                                                                   \n" \
+"   for(q = 0, j = 0; q < height; q++){                                 \n" \
+"       if(k < 0){                                                      \n" \
+"           dist[q*width + x] = INFINITY;                               \n" \
+"           continue;                                                   \n" \
+"       }                                                               \n" \
+"       while(j < k && z[(j + 1)*width + x] < (float)q) j++;            \n" \
+"       int p = v[j*width + x];                                         \n" \
+"       dist[q*width + x] = sqrt((float)((q - p)*(q - p)) + f[p*width + x]);\n" \
+"   }                                                                   \n" \
+"}                                                                      \n" \
+"\n";
+
+cl_int dtInit(dtTransform& dt, cl_context context, cl_device_id device)
+{
+    size_t max_local = DT_LOCAL;
+    cl_int err;
+
+    dt.context = context;
+    dt.device = device;
+    dt.rows = dt.cols = NULL;
+    dt.f = dt.v = dt.z = NULL;
+    dt.npix = 0;
+    dt.local = 1;
+
+    dt.program = clCreateProgramWithSource(context, 1, &DistanceSource, NULL, &err);
+    if (!dt.program)
+        return err;
+    err = clBuildProgram(dt.program, 0, NULL, NULL, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build the distance transform kernels!\n");
+        clGetProgramBuildInfo(dt.program, device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        return err;
+    }
+    dt.rows = clCreateKernel(dt.program, "dt_rows", &err);
+    dt.cols = clCreateKernel(dt.program, "dt_cols", &err);
+    if (!dt.rows || !dt.cols)
+    {
+        printf("Error: Failed to create the distance transform kernels!\n");
+        return err;
+    }
+    clGetKernelWorkGroupInfo(dt.rows, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_local), &max_local, NULL);
+    dt.local = DT_LOCAL;
+    while (dt.local > max_local) dt.local >>= 1;
+    return CL_SUCCESS;
+}
+
+static void dtReleaseBuffers(dtTransform& dt)
+{
+    if (dt.f)
+        clReleaseMemObject(dt.f);
+    if (dt.v)
+        clReleaseMemObject(dt.v);
+    if (dt.z)
+        clReleaseMemObject(dt.z);
+    dt.f = dt.v = dt.z = NULL;
+    dt.npix = 0;
+}
+
+void dtRelease(dtTransform& dt)
+{
+    dtReleaseBuffers(dt);
+    if (dt.rows)
+        clReleaseKernel(dt.rows);
+    if (dt.cols)
+        clReleaseKernel(dt.cols);
+    if (dt.program)
+        clReleaseProgram(dt.program);
+    dt.rows = dt.cols = NULL;
+    dt.program = NULL;
+}
+
+static cl_int dtEnqueue(cl_command_queue commands, cl_kernel kernel, size_t global,
+    const size_t* local, std::vector<cl_event>* events)
+{
+    cl_event event;
+    cl_int err;
+
+    err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, local, 0, NULL, events ? &event : NULL);
+    if (err == CL_SUCCESS && events)
+        events->push_back(event);
+    return err;
+}
+
+cl_int dtRun(dtTransform& dt, cl_command_queue commands, cl_mem mask, cl_mem dist,
+    int width, int height, std::vector<cl_event>* events)
+{
+    size_t npix = (size_t)width * height;
+    cl_int err = CL_SUCCESS;
+
+    // beyond, the squared distances along a row or a column are no longer
+    // exact in float
+    if (width > DT_MAX_SIDE || height > DT_MAX_SIDE)
+        return CL_INVALID_VALUE;
+    if (dt.npix < npix)
+    {
+        dtReleaseBuffers(dt);
+        dt.f = clCreateBuffer(dt.context, CL_MEM_READ_WRITE, sizeof(cl_float) * npix, NULL, &err);
+        dt.v = clCreateBuffer(dt.context, CL_MEM_READ_WRITE, sizeof(cl_int) * npix, NULL, &err);
+        dt.z = clCreateBuffer(dt.context, CL_MEM_READ_WRITE, sizeof(cl_float) * npix, NULL, &err);
+        if (!dt.f || !dt.v || !dt.z)
+        {
+            dtReleaseBuffers(dt);
+            return err;
+        }
+        dt.npix = npix;
+    }
+    err = clSetKernelArg(dt.rows, 0, sizeof(cl_mem), &mask);
+    err |= clSetKernelArg(dt.rows, 1, sizeof(cl_mem), &dt.f);
+    err |= clSetKernelArg(dt.rows, 2, sizeof(int), &width);
+    err |= clSetKernelArg(dt.rows, 3, sizeof(int), &height);
+    err |= clSetKernelArg(dt.rows, 4, sizeof(cl_int) * dt.local, NULL);
+    err |= clSetKernelArg(dt.cols, 0, sizeof(cl_mem), &dt.f);
+    err |= clSetKernelArg(dt.cols, 1, sizeof(cl_mem), &dt.v);
+    err |= clSetKernelArg(dt.cols, 2, sizeof(cl_mem), &dt.z);
+    err |= clSetKernelArg(dt.cols, 3, sizeof(cl_mem), &dist);
+    err |= clSetKernelArg(dt.cols, 4, sizeof(int), &width);
+    err |= clSetKernelArg(dt.cols, 5, sizeof(int), &height);
+    if (err != CL_SUCCESS)
+        return err;
+    err = dtEnqueue(commands, dt.rows, height * dt.local, &dt.local, events);
+    if (err != CL_SUCCESS)
+        return err;
+    return dtEnqueue(commands, dt.cols, width, NULL, events);
+}
+
+void dtReference(const unsigned char* mask, float* dist, int width, int height)
+{
+    std::vector<float> f((size_t)width * height), z(height);
+    std::vector<int> v(height);
+    int x, y, q, j, k;
+
+    for (y = 0; y < height; y++) {
+        const unsigned char* m = mask + (size_t)y * width;
+        float* o = &f[(size_t)y * width];
+        int last = -1;
+        for (x = 0; x < width; x++) {
+            if (m[x])
+                last = x;
+            o[x] = last < 0 ? INFINITY : (float)(x - last);
+        }
+        last = -1;
+        for (x = width - 1; x >= 0; x--) {
+            float d = o[x];
+            if (m[x])
+                last = x;
+            if (last >= 0 && (float)(last - x) < d)
+                d = (float)(last - x);
+            o[x] = d * d;
+        }
+    }
+
+    for (x = 0; x < width; x++) {
+        k = -1;
+        for (q = 0; q < height; q++) {
+            float fq = f[(size_t)q * width + x], s;
+            if (isinf(fq))
+                continue;
+            if (k < 0)
+            {
+                k = 0;
+                v[0] = q;
+                z[0] = -INFINITY;
+                continue;
+            }
+            for (;;) {
+                int p = v[k];
+                s = ((fq + (float)(q * q)) - (f[(size_t)p * width + x] + (float)(p * p))) / (float)(2 * q - 2 * p);
+                if (s > z[k])
+                    break;
+                k--;
+            }
+            k++;
+            v[k] = q;
+            z[k] = s;
+        }
+        for (q = 0, j = 0; q < height; q++) {
+            if (k < 0)
+            {
+                dist[(size_t)q * width + x] = INFINITY;
+                continue;
+            }
+            while (j < k && z[j + 1] < (float)q)
+                j++;
+            int p = v[j];
+            dist[(size_t)q * width + x] = sqrtf((float)((q - p) * (q - p)) + f[(size_t)p * width + x]);
+        }
+    }
+}
@@ -0,0 +1,56 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Distance.h
+//
+// Purpose:    Exact Euclidean distance transform of a binary uchar image on the
+//             device : the distance of every pixel to the nearest non zero
+//             one, INFINITY when the image has none.
+//
+//             Felzenszwalb-Huttenlocher : the squared distance is separable,
+//             so a first pass gets it along each row, a work-group per row
+//             scanning it a tile at a time so that its work-items read and
+//             write neighbouring addresses, and a second one takes the lower
+//             envelope of the parabolas (y - q)^2 + f(q) down each column,
+//             one work-item per column. The envelope, of at most height parabolas, is kept in
+//             global memory interleaved by column, so that the neighbouring
+//             work-items of that pass read and write neighbouring addresses.
+//             Both passes are linear in the pixels, whatever the distances.
+//
+//             dtTransform dt;
+//             dtInit(dt, context, device);
+//             dtRun(dt, commands, mask, dist, width, height, NULL);
+//             dtRelease(dt);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "CL/cl.h"
+
+#define DT_LOCAL 256            // work-group of the row pass, halved to fit the device
+#define DT_MAX_SIDE 4096        // largest width and height, see Distance.cpp
+
+struct dtTransform {
+    cl_context context;
+    cl_device_id device;
+    cl_program program;
+    cl_kernel rows, cols;
+    cl_mem f;                   // squared distances along the rows, float
+    cl_mem v, z;                // parabolas of the envelopes and their bounds
+    size_t npix;                // of the buffers
+    size_t local;               // work-group of the row pass
+};
+
+cl_int dtInit(dtTransform& dt, cl_context context, cl_device_id device);
+void dtRelease(dtTransform& dt);
+
+// dist (float) = distance of each pixel of mask (uchar, width x height) to the
+// nearest non zero one, CL_INVALID_VALUE if width or height is over
+// DT_MAX_SIDE ; the events of the kernels are appended to events if
+// not NULL
+cl_int dtRun(dtTransform& dt, cl_command_queue commands, cl_mem mask, cl_mem dist,
+    int width, int height, std::vector<cl_event>* events);
+
+// the same on the host
+void dtReference(const unsigned char* mask, float* dist, int width, int height);
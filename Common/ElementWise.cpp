@@ -0,0 +1,201 @@
+//------------------------------------------------------------------------------
+//
+// Name:       ElementWise.cpp
+//
+// Purpose:    Expression graph fusion, see ElementWise.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include "ElementWise.h"
+
+int ewInput(ewGraph& g, cl_mem buf)
+{
+    ewNode n;
+    size_t slot;
+
+    // one slot per distinct buffer, so a buffer used twice is loaded once
+    for (slot = 0; slot < g.inputs.size() && g.inputs[slot] != buf; slot++);
+    if (slot == g.inputs.size())
+        g.inputs.push_back(buf);
+
+    n.op = 'i';
+    n.a = (int)slot;
+    n.b = -1;
+    g.nodes.push_back(n);
+    return (int)g.nodes.size() - 1;
+}
+
+int ewOp(ewGraph& g, char op, int a, int b)
+{
+    ewNode n;
+    n.op = op;
+    n.a = a;
+    n.b = b;
+    g.nodes.push_back(n);
+    return (int)g.nodes.size() - 1;
+}
+
+void ewOutput(ewGraph& g, int node, cl_mem buf)
+{
+    g.outputs.push_back(node);
+    g.outbufs.push_back(buf);
+}
+
+std::string ewShape(const ewGraph& g)
+{
+    std::string s;
+    char item[64];
+    size_t i;
+
+    for (i = 0; i < g.nodes.size(); i++) {
+        if (g.nodes[i].op == 'i')
+            sprintf(item, "i%d;", g.nodes[i].a);
+        else
+            sprintf(item, "%c%d,%d;", g.nodes[i].op, g.nodes[i].a, g.nodes[i].b);
+        s += item;
+    }
+    for (i = 0; i < g.outputs.size(); i++) {
+        sprintf(item, "o%d;", g.outputs[i]);
+        s += item;
+    }
+    return s;
+}
+
+std::string ewSource(const ewGraph& g)
+{
+    std::string s;
+    char line[128];
+    size_t i;
+
+    s = "__kernel void ew_fused(\n";
+    for (i = 0; i < g.inputs.size(); i++) {
+        sprintf(line, "   __global const float* in%d,\n", (int)i);
+        s += line;
+    }
+    for (i = 0; i < g.outputs.size(); i++) {
+        sprintf(line, "   __global float* out%d,\n", (int)i);
+        s += line;
+    }
+    s += "   const unsigned int count)\n{\n";
+    s += "   int i = get_global_id(0);\n";
+    s += "   if(i >= count) return;\n";
+    for (i = 0; i < g.inputs.size(); i++) {
+        sprintf(line, "   float x%d = in%d[i];\n", (int)i, (int)i);
+        s += line;
+    }
+    for (i = 0; i < g.nodes.size(); i++) {
+        const ewNode& n = g.nodes[i];
+        if (n.op == 'i')
+            sprintf(line, "   float v%d = x%d;\n", (int)i, n.a);
+        else
+            sprintf(line, "   float v%d = v%d %c v%d;\n", (int)i, n.a, n.op, n.b);
+        s += line;
+    }
+    for (i = 0; i < g.outputs.size(); i++) {
+        sprintf(line, "   out%d[i] = v%d;\n", (int)i, g.outputs[i]);
+        s += line;
+    }
+    s += "}\n";
+    return s;
+}
+
+size_t ewBytesFused(const ewGraph& g, unsigned int count)
+{
+    return (g.inputs.size() + g.outputs.size()) * sizeof(float) * count;
+}
+
+size_t ewBytesUnfused(const ewGraph& g, unsigned int count)
+{
+    size_t ops = 0, i;
+
+    // every operation reads its two operands and writes its result
+    for (i = 0; i < g.nodes.size(); i++)
+        if (g.nodes[i].op != 'i')
+            ops++;
+    return ops * 3 * sizeof(float) * count;
+}
+
+void ewCacheInit(ewCache& cache, cl_context context, cl_device_id device)
+{
+    cache.context = context;
+    cache.device = device;
+    cache.hits = 0;
+    cache.misses = 0;
+}
+
+void ewCacheRelease(ewCache& cache)
+{
+    std::map<std::string, cl_kernel>::iterator k;
+    std::map<std::string, cl_program>::iterator p;
+
+    for (k = cache.kernels.begin(); k != cache.kernels.end(); ++k)
+        clReleaseKernel(k->second);
+    for (p = cache.programs.begin(); p != cache.programs.end(); ++p)
+        clReleaseProgram(p->second);
+    cache.kernels.clear();
+    cache.programs.clear();
+}
+
+cl_int ewEnqueue(ewCache& cache, const ewGraph& g, cl_command_queue commands, unsigned int count,
+    cl_uint nwait, const cl_event* wait, cl_event* event)
+{
+    cl_int err;
+    cl_kernel kernel;
+    std::string shape = ewShape(g);
+    std::map<std::string, cl_kernel>::iterator it = cache.kernels.find(shape);
+
+    if (it != cache.kernels.end()) {
+        kernel = it->second;
+        cache.hits++;
+    }
+    else {
+        std::string source = ewSource(g);
+        const char* src = source.c_str();
+        cl_program program = clCreateProgramWithSource(cache.context, 1, &src, NULL, &err);
+        if (!program)
+        {
+            printf("Error: Failed to create fused program!\n");
+            return err;
+        }
+        err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            size_t len;
+            char buffer[2048];
+
+            printf("Error: Failed to build fused program!\n%s\n", src);
+            clGetProgramBuildInfo(program, cache.device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+            printf("%s\n", buffer);
+            clReleaseProgram(program);
+            return err;
+        }
+        kernel = clCreateKernel(program, "ew_fused", &err);
+        if (!kernel || err != CL_SUCCESS)
+        {
+            printf("Error: Failed to create fused kernel!\n");
+            clReleaseProgram(program);
+            return err;
+        }
+        cache.programs[shape] = program;
+        cache.kernels[shape] = kernel;
+        cache.misses++;
+    }
+
+    cl_uint arg = 0;
+    size_t i;
+    err = CL_SUCCESS;
+    for (i = 0; i < g.inputs.size(); i++)
+        err |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &g.inputs[i]);
+    for (i = 0; i < g.outbufs.size(); i++)
+        err |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &g.outbufs[i]);
+    err |= clSetKernelArg(kernel, arg++, sizeof(unsigned int), &count);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to set fused kernel arguments! %d\n", err);
+        return err;
+    }
+
+    size_t global = count;
+    return clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, NULL, nwait, wait, event);
+}
@@ -0,0 +1,70 @@
+//------------------------------------------------------------------------------
+//
+// Name:       ElementWise.h
+//
+// Purpose:    Expression graphs of element-wise float vector operations,
+//             fused into a single generated kernel.
+//
+//             A graph is built from input buffers and binary operations
+//             (+ - * /), the nodes marked as outputs are written back. The
+//             generated kernel loads every input once, keeps intermediates
+//             in registers and stores only the outputs. Programs are cached
+//             by expression shape : the same chain over other buffers of the
+//             same roles reuses the compiled kernel.
+//
+//             ewGraph g;
+//             int a = ewInput(g, a_in), b = ewInput(g, b_in);
+//             int c = ewOp(g, '+', a, b);
+//             ewOutput(g, ewOp(g, '+', ewOp(g, '+', c, a), b), e_out);
+//             ewEnqueue(cache, g, commands, count, 0, NULL, &event);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "CL/cl.h"
+
+struct ewNode {
+    char op;                // 'i' for an input, otherwise + - * /
+    int a, b;               // operand nodes, input slot for 'i'
+};
+
+struct ewGraph {
+    std::vector<ewNode> nodes;
+    std::vector<cl_mem> inputs;     // distinct input buffers, in slot order
+    std::vector<int> outputs;       // output nodes
+    std::vector<cl_mem> outbufs;    // and their buffers
+};
+
+struct ewCache {
+    cl_context context;
+    cl_device_id device;
+    std::map<std::string, cl_program> programs;
+    std::map<std::string, cl_kernel> kernels;
+    int hits, misses;
+};
+
+// graph construction, returns the node index
+int ewInput(ewGraph& g, cl_mem buf);
+int ewOp(ewGraph& g, char op, int a, int b);
+void ewOutput(ewGraph& g, int node, cl_mem buf);
+
+// cache key of the graph, independent of the actual buffers
+std::string ewShape(const ewGraph& g);
+
+// OpenCL C source of the fused kernel "ew_fused"
+std::string ewSource(const ewGraph& g);
+
+// global memory traffic of the fused kernel, and of one launch per operation
+size_t ewBytesFused(const ewGraph& g, unsigned int count);
+size_t ewBytesUnfused(const ewGraph& g, unsigned int count);
+
+void ewCacheInit(ewCache& cache, cl_context context, cl_device_id device);
+void ewCacheRelease(ewCache& cache);
+
+// builds (or reuses) the fused kernel and enqueues it over count elements
+cl_int ewEnqueue(ewCache& cache, const ewGraph& g, cl_command_queue commands, unsigned int count,
+    cl_uint nwait, const cl_event* wait, cl_event* event);
@@ -0,0 +1,255 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Histogram.cpp
+//
+// Purpose:    Histogram and threshold selection on the device, see Histogram.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <limits.h>
+#include "Histogram.h"
+
+//------------------------------------------------------------------------------
+//
+// Built with -DBINS=HG_BINS. The selection is in integers, so that hgSelect
+// picks the same split on the host bit for bit : with less than 2^32 counts,
+// the class means are fixed point with 10 fractional bits, under 2^20, their
+// difference d is at least one bin (1024) and Otsu's variance between the
+// classes, wb * wf / total * d * d, stays under 2^60. The threshold itself is
+// scaled by 1 / BINS, a power of two, with no float division.
+//
+
+const char* HistogramSource = "\n" \
+"__kernel void hg_clear(__global uint* bins)                            \n" \
+"{                                                                      \n" \
+"   bins[get_global_id(0)] = 0;                                         \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void hg_count(__global const float* in, const uint n,         \n" \
+"   const int skip_zero, const float scale, __global uint* bins)        \n" \
+"{                                                                      \n" \
+"   __local uint part[BINS];                                            \n" \
+"   int l = get_local_id(0), size = get_local_size(0);                  \n" \
+"   uint k;                                                             \n" \
+"   int i;                                                              \n" \
+"   for(i = l; i < BINS; i += size)                                     \n" \
+"       part[i] = 0;                                                    \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                                       \n" \
+"   for(k = get_global_id(0); k < n; k += get_global_size(0)){          \n" \
+"       float v = in[k];                                                \n" \
+"       if(skip_zero && v == 0.0f) continue;                            \n" \
+"       atomic_inc(&part[clamp((int)(v*scale), 0, BINS-1)]);            \n" \
+"   }                                                                   \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                                       \n" \
+"   for(i = l; i < BINS; i += size)                                     \n" \
+"       if(part[i]) atomic_add(&bins[i], part[i]);                      \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// one work-item ; method 0 Otsu, 1 percentile param                   \n" \
+"__kernel void hg_select(__global const uint* bins, const int method,   \n" \
+"   const float param, const float max, const float ratio,             \n" \
+"   __global float* pair)                                               \n" \
+"{                                                                      \n" \
+"   ulong total = 0, sum = 0, wb = 0, sumb = 0;                         \n" \
+"   int i, split = BINS-1;                                              \n" \
+"   for(i = 0; i < BINS; i++){                                          \n" \
+"       total += bins[i];                                               \n" \
+"       sum += (ulong)i*bins[i];                                        \n" \
+"   }                                                                   \n" \
+"   if(total > 0 && method == 0){                                       \n" \
+"       long best = -1;                                                 \n" \
+"       for(i = 0; i < BINS-1; i++){                                    \n" \
+"           wb += bins[i];                                              \n" \
+"           sumb += (ulong)i*bins[i];                                   \n" \
+"           if(wb == 0) continue;                                       \n" \
+"           if(wb == total) break;                                      \n" \
+"           ulong wf = total - wb;                                      \n" \
+"           ulong d = ((sum - sumb) << 10)/wf - (sumb << 10)/wb;        \n" \
+"           long between = (long)((wb*wf/total*d >> 10)*d);             \n" \
+"           if(between > best){ best = between; split = i; }            \n" \
+"       }                                                               \n" \
+"   }                                                                   \n" \
+"   else if(total > 0){                                                 \n" \
+"       for(i = 0; i < BINS-1; i++){                                    \n" \
+"           wb += bins[i];                                              \n" \
+"           if((float)wb >= param*(float)total) break;                  \n" \
+"       }                                                               \n" \
+"       split = i;                                                      \n" \
+"   }                                                                   \n" \
+"   float t = (float)(split + 1)*max*(1.0f/BINS);                       \n" \
+"   pair[0] = ratio*t;                                                  \n" \
+"   pair[1] = t;                                                        \n" \
+"}                                                                      \n" \
+"\n";
+
+cl_int hgInit(hgHistogram& hg, cl_context context, cl_device_id device)
+{
+    char options[32];
+    cl_int err;
+
+    hg.context = context;
+    hg.device = device;
+    hg.clear = hg.count = hg.select = NULL;
+    hg.bins = NULL;
+    hg.local = HG_LOCAL;
+
+    hg.program = clCreateProgramWithSource(context, 1, &HistogramSource, NULL, &err);
+    if (!hg.program)
+        return err;
+    sprintf(options, "-DBINS=%d", HG_BINS);
+    err = clBuildProgram(hg.program, 0, NULL, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build the histogram kernels!\n");
+        clGetProgramBuildInfo(hg.program, device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        return err;
+    }
+    hg.clear = clCreateKernel(hg.program, "hg_clear", &err);
+    hg.count = clCreateKernel(hg.program, "hg_count", &err);
+    hg.select = clCreateKernel(hg.program, "hg_select", &err);
+    if (!hg.clear || !hg.count || !hg.select)
+    {
+        printf("Error: Failed to create the histogram kernels!\n");
+        return err;
+    }
+    // hg_count strides over any local size, kept a power of two under the kernel's limit
+    size_t max_size;
+    if (clGetKernelWorkGroupInfo(hg.count, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL) == CL_SUCCESS) {
+        while (hg.local > max_size)
+            hg.local /= 2;
+    }
+    hg.bins = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * HG_BINS, NULL, &err);
+    if (!hg.bins)
+        return err;
+    return CL_SUCCESS;
+}
+
+void hgRelease(hgHistogram& hg)
+{
+    if (hg.bins)
+        clReleaseMemObject(hg.bins);
+    if (hg.clear)
+        clReleaseKernel(hg.clear);
+    if (hg.count)
+        clReleaseKernel(hg.count);
+    if (hg.select)
+        clReleaseKernel(hg.select);
+    if (hg.program)
+        clReleaseProgram(hg.program);
+    hg.bins = NULL;
+    hg.clear = hg.count = hg.select = NULL;
+    hg.program = NULL;
+}
+
+static cl_int hgEnqueue(cl_command_queue commands, cl_kernel kernel, size_t global, size_t local,
+    std::vector<cl_event>* events)
+{
+    cl_event event;
+    cl_int err;
+
+    err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, local ? &local : NULL, 0, NULL, events ? &event : NULL);
+    if (err == CL_SUCCESS && events)
+        events->push_back(event);
+    return err;
+}
+
+cl_int hgCount(hgHistogram& hg, cl_command_queue commands, cl_mem image, size_t n, int skip_zero,
+    float max, std::vector<cl_event>* events)
+{
+    cl_uint count = (cl_uint)n;
+    float scale = HG_BINS / max;
+    cl_int err;
+
+    // the kernel indexes and hg_select sums the counts in uint
+    if (n > UINT_MAX)
+        return CL_INVALID_BUFFER_SIZE;
+    err = clSetKernelArg(hg.clear, 0, sizeof(cl_mem), &hg.bins);
+    err |= clSetKernelArg(hg.count, 0, sizeof(cl_mem), &image);
+    err |= clSetKernelArg(hg.count, 1, sizeof(cl_uint), &count);
+    err |= clSetKernelArg(hg.count, 2, sizeof(int), &skip_zero);
+    err |= clSetKernelArg(hg.count, 3, sizeof(float), &scale);
+    err |= clSetKernelArg(hg.count, 4, sizeof(cl_mem), &hg.bins);
+    if (err != CL_SUCCESS)
+        return err;
+    err = hgEnqueue(commands, hg.clear, HG_BINS, 0, events);
+    if (err != CL_SUCCESS)
+        return err;
+    return hgEnqueue(commands, hg.count, HG_GROUPS * hg.local, hg.local, events);
+}
+
+cl_int hgThreshold(hgHistogram& hg, cl_command_queue commands, int method, float param, float max,
+    float ratio, cl_mem pair, std::vector<cl_event>* events)
+{
+    cl_int err;
+
+    err = clSetKernelArg(hg.select, 0, sizeof(cl_mem), &hg.bins);
+    err |= clSetKernelArg(hg.select, 1, sizeof(int), &method);
+    err |= clSetKernelArg(hg.select, 2, sizeof(float), &param);
+    err |= clSetKernelArg(hg.select, 3, sizeof(float), &max);
+    err |= clSetKernelArg(hg.select, 4, sizeof(float), &ratio);
+    err |= clSetKernelArg(hg.select, 5, sizeof(cl_mem), &pair);
+    if (err != CL_SUCCESS)
+        return err;
+    return hgEnqueue(commands, hg.select, 1, 1, events);
+}
+
+void hgReference(const float* image, size_t n, int skip_zero, float max, std::vector<cl_uint>& bins)
+{
+    float scale = HG_BINS / max;
+    size_t k;
+
+    bins.assign(HG_BINS, 0);
+    for (k = 0; k < n; k++) {
+        if (skip_zero && image[k] == 0.0f)
+            continue;
+        int b = (int)(image[k] * scale);
+        bins[b < 0 ? 0 : (b > HG_BINS - 1 ? HG_BINS - 1 : b)]++;
+    }
+}
+
+float hgSelect(const std::vector<cl_uint>& bins, int method, float param, float max)
+{
+    unsigned long long total = 0, sum = 0, wb = 0, sumb = 0;
+    int i, split = HG_BINS - 1;
+
+    for (i = 0; i < HG_BINS; i++) {
+        total += bins[i];
+        sum += (unsigned long long)i * bins[i];
+    }
+    if (total > 0 && method == HG_OTSU)
+    {
+        long long best = -1;
+        for (i = 0; i < HG_BINS - 1; i++) {
+            wb += bins[i];
+            sumb += (unsigned long long)i * bins[i];
+            if (wb == 0)
+                continue;
+            if (wb == total)
+                break;
+            // in integers as on the device, see HistogramSource
+            unsigned long long wf = total - wb;
+            unsigned long long d = ((sum - sumb) << 10) / wf - (sumb << 10) / wb;
+            long long between = (long long)((wb * wf / total * d >> 10) * d);
+            if (between > best)
+            {
+                best = between;
+                split = i;
+            }
+        }
+    }
+    else if (total > 0)
+    {
+        for (i = 0; i < HG_BINS - 1; i++) {
+            wb += bins[i];
+            if ((float)wb >= param * (float)total)
+                break;
+        }
+        split = i;
+    }
+    return (float)(split + 1) * max * (1.0f / HG_BINS);
+}
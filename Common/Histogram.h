@@ -0,0 +1,64 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Histogram.h
+//
+// Purpose:    Histogram of a float image and threshold selection, on the
+//             device.
+//
+//             Each work-group counts into its own copy of the bins in local
+//             memory, where the atomics only contend within the group, and
+//             adds it to the global bins once at the end ; the groups stride
+//             over the image, HG_GROUPS of them whatever its size. Values
+//             are binned over [0, max), the larger ones in the last bin.
+//
+//             The threshold is then chosen by a single work-item, from the
+//             bins alone : Otsu's (the split maximising the variance between
+//             the two classes) or a percentile. It is written to a device
+//             buffer as a hysteresis pair, { ratio * t, t }, which the next
+//             kernels read directly ; the host never sees the image.
+//
+//             hgHistogram hg;
+//             hgInit(hg, context, device);
+//             hgCount(hg, commands, image, npix, 1, max, NULL);
+//             hgThreshold(hg, commands, HG_OTSU, 0.0f, max, 0.4f, pair, NULL);
+//             hgRelease(hg);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "CL/cl.h"
+
+#define HG_BINS 1024
+#define HG_LOCAL 256            // work-items per group, fewer if the kernel allows less
+#define HG_GROUPS 64
+
+enum { HG_OTSU, HG_PERCENTILE };
+
+struct hgHistogram {
+    cl_context context;
+    cl_device_id device;
+    cl_program program;
+    cl_kernel clear, count, select;
+    cl_mem bins;                // HG_BINS uint
+    size_t local;               // work-items per group of hg_count
+};
+
+cl_int hgInit(hgHistogram& hg, cl_context context, cl_device_id device);
+void hgRelease(hgHistogram& hg);
+
+// bins of the n floats of image over [0, max), leaving out the zeros when
+// skip_zero, n at most UINT_MAX ; the events of the kernels are appended to
+// events if not NULL
+cl_int hgCount(hgHistogram& hg, cl_command_queue commands, cl_mem image, size_t n, int skip_zero,
+    float max, std::vector<cl_event>* events);
+
+// threshold t of the bins of the last hgCount, Otsu's or the value under which
+// a fraction param of the counts fall ; pair (2 floats) gets { ratio * t, t }
+cl_int hgThreshold(hgHistogram& hg, cl_command_queue commands, int method, float param, float max,
+    float ratio, cl_mem pair, std::vector<cl_event>* events);
+
+// the same on the host
+void hgReference(const float* image, size_t n, int skip_zero, float max, std::vector<cl_uint>& bins);
+float hgSelect(const std::vector<cl_uint>& bins, int method, float param, float max);
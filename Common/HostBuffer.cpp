@@ -0,0 +1,124 @@
+//------------------------------------------------------------------------------
+//
+// Name:       HostBuffer.cpp
+//
+// Purpose:    Zero copy host buffers, see HostBuffer.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "HostBuffer.h"
+
+int hbUnifiedMemory(cl_device_id device)
+{
+    cl_bool unified = CL_FALSE;
+
+    if (clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL) != CL_SUCCESS)
+        return 0;
+    return unified == CL_TRUE;
+}
+
+void* hbAlignedAlloc(size_t bytes)
+{
+    bytes = (bytes + HB_SIZE_MULTIPLE - 1) / HB_SIZE_MULTIPLE * HB_SIZE_MULTIPLE;
+#ifdef _WIN32
+    return _aligned_malloc(bytes, HB_ALIGNMENT);
+#else
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, HB_ALIGNMENT, bytes) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+void hbAlignedFree(void* ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+cl_int hbCreate(hbBuffer& b, cl_context context, cl_mem_flags flags, size_t bytes, int zero_copy)
+{
+    cl_int err;
+
+    b.bytes = bytes;
+    b.zero_copy = zero_copy;
+    b.mapped = NULL;
+    b.map_flags = 0;
+    b.host = hbAlignedAlloc(bytes);
+    if (!b.host)
+        return CL_OUT_OF_HOST_MEMORY;
+
+    if (zero_copy)
+        b.mem = clCreateBuffer(context, flags | CL_MEM_USE_HOST_PTR, bytes, b.host, &err);
+    else
+        b.mem = clCreateBuffer(context, flags, bytes, NULL, &err);
+    if (!b.mem)
+    {
+        hbAlignedFree(b.host);
+        b.host = NULL;
+    }
+    return err;
+}
+
+void* hbMap(cl_command_queue commands, hbBuffer& b, cl_map_flags flags, cl_event* event)
+{
+    cl_int err = CL_SUCCESS;
+
+    if (event)
+        *event = NULL;
+    if (b.mapped)
+        return b.mapped;
+
+    if (b.zero_copy)
+        b.mapped = clEnqueueMapBuffer(commands, b.mem, CL_TRUE, flags, 0, b.bytes, 0, NULL, event, &err);
+    else {
+        // only a read needs the device content, a write overwrites the shadow
+        if (flags & CL_MAP_READ)
+            err = clEnqueueReadBuffer(commands, b.mem, CL_TRUE, 0, b.bytes, b.host, 0, NULL, event);
+        b.mapped = err == CL_SUCCESS ? b.host : NULL;
+    }
+    if (err != CL_SUCCESS)
+        printf("Error: Failed to map buffer! %d\n", err);
+    b.map_flags = flags;
+    return b.mapped;
+}
+
+cl_int hbUnmap(cl_command_queue commands, hbBuffer& b, cl_event* event)
+{
+    cl_int err = CL_SUCCESS;
+
+    if (event)
+        *event = NULL;
+    if (!b.mapped)
+        return CL_SUCCESS;
+
+    if (b.zero_copy)
+        err = clEnqueueUnmapMemObject(commands, b.mem, b.mapped, 0, NULL, event);
+    else if (b.map_flags & (CL_MAP_WRITE | CL_MAP_WRITE_INVALIDATE_REGION))
+        err = clEnqueueWriteBuffer(commands, b.mem, CL_TRUE, 0, b.bytes, b.host, 0, NULL, event);
+    b.mapped = NULL;
+    return err;
+}
+
+void hbRelease(cl_command_queue commands, hbBuffer& b)
+{
+    if (b.mapped && b.zero_copy)
+        clEnqueueUnmapMemObject(commands, b.mem, b.mapped, 0, NULL, NULL);
+    b.mapped = NULL;
+    if (b.mem)
+        clReleaseMemObject(b.mem);
+    // the device may still use the host storage until the release has gone through
+    clFinish(commands);
+    if (b.host)
+        hbAlignedFree(b.host);
+    b.mem = NULL;
+    b.host = NULL;
+}
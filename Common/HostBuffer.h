@@ -0,0 +1,53 @@
+//------------------------------------------------------------------------------
+//
+// Name:       HostBuffer.h
+//
+// Purpose:    Buffers shared between the host and the device.
+//
+//             On devices sharing the host memory (CPU devices, integrated
+//             GPUs : CL_DEVICE_HOST_UNIFIED_MEMORY) the buffer is created with
+//             CL_MEM_USE_HOST_PTR over a page aligned allocation, and the host
+//             accesses it through map / unmap : no copy is made. On other
+//             devices the same calls fall back to read / write of a host
+//             shadow copy, so the calling code is the same in both modes.
+//
+//             float* p = (float*)hbMap(commands, buf, CL_MAP_WRITE, NULL);
+//             ... fill p ...
+//             hbUnmap(commands, buf, NULL);        // the device owns it again
+//             ... kernels using buf.mem ...
+//             p = (float*)hbMap(commands, buf, CL_MAP_READ, NULL);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CL/cl.h"
+
+#define HB_ALIGNMENT 4096    // page alignment, enough for every zero copy rule we know of
+#define HB_SIZE_MULTIPLE 64  // allocation size rounded to a cache line
+
+struct hbBuffer {
+    cl_mem mem;
+    void* host;             // backing store in zero copy mode, shadow copy otherwise
+    size_t bytes;
+    int zero_copy;
+    void* mapped;           // host pointer while the host owns the buffer
+    cl_map_flags map_flags;
+};
+
+// 1 when the device shares the host memory
+int hbUnifiedMemory(cl_device_id device);
+
+void* hbAlignedAlloc(size_t bytes);
+void hbAlignedFree(void* ptr);
+
+// flags are the access flags (CL_MEM_READ_ONLY...), the host pointer flags are added here
+cl_int hbCreate(hbBuffer& b, cl_context context, cl_mem_flags flags, size_t bytes, int zero_copy);
+
+// gives the buffer to the host, blocking ; event is NULL when no command was needed
+void* hbMap(cl_command_queue commands, hbBuffer& b, cl_map_flags flags, cl_event* event);
+
+// gives the buffer back to the device
+cl_int hbUnmap(cl_command_queue commands, hbBuffer& b, cl_event* event);
+
+void hbRelease(cl_command_queue commands, hbBuffer& b);
@@ -0,0 +1,493 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Labeling.cpp
+//
+// Purpose:    Connected components and contours on the device, see Labeling.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <limits.h>
+#include <algorithm>
+#include "Labeling.h"
+
+//------------------------------------------------------------------------------
+//
+// Moore tracing : from a pixel p and its backtrack b (the background pixel
+// seen last), the 8 neighbours are scanned clockwise from b ; the first pixel
+// of the component is the next p, the neighbour scanned just before it the
+// next b. The root has the background on its left, so tracing starts there
+// with b to the west ; it stops when it is about to leave the root towards
+// the same pixel as the first move, from where it would go round again. (On
+// one pixel wide lines, coming back to the root with the same b, Jacob's
+// criterion, does not always happen.)
+//
+
+const char* LabelSource = "\n" \
+"__constant int DX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };                  \n" \
+"__constant int DY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };                  \n" \
+"__constant int DIR[9] = { 5, 6, 7, 4, -1, 0, 3, 2, 1 };                \n" \
+"                                                                       \n" \
+"__kernel void lb_init(__global const uchar* mask, __global int* label, \n" \
+"   const int width, const int height)                                  \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   label[y*width + x] = mask[y*width + x] ? y*width + x : -1;          \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// hooks the root of the pixel to the smallest label around it        \n" \
+"__kernel void lb_link(__global int* label, __global int* changed,      \n" \
+"   const int width, const int height)                                  \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i, j, l, m, q;                                                  \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   l = label[y*width + x];                                             \n" \
+"   if(l < 0) return;                                                   \n" \
+"   m = l;                                                              \n" \
+"   for(j = max(y-1, 0); j <= min(y+1, height-1); j++)                  \n" \
+"       for(i = max(x-1, 0); i <= min(x+1, width-1); i++){              \n" \
+"           q = label[j*width + i];                                     \n" \
+"           if(q >= 0 && q < m) m = q; }                                \n" \
+"   if(m < l){                                                          \n" \
+"       atomic_min(&label[l], m);                                       \n" \
+"       *changed = 1; }                                                 \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// pointer jumping, every pixel ends pointing to its root              \n" \
+"__kernel void lb_compress(__global int* label, const int width, const int height)\n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int l, n;                                                           \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   l = label[y*width + x];                                             \n" \
+"   if(l < 0) return;                                                   \n" \
+"   while((n = label[l]) != l) l = n;                                   \n" \
+"   label[y*width + x] = l;                                             \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// one slot per component, while there is room                         \n" \
+"__kernel void lb_roots(__global const int* label, __global uint* root, \n" \
+"   __global uint* ncomp, const uint capacity, const int width, const int height)\n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   uint c;                                                             \n" \
+"   if(x >= width || y >= height || label[y*width + x] != y*width + x) return;\n" \
+"   c = atomic_inc(ncomp);                                              \n" \
+"   if(c < capacity) root[c] = y*width + x;                             \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"uint trace(__global const int* label, const int s, const int width,    \n" \
+"   const int height, const uint limit, __global ushort2* out)          \n" \
+"{                                                                      \n" \
+"   int px = s % width, py = s / width;                                 \n" \
+"   int b = 4, d = 0, first = 0, k, qx, qy;                             \n" \
+"   uint n = 0;                                                         \n" \
+"   for(;;){                                                            \n" \
+"       for(k = 1; k <= 8; k++){                                        \n" \
+"           d = (b + k) & 7;                                            \n" \
+"           qx = px + DX[d]; qy = py + DY[d];                           \n" \
+"           if(qx >= 0 && qy >= 0 && qx < width && qy < height          \n" \
+"               && label[qy*width + qx] == s) break; }                  \n" \
+"       if(n > 0 && py*width + px == s && d == first) break;            \n" \
+"       if(out) out[n] = (ushort2)(px, py);                             \n" \
+"       n++;                                                            \n" \
+"       if(k > 8 || n >= limit) break;                                  \n" \
+"       if(n == 1) first = d;                                           \n" \
+"       qx = DX[(d + 7) & 7] - DX[d];                                   \n" \
+"       qy = DY[(d + 7) & 7] - DY[d];                                   \n" \
+"       px += DX[d]; py += DY[d];                                       \n" \
+"       b = DIR[(qy + 1)*3 + qx + 1];                                   \n" \
+"   }                                                                   \n" \
+"   return n;                                                           \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void lb_count(__global const int* label, __global const uint* root,\n" \
+"   __global uint* length, const uint ncomp, const int width,           \n" \
+"   const int height, const uint limit)                                 \n" \
+"{                                                                      \n" \
+"   uint c = get_global_id(0);                                          \n" \
+"   if(c >= ncomp) return;                                              \n" \
+"   length[c] = trace(label, root[c], width, height, limit, 0);         \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void lb_write(__global const int* label, __global const uint* root,\n" \
+"   __global const uint* offset, __global ushort2* point, const uint ncomp,\n" \
+"   const int width, const int height, const uint limit)                \n" \
+"{                                                                      \n" \
+"   uint c = get_global_id(0);                                          \n" \
+"   if(c >= ncomp) return;                                              \n" \
+"   trace(label, root[c], width, height, limit, point + offset[c]);     \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// exclusive prefix sum by one work-group, chunk after chunk           \n" \
+"__kernel void lb_scan(__global const uint* length, __global uint* offset,\n" \
+"   const uint n, __local uint* tmp)                                    \n" \
+"{                                                                      \n" \
+"   uint lid = get_local_id(0), size = get_local_size(0);               \n" \
+"   uint base, s, v, t, carry = 0;                                      \n" \
+"   for(base = 0; base < n; base += size){                              \n" \
+"       v = base + lid < n ? length[base + lid] : 0;                    \n" \
+"       tmp[lid] = v;                                                   \n" \
+"       barrier(CLK_LOCAL_MEM_FENCE);                                   \n" \
+"       for(s = 1; s < size; s <<= 1){                                  \n" \
+"           t = lid >= s ? tmp[lid - s] : 0;                            \n" \
+"           barrier(CLK_LOCAL_MEM_FENCE);                               \n" \
+"           tmp[lid] += t;                                              \n" \
+"           barrier(CLK_LOCAL_MEM_FENCE); }                             \n" \
+"       if(base + lid < n) offset[base + lid] = carry + tmp[lid] - v;   \n" \
+"       carry += tmp[size - 1];                                         \n" \
+"       barrier(CLK_LOCAL_MEM_FENCE);                                   \n" \
+"   }                                                                   \n" \
+"   if(lid == 0) offset[n] = carry;                                     \n" \
+"}                                                                      \n" \
+"\n";
+
+cl_int lbInit(lbLabeler& lb, cl_context context, cl_device_id device)
+{
+    cl_int err;
+
+    lb.context = context;
+    lb.device = device;
+    lb.width = lb.height = 0;
+    lb.npix = 0;
+    lb.label = lb.root = lb.length = lb.offset = lb.point = NULL;
+    lb.comp_capacity = lb.trace_capacity = lb.point_capacity = 0;
+    lb.components = lb.points = 0;
+    lb.passes = 0;
+
+    lb.program = clCreateProgramWithSource(context, 1, &LabelSource, NULL, &err);
+    if (!lb.program)
+        return err;
+    err = clBuildProgram(lb.program, 0, NULL, NULL, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build the labelling kernels!\n");
+        clGetProgramBuildInfo(lb.program, device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        return err;
+    }
+    lb.init = clCreateKernel(lb.program, "lb_init", &err);
+    lb.link = clCreateKernel(lb.program, "lb_link", &err);
+    lb.compress = clCreateKernel(lb.program, "lb_compress", &err);
+    lb.roots = clCreateKernel(lb.program, "lb_roots", &err);
+    lb.count = clCreateKernel(lb.program, "lb_count", &err);
+    lb.scan = clCreateKernel(lb.program, "lb_scan", &err);
+    lb.write = clCreateKernel(lb.program, "lb_write", &err);
+    if (!lb.init || !lb.link || !lb.compress || !lb.roots || !lb.count || !lb.scan || !lb.write)
+    {
+        printf("Error: Failed to create the labelling kernels!\n");
+        return err;
+    }
+    lb.changed = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int), NULL, &err);
+    lb.ncomp = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, &err);
+    if (!lb.changed || !lb.ncomp)
+        return err;
+    return CL_SUCCESS;
+}
+
+void lbRelease(lbLabeler& lb)
+{
+    cl_mem* mems[] = { &lb.label, &lb.changed, &lb.ncomp, &lb.root, &lb.length, &lb.offset, &lb.point };
+    size_t i;
+    for (i = 0; i < sizeof(mems) / sizeof(mems[0]); i++) {
+        if (*mems[i])
+            clReleaseMemObject(*mems[i]);
+        *mems[i] = NULL;
+    }
+    clReleaseKernel(lb.init);
+    clReleaseKernel(lb.link);
+    clReleaseKernel(lb.compress);
+    clReleaseKernel(lb.roots);
+    clReleaseKernel(lb.count);
+    clReleaseKernel(lb.scan);
+    clReleaseKernel(lb.write);
+    clReleaseProgram(lb.program);
+}
+
+// grows buf to count elements of size bytes, the content is lost
+static cl_int lbReserve(lbLabeler& lb, cl_mem& buf, size_t& capacity, size_t count, size_t size)
+{
+    cl_int err = CL_SUCCESS;
+    if (count <= capacity && buf)
+        return CL_SUCCESS;
+    if (buf)
+        clReleaseMemObject(buf);
+    // some slack, the counts move from one image to the next
+    capacity = count + count / 4 + 64;
+    buf = clCreateBuffer(lb.context, CL_MEM_READ_WRITE, capacity * size, NULL, &err);
+    if (!buf)
+        capacity = 0;
+    return buf ? CL_SUCCESS : err;
+}
+
+static cl_int lbEnqueue(lbLabeler& lb, cl_command_queue commands, cl_kernel kernel, std::vector<cl_event>* events)
+{
+    size_t local[2] = { LB_LOCAL, LB_LOCAL };
+    size_t global[2] = {
+        ((size_t)lb.width + LB_LOCAL - 1) / LB_LOCAL * LB_LOCAL,
+        ((size_t)lb.height + LB_LOCAL - 1) / LB_LOCAL * LB_LOCAL };
+    cl_event event;
+    cl_int err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, local, 0, NULL, events ? &event : NULL);
+    if (err == CL_SUCCESS && events)
+        events->push_back(event);
+    return err;
+}
+
+cl_int lbLabel(lbLabeler& lb, cl_command_queue commands, cl_mem mask, int width, int height,
+    std::vector<cl_event>* events)
+{
+    const cl_int zero = 0;
+    cl_int changed = 1;
+    cl_int err;
+    int k;
+
+    // the labels are pixel indices in int
+    if ((size_t)width * height > INT_MAX)
+        return CL_INVALID_BUFFER_SIZE;
+    if (lb.width != width || lb.height != height)
+    {
+        if (lb.label)
+            clReleaseMemObject(lb.label);
+        lb.npix = (size_t)width * height;
+        lb.label = clCreateBuffer(lb.context, CL_MEM_READ_WRITE, sizeof(cl_int) * lb.npix, NULL, &err);
+        if (!lb.label)
+            return err;
+        lb.width = width;
+        lb.height = height;
+    }
+
+    err = clSetKernelArg(lb.init, 0, sizeof(cl_mem), &mask);
+    err |= clSetKernelArg(lb.init, 1, sizeof(cl_mem), &lb.label);
+    err |= clSetKernelArg(lb.init, 2, sizeof(int), &width);
+    err |= clSetKernelArg(lb.init, 3, sizeof(int), &height);
+    err |= clSetKernelArg(lb.link, 0, sizeof(cl_mem), &lb.label);
+    err |= clSetKernelArg(lb.link, 1, sizeof(cl_mem), &lb.changed);
+    err |= clSetKernelArg(lb.link, 2, sizeof(int), &width);
+    err |= clSetKernelArg(lb.link, 3, sizeof(int), &height);
+    err |= clSetKernelArg(lb.compress, 0, sizeof(cl_mem), &lb.label);
+    err |= clSetKernelArg(lb.compress, 1, sizeof(int), &width);
+    err |= clSetKernelArg(lb.compress, 2, sizeof(int), &height);
+    if (err != CL_SUCCESS)
+        return err;
+
+    err = lbEnqueue(lb, commands, lb.init, events);
+    lb.passes = 0;
+    while (err == CL_SUCCESS && changed)
+    {
+        clEnqueueWriteBuffer(commands, lb.changed, CL_FALSE, 0, sizeof(cl_int), &zero, 0, NULL, NULL);
+        for (k = 0; k < LB_BATCH && err == CL_SUCCESS; k++) {
+            err = lbEnqueue(lb, commands, lb.link, events);
+            if (err == CL_SUCCESS)
+                err = lbEnqueue(lb, commands, lb.compress, events);
+        }
+        lb.passes += LB_BATCH;
+        if (err == CL_SUCCESS)
+            err = clEnqueueReadBuffer(commands, lb.changed, CL_TRUE, 0, sizeof(cl_int), &changed, 0, NULL, NULL);
+    }
+    if (err != CL_SUCCESS)
+        return err;
+
+    // the roots, again with a larger buffer if they did not fit
+    for (;;)
+    {
+        cl_uint capacity = (cl_uint)lb.comp_capacity;
+        cl_mem root = lb.root;
+        err = clEnqueueWriteBuffer(commands, lb.ncomp, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+        err |= clSetKernelArg(lb.roots, 0, sizeof(cl_mem), &lb.label);
+        err |= clSetKernelArg(lb.roots, 1, sizeof(cl_mem), root ? &root : &lb.ncomp);
+        err |= clSetKernelArg(lb.roots, 2, sizeof(cl_mem), &lb.ncomp);
+        err |= clSetKernelArg(lb.roots, 3, sizeof(cl_uint), &capacity);
+        err |= clSetKernelArg(lb.roots, 4, sizeof(int), &width);
+        err |= clSetKernelArg(lb.roots, 5, sizeof(int), &height);
+        if (err == CL_SUCCESS)
+            err = lbEnqueue(lb, commands, lb.roots, events);
+        if (err == CL_SUCCESS)
+            err = clEnqueueReadBuffer(commands, lb.ncomp, CL_TRUE, 0, sizeof(cl_uint), &lb.components, 0, NULL, NULL);
+        if (err != CL_SUCCESS || lb.components <= capacity)
+            return err;
+        err = lbReserve(lb, lb.root, lb.comp_capacity, lb.components, sizeof(cl_uint));
+        if (err != CL_SUCCESS)
+            return err;
+    }
+}
+
+cl_int lbTrace(lbLabeler& lb, cl_command_queue commands, std::vector<cl_event>* events)
+{
+    size_t length_capacity = lb.trace_capacity;
+    size_t local = 64;
+    size_t global;
+    size_t scan_local = LB_SCAN_LOCAL, max_local;
+    cl_uint ncomp = lb.components;
+    // every boundary pixel is passed at most 4 times
+    cl_uint limit = lb.npix > 0x3FFFFFFF ? 0xFFFFFFFF : (cl_uint)(4 * lb.npix + 1);
+    cl_event event;
+    cl_int err;
+
+    lb.points = 0;
+    if (ncomp == 0)
+        return CL_SUCCESS;
+    global = (ncomp + local - 1) / local * local;
+    err = lbReserve(lb, lb.length, length_capacity, ncomp + 1, sizeof(cl_uint));
+    if (err == CL_SUCCESS)
+        err = lbReserve(lb, lb.offset, lb.trace_capacity, ncomp + 1, sizeof(cl_uint));
+    if (err != CL_SUCCESS)
+        return err;
+
+    err = clSetKernelArg(lb.count, 0, sizeof(cl_mem), &lb.label);
+    err |= clSetKernelArg(lb.count, 1, sizeof(cl_mem), &lb.root);
+    err |= clSetKernelArg(lb.count, 2, sizeof(cl_mem), &lb.length);
+    err |= clSetKernelArg(lb.count, 3, sizeof(cl_uint), &ncomp);
+    err |= clSetKernelArg(lb.count, 4, sizeof(int), &lb.width);
+    err |= clSetKernelArg(lb.count, 5, sizeof(int), &lb.height);
+    err |= clSetKernelArg(lb.count, 6, sizeof(cl_uint), &limit);
+    if (err == CL_SUCCESS)
+        err = clEnqueueNDRangeKernel(commands, lb.count, 1, NULL, &global, &local, 0, NULL, events ? &event : NULL);
+    if (err != CL_SUCCESS)
+        return err;
+    if (events)
+        events->push_back(event);
+
+    // a power of two for the scan
+    clGetKernelWorkGroupInfo(lb.scan, lb.device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_local), &max_local, NULL);
+    while (scan_local > max_local)
+        scan_local >>= 1;
+    err = clSetKernelArg(lb.scan, 0, sizeof(cl_mem), &lb.length);
+    err |= clSetKernelArg(lb.scan, 1, sizeof(cl_mem), &lb.offset);
+    err |= clSetKernelArg(lb.scan, 2, sizeof(cl_uint), &ncomp);
+    err |= clSetKernelArg(lb.scan, 3, sizeof(cl_uint) * scan_local, NULL);
+    if (err == CL_SUCCESS)
+        err = clEnqueueNDRangeKernel(commands, lb.scan, 1, NULL, &scan_local, &scan_local, 0, NULL, events ? &event : NULL);
+    if (err != CL_SUCCESS)
+        return err;
+    if (events)
+        events->push_back(event);
+    err = clEnqueueReadBuffer(commands, lb.offset, CL_TRUE, sizeof(cl_uint) * ncomp, sizeof(cl_uint), &lb.points, 0, NULL, NULL);
+    if (err == CL_SUCCESS)
+        err = lbReserve(lb, lb.point, lb.point_capacity, lb.points, sizeof(cl_ushort2));
+    if (err != CL_SUCCESS)
+        return err;
+
+    err = clSetKernelArg(lb.write, 0, sizeof(cl_mem), &lb.label);
+    err |= clSetKernelArg(lb.write, 1, sizeof(cl_mem), &lb.root);
+    err |= clSetKernelArg(lb.write, 2, sizeof(cl_mem), &lb.offset);
+    err |= clSetKernelArg(lb.write, 3, sizeof(cl_mem), &lb.point);
+    err |= clSetKernelArg(lb.write, 4, sizeof(cl_uint), &ncomp);
+    err |= clSetKernelArg(lb.write, 5, sizeof(int), &lb.width);
+    err |= clSetKernelArg(lb.write, 6, sizeof(int), &lb.height);
+    err |= clSetKernelArg(lb.write, 7, sizeof(cl_uint), &limit);
+    if (err == CL_SUCCESS)
+        err = clEnqueueNDRangeKernel(commands, lb.write, 1, NULL, &global, &local, 0, NULL, events ? &event : NULL);
+    if (err == CL_SUCCESS && events)
+        events->push_back(event);
+    return err;
+}
+
+cl_int lbRead(lbLabeler& lb, cl_command_queue commands, std::vector<cl_uint>& roots,
+    std::vector<cl_uint>& offsets, std::vector<cl_ushort2>& points)
+{
+    std::vector<cl_uint> r(lb.components), o(lb.components + 1);
+    std::vector<cl_ushort2> p(lb.points);
+    std::vector<std::pair<cl_uint, cl_uint> > order(lb.components);
+    cl_int err = CL_SUCCESS;
+    size_t c;
+
+    roots.clear();
+    offsets.assign(1, 0);
+    points.clear();
+    if (!lb.components)
+        return CL_SUCCESS;
+    err = clEnqueueReadBuffer(commands, lb.root, CL_FALSE, 0, sizeof(cl_uint) * r.size(), &r[0], 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(commands, lb.offset, CL_FALSE, 0, sizeof(cl_uint) * o.size(), &o[0], 0, NULL, NULL);
+    if (lb.points)
+        err |= clEnqueueReadBuffer(commands, lb.point, CL_FALSE, 0, sizeof(cl_ushort2) * p.size(), &p[0], 0, NULL, NULL);
+    err |= clFinish(commands);
+    if (err != CL_SUCCESS)
+        return err;
+
+    // the atomics leave the components in any order, raster order of the roots is stable
+    for (c = 0; c < r.size(); c++)
+        order[c] = std::make_pair(r[c], (cl_uint)c);
+    std::sort(order.begin(), order.end());
+    points.reserve(p.size());
+    for (c = 0; c < order.size(); c++) {
+        cl_uint k = order[c].second;
+        roots.push_back(order[c].first);
+        points.insert(points.end(), p.begin() + o[k], p.begin() + o[k + 1]);
+        offsets.push_back((cl_uint)points.size());
+    }
+    return CL_SUCCESS;
+}
+
+void lbReference(const unsigned char* mask, int width, int height, std::vector<int>& labels,
+    std::vector<cl_uint>& roots, std::vector<cl_uint>& offsets, std::vector<cl_ushort2>& points)
+{
+    static const int dx[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+    static const int dy[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+    static const int dir[9] = { 5, 6, 7, 4, -1, 0, 3, 2, 1 };
+    size_t npix = (size_t)width * height;
+    std::vector<int> stack;
+    int s, i, j;
+
+    labels.assign(npix, -1);
+    roots.clear();
+    offsets.assign(1, 0);
+    points.clear();
+
+    // the first pixel met in raster order is the smallest index of its component
+    for (s = 0; s < (int)npix; s++) {
+        if (!mask[s] || labels[s] >= 0)
+            continue;
+        labels[s] = s;
+        stack.push_back(s);
+        while (!stack.empty()) {
+            int k = stack.back();
+            stack.pop_back();
+            for (j = -1; j <= 1; j++)
+                for (i = -1; i <= 1; i++) {
+                    int x = k % width + i, y = k / width + j;
+                    if (x < 0 || y < 0 || x >= width || y >= height || !mask[y * width + x] || labels[y * width + x] >= 0)
+                        continue;
+                    labels[y * width + x] = s;
+                    stack.push_back(y * width + x);
+                }
+        }
+        roots.push_back(s);
+    }
+
+    for (size_t c = 0; c < roots.size(); c++) {
+        int root = (int)roots[c];
+        int px = root % width, py = root / width;
+        int b = 4, d = 0, first = 0, k;
+        size_t n = 0;
+        for (;;) {
+            cl_ushort2 pt;
+            for (k = 1; k <= 8; k++) {
+                d = (b + k) & 7;
+                int qx = px + dx[d], qy = py + dy[d];
+                if (qx >= 0 && qy >= 0 && qx < width && qy < height && labels[qy * width + qx] == root)
+                    break;
+            }
+            if (n > 0 && py * width + px == root && d == first)
+                break;
+            pt.s[0] = (cl_ushort)px;
+            pt.s[1] = (cl_ushort)py;
+            points.push_back(pt);
+            n++;
+            if (k > 8)
+                break;
+            if (n == 1)
+                first = d;
+            int bx = dx[(d + 7) & 7] - dx[d];
+            int by = dy[(d + 7) & 7] - dy[d];
+            px += dx[d];
+            py += dy[d];
+            b = dir[(by + 1) * 3 + bx + 1];
+        }
+        offsets.push_back((cl_uint)points.size());
+    }
+}
@@ -0,0 +1,82 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Labeling.h
+//
+// Purpose:    Connected components (8-connected) of a binary image and their
+//             outer contours, on the device.
+//
+//             Labelling is label equivalence : every foreground pixel starts
+//             with its own index, each pass hooks the root of a pixel to the
+//             smallest label around it with atomic_min and then compresses
+//             the paths by pointer jumping, until a pass changes nothing. The
+//             label of a component ends as the index of its first pixel in
+//             raster order, its root.
+//
+//             Contours are traced from the roots by Moore neighbour tracing,
+//             one work-item per component, in three steps : a pass counting
+//             the points of every contour, a prefix sum of the counts giving
+//             the offsets, a second pass writing the points there. The host
+//             only reads the number of components and of points, to size the
+//             buffers.
+//
+//             lbLabeler lb;
+//             lbInit(lb, context, device);
+//             lbLabel(lb, commands, mask, width, height, NULL);
+//             lbTrace(lb, commands, NULL);
+//             lbRead(lb, commands, roots, offsets, points);
+//             lbRelease(lb);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "CL/cl.h"
+
+#define LB_LOCAL 16             // labelling work-groups of LB_LOCAL x LB_LOCAL
+#define LB_BATCH 4              // passes between two reads of the changed flag
+#define LB_SCAN_LOCAL 256       // work-group of the prefix sum
+
+struct lbLabeler {
+    cl_context context;
+    cl_device_id device;
+    cl_program program;
+    cl_kernel init, link, compress, roots, count, scan, write;
+
+    int width, height;
+    cl_mem label;               // int per pixel, -1 for the background
+    cl_mem changed;
+    cl_mem ncomp;               // component counter of lb_roots
+    size_t npix;
+
+    cl_uint components;
+    cl_uint points;
+    size_t comp_capacity;       // elements of root
+    size_t trace_capacity;      // of length and offset
+    size_t point_capacity;
+    cl_mem root;                // first pixel of each component
+    cl_mem length;              // points of each contour
+    cl_mem offset;              // components + 1, the last one is the total
+    cl_mem point;               // x, y of the contours one after the other
+
+    int passes;                 // of the last lbLabel
+};
+
+cl_int lbInit(lbLabeler& lb, cl_context context, cl_device_id device);
+void lbRelease(lbLabeler& lb);
+
+// labels the non zero pixels of mask (uchar, width x height, at most INT_MAX
+// pixels) ; the events of the kernels are appended to events if not NULL
+cl_int lbLabel(lbLabeler& lb, cl_command_queue commands, cl_mem mask, int width, int height,
+    std::vector<cl_event>* events);
+
+// contours of the components of the last lbLabel
+cl_int lbTrace(lbLabeler& lb, cl_command_queue commands, std::vector<cl_event>* events);
+
+// contour c is points[offsets[c] .. offsets[c + 1]) and starts at its root
+cl_int lbRead(lbLabeler& lb, cl_command_queue commands, std::vector<cl_uint>& roots,
+    std::vector<cl_uint>& offsets, std::vector<cl_ushort2>& points);
+
+// the same on the host : labels (-1 background) and contours, ordered by root
+void lbReference(const unsigned char* mask, int width, int height, std::vector<int>& labels,
+    std::vector<cl_uint>& roots, std::vector<cl_uint>& offsets, std::vector<cl_ushort2>& points);
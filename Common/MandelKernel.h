@@ -0,0 +1,67 @@
+//------------------------------------------------------------------------------
+//
+// Name:       MandelKernel.h
+//
+// Purpose:    The mandel kernel of Mandelbrot, shared with the Benchmark
+//             harness so that both always run the same code.
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+static const char* MandelSource = "\n" \
+"__kernel void mandel(                                                                          \n" \
+"   const double x0,                                                                            \n" \
+"   const double y0,                                                                            \n" \
+"   const double stepsize,                                                                      \n" \
+"   const unsigned int maxIter,                                                                 \n" \
+"   __global unsigned int *restrict framebuffer,                                                \n" \
+"   const unsigned int windowWidth,                                                             \n" \
+"   const unsigned int windowHeight                                                             \n" \
+"   )                                                                                           \n" \
+"{// WORK ITEM POSITION                                                                         \n" \
+"   const size_t windowPosX = get_global_id(0);                                                 \n" \
+"   const size_t windowPosY = get_global_id(1);                                                 \n" \
+"   if(windowPosX >= windowWidth || windowPosY >= windowHeight) return;                         \n" \
+"   const double stepPosX = x0 + (windowPosX * stepsize);                                       \n" \
+"   const double stepPosY = y0 - (windowPosY * stepsize);                                       \n" \
+"                                                                                               \n" \
+"   double x = 0.0;                                                                             \n" \
+"   double y = 0.0;                                                                             \n" \
+"   double x2 = 0.0;                                                                            \n" \
+"   double y2 = 0.0;                                                                            \n" \
+"   unsigned int i = 0;                                                                         \n" \
+"                                                                                               \n" \
+"   while(x2 + y2 < 4.0 && i < maxIter){                                                        \n" \
+"        x2 = x*x;                                                                              \n" \
+"        y2 = y*y;                                                                              \n" \
+"        y = 2*x*y + stepPosY;                                                                  \n" \
+"        x = x2 - y2 + stepPosX;                                                                \n" \
+"        i++;                          }                                                        \n" \
+"                                                                                               \n" \
+"    if(i >= maxIter) {framebuffer[windowWidth * windowPosY + windowPosX] = 0;return;}          \n" \
+"                                                                                               \n" \
+"    int mod = i%16;                                                                            \n" \
+"    char r, g, b = 0;                                                                          \n" \
+"    switch (mod)                                                                               \n" \
+"    {                                                                                          \n" \
+"        case 0: r = 66; g = 30; b = 15; break;                                                 \n" \
+"        case 1: r = 25; g = 7; b = 26; break;                                                  \n" \
+"        case 2: r = 9; g = 1; b = 47; break;                                                   \n" \
+"        case 3: r = 4; g = 4; b = 73; break;                                                   \n" \
+"        case 4: r = 0; g = 7; b = 100; break;                                                  \n" \
+"        case 5: r = 12; g = 44; b = 138; break;                                                \n" \
+"        case 6: r = 24; g = 82; b = 177; break;                                                \n" \
+"        case 7: r = 57; g = 125; b = 209; break;                                               \n" \
+"        case 8: r = 134; g = 181; b = 229; break;                                              \n" \
+"        case 9: r = 211; g = 236; b = 248; break;                                              \n" \
+"        case 10: r = 241; g = 233; b = 191; break;                                             \n" \
+"        case 11: r = 248; g = 201; b = 95; break;                                              \n" \
+"        case 12: r = 254; g = 170; b = 0; break;                                               \n" \
+"        case 13: r = 204; g = 128; b = 0; break;                                               \n" \
+"        case 14: r = 153; g = 87; b = 0; break;                                                \n" \
+"        case 15: r = 106; g = 52; b = 3; break;                                                \n" \
+"    }                                                                                          \n" \
+"   framebuffer[windowWidth*windowPosY + windowPosX] = (unsigned int)(0 + (r<<16) + (g<<8) + b);\n" \
+"}                                                                                              \n" \
+"\n";
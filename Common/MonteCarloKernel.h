@@ -0,0 +1,56 @@
+//------------------------------------------------------------------------------
+//
+// Name:       MonteCarloKernel.h
+//
+// Purpose:    The hello and hello_stream kernels of PI_MonteCarlo, shared with
+//             the Benchmark harness so that both always run the same code.
+//             To be given to clCreateProgramWithSource after PhiloxSource.
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+// every work-item draws one Philox block from (global id, iteration) and tests two points,
+// the group count goes to output[iter * ngroups + group]
+static const char* MonteCarloSource =
+"__kernel void hello(__global uint *output, __local uint *localB, const uint seed, const uint iter)\n"\
+"{\n"\
+"	size_t lid = get_local_id(0);\n"\
+"	size_t gid = get_group_id(0);\n"\
+"	size_t gsize = get_local_size(0);\n"\
+"	size_t id = lid+gid*gsize;\n"\
+"	uint4 r = philox4x32_10((uint4)((uint)id, iter, 0, 0), (uint2)(seed, 0));\n"\
+"	double x0 = philox_u01(r.x), y0 = philox_u01(r.y);\n"\
+"	double x1 = philox_u01(r.z), y1 = philox_u01(r.w);\n"\
+"	localB[lid] = (x0*x0+y0*y0 < 1 ? 1 : 0) + (x1*x1+y1*y1 < 1 ? 1 : 0);\n"\
+"	\n"\
+"   uint i, sum;                                          \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                                 \n" \
+"   sum = 0;                                                 \n" \
+"   if(lid == 0){\n" \
+"       for(i=0; i<gsize; i++)                                        \n" \
+"           sum+=localB[i];                                             \n" \
+"       output[iter*get_num_groups(0)+gid] =sum;}                                             \n" \
+"}\n"\
+"\n"\
+"__kernel void hello_stream(__global uint *output, __local uint *localB, const uint seed, const uint batch, const uint slot, const uint nblocks)\n"\
+"{\n"\
+"	size_t lid = get_local_id(0);\n"\
+"	uint id = (uint)get_global_id(0);\n"\
+"	uint hits = 0;\n"\
+"	for(uint j=0; j<nblocks; j++){\n"\
+"	uint4 r = philox4x32_10((uint4)(id, batch, j, 1), (uint2)(seed, 0));\n"\
+"	double x0 = philox_u01(r.x), y0 = philox_u01(r.y);\n"\
+"	double x1 = philox_u01(r.z), y1 = philox_u01(r.w);\n"\
+"	hits += (x0*x0+y0*y0 < 1 ? 1 : 0) + (x1*x1+y1*y1 < 1 ? 1 : 0);}\n"\
+"	localB[lid] = hits;\n"\
+"	\n"\
+"	for(uint stride=get_local_size(0)/2; stride>0; stride/=2){\n"\
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"\
+"	if(lid < stride)\n"\
+"	localB[lid] += localB[lid+stride];}\n"\
+"	\n"\
+"	if(lid == 0)\n"\
+"	output[slot*get_num_groups(0)+get_group_id(0)] = localB[0];\n"\
+"}\n"\
+"\n";
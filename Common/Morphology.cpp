@@ -0,0 +1,347 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Morphology.cpp
+//
+// Purpose:    Erosion, dilation, opening and closing by a rectangle, see
+//             Morphology.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "Morphology.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MO_SSE2
+#include <emmintrin.h>
+#endif
+
+//------------------------------------------------------------------------------
+//
+// One pass along the rows (vertical 0) or the columns (vertical 1). Blocks of
+// k = 2 r + 1 pixels start at 0 on each line ; past the end of the line the
+// pixels are the identity of the operation, so g at the last pixel stands for
+// the whole last block and the lines need no padding.
+//
+
+const char* MorphologySource = "\n" \
+"#define OP(a, b) (dilate ? max(a, b) : min(a, b))                      \n" \
+"                                                                       \n" \
+"// g and h of block b of line line                                     \n" \
+"__kernel void mo_blocks(__global const uchar* in, __global uchar* g,   \n" \
+"   __global uchar* h, const int width, const int height, const int r,  \n" \
+"   const int vertical, const int dilate)                               \n" \
+"{                                                                      \n" \
+"   int line = get_global_id(vertical ? 0 : 1);                         \n" \
+"   int b = get_global_id(vertical ? 1 : 0);                            \n" \
+"   int length = vertical ? height : width;                             \n" \
+"   int lines = vertical ? width : height;                              \n" \
+"   int step = vertical ? width : 1;                                    \n" \
+"   int base = vertical ? line : line*width;                            \n" \
+"   int k = 2*r + 1, start = b*k, end = min(start + k, length), i;      \n" \
+"   uchar acc;                                                          \n" \
+"   if(line >= lines || start >= length) return;                        \n" \
+"   acc = in[base + start*step];                                        \n" \
+"   g[base + start*step] = acc;                                         \n" \
+"   for(i = start + 1; i < end; i++){                                   \n" \
+"       acc = OP(acc, in[base + i*step]);                               \n" \
+"       g[base + i*step] = acc;                                         \n" \
+"   }                                                                   \n" \
+"   acc = in[base + (end - 1)*step];                                    \n" \
+"   h[base + (end - 1)*step] = acc;                                     \n" \
+"   for(i = end - 2; i >= start; i--){                                  \n" \
+"       acc = OP(acc, in[base + i*step]);                               \n" \
+"       h[base + i*step] = acc;                                         \n" \
+"   }                                                                   \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void mo_merge(__global const uchar* g, __global const uchar* h,\n" \
+"   __global uchar* out, const int width, const int height, const int r,\n" \
+"   const int vertical, const int dilate)                               \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   int pos = vertical ? y : x, length = vertical ? height : width;     \n" \
+"   int step = vertical ? width : 1;                                    \n" \
+"   int base = y*width + x - pos*step;                                  \n" \
+"   int k = 2*r + 1, lo = pos - r, hi = pos + r;                        \n" \
+"   uchar id = dilate ? 0 : 255;                                        \n" \
+"   uchar a = lo >= 0 ? h[base + lo*step] : id;                         \n" \
+"   uchar c = id;                                                       \n" \
+"   if(hi < length) c = g[base + hi*step];                              \n" \
+"   else if(hi/k == (length - 1)/k) c = g[base + (length - 1)*step];    \n" \
+"   out[y*width + x] = OP(a, c);                                        \n" \
+"}                                                                      \n" \
+"\n";
+
+static const char* mo_op_names[MO_OPS] = { "erode", "dilate", "open", "close" };
+
+const char* moOpName(int op)
+{
+    return mo_op_names[op];
+}
+
+cl_int moInit(moMorph& mo, cl_context context, cl_device_id device)
+{
+    cl_int err;
+
+    mo.context = context;
+    mo.device = device;
+    mo.blocks = mo.merge = NULL;
+    mo.g = mo.h = mo.tmp = NULL;
+    mo.bytes = 0;
+
+    mo.program = clCreateProgramWithSource(context, 1, &MorphologySource, NULL, &err);
+    if (!mo.program)
+        return err;
+    err = clBuildProgram(mo.program, 0, NULL, NULL, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build the morphology kernels!\n");
+        clGetProgramBuildInfo(mo.program, device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        return err;
+    }
+    mo.blocks = clCreateKernel(mo.program, "mo_blocks", &err);
+    mo.merge = clCreateKernel(mo.program, "mo_merge", &err);
+    if (!mo.blocks || !mo.merge)
+    {
+        printf("Error: Failed to create the morphology kernels!\n");
+        return err;
+    }
+    return CL_SUCCESS;
+}
+
+static void moReleaseBuffers(moMorph& mo)
+{
+    if (mo.g)
+        clReleaseMemObject(mo.g);
+    if (mo.h)
+        clReleaseMemObject(mo.h);
+    if (mo.tmp)
+        clReleaseMemObject(mo.tmp);
+    mo.g = mo.h = mo.tmp = NULL;
+    mo.bytes = 0;
+}
+
+void moRelease(moMorph& mo)
+{
+    moReleaseBuffers(mo);
+    if (mo.blocks)
+        clReleaseKernel(mo.blocks);
+    if (mo.merge)
+        clReleaseKernel(mo.merge);
+    if (mo.program)
+        clReleaseProgram(mo.program);
+    mo.blocks = mo.merge = NULL;
+    mo.program = NULL;
+}
+
+static cl_int moEnqueue(cl_command_queue commands, cl_kernel kernel, size_t gx, size_t gy,
+    std::vector<cl_event>* events)
+{
+    size_t global[2] = { gx, gy };
+    cl_event event;
+    cl_int err;
+
+    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, NULL, 0, NULL, events ? &event : NULL);
+    if (err == CL_SUCCESS && events)
+        events->push_back(event);
+    return err;
+}
+
+static cl_int moPass(moMorph& mo, cl_command_queue commands, cl_mem in, cl_mem out, int width, int height,
+    int r, int vertical, int dilate, std::vector<cl_event>* events)
+{
+    int length = vertical ? height : width;
+    size_t nblocks = ((size_t)length + 2 * r) / (2 * r + 1);
+    cl_int err;
+
+    err = clSetKernelArg(mo.blocks, 0, sizeof(cl_mem), &in);
+    err |= clSetKernelArg(mo.blocks, 1, sizeof(cl_mem), &mo.g);
+    err |= clSetKernelArg(mo.blocks, 2, sizeof(cl_mem), &mo.h);
+    err |= clSetKernelArg(mo.merge, 0, sizeof(cl_mem), &mo.g);
+    err |= clSetKernelArg(mo.merge, 1, sizeof(cl_mem), &mo.h);
+    err |= clSetKernelArg(mo.merge, 2, sizeof(cl_mem), &out);
+    for (int k = 0; k < 2; k++) {
+        cl_kernel kernel = k ? mo.merge : mo.blocks;
+        err |= clSetKernelArg(kernel, 3, sizeof(int), &width);
+        err |= clSetKernelArg(kernel, 4, sizeof(int), &height);
+        err |= clSetKernelArg(kernel, 5, sizeof(int), &r);
+        err |= clSetKernelArg(kernel, 6, sizeof(int), &vertical);
+        err |= clSetKernelArg(kernel, 7, sizeof(int), &dilate);
+    }
+    if (err != CL_SUCCESS)
+        return err;
+    if (vertical)
+        err = moEnqueue(commands, mo.blocks, width, nblocks, events);
+    else
+        err = moEnqueue(commands, mo.blocks, nblocks, height, events);
+    if (err != CL_SUCCESS)
+        return err;
+    return moEnqueue(commands, mo.merge, width, height, events);
+}
+
+cl_int moRun(moMorph& mo, cl_command_queue commands, int op, cl_mem in, cl_mem out,
+    int width, int height, int rx, int ry, std::vector<cl_event>* events)
+{
+    size_t bytes = (size_t)width * height;
+    int steps[2] = { op == MO_DILATE || op == MO_CLOSE, op == MO_OPEN };
+    int nsteps = op == MO_OPEN || op == MO_CLOSE ? 2 : 1;
+    cl_int err = CL_SUCCESS;
+    int s;
+
+    if (op < 0 || op >= MO_OPS || rx < 0 || ry < 0)
+        return CL_INVALID_VALUE;
+    if (mo.bytes < bytes)
+    {
+        moReleaseBuffers(mo);
+        mo.g = clCreateBuffer(mo.context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        mo.h = clCreateBuffer(mo.context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        mo.tmp = clCreateBuffer(mo.context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        if (!mo.g || !mo.h || !mo.tmp)
+        {
+            moReleaseBuffers(mo);
+            return err;
+        }
+        mo.bytes = bytes;
+    }
+    // the second step of an opening or a closing works in place on out
+    for (s = 0; s < nsteps && err == CL_SUCCESS; s++) {
+        err = moPass(mo, commands, s ? out : in, mo.tmp, width, height, rx, 0, steps[s], events);
+        if (err == CL_SUCCESS)
+            err = moPass(mo, commands, mo.tmp, out, width, height, ry, 1, steps[s], events);
+    }
+    return err;
+}
+
+//------------------------------------------------------------------------------
+//
+// Host. Images are kept with a stride rounded up to 16 bytes so that every row
+// is whole SSE2 vectors ; the padding columns are computed like the others and
+// never read back.
+//
+
+static inline int moStride(int width)
+{
+    return (width + 15) & ~15;
+}
+
+// out = op(a, b) over n bytes, n a multiple of 16
+static inline void moLine(const unsigned char* a, const unsigned char* b, unsigned char* out, int n, int dilate)
+{
+    int i;
+#ifdef MO_SSE2
+    if (dilate)
+        for (i = 0; i < n; i += 16)
+            _mm_storeu_si128((__m128i*)(out + i), _mm_max_epu8(_mm_loadu_si128((const __m128i*)(a + i)),
+                _mm_loadu_si128((const __m128i*)(b + i))));
+    else
+        for (i = 0; i < n; i += 16)
+            _mm_storeu_si128((__m128i*)(out + i), _mm_min_epu8(_mm_loadu_si128((const __m128i*)(a + i)),
+                _mm_loadu_si128((const __m128i*)(b + i))));
+#else
+    if (dilate)
+        for (i = 0; i < n; i++)
+            out[i] = a[i] > b[i] ? a[i] : b[i];
+    else
+        for (i = 0; i < n; i++)
+            out[i] = a[i] < b[i] ? a[i] : b[i];
+#endif
+}
+
+// van Herk / Gil-Werman down the columns, whole rows at a time ; dst may be src
+static void moColumns(const unsigned char* src, unsigned char* dst, int height, int stride, int r, int dilate,
+    unsigned char* g, unsigned char* h, const unsigned char* id)
+{
+    int k = 2 * r + 1, start, y;
+
+    for (start = 0; start < height; start += k) {
+        int end = start + k < height ? start + k : height;
+        memcpy(g + (size_t)start * stride, src + (size_t)start * stride, stride);
+        for (y = start + 1; y < end; y++)
+            moLine(g + (size_t)(y - 1) * stride, src + (size_t)y * stride, g + (size_t)y * stride, stride, dilate);
+        memcpy(h + (size_t)(end - 1) * stride, src + (size_t)(end - 1) * stride, stride);
+        for (y = end - 2; y >= start; y--)
+            moLine(h + (size_t)(y + 1) * stride, src + (size_t)y * stride, h + (size_t)y * stride, stride, dilate);
+    }
+    for (y = 0; y < height; y++) {
+        int lo = y - r, hi = y + r;
+        const unsigned char* a = lo >= 0 ? h + (size_t)lo * stride : id;
+        const unsigned char* c = id;
+        if (hi < height)
+            c = g + (size_t)hi * stride;
+        else if (hi / k == (height - 1) / k)
+            c = g + (size_t)(height - 1) * stride;
+        moLine(a, c, dst + (size_t)y * stride, stride, dilate);
+    }
+}
+
+// dst (height x width, dst_stride) = src (width x height, src_stride) transposed
+static void moTranspose(const unsigned char* src, int width, int height, int src_stride,
+    unsigned char* dst, int dst_stride)
+{
+    int bx, by, x, y;
+
+    for (by = 0; by < height; by += 16)
+        for (bx = 0; bx < width; bx += 16) {
+            int ex = bx + 16 < width ? bx + 16 : width;
+            int ey = by + 16 < height ? by + 16 : height;
+            for (x = bx; x < ex; x++)
+                for (y = by; y < ey; y++)
+                    dst[(size_t)x * dst_stride + y] = src[(size_t)y * src_stride + x];
+        }
+}
+
+void moCPU(const unsigned char* in, unsigned char* out, int width, int height, int op, int rx, int ry)
+{
+    int sw = moStride(width), sh = moStride(height);
+    size_t scratch = (size_t)sw * height > (size_t)sh * width ? (size_t)sw * height : (size_t)sh * width;
+    std::vector<unsigned char> img((size_t)sw * height, 0), t((size_t)sh * width, 0);
+    std::vector<unsigned char> g(scratch), h(scratch), id(sw > sh ? sw : sh);
+    int steps[2] = { op == MO_DILATE || op == MO_CLOSE, op == MO_OPEN };
+    int nsteps = op == MO_OPEN || op == MO_CLOSE ? 2 : 1;
+    int s, y;
+
+    for (y = 0; y < height; y++)
+        memcpy(&img[(size_t)y * sw], in + (size_t)y * width, width);
+    for (s = 0; s < nsteps; s++) {
+        memset(&id[0], steps[s] ? 0 : 255, id.size());
+        // the rows are the columns of the transposed image
+        moTranspose(&img[0], width, height, sw, &t[0], sh);
+        moColumns(&t[0], &t[0], width, sh, rx, steps[s], &g[0], &h[0], &id[0]);
+        moTranspose(&t[0], height, width, sh, &img[0], sw);
+        moColumns(&img[0], &img[0], height, sw, ry, steps[s], &g[0], &h[0], &id[0]);
+    }
+    for (y = 0; y < height; y++)
+        memcpy(out + (size_t)y * width, &img[(size_t)y * sw], width);
+}
+
+void moReference(const unsigned char* in, unsigned char* out, int width, int height, int op, int rx, int ry)
+{
+    std::vector<unsigned char> src(in, in + (size_t)width * height);
+    int steps[2] = { op == MO_DILATE || op == MO_CLOSE, op == MO_OPEN };
+    int nsteps = op == MO_OPEN || op == MO_CLOSE ? 2 : 1;
+    int s, x, y, i, j;
+
+    for (s = 0; s < nsteps; s++) {
+        for (y = 0; y < height; y++)
+            for (x = 0; x < width; x++) {
+                unsigned char v = steps[s] ? 0 : 255;
+                for (j = y - ry; j <= y + ry; j++)
+                    for (i = x - rx; i <= x + rx; i++) {
+                        if (i < 0 || j < 0 || i >= width || j >= height)
+                            continue;
+                        unsigned char p = src[(size_t)j * width + i];
+                        v = steps[s] ? (p > v ? p : v) : (p < v ? p : v);
+                    }
+                out[(size_t)y * width + x] = v;
+            }
+        if (s + 1 < nsteps)
+            src.assign(out, out + (size_t)width * height);
+    }
+}
@@ -0,0 +1,61 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Morphology.h
+//
+// Purpose:    Erosion, dilation, opening and closing of uchar images by a
+//             (2 rx + 1) x (2 ry + 1) rectangle, on the device and on the
+//             host. Pixels outside the image take no part in the min / max.
+//
+//             The rectangle is a row pass then a column pass, each by van
+//             Herk / Gil-Werman : the line is cut in blocks of k = 2 r + 1
+//             pixels, g is the running min (max) from the start of each block
+//             and h the one from its end, and the window around x is then
+//             op(h[x - r], g[x + r]), whatever r. It costs 3 comparisons per
+//             pixel and pass for any size of rectangle.
+//
+//             On the device one work-item scans a block, the lines one next
+//             to the other in the work-items, and a second kernel merges g
+//             and h per pixel. On the host moCPU runs the column pass with
+//             SSE2 on 16 columns at a time, and the row pass the same way on
+//             the image transposed by 16 x 16 blocks ; without SSE2 it falls
+//             back to scalar code.
+//
+//             moMorph mo;
+//             moInit(mo, context, device);
+//             moRun(mo, commands, MO_OPEN, in, out, width, height, 1, 1, NULL);
+//             moRelease(mo);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "CL/cl.h"
+
+enum { MO_ERODE, MO_DILATE, MO_OPEN, MO_CLOSE, MO_OPS };
+
+struct moMorph {
+    cl_context context;
+    cl_device_id device;
+    cl_program program;
+    cl_kernel blocks, merge;
+    cl_mem g, h;                // running min / max of the blocks
+    cl_mem tmp;                 // between the row and the column pass
+    size_t bytes;               // of each of them
+};
+
+const char* moOpName(int op);
+
+cl_int moInit(moMorph& mo, cl_context context, cl_device_id device);
+void moRelease(moMorph& mo);
+
+// out = op(in), in and out uchar width x height, the same buffer or not ; the
+// events of the kernels are appended to events if not NULL
+cl_int moRun(moMorph& mo, cl_command_queue commands, int op, cl_mem in, cl_mem out,
+    int width, int height, int rx, int ry, std::vector<cl_event>* events);
+
+// the same on the host, in and out may be the same
+void moCPU(const unsigned char* in, unsigned char* out, int width, int height, int op, int rx, int ry);
+
+// the same again, straight min / max over the rectangle, for the checks
+void moReference(const unsigned char* in, unsigned char* out, int width, int height, int op, int rx, int ry);
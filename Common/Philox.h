@@ -0,0 +1,76 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Philox.h
+//
+// Purpose:    Counter-based random numbers (Philox4x32-10, Salmon et al. 2011)
+//             shared by the Monte Carlo targets.
+//
+//             PhiloxSource is OpenCL C, to be given to clCreateProgramWithSource
+//             ahead of the kernel source. Each work-item derives its numbers
+//             from (key = seed, counter = global id / iteration / sample), so no
+//             state is stored and a run is reproducible for a given seed.
+//             philox4x32_10() is the host twin, returning the same numbers for
+//             the same counter and key so sequential runs can be compared.
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+static const char* PhiloxSource = "\n" \
+"#pragma OPENCL EXTENSION cl_khr_fp64 : enable                          \n" \
+"uint4 philox4x32_round(uint4 c, uint2 k)                               \n" \
+"{                                                                      \n" \
+"   uint hi0 = mul_hi(0xD2511F53u, c.x);                                \n" \
+"   uint lo0 = 0xD2511F53u * c.x;                                       \n" \
+"   uint hi1 = mul_hi(0xCD9E8D57u, c.z);                                \n" \
+"   uint lo1 = 0xCD9E8D57u * c.z;                                       \n" \
+"   return (uint4)(hi1 ^ c.y ^ k.x, lo1, hi0 ^ c.w ^ k.y, lo0);         \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"uint4 philox4x32_10(uint4 c, uint2 k)                                  \n" \
+"{                                                                      \n" \
+"   for(int r=0; r<9; r++){                                             \n" \
+"       c = philox4x32_round(c, k);                                     \n" \
+"       k.x += 0x9E3779B9u; k.y += 0xBB67AE85u; }                       \n" \
+"   return philox4x32_round(c, k);                                      \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"double philox_u01(uint x)                                              \n" \
+"{                                                                      \n" \
+"   return ((double)x + 0.5) * (1.0 / 4294967296.0);                   \n" \
+"}                                                                      \n" \
+"\n";
+
+// host side Philox4x32-10, out may alias ctr
+static inline void philox4x32_10(const unsigned int ctr[4], const unsigned int key[2], unsigned int out[4])
+{
+    unsigned int c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    unsigned int k0 = key[0], k1 = key[1];
+    int r;
+
+    for (r = 0; r < 10; r++) {
+        unsigned long long p0 = (unsigned long long)PHILOX_M0 * c0;
+        unsigned long long p1 = (unsigned long long)PHILOX_M1 * c2;
+        unsigned int hi0 = (unsigned int)(p0 >> 32), lo0 = (unsigned int)p0;
+        unsigned int hi1 = (unsigned int)(p1 >> 32), lo1 = (unsigned int)p1;
+
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+// same mapping as philox_u01 in the kernel source, (0,1) exclusive
+static inline double philox_u01(unsigned int x)
+{
+    return ((double)x + 0.5) * (1.0 / 4294967296.0);
+}
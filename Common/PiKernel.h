@@ -0,0 +1,136 @@
+//------------------------------------------------------------------------------
+//
+// Name:       PiKernel.h
+//
+// Purpose:    The pi_inte kernel of PI_Integral and its accumulators, shared
+//             with the Benchmark harness so that both always run the same code.
+//             Built with -DACCU=0..3 to choose the accumulation.
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+// kernel:  pi_inte  
+//
+// Purpose: Midpoint integration of 4/(1+x*x) over [0,1]
+// 
+// input: step, nworkiter steps per work item
+//
+// output: ypartial, one (hi, lo) pair per work group, hi + lo being the group sum
+//         with the accumulation strategy given by ACCU
+//
+
+static const char* PiSource = "\n" \
+"#pragma OPENCL EXTENSION cl_khr_fp64 : enable                          \n" \
+"#ifndef ACCU                                                           \n" \
+"#define ACCU 0                                                         \n" \
+"#endif                                                                 \n" \
+"#ifndef PAIRWISE_BLOCK                                                 \n" \
+"#define PAIRWISE_BLOCK 16                                              \n" \
+"#endif                                                                 \n" \
+"                                                                       \n" \
+"typedef struct {                                                       \n" \
+"   double hi, lo;                                                      \n" \
+"#if ACCU == 2                                                          \n" \
+"   double level[64];                                                   \n" \
+"   ulong nblocks;                                                      \n" \
+"   double block;                                                       \n" \
+"   uint nblock;                                                        \n" \
+"#endif                                                                 \n" \
+"} accu_t;                                                              \n" \
+"                                                                       \n" \
+"void accu_init(accu_t *a)                                              \n" \
+"{                                                                      \n" \
+"   a->hi = 0; a->lo = 0;                                               \n" \
+"#if ACCU == 2                                                          \n" \
+"   a->nblocks = 0; a->block = 0; a->nblock = 0;                        \n" \
+"#endif                                                                 \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"void accu_add(accu_t *a, double v)                                     \n" \
+"{                                                                      \n" \
+"#if ACCU == 0                                                          \n" \
+"   a->hi += v;                                                         \n" \
+"#elif ACCU == 1                                                        \n" \
+"   double t = a->hi + v;                                               \n" \
+"   if(fabs(a->hi) >= fabs(v)) a->lo += (a->hi - t) + v;                \n" \
+"   else a->lo += (v - t) + a->hi;                                      \n" \
+"   a->hi = t;                                                          \n" \
+"#elif ACCU == 2                                                        \n" \
+"   a->block += v;                                                      \n" \
+"   if(++a->nblock == PAIRWISE_BLOCK){                                  \n" \
+"       double s = a->block;                                            \n" \
+"       uint l = 0;                                                     \n" \
+"       while(a->nblocks & ((ulong)1 << l)){                            \n" \
+"           s += a->level[l]; l++; }                                    \n" \
+"       a->level[l] = s;                                                \n" \
+"       a->nblocks++; a->block = 0; a->nblock = 0; }                    \n" \
+"#else                                                                  \n" \
+"   double s = a->hi + v;                                               \n" \
+"   double bp = s - a->hi;                                              \n" \
+"   double e = (a->hi - (s - bp)) + (v - bp) + a->lo;                   \n" \
+"   a->hi = s + e;                                                      \n" \
+"   a->lo = e - (a->hi - s);                                            \n" \
+"#endif                                                                 \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"void accu_add_pair(accu_t *a, double hi, double lo)                    \n" \
+"{                                                                      \n" \
+"#if ACCU == 3                                                          \n" \
+"   double s = a->hi + hi;                                              \n" \
+"   double bp = s - a->hi;                                              \n" \
+"   double e = (a->hi - (s - bp)) + (hi - bp) + a->lo + lo;             \n" \
+"   a->hi = s + e;                                                      \n" \
+"   a->lo = e - (a->hi - s);                                            \n" \
+"#else                                                                  \n" \
+"   accu_add(a, hi);                                                    \n" \
+"   if(lo != 0) accu_add(a, lo);                                        \n" \
+"#endif                                                                 \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"double2 accu_result(accu_t *a)                                         \n" \
+"{                                                                      \n" \
+"#if ACCU == 2                                                          \n" \
+"   double s = a->block;                                                \n" \
+"   for(uint l=0; l<64; l++)                                            \n" \
+"       if(a->nblocks & ((ulong)1 << l)) s += a->level[l];              \n" \
+"   return (double2)(s, 0);                                             \n" \
+"#else                                                                  \n" \
+"   return (double2)(a->hi, a->lo);                                     \n" \
+"#endif                                                                 \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void pi_inte(                                                 \n" \
+"   __local double* ylocal,                                             \n" \
+"   __global double* ypartial,                                          \n" \
+"   const double step,                                                  \n" \
+"   const unsigned int nworkiter)                                       \n" \
+"{                                                                      \n" \
+"   int localID = get_local_id(0);                                      \n" \
+"   int n_workitems = get_local_size(0);                                \n" \
+"   int groupID = get_group_id(0);                                      \n" \
+"   ulong ibegin = (ulong)get_global_id(0)*nworkiter;                   \n" \
+"   ulong iend = ibegin + nworkiter;                                    \n" \
+"   ulong i;                                                            \n" \
+"   int k;                                                              \n" \
+"   double x;                                                           \n" \
+"   double2 r;                                                          \n" \
+"   accu_t accu;                                                        \n" \
+"   accu_init(&accu);                                                   \n" \
+"   for(i=ibegin; i<iend; i++){                                         \n" \
+"       x=(i+0.5)*step;                                                 \n" \
+"       accu_add(&accu, 4.0/(1.0+(x*x))); }                             \n" \
+"   r = accu_result(&accu);                                             \n" \
+"   ylocal[2*localID]=r.x;                                              \n" \
+"   ylocal[2*localID+1]=r.y;                                            \n" \
+"   barrier(CLK_LOCAL_MEM_FENCE);                                       \n" \
+"   if(localID == 0){                                                   \n" \
+"       accu_init(&accu);                                               \n" \
+"       for(k=0; k<n_workitems; k++)                                    \n" \
+"           accu_add_pair(&accu, ylocal[2*k], ylocal[2*k+1]);           \n" \
+"       r = accu_result(&accu);                                         \n" \
+"       ypartial[2*groupID] =r.x;                                       \n" \
+"       ypartial[2*groupID+1] =r.y;                                     \n" \
+"   }                                                                   \n" \
+"}                                                                      \n" \
+"\n";
@@ -0,0 +1,235 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Pyramid.cpp
+//
+// Purpose:    Gaussian and Laplacian pyramids on the device, see Pyramid.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include "Pyramid.h"
+
+//------------------------------------------------------------------------------
+//
+// width x height is the size of the finer image of the two, the coarser one is
+// (width + 1) / 2 x (height + 1) / 2. Expanding puts the coarse pixels on the
+// even fine pixels and filters : only the taps landing on a coarse pixel
+// count, they sum to half of the filter in each direction, hence the 4.
+//
+
+const char* PyramidSource = "\n" \
+"__constant float W[5] = { 0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f };     \n" \
+"#define PIX(img, x, y, w, h) img[clamp(y, 0, (h)-1)*(w) + clamp(x, 0, (w)-1)]\n" \
+"                                                                       \n" \
+"__kernel void py_reduce(__global const float* in, __global float* out, \n" \
+"   const int width, const int height)                                  \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int cw = (width + 1)/2, ch = (height + 1)/2;                        \n" \
+"   int i, j;                                                           \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(x >= cw || y >= ch) return;                                      \n" \
+"   for(j = -2; j <= 2; j++)                                            \n" \
+"       for(i = -2; i <= 2; i++)                                        \n" \
+"           sum += W[j+2]*W[i+2] * PIX(in, 2*x+i, 2*y+j, width, height);\n" \
+"   out[y*cw + x] = sum;                                                \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void py_laplacian(__global const float* fine,                 \n" \
+"   __global const float* coarse, __global float* lap,                  \n" \
+"   const int width, const int height)                                  \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int cw = (width + 1)/2, ch = (height + 1)/2;                        \n" \
+"   int i, j;                                                           \n" \
+"   float sum = 0.0f;                                                   \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   for(j = -2; j <= 2; j++)                                            \n" \
+"       for(i = -2; i <= 2; i++)                                        \n" \
+"           if(((x-i) & 1) == 0 && ((y-j) & 1) == 0)                    \n" \
+"               sum += W[j+2]*W[i+2] * PIX(coarse, (x-i)/2, (y-j)/2, cw, ch);\n" \
+"   lap[y*width + x] = fine[y*width + x] - 4.0f*sum;                    \n" \
+"}                                                                      \n" \
+"\n";
+
+static const float py_weights[5] = { 0.0625f, 0.25f, 0.375f, 0.25f, 0.0625f };
+
+cl_int pyInit(pyPyramid& pyr, cl_context context, cl_device_id device)
+{
+    cl_int err;
+    int l;
+
+    pyr.context = context;
+    pyr.device = device;
+    pyr.levels = 0;
+    for (l = 0; l < PY_MAX_LEVELS; l++) {
+        pyr.width[l] = pyr.height[l] = 0;
+        pyr.gauss[l] = pyr.lap[l] = NULL;
+    }
+    pyr.reduce = pyr.laplacian = NULL;
+
+    pyr.program = clCreateProgramWithSource(context, 1, &PyramidSource, NULL, &err);
+    if (!pyr.program)
+        return err;
+    err = clBuildProgram(pyr.program, 0, NULL, NULL, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build the pyramid kernels!\n");
+        clGetProgramBuildInfo(pyr.program, device, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        return err;
+    }
+    pyr.reduce = clCreateKernel(pyr.program, "py_reduce", &err);
+    pyr.laplacian = clCreateKernel(pyr.program, "py_laplacian", &err);
+    if (!pyr.reduce || !pyr.laplacian)
+    {
+        printf("Error: Failed to create the pyramid kernels!\n");
+        return err;
+    }
+    return CL_SUCCESS;
+}
+
+static void pyReleaseLevel(pyPyramid& pyr, int l)
+{
+    if (pyr.gauss[l])
+        clReleaseMemObject(pyr.gauss[l]);
+    if (pyr.lap[l])
+        clReleaseMemObject(pyr.lap[l]);
+    pyr.gauss[l] = pyr.lap[l] = NULL;
+    pyr.width[l] = pyr.height[l] = 0;
+}
+
+void pyRelease(pyPyramid& pyr)
+{
+    int l;
+    for (l = 0; l < PY_MAX_LEVELS; l++)
+        pyReleaseLevel(pyr, l);
+    if (pyr.reduce)
+        clReleaseKernel(pyr.reduce);
+    if (pyr.laplacian)
+        clReleaseKernel(pyr.laplacian);
+    if (pyr.program)
+        clReleaseProgram(pyr.program);
+    pyr.program = NULL;
+    pyr.levels = 0;
+}
+
+static cl_int pyEnqueue(cl_command_queue commands, cl_kernel kernel, int width, int height,
+    std::vector<cl_event>* events)
+{
+    size_t global[2] = { (size_t)width, (size_t)height };
+    cl_event event;
+    cl_int err;
+
+    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global, NULL, 0, NULL, events ? &event : NULL);
+    if (err == CL_SUCCESS && events)
+        events->push_back(event);
+    return err;
+}
+
+cl_int pyBuild(pyPyramid& pyr, cl_command_queue commands, cl_mem image, int width, int height,
+    int levels, std::vector<cl_event>* events)
+{
+    cl_int err = CL_SUCCESS;
+    int l;
+
+    if (levels > PY_MAX_LEVELS)
+        levels = PY_MAX_LEVELS;
+    pyr.levels = 0;
+    for (l = 0; l < levels; l++) {
+        int w = l ? (pyr.width[l - 1] + 1) / 2 : width;
+        int h = l ? (pyr.height[l - 1] + 1) / 2 : height;
+        if (l && (w < PY_MIN_SIDE || h < PY_MIN_SIDE))
+            break;
+        if (pyr.width[l] != w || pyr.height[l] != h)
+        {
+            pyReleaseLevel(pyr, l);
+            pyr.gauss[l] = clCreateBuffer(pyr.context, CL_MEM_READ_WRITE, sizeof(cl_float) * w * h, NULL, &err);
+            pyr.lap[l] = clCreateBuffer(pyr.context, CL_MEM_READ_WRITE, sizeof(cl_float) * w * h, NULL, &err);
+            if (!pyr.gauss[l] || !pyr.lap[l])
+            {
+                pyReleaseLevel(pyr, l);
+                return err;
+            }
+            pyr.width[l] = w;
+            pyr.height[l] = h;
+        }
+        pyr.levels++;
+    }
+    if (pyr.levels == 0)
+        return CL_INVALID_VALUE;
+
+    err = clEnqueueCopyBuffer(commands, image, pyr.gauss[0], 0, 0, sizeof(cl_float) * width * height, 0, NULL, NULL);
+    for (l = 0; l + 1 < pyr.levels && err == CL_SUCCESS; l++) {
+        err = clSetKernelArg(pyr.reduce, 0, sizeof(cl_mem), &pyr.gauss[l]);
+        err |= clSetKernelArg(pyr.reduce, 1, sizeof(cl_mem), &pyr.gauss[l + 1]);
+        err |= clSetKernelArg(pyr.reduce, 2, sizeof(int), &pyr.width[l]);
+        err |= clSetKernelArg(pyr.reduce, 3, sizeof(int), &pyr.height[l]);
+        if (err == CL_SUCCESS)
+            err = pyEnqueue(commands, pyr.reduce, pyr.width[l + 1], pyr.height[l + 1], events);
+    }
+    for (l = 0; l + 1 < pyr.levels && err == CL_SUCCESS; l++) {
+        err = clSetKernelArg(pyr.laplacian, 0, sizeof(cl_mem), &pyr.gauss[l]);
+        err |= clSetKernelArg(pyr.laplacian, 1, sizeof(cl_mem), &pyr.gauss[l + 1]);
+        err |= clSetKernelArg(pyr.laplacian, 2, sizeof(cl_mem), &pyr.lap[l]);
+        err |= clSetKernelArg(pyr.laplacian, 3, sizeof(int), &pyr.width[l]);
+        err |= clSetKernelArg(pyr.laplacian, 4, sizeof(int), &pyr.height[l]);
+        if (err == CL_SUCCESS)
+            err = pyEnqueue(commands, pyr.laplacian, pyr.width[l], pyr.height[l], events);
+    }
+    return err;
+}
+
+static inline float pyPix(const std::vector<float>& img, int x, int y, int width, int height)
+{
+    x = x < 0 ? 0 : (x > width - 1 ? width - 1 : x);
+    y = y < 0 ? 0 : (y > height - 1 ? height - 1 : y);
+    return img[(size_t)y * width + x];
+}
+
+void pyReference(const float* image, int width, int height, int levels,
+    std::vector<std::vector<float> >& gauss, std::vector<std::vector<float> >& lap)
+{
+    std::vector<int> ws, hs;
+    int l, x, y, i, j;
+
+    gauss.assign(1, std::vector<float>(image, image + (size_t)width * height));
+    ws.push_back(width);
+    hs.push_back(height);
+    for (l = 1; l < levels && l < PY_MAX_LEVELS; l++) {
+        int fw = ws[l - 1], fh = hs[l - 1];
+        int w = (fw + 1) / 2, h = (fh + 1) / 2;
+        if (w < PY_MIN_SIDE || h < PY_MIN_SIDE)
+            break;
+        std::vector<float> level((size_t)w * h);
+        for (y = 0; y < h; y++)
+            for (x = 0; x < w; x++) {
+                float sum = 0.0f;
+                for (j = -2; j <= 2; j++)
+                    for (i = -2; i <= 2; i++)
+                        sum += py_weights[j + 2] * py_weights[i + 2] * pyPix(gauss[l - 1], 2 * x + i, 2 * y + j, fw, fh);
+                level[(size_t)y * w + x] = sum;
+            }
+        gauss.push_back(level);
+        ws.push_back(w);
+        hs.push_back(h);
+    }
+
+    lap.resize(gauss.size() - 1);
+    for (l = 0; l + 1 < (int)gauss.size(); l++) {
+        int w = ws[l], h = hs[l];
+        lap[l].resize((size_t)w * h);
+        for (y = 0; y < h; y++)
+            for (x = 0; x < w; x++) {
+                float sum = 0.0f;
+                for (j = -2; j <= 2; j++)
+                    for (i = -2; i <= 2; i++)
+                        if (((x - i) & 1) == 0 && ((y - j) & 1) == 0)
+                            sum += py_weights[j + 2] * py_weights[i + 2] * pyPix(gauss[l + 1], (x - i) / 2, (y - j) / 2, ws[l + 1], hs[l + 1]);
+                lap[l][(size_t)y * w + x] = gauss[l][(size_t)y * w + x] - 4.0f * sum;
+            }
+    }
+}
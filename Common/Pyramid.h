@@ -0,0 +1,54 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Pyramid.h
+//
+// Purpose:    Gaussian and Laplacian pyramids of a float image, on the device.
+//
+//             Each Gaussian level is the previous one filtered by the 5 tap
+//             binomial [1 4 6 4 1] / 16 in both directions and decimated by 2,
+//             (width + 1) / 2 x (height + 1) / 2, borders clamped to the edge.
+//             The Laplacian level l is gauss[l] minus gauss[l + 1] expanded
+//             back to its size with the same filter, so summing the expanded
+//             levels from the coarsest Gaussian gives the image back. Levels
+//             are added while both sides stay PY_MIN_SIDE pixels or more.
+//
+//             pyPyramid pyr;
+//             pyInit(pyr, context, device);
+//             pyBuild(pyr, commands, image, width, height, 4, NULL);
+//             ... pyr.gauss[l], pyr.lap[l], pyr.width[l] x pyr.height[l] ...
+//             pyRelease(pyr);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "CL/cl.h"
+
+#define PY_MAX_LEVELS 12
+#define PY_MIN_SIDE 16
+
+struct pyPyramid {
+    cl_context context;
+    cl_device_id device;
+    cl_program program;
+    cl_kernel reduce, laplacian;
+
+    int levels;                         // of the last pyBuild
+    int width[PY_MAX_LEVELS], height[PY_MAX_LEVELS];
+    cl_mem gauss[PY_MAX_LEVELS];        // gauss[0] is a copy of the image
+    cl_mem lap[PY_MAX_LEVELS];          // levels - 1 of them, the last level is gauss
+};
+
+cl_int pyInit(pyPyramid& pyr, cl_context context, cl_device_id device);
+void pyRelease(pyPyramid& pyr);
+
+// both pyramids of image (float, width x height), at most levels levels ; the
+// buffers are kept while the sizes do not change, the events of the kernels
+// are appended to events if not NULL
+cl_int pyBuild(pyPyramid& pyr, cl_command_queue commands, cl_mem image, int width, int height,
+    int levels, std::vector<cl_event>* events);
+
+// the same on the host
+void pyReference(const float* image, int width, int height, int levels,
+    std::vector<std::vector<float> >& gauss, std::vector<std::vector<float> >& lap);
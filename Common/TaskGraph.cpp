@@ -0,0 +1,226 @@
+//------------------------------------------------------------------------------
+//
+// Name:       TaskGraph.cpp
+//
+// Purpose:    Command graph executor, see TaskGraph.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include "TaskGraph.h"
+
+static int tgNewTask(tgGraph& g, int kind)
+{
+    tgTask t;
+    t.kind = kind;
+    t.kernel = NULL;
+    t.global = 0;
+    t.local = 0;
+    t.buffer = NULL;
+    t.bytes = 0;
+    t.host = NULL;
+    t.queue = -1;
+    t.event = NULL;
+    g.tasks.push_back(t);
+    return (int)g.tasks.size() - 1;
+}
+
+int tgWrite(tgGraph& g, cl_mem buf, size_t bytes, const void* host)
+{
+    int t = tgNewTask(g, TG_WRITE);
+    g.tasks[t].buffer = buf;
+    g.tasks[t].bytes = bytes;
+    g.tasks[t].host = (void*)host;
+    g.tasks[t].writes.push_back(buf);
+    return t;
+}
+
+int tgRead(tgGraph& g, cl_mem buf, size_t bytes, void* host)
+{
+    int t = tgNewTask(g, TG_READ);
+    g.tasks[t].buffer = buf;
+    g.tasks[t].bytes = bytes;
+    g.tasks[t].host = host;
+    g.tasks[t].reads.push_back(buf);
+    return t;
+}
+
+int tgKernel(tgGraph& g, cl_kernel kernel, size_t global, size_t local)
+{
+    int t = tgNewTask(g, TG_KERNEL);
+    g.tasks[t].kernel = kernel;
+    g.tasks[t].global = global;
+    g.tasks[t].local = local;
+    return t;
+}
+
+void tgArg(tgGraph& g, int task, size_t size, const void* value)
+{
+    tgArgValue a;
+    a.value.resize(size);
+    memcpy(&a.value[0], value, size);
+    a.local = 0;
+    g.tasks[task].args.push_back(a);
+}
+
+void tgArgLocal(tgGraph& g, int task, size_t size)
+{
+    tgArgValue a;
+    a.value.resize(size);
+    a.local = 1;
+    g.tasks[task].args.push_back(a);
+}
+
+void tgArgIn(tgGraph& g, int task, cl_mem buf)
+{
+    tgArg(g, task, sizeof(cl_mem), &buf);
+    g.tasks[task].reads.push_back(buf);
+}
+
+void tgArgOut(tgGraph& g, int task, cl_mem buf)
+{
+    tgArg(g, task, sizeof(cl_mem), &buf);
+    g.tasks[task].writes.push_back(buf);
+}
+
+void tgArgInOut(tgGraph& g, int task, cl_mem buf)
+{
+    tgArg(g, task, sizeof(cl_mem), &buf);
+    g.tasks[task].reads.push_back(buf);
+    g.tasks[task].writes.push_back(buf);
+}
+
+static void tgAddDep(tgTask& t, int dep)
+{
+    size_t i;
+    for (i = 0; i < t.deps.size(); i++)
+        if (t.deps[i] == dep)
+            return;
+    t.deps.push_back(dep);
+}
+
+// dependencies from the declared accesses, tasks being in program order
+static void tgWireDeps(tgGraph& g)
+{
+    std::map<cl_mem, int> last_writer;
+    std::map<cl_mem, std::vector<int> > readers;
+    size_t t, i, r;
+
+    for (t = 0; t < g.tasks.size(); t++) {
+        tgTask& task = g.tasks[t];
+        task.deps.clear();
+
+        // read after write
+        for (i = 0; i < task.reads.size(); i++)
+            if (last_writer.count(task.reads[i]))
+                tgAddDep(task, last_writer[task.reads[i]]);
+
+        // write after write, write after read
+        for (i = 0; i < task.writes.size(); i++) {
+            cl_mem buf = task.writes[i];
+            if (last_writer.count(buf))
+                tgAddDep(task, last_writer[buf]);
+            std::vector<int>& rd = readers[buf];
+            for (r = 0; r < rd.size(); r++)
+                if (rd[r] != (int)t)
+                    tgAddDep(task, rd[r]);
+        }
+
+        for (i = 0; i < task.reads.size(); i++)
+            readers[task.reads[i]].push_back((int)t);
+        for (i = 0; i < task.writes.size(); i++) {
+            last_writer[task.writes[i]] = (int)t;
+            readers[task.writes[i]].clear();
+        }
+    }
+}
+
+cl_int tgRun(tgGraph& g, cl_command_queue* queues, int nqueues)
+{
+    std::vector<int> last_on_queue(nqueues, -1);
+    std::vector<int> has_dependent(g.tasks.size(), 0);
+    int next_queue = 0;
+    cl_int err;
+    size_t t, i;
+
+    tgWireDeps(g);
+
+    for (t = 0; t < g.tasks.size(); t++) {
+        tgTask& task = g.tasks[t];
+        std::vector<cl_event> wait;
+        int q = -1;
+
+        // continue a chain on the queue of the dependency it follows,
+        // independent tasks start on the next queue
+        for (i = 0; i < task.deps.size() && q < 0; i++)
+            if (last_on_queue[g.tasks[task.deps[i]].queue] == task.deps[i])
+                q = g.tasks[task.deps[i]].queue;
+        if (q < 0) {
+            q = next_queue;
+            next_queue = (next_queue + 1) % nqueues;
+        }
+        task.queue = q;
+
+        // the in-order queue already orders tasks of the same queue
+        for (i = 0; i < task.deps.size(); i++) {
+            has_dependent[task.deps[i]] = 1;
+            if (g.tasks[task.deps[i]].queue != q)
+                wait.push_back(g.tasks[task.deps[i]].event);
+        }
+        cl_uint nwait = (cl_uint)wait.size();
+        const cl_event* pwait = nwait ? &wait[0] : NULL;
+
+        switch (task.kind) {
+        case TG_WRITE:
+            err = clEnqueueWriteBuffer(queues[q], task.buffer, CL_FALSE, 0, task.bytes, task.host, nwait, pwait, &task.event);
+            break;
+        case TG_READ:
+            err = clEnqueueReadBuffer(queues[q], task.buffer, CL_FALSE, 0, task.bytes, task.host, nwait, pwait, &task.event);
+            break;
+        default:
+            err = CL_SUCCESS;
+            for (i = 0; i < task.args.size(); i++)
+                err |= clSetKernelArg(task.kernel, (cl_uint)i, task.args[i].value.size(),
+                    task.args[i].local ? NULL : &task.args[i].value[0]);
+            if (err == CL_SUCCESS)
+                err = clEnqueueNDRangeKernel(queues[q], task.kernel, 1, NULL, &task.global,
+                    task.local ? &task.local : NULL, nwait, pwait, &task.event);
+            break;
+        }
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to enqueue task %d! %d\n", (int)t, err);
+            return err;
+        }
+        last_on_queue[q] = (int)t;
+    }
+
+    // cross-queue waits need every queue submitted
+    for (i = 0; i < (size_t)nqueues; i++)
+        clFlush(queues[i]);
+
+    // single host wait, on the tasks nothing depends on
+    std::vector<cl_event> sinks;
+    for (t = 0; t < g.tasks.size(); t++)
+        if (!has_dependent[t])
+            sinks.push_back(g.tasks[t].event);
+    if (sinks.empty())
+        return CL_SUCCESS;
+    return clWaitForEvents((cl_uint)sinks.size(), &sinks[0]);
+}
+
+cl_event tgEvent(const tgGraph& g, int task)
+{
+    return g.tasks[task].event;
+}
+
+void tgRelease(tgGraph& g)
+{
+    size_t t;
+    for (t = 0; t < g.tasks.size(); t++)
+        if (g.tasks[t].event)
+            clReleaseEvent(g.tasks[t].event);
+    g.tasks.clear();
+}
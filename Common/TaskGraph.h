@@ -0,0 +1,75 @@
+//------------------------------------------------------------------------------
+//
+// Name:       TaskGraph.h
+//
+// Purpose:    Small command graph executor : writes, kernels and reads
+//             declare the buffers they read and write, the executor derives
+//             the event wait lists from them (read after write, write after
+//             read, write after write) and spreads independent branches over
+//             several in-order queues.
+//
+//             Nothing blocks while the graph is enqueued, tgRun waits once on
+//             the tasks nobody depends on (usually the final reads).
+//
+//             tgGraph g;
+//             tgWrite(g, a_in, bytes, a_data);
+//             int t = tgKernel(g, kernel, global, local);
+//             tgArgIn(g, t, a_in); tgArgOut(g, t, c_out); tgArg(g, t, sizeof(n), &n);
+//             tgRead(g, c_out, bytes, c_data);
+//             tgRun(g, queues, 2);
+//             ...
+//             tgRelease(g);
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "CL/cl.h"
+
+#define TG_WRITE 0
+#define TG_KERNEL 1
+#define TG_READ 2
+
+struct tgArgValue {
+    std::vector<unsigned char> value;
+    int local;                      // __local argument, value holds no data
+};
+
+struct tgTask {
+    int kind;
+    cl_kernel kernel;
+    size_t global, local;
+    std::vector<tgArgValue> args;
+    cl_mem buffer;                  // write and read
+    size_t bytes;
+    void* host;
+    std::vector<cl_mem> reads, writes;
+    std::vector<int> deps;          // filled by tgRun
+    int queue;
+    cl_event event;
+};
+
+struct tgGraph {
+    std::vector<tgTask> tasks;
+};
+
+// task creation, returns the task index
+int tgWrite(tgGraph& g, cl_mem buf, size_t bytes, const void* host);
+int tgRead(tgGraph& g, cl_mem buf, size_t bytes, void* host);
+int tgKernel(tgGraph& g, cl_kernel kernel, size_t global, size_t local);
+
+// kernel arguments, in order; buffer arguments also declare the dependency
+void tgArg(tgGraph& g, int task, size_t size, const void* value);
+void tgArgLocal(tgGraph& g, int task, size_t size);
+void tgArgIn(tgGraph& g, int task, cl_mem buf);
+void tgArgOut(tgGraph& g, int task, cl_mem buf);
+void tgArgInOut(tgGraph& g, int task, cl_mem buf);
+
+// enqueues the whole graph on nqueues in-order queues and waits for its sinks
+cl_int tgRun(tgGraph& g, cl_command_queue* queues, int nqueues);
+
+// event of a task after tgRun, for profiling
+cl_event tgEvent(const tgGraph& g, int task);
+
+void tgRelease(tgGraph& g);
@@ -0,0 +1,160 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Trace.cpp
+//
+// Purpose:    Command and host span tracing, see Trace.h
+//
+//------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <chrono>
+#include "Trace.h"
+
+#define TR_HOST_PID 1
+#define TR_DEVICE_PID 2
+
+static double trNowUs()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// names go into JSON strings
+static std::string trEscape(const std::string& s)
+{
+    std::string out;
+    size_t i;
+    for (i = 0; i < s.size(); i++) {
+        if (s[i] == '"' || s[i] == '\\')
+            out += '\\';
+        if ((unsigned char)s[i] >= 0x20)
+            out += s[i];
+    }
+    return out;
+}
+
+void trInit(trTrace& trace)
+{
+    trace.commands.clear();
+    trace.spans.clear();
+    trace.origin_us = trNowUs();
+}
+
+void trLane(trTrace& trace, int lane, const char* name)
+{
+    trace.lanes[lane] = name;
+}
+
+void trAdd(trTrace& trace, const char* name, int lane, cl_event event)
+{
+    trCmd c;
+    if (!event)
+        return;
+    clRetainEvent(event);
+    c.name = name;
+    c.lane = lane;
+    c.event = event;
+    c.host_us = trNowUs();
+    trace.commands.push_back(c);
+}
+
+int trBegin(trTrace& trace, const char* name)
+{
+    trSpan s;
+    s.name = name;
+    s.start_us = trNowUs();
+    s.end_us = s.start_us;
+    trace.spans.push_back(s);
+    return (int)trace.spans.size() - 1;
+}
+
+void trEnd(trTrace& trace, int span)
+{
+    trace.spans[span].end_us = trNowUs();
+}
+
+int trWrite(trTrace& trace, const char* path)
+{
+    std::vector<cl_ulong> stamps(4 * trace.commands.size());
+    static const cl_profiling_info info[4] = {
+        CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END };
+    std::map<int, std::string>::const_iterator it;
+    double offset = 0.0;
+    int have_offset = 0;
+    int missing = 0;
+    size_t c, k;
+    FILE* f;
+
+    for (c = 0; c < trace.commands.size(); c++) {
+        trCmd& cmd = trace.commands[c];
+        clWaitForEvents(1, &cmd.event);
+        for (k = 0; k < 4; k++)
+            if (clGetEventProfilingInfo(cmd.event, info[k], sizeof(cl_ulong), &stamps[4 * c + k], NULL) != CL_SUCCESS) {
+                missing++;
+                stamps[4 * c] = 0;
+                break;
+            }
+        if (k < 4)
+            continue;
+        double d = cmd.host_us - stamps[4 * c] * 1.0e-3;
+        if (!have_offset || d < offset)
+            offset = d;
+        have_offset = 1;
+    }
+    if (missing)
+        printf("Warning: %d commands without profiling info, is the queue created with CL_QUEUE_PROFILING_ENABLE?\n", missing);
+
+    f = fopen(path, "w");
+    if (!f)
+    {
+        printf("Error: Failed to open %s!\n", path);
+        return 1;
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"host\"}},\n", TR_HOST_PID);
+    fprintf(f, "{\"ph\":\"M\",\"pid\":%d,\"name\":\"process_name\",\"args\":{\"name\":\"device\"}}", TR_DEVICE_PID);
+    for (it = trace.lanes.begin(); it != trace.lanes.end(); ++it)
+        fprintf(f, ",\n{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+            TR_DEVICE_PID, it->first, trEscape(it->second).c_str());
+
+    for (c = 0; c < trace.spans.size(); c++) {
+        const trSpan& s = trace.spans[c];
+        fprintf(f, ",\n{\"ph\":\"X\",\"pid\":%d,\"tid\":0,\"cat\":\"host\",\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+            TR_HOST_PID, trEscape(s.name).c_str(), s.start_us - trace.origin_us, s.end_us - s.start_us);
+    }
+
+    for (c = 0; c < trace.commands.size(); c++) {
+        const trCmd& cmd = trace.commands[c];
+        const cl_ulong* t = &stamps[4 * c];
+        if (!t[0])
+            continue;
+        double queued = t[0] * 1.0e-3 + offset - trace.origin_us;
+        double submit = t[1] * 1.0e-3 + offset - trace.origin_us;
+        double start = t[2] * 1.0e-3 + offset - trace.origin_us;
+        double end = t[3] * 1.0e-3 + offset - trace.origin_us;
+        std::string name = trEscape(cmd.name);
+
+        // the waits of one queue overlap each other, async slices may
+        fprintf(f, ",\n{\"ph\":\"b\",\"pid\":%d,\"tid\":%d,\"cat\":\"queued\",\"id\":%d,\"name\":\"%s queued\",\"ts\":%.3f}",
+            TR_DEVICE_PID, cmd.lane, (int)c, name.c_str(), queued);
+        fprintf(f, ",\n{\"ph\":\"e\",\"pid\":%d,\"tid\":%d,\"cat\":\"queued\",\"id\":%d,\"name\":\"%s queued\",\"ts\":%.3f}",
+            TR_DEVICE_PID, cmd.lane, (int)c, name.c_str(), start);
+        fprintf(f, ",\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"cat\":\"command\",\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"queued_us\":%.3f,\"submit_us\":%.3f,\"queue_delay_us\":%.3f,\"submit_delay_us\":%.3f}}",
+            TR_DEVICE_PID, cmd.lane, name.c_str(), start, end - start, queued, submit, start - queued, start - submit);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    printf("Trace : %lu commands, %lu host spans written to %s\n",
+        (unsigned long)(trace.commands.size() - missing), (unsigned long)trace.spans.size(), path);
+    return 0;
+}
+
+void trRelease(trTrace& trace)
+{
+    size_t c;
+    for (c = 0; c < trace.commands.size(); c++)
+        clReleaseEvent(trace.commands[c].event);
+    trace.commands.clear();
+    trace.spans.clear();
+}
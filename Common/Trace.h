@@ -0,0 +1,72 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Trace.h
+//
+// Purpose:    Timeline of the OpenCL commands and of host side spans, written
+//             in the Chrome trace event format (chrome://tracing, Perfetto).
+//
+//             Every command added with its event gets its QUEUED, SUBMIT,
+//             START and END timestamps read when the trace is written : the
+//             execution shows as a slice on the lane (one per queue), the time
+//             from QUEUED to START as an async "queued" slice above it, so
+//             queueing delay, overlap between queues and host gaps can be seen
+//             side by side. The queue needs CL_QUEUE_PROFILING_ENABLE.
+//
+//             Device timestamps are moved to the host clock with the smallest
+//             (host time at trAdd - QUEUED) over the commands : trAdd comes
+//             right after the enqueue, so that is the closest bound we have
+//             without clGetDeviceAndHostTimer (OpenCL 2.1).
+//
+//             trTrace trace;
+//             trInit(trace);
+//             trLane(trace, 1, "compute");
+//             int s = trBegin(trace, "fill");  ...  trEnd(trace, s);
+//             clEnqueueNDRangeKernel(commands, ..., &event);
+//             trAdd(trace, "vadd", 1, event);
+//             trWrite(trace, "vadd.json");
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include "CL/cl.h"
+
+struct trCmd {
+    std::string name;
+    int lane;
+    cl_event event;         // retained by the trace
+    double host_us;         // host time when added
+};
+
+struct trSpan {
+    std::string name;
+    double start_us, end_us;
+};
+
+struct trTrace {
+    std::vector<trCmd> commands;
+    std::vector<trSpan> spans;
+    std::map<int, std::string> lanes;
+    double origin_us;       // host time at trInit, the 0 of the trace
+};
+
+void trInit(trTrace& trace);
+
+// name shown for the lane of the commands
+void trLane(trTrace& trace, int lane, const char* name);
+
+// records a command, call it right after the enqueue ; a NULL event is ignored
+void trAdd(trTrace& trace, const char* name, int lane, cl_event event);
+
+// host span, trBegin returns the index to give to trEnd
+int trBegin(trTrace& trace, const char* name);
+void trEnd(trTrace& trace, int span);
+
+// waits for the commands and writes the JSON file, 0 on success
+int trWrite(trTrace& trace, const char* path);
+
+// releases the events, the trace can be filled again after trInit
+void trRelease(trTrace& trace);
@@ -0,0 +1,32 @@
+//------------------------------------------------------------------------------
+//
+// Name:       VaddKernel.h
+//
+// Purpose:    The vadd kernel of VectorAdd, shared with the Benchmark harness
+//             so that both always run the same code.
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+// kernel:  vadd  
+//
+// Purpose: Compute the elementwise sum c = a+b
+// 
+// input: a and b float vectors of length count
+//
+// output: c float vector of length count holding the sum a + b
+//
+
+static const char* VaddSource = "\n" \
+"__kernel void vadd(                                                    \n" \
+"   __global float* a,                                                  \n" \
+"   __global float* b,                                                  \n" \
+"   __global float* c,                                                  \n" \
+"   const unsigned int count)                                           \n" \
+"{                                                                      \n" \
+"   int i = get_global_id(0);                                           \n" \
+"   if(i < count)                                                       \n" \
+"       c[i] = a[i] + b[i];                                             \n" \
+"}                                                                      \n" \
+"\n";
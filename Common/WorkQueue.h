@@ -0,0 +1,74 @@
+//------------------------------------------------------------------------------
+//
+// Name:       WorkQueue.h
+//
+// Purpose:    Bounded blocking queue between the threads of a pipeline.
+//
+//             wqPush blocks while the queue is full, so a fast stage cannot
+//             run ahead of a slow one by more than the capacity, and memory
+//             stays bounded. Each producer calls wqDone once it is finished ;
+//             when the last one has, wqPop returns 0 on the empty queue and
+//             the consumers stop.
+//
+//             wqQueue<Job*> q;
+//             wqInit(q, 4, 2);                // capacity 4, 2 producers
+//             producer : wqPush(q, job); ... wqDone(q);
+//             consumer : while (wqPop(q, job)) { ... }
+//
+//------------------------------------------------------------------------------
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+template <class T>
+struct wqQueue {
+    std::deque<T> items;
+    size_t capacity;
+    int producers;          // still running
+    std::mutex lock;
+    std::condition_variable not_empty, not_full;
+};
+
+template <class T>
+void wqInit(wqQueue<T>& q, size_t capacity, int producers)
+{
+    q.items.clear();
+    q.capacity = capacity ? capacity : 1;
+    q.producers = producers;
+}
+
+template <class T>
+void wqPush(wqQueue<T>& q, const T& item)
+{
+    std::unique_lock<std::mutex> guard(q.lock);
+    while (q.items.size() >= q.capacity)
+        q.not_full.wait(guard);
+    q.items.push_back(item);
+    q.not_empty.notify_one();
+}
+
+// 0 once the producers are done and the queue is drained
+template <class T>
+int wqPop(wqQueue<T>& q, T& item)
+{
+    std::unique_lock<std::mutex> guard(q.lock);
+    while (q.items.empty() && q.producers > 0)
+        q.not_empty.wait(guard);
+    if (q.items.empty())
+        return 0;
+    item = q.items.front();
+    q.items.pop_front();
+    q.not_full.notify_one();
+    return 1;
+}
+
+template <class T>
+void wqDone(wqQueue<T>& q)
+{
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (--q.producers <= 0)
+        q.not_empty.notify_all();
+}
@@ -2,8 +2,8 @@
 //
 // Name:       vadd.c
 // 
-// Purpose:    Elementwise addition of two vectors (c = a + b)
-//             Use the profiling interface with events to time the vadd
+// Purpose:    Integral of 4/(1+x*x) over [0,1], one build per accumulation
+//             strategy, timed with the profiling interface
 //
 // HISTORY:    Written by Tim Mattson, June 2011
 //             
@@ -23,50 +23,106 @@
 #else
 #include "CL/cl.h"
 #endif
+#include "../Common/PiKernel.h"
 
 //------------------------------------------------------------------------------
 
 #define NWORKITER (100000)    // number of iters per work item
 #define NTOTALITER (256*256*256)    // number of total iter
+#define PAIRWISE_BLOCK 16    // terms summed naively before entering the pairwise tree
+#define PI_TARGET_ERROR 1e-13    // accuracy target used to pick a strategy
+#define PI_REF 3.14159265358979323846
+
+// accumulation strategies, selected at build time with -DACCU=n
+#define ACCU_NAIVE 0
+#define ACCU_NEUMAIER 1
+#define ACCU_PAIRWISE 2
+#define ACCU_DOUBLEDOUBLE 3
+#define ACCU_COUNT 4
+
+static const char* AccuName[ACCU_COUNT] = { "naive", "neumaier", "pairwise", "double-double" };
 
 //------------------------------------------------------------------------------
 //
-// kernel:  vadd  
-//
-// Purpose: Compute the elementwise sum c = a+b
-// 
-// input: a and b float vectors of length count
-//
-// output: c float vector of length count holding the sum a + b
+// host twin of the kernel accumulators, same strategies and same order of operations
 //
 
-const char* KernelSource = "\n" \
-"__kernel void pi_inte(                                                         \n" \
-"   __local double* ylocal,                                                  \n" \
-"   __global double* ypartial,                                                  \n" \
-"   const double step,                                                  \n" \
-"   const unsigned int nworkiter)                                           \n" \
-"{                                                                      \n" \
-"   int localID = get_local_id(0);                                           \n" \
-"   int n_workitems = get_local_size(0);                                           \n" \
-"   int groupID = get_group_id(0);                                           \n" \
-"   int ibegin = (localID + groupID*n_workitems)*nworkiter;                         \n" \
-"   int iend = ibegin + nworkiter;                                          \n" \
-"   int i;                                          \n" \
-"   double x, accu, sum;                                          \n" \
-"   for(i=ibegin; i<iend; i++){                                        \n" \
-"       x=(i+0.5)*step;                                              \n" \
-"       accu+=4.0/(1+(x*x)); }                                            \n" \
-"   ylocal[localID]=accu;                                \n" \
-"   barrier(CLK_LOCAL_MEM_FENCE);                                 \n" \
-"   sum = 0;                                                 \n" \
-"   if(localID == 0){\n" \
-"       for(i=0; i<n_workitems; i++)                                        \n" \
-"           sum+=ylocal[i];                                             \n" \
-"       ypartial[groupID] =sum;                                             \n" \
-"   }                                      \n" \
-"}                                                                      \n" \
-"\n";
+typedef struct {
+    double hi, lo;
+    double level[64];              // pairwise : level l holds the sum of 2^l blocks
+    unsigned long long nblocks;
+    double block;
+    int nblock;
+} accu_t;
+
+static void accu_init(accu_t* a)
+{
+    a->hi = 0; a->lo = 0;
+    a->nblocks = 0; a->block = 0; a->nblock = 0;
+}
+
+static void accu_add(int strategy, accu_t* a, double v)
+{
+    double t, s, bp, e;
+    int l;
+
+    switch (strategy) {
+    case ACCU_NAIVE:
+        a->hi += v;
+        break;
+    case ACCU_NEUMAIER:
+        t = a->hi + v;
+        if (fabs(a->hi) >= fabs(v)) a->lo += (a->hi - t) + v;
+        else a->lo += (v - t) + a->hi;
+        a->hi = t;
+        break;
+    case ACCU_PAIRWISE:
+        a->block += v;
+        if (++a->nblock == PAIRWISE_BLOCK) {
+            s = a->block;
+            l = 0;
+            while (a->nblocks & (1ULL << l)) {
+                s += a->level[l]; l++;
+            }
+            a->level[l] = s;
+            a->nblocks++; a->block = 0; a->nblock = 0;
+        }
+        break;
+    default:
+        s = a->hi + v;
+        bp = s - a->hi;
+        e = (a->hi - (s - bp)) + (v - bp) + a->lo;
+        a->hi = s + e;
+        a->lo = e - (a->hi - s);
+        break;
+    }
+}
+
+static void accu_add_pair(int strategy, accu_t* a, double hi, double lo)
+{
+    if (strategy == ACCU_DOUBLEDOUBLE) {
+        double s = a->hi + hi;
+        double bp = s - a->hi;
+        double e = (a->hi - (s - bp)) + (hi - bp) + a->lo + lo;
+        a->hi = s + e;
+        a->lo = e - (a->hi - s);
+        return;
+    }
+    accu_add(strategy, a, hi);
+    if (lo != 0) accu_add(strategy, a, lo);
+}
+
+static double accu_result(int strategy, accu_t* a)
+{
+    if (strategy == ACCU_PAIRWISE) {
+        double s = a->block;
+        int l;
+        for (l = 0; l < 64; l++)
+            if (a->nblocks & (1ULL << l)) s += a->level[l];
+        return s;
+    }
+    return a->hi + a->lo;
+}
 
 //------------------------------------------------------------------------------
 
@@ -78,14 +134,17 @@ int main(int argc, char** argv)
     size_t global;                      // global domain size  
     size_t local;                       // local  domain size  
     
-    int ntotal_iter = NTOTALITER;
+    long long ntotal_iter = NTOTALITER;
     int nwork_iter = NWORKITER;
+    double target = PI_TARGET_ERROR;
     double step;
-    int max_size, workgroup_size = 16;
-    int nworkgroup;
-    int i;
+    size_t max_size, workgroup_size = 16;
+    int nworkgroup = 0;
+    long long nsteps = 0;
+    int i, s;
+    long long j;
 
-    double        *psum_data;        // c vector (a+b) returned from the compute device
+    double        *psum_data = NULL; // (hi, lo) partial sums returned from the compute device, set up by the first strategy run
     
     cl_device_id     device_id;         // compute device id 
     cl_context       context;           // compute context
@@ -93,7 +152,15 @@ int main(int argc, char** argv)
     cl_program       program;           // compute program
     cl_kernel        kernel;            // compute kernel
 
-    cl_mem y_out;                       // device memory used for the output c vector
+    cl_mem y_out = NULL;                // device memory used for the partial sums
+
+    double pi_par[ACCU_COUNT], pi_seq[ACCU_COUNT];
+    double ns_par[ACCU_COUNT], ns_seq[ACCU_COUNT];
+    int ran[ACCU_COUNT] = { 0 };
+
+    // usage : PI_Integral [total iter] [target error]
+    if (argc > 1) ntotal_iter = atoll(argv[1]);
+    if (argc > 2) target = atof(argv[2]);
 
     // use whichever one is "first"
     cl_uint numPlatforms;
@@ -131,181 +198,179 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    // Create the compute program from the source buffer
-    program = clCreateProgramWithSource(context, 1, (const char**)&KernelSource, NULL, &err);
-    if (!program)
+    // One program per accumulation strategy, all on the same decomposition
+    for (s = 0; s < ACCU_COUNT; s++)
     {
-        printf("Error: Failed to create compute program!\n");
-        return EXIT_FAILURE;
-    }
-
-    // Build the program  
-    err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (err != CL_SUCCESS)
-    {
-        size_t len;
-        char buffer[2048];
-
-        printf("Error: Failed to build program executable!\n");
-        clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-        printf("%s\n", buffer);
-        exit(1);
-    }
-
-    // Create the compute kernel from the program 
-    kernel = clCreateKernel(program, "pi_inte", &err);
-    if (!kernel || err != CL_SUCCESS)
-    {
-        printf("Error: Failed to create compute kernel!\n");
-        exit(1);
-    }
-    size_t len;
-    char buffer[2048];
-    err = clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(buffer), buffer, &len);
-    printf("kernel function name : %s\n", buffer);
+        char options[128];
+        sprintf(options, "-DACCU=%d -DPAIRWISE_BLOCK=%d", s, PAIRWISE_BLOCK);
 
-    // Get the maximum work group size for executing the kernel on the device
-    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
-        printf("maxsize = %d\n", max_size);
-    }
-    if (max_size > workgroup_size) workgroup_size = max_size;
-
-    // Now that we know the size of the work_groups, we can set the number of work
-    // groups, the actual number of steps, and the step size
-    nworkgroup = ntotal_iter / (workgroup_size * nwork_iter);
-
-    if (nworkgroup < 1)
-    {
-        int comp_units;
-        err = clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &comp_units, NULL);
-        if (err != CL_SUCCESS)
+        // Create the compute program from the source buffer
+        program = clCreateProgramWithSource(context, 1, &PiSource, NULL, &err);
+        if (!program)
         {
-            printf("Error: Failed to access device number of compute units !\n");
+            printf("Error: Failed to create compute program!\n");
             return EXIT_FAILURE;
         }
-        nworkgroup = comp_units;
-        workgroup_size = ntotal_iter / (nworkgroup * nwork_iter);
-    }
-    int nsteps = workgroup_size * nwork_iter * nworkgroup;
-    step = 1.0 / (double)nsteps;
 
-    printf("Total iter : %d || Nstep : %d\n", ntotal_iter, nsteps);
-    
-    psum_data = (double*)malloc(sizeof(double) * nworkgroup);
+        // Build the program  
+        err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            size_t len;
+            char buffer[2048];
 
+            printf("Error: Failed to build program executable (%s)!\n", options);
+            clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+            printf("%s\n", buffer);
+            exit(1);
+        }
 
-    printf(" %d work groups of size %d.  %d Integration steps\n",
-        (int)nworkgroup, (int)workgroup_size, nsteps);
+        // Create the compute kernel from the program 
+        kernel = clCreateKernel(program, "pi_inte", &err);
+        if (!kernel || err != CL_SUCCESS)
+        {
+            printf("Error: Failed to create compute kernel!\n");
+            exit(1);
+        }
 
-    // Create the input (a, b) and output (c) arrays in device memory  
-    y_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(double) * nworkgroup, NULL, NULL);
-    if (!y_out)
-    {
-        printf("Error: Failed to allocate device memory!\n");
-        exit(1);
-    }
+        // Get the maximum work group size for executing the kernel on the device
+        err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to retrieve kernel work group info! %d\n", err);
+            exit(1);
+        }
 
-    // Set the arguments to our compute kernel
-    err = 0;
-    err = clSetKernelArg(kernel, 0, sizeof(double) * workgroup_size, NULL);
-    err = clSetKernelArg(kernel, 1, sizeof(cl_mem), &y_out);
-    err |= clSetKernelArg(kernel, 2, sizeof(double), &step);
-    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &nwork_iter);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to set kernel arguments! %d\n", err);
-        exit(1);
-    }
+        if (s == 0)
+        {
+            if (max_size > workgroup_size) workgroup_size = max_size;
+
+            // Now that we know the size of the work_groups, we can set the number of work
+            // groups, the actual number of steps, and the step size
+            nworkgroup = (int)(ntotal_iter / ((long long)workgroup_size * nwork_iter));
+
+            if (nworkgroup < 1)
+            {
+                cl_uint comp_units;
+                err = clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &comp_units, NULL);
+                if (err != CL_SUCCESS)
+                {
+                    printf("Error: Failed to access device number of compute units !\n");
+                    return EXIT_FAILURE;
+                }
+                nworkgroup = comp_units;
+                workgroup_size = (size_t)(ntotal_iter / ((long long)nworkgroup * nwork_iter));
+                if (workgroup_size < 1) workgroup_size = 1;
+            }
+            nsteps = (long long)workgroup_size * nwork_iter * nworkgroup;
+            step = 1.0 / (double)nsteps;
+
+            printf("Total iter : %lld || Nstep : %lld\n", ntotal_iter, nsteps);
+            printf(" %d work groups of size %d.  %lld Integration steps\n\n",
+                (int)nworkgroup, (int)workgroup_size, nsteps);
+
+            psum_data = (double*)malloc(sizeof(double) * 2 * nworkgroup);
+
+            // Create the output (hi, lo pairs) array in device memory  
+            y_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(double) * 2 * nworkgroup, NULL, NULL);
+            if (!y_out || !psum_data)
+            {
+                printf("Error: Failed to allocate device memory!\n");
+                exit(1);
+            }
+        }
+        else if (max_size < workgroup_size)
+        {
+            printf("%-14s : skipped, kernel work group limit %d < %d\n", AccuName[s], (int)max_size, (int)workgroup_size);
+            clReleaseKernel(kernel);
+            clReleaseProgram(program);
+            continue;
+        }
 
-    // Get the maximum work group size for executing the kernel on the device
-    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
-        exit(1);
-    }
-    double rtime;
-    rtime = clock();
-
-    // Execute the kernel over the entire range of our 1d input data set
-    // using the maximum number of work group items for this device
-    cl_event prof_event;
-    global = nworkgroup*workgroup_size;
-    local = workgroup_size;
-    err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, &prof_event);
-    if (err)
-    {
-        printf("Error: Failed to execute kernel!\n");
-        return EXIT_FAILURE;
-    }
+        // Set the arguments to our compute kernel
+        err = clSetKernelArg(kernel, 0, sizeof(double) * 2 * workgroup_size, NULL);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &y_out);
+        err |= clSetKernelArg(kernel, 2, sizeof(double), &step);
+        err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &nwork_iter);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to set kernel arguments! %d\n", err);
+            exit(1);
+        }
 
-    // Wait for the commands to complete before reading back results
-    clFinish(commands);
-   
+        // Execute the kernel over the entire range of our 1d input data set
+        cl_event prof_event;
+        global = nworkgroup * workgroup_size;
+        local = workgroup_size;
+        err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, &prof_event);
+        if (err)
+        {
+            printf("Error: Failed to execute kernel!\n");
+            return EXIT_FAILURE;
+        }
 
-    // Read back the results from the compute device
-    err = clEnqueueReadBuffer(commands, y_out, CL_TRUE, 0, sizeof(double) * nworkgroup, psum_data, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to read output array! %d\n", err);
-        exit(1);
-    }
+        // Read back the results from the compute device, the blocking read waits for the kernel
+        err = clEnqueueReadBuffer(commands, y_out, CL_TRUE, 0, sizeof(double) * 2 * nworkgroup, psum_data, 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to read output array! %d\n", err);
+            exit(1);
+        }
 
-    // Test the results
-    double res = 0.0;
-    for (i = 0; i < nworkgroup; i++)
-    {
-        res += psum_data[i];
-       
+        // Reduce the partials with the same strategy
+        accu_t accu;
+        accu_init(&accu);
+        for (i = 0; i < nworkgroup; i++)
+            accu_add_pair(s, &accu, psum_data[2 * i], psum_data[2 * i + 1]);
+        pi_par[s] = accu_result(s, &accu) * step;
+
+        // extract timing data from the event, prof_event
+        cl_ulong ev_start_time = (cl_ulong)0;
+        cl_ulong ev_end_time = (cl_ulong)0;
+        err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_START,
+            sizeof(cl_ulong), &ev_start_time, NULL);
+        err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_END,
+            sizeof(cl_ulong), &ev_end_time, NULL);
+        ns_par[s] = (double)(ev_end_time - ev_start_time) / (double)nsteps;
+
+        clReleaseEvent(prof_event);
+        clReleaseKernel(kernel);
+        clReleaseProgram(program);
+
+        /// SEQ, same strategy over all the steps
+        double rtime = clock();
+        double x;
+        accu_init(&accu);
+        for (j = 0; j < nsteps; j++) {
+            x = (j + 0.5) * step;
+            accu_add(s, &accu, 4.0 / (1.0 + x * x));
+        }
+        pi_seq[s] = accu_result(s, &accu) * step;
+        rtime = clock() - rtime;
+        ns_seq[s] = rtime * 1.0e9 / CLOCKS_PER_SEC / (double)nsteps;
+        ran[s] = 1;
 
+        printf("%-14s : PAR Pi = %.16f (err %.3e, %.4f ns/step) || SEQ Pi = %.16f (err %.3e, %.4f ns/step)\n",
+            AccuName[s], pi_par[s], fabs(pi_par[s] - PI_REF), ns_par[s], pi_seq[s], fabs(pi_seq[s] - PI_REF), ns_seq[s]);
     }
 
-    res *= step;
-
-    // summarize results
-    printf("Pi = %lf\n", res);
-
-    rtime = clock() - rtime;
-
-    printf("\nThe kernel ran in %lf ms\n", rtime*1000/CLOCKS_PER_SEC);
-
-    // extract timing data from the event, prof_event
-    err = clWaitForEvents(1, &prof_event);
-    cl_ulong ev_start_time = (cl_ulong)0;
-    cl_ulong ev_end_time = (cl_ulong)0;
-    err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_START,
-        sizeof(cl_ulong), &ev_start_time, NULL);
-    err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_END,
-        sizeof(cl_ulong), &ev_end_time, NULL);
-    printf("prof says %f ms \n", (double)(ev_end_time - ev_start_time) * 1.0e-6);
-
-
-
-    // cleanup then shutdown
-    clReleaseMemObject(y_out);
-    clReleaseProgram(program);
-    clReleaseKernel(kernel);
+    // fastest device strategy within the accuracy target
+    int best = -1;
+    for (s = 0; s < ACCU_COUNT; s++)
+        if (ran[s] && fabs(pi_par[s] - PI_REF) <= target && (best < 0 || ns_par[s] < ns_par[best]))
+            best = s;
+    if (best >= 0)
+        printf("\nFastest strategy within %.1e : %s (%.4f ns/step)\n", target, AccuName[best], ns_par[best]);
+    else
+        printf("\nNo strategy within %.1e at %lld steps\n", target, nsteps);
+
+    // cleanup then shutdown, the partial sums only exist if a strategy ran
+    if (y_out)
+        clReleaseMemObject(y_out);
     clReleaseCommandQueue(commands);
     clReleaseContext(context);
-
-    /// SEQ
-    rtime = 0.0;
-    rtime = clock();
-    double x = 0;
-    double sum = 0;
-    for (i = 0;i < nsteps;i++) {
-        x = (i + 0.5) * step;
-        sum += 4.0 / (1.0 + x * x);
-    }
-    sum *= step;
-    rtime = clock() - rtime;
-
-    printf("SEQ : PI=%g || Time : %g ms\n", sum, rtime*1000/CLOCKS_PER_SEC);
-
+    if (psum_data)
+        free(psum_data);
 
     return 0;
 }
-
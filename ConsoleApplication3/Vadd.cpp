@@ -4,37 +4,63 @@
 #include <iostream>
 #include <CL/opencl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#include "../Common/Philox.h"
 
-#define DATA_SIZE 128
+#define DATA_SIZE 128		// points per iteration, two per work-item
 #define ITER_MAX 2000
+#define WORKGROUP_SIZE 64	// must be a power of two dividing DATA_SIZE / 2
+#define SEED 20210323u
 
+// hello : two Philox points per work-item, tree reduction in local memory, one partial count per work-group
+// reduce : single work-group pass over the partials, accumulated into total[0] on the device
 const char* KernelSource =
-"__kernel void hello(__global double *input, __global double *output)\n"\
+"__kernel void hello(__global uint *partial, __local uint *localB, const uint seed)\n"\
 "{\n"\
 "	size_t id = get_global_id(0);\n"\
-"	size_t group_size = get_global_size(0);\n"\
-"	double temp = input[2*id]*input[2*id]+input[2*id+1]*input[2*id+1];\n"\
-"	if(temp < 1){\n"\
-"	output[id] = 1;}else{\n"\
-"	output[id] = 0;}\n"\
+"	size_t lid = get_local_id(0);\n"\
+"	uint4 r = philox4x32_10((uint4)((uint)id, 0, 0, 0), (uint2)(seed, 0));\n"\
+"	double x0 = philox_u01(r.x), y0 = philox_u01(r.y);\n"\
+"	double x1 = philox_u01(r.z), y1 = philox_u01(r.w);\n"\
+"	localB[lid] = (x0*x0+y0*y0 < 1 ? 1 : 0) + (x1*x1+y1*y1 < 1 ? 1 : 0);\n"\
 "	\n"\
-"	for(uint stride=group_size/2; stride>0; stride/=2){\n"\
+"	for(uint stride=get_local_size(0)/2; stride>0; stride/=2){\n"\
 "	barrier(CLK_LOCAL_MEM_FENCE);\n"\
-"	if(id < stride)\n"\
-"	output[id] += output[id+stride];}\n"\
+"	if(lid < stride)\n"\
+"	localB[lid] += localB[lid+stride];}\n"\
+"	\n"\
+"	if(lid == 0)\n"\
+"	partial[get_group_id(0)] = localB[0];\n"\
+"}\n"\
+"\n"\
+"__kernel void reduce(__global const uint *partial, const uint npartial, __local uint *localB, __global ulong *total)\n"\
+"{\n"\
+"	size_t lid = get_local_id(0);\n"\
+"	uint sum = 0;\n"\
+"	for(uint i=lid; i<npartial; i+=get_local_size(0))\n"\
+"	sum += partial[i];\n"\
+"	localB[lid] = sum;\n"\
+"	\n"\
+"	for(uint stride=get_local_size(0)/2; stride>0; stride/=2){\n"\
+"	barrier(CLK_LOCAL_MEM_FENCE);\n"\
+"	if(lid < stride)\n"\
+"	localB[lid] += localB[lid+stride];}\n"\
+"	\n"\
+"	if(lid == 0)\n"\
+"	total[0] += localB[0];\n"\
 "}\n"\
 "\n";
 
 clock_t t1, t2;
 
-int main()
+int main(int argc, char** argv)
 {
 	t1 = clock();
 
 	cl_context context;
 	cl_context_properties properties[3];
-	cl_kernel kernel;
+	cl_kernel kernel, kernel_reduce;
 	cl_command_queue command_queue;
 	cl_program program;
 	cl_int err;
@@ -42,18 +68,17 @@ int main()
 	cl_uint num_of_platform = 0;
 	cl_device_id device_id;
 	cl_uint num_of_devices = 0;
-	cl_mem input, output;
-	size_t global;
-
-	double inputData[DATA_SIZE*2] = { 0 };
-	double results[DATA_SIZE] = { 0 };
+	cl_mem partial, total;
+	size_t global, local, max_size;
+	cl_uint npartial;
+	cl_ulong hits = 0;
+	cl_uint seed = SEED;
 
 	int i;
 
-	//Init random memory, cannot be done on the GPU
-	for (i = 0; i < DATA_SIZE*2; i++) {
-		inputData[i] = ((double)rand()) / RAND_MAX;
-	}
+	//the samples are generated on the device from the seed, nothing is uploaded
+	if (argc > 1)
+		seed = (cl_uint)strtoul(argv[1], NULL, 0);
 
 	//retrieves a list of platforms available
 	if (clGetPlatformIDs(1, &platform_id, &num_of_platform) != CL_SUCCESS)
@@ -78,111 +103,142 @@ int main()
 	context = clCreateContext(properties, 1, &device_id, NULL, NULL, &err);
 
 	//create a command queue using the context and device
-	command_queue = clCreateCommandQueue(context, device_id, 0, &err);
+	command_queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
 
-	//create a program from the kernel source code
-	program = clCreateProgramWithSource(context, 1, (const char**) &KernelSource, NULL, &err);
+	//create a program from the generator and kernel source code
+	const char* sources[2] = { PhiloxSource, KernelSource };
+	program = clCreateProgramWithSource(context, 2, sources, NULL, &err);
 
 	//compile the program
-	if (clBuildProgram(program, 0, NULL, NULL, NULL, NULL) != CL_SUCCESS) 
+	if (clBuildProgram(program, 0, NULL, NULL, NULL, NULL) != CL_SUCCESS)
 	{
+		size_t len;
+		char buffer[2048];
+
 		printf("Err unable to build program\n");
+		clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+		printf("%s\n", buffer);
 		return 1;
 	}
 
-	//specify which kernel from the program to execute
+	//specify which kernels from the program to execute
 	kernel = clCreateKernel(program, "hello", &err);
+	kernel_reduce = clCreateKernel(program, "reduce", &err);
 
-	//create buffers for the input and output
-	input = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(double) * DATA_SIZE * 2, NULL, NULL);
-	output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(double), NULL, NULL);
+	//work-group size : power of two that fits both kernels on the device, the tree reductions rely on it
+	local = WORKGROUP_SIZE;
+	if (clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL) == CL_SUCCESS) {
+		while (local > max_size)
+			local /= 2;
+	}
+	if (clGetKernelWorkGroupInfo(kernel_reduce, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL) == CL_SUCCESS) {
+		while (local > max_size)
+			local /= 2;
+	}
+	global = DATA_SIZE / 2;
+	npartial = (cl_uint)(global / local);
 
-	//load data into the input buffer
-	clEnqueueWriteBuffer(command_queue, input, CL_TRUE, 0, sizeof(double) * DATA_SIZE * 2, inputData, 0, NULL, NULL);
+	//create buffers for the per group partials and the running total
+	partial = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * npartial, NULL, NULL);
+	total = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_ulong), NULL, NULL);
+	if (!partial || !total)
+	{
+		printf("Error: Failed to allocate device memory!\n");
+		return 1;
+	}
 
-	//set the argument list for the kernel command
-	clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
-	clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
-	global = DATA_SIZE;
+	//clear the total, once for the whole run
+	clEnqueueWriteBuffer(command_queue, total, CL_TRUE, 0, sizeof(cl_ulong), &hits, 0, NULL, NULL);
+
+	//set the argument list for the kernel commands
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &partial);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_uint) * local, NULL);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &seed);
+	err |= clSetKernelArg(kernel_reduce, 0, sizeof(cl_mem), &partial);
+	err |= clSetKernelArg(kernel_reduce, 1, sizeof(cl_uint), &npartial);
+	err |= clSetKernelArg(kernel_reduce, 2, sizeof(cl_uint) * local, NULL);
+	err |= clSetKernelArg(kernel_reduce, 3, sizeof(cl_mem), &total);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to set kernel arguments! %d\n", err);
+		return 1;
+	}
 
+	//every iteration draws its own counters through the global offset,
+	//the in-order queue chains hello and reduce so the host never waits inside the loop
 	int iter;
-	double r2[ITER_MAX];
-	double rf = 0;
-	double temp;
-	for (iter = 0; iter < ITER_MAX-1; iter++) {
-
-		//enqueue the kernel command for execution
-		clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global, NULL, 0, NULL, NULL);
-
-		//create new random numbers for the next iteration (while gpu is sync up)
-		for (i = 0; i < DATA_SIZE * 2; i++) {
-			inputData[i] = ((double)rand()) / RAND_MAX;
+	cl_event first_event, last_event;
+	for (iter = 0; iter < ITER_MAX; iter++) {
+		size_t offset = (size_t)iter * global;
+
+		err = clEnqueueNDRangeKernel(command_queue, kernel, 1, &offset, &global, &local, 0, NULL, iter == 0 ? &first_event : NULL);
+		err |= clEnqueueNDRangeKernel(command_queue, kernel_reduce, 1, NULL, &local, &local, 0, NULL, iter == ITER_MAX - 1 ? &last_event : NULL);
+		if (err != CL_SUCCESS)
+		{
+			printf("Error: Failed to execute kernel! %d\n", err);
+			return 1;
 		}
+	}
 
-		//wait for queue to empty
-		clFinish(command_queue);
-
-		//copy the result from out of the output buffer
-		clEnqueueReadBuffer(command_queue, output, CL_TRUE, 0, sizeof(double), results, 0, NULL, NULL);
-
-		//get the result
-		temp = results[0];
-		r2[iter] = 4 *temp / DATA_SIZE;
-		rf += r2[iter];
+	//single read back of the hit count, blocking on the end of the queue
+	clEnqueueReadBuffer(command_queue, total, CL_TRUE, 0, sizeof(cl_ulong), &hits, 0, NULL, NULL);
 
+	cl_ulong ev_start_time = (cl_ulong)0;
+	cl_ulong ev_end_time = (cl_ulong)0;
+	clGetEventProfilingInfo(first_event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+	clGetEventProfilingInfo(last_event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+	double device_ms = (double)(ev_end_time - ev_start_time) * 1.0e-6;
 
-	}
-	
-	//average the the results
-	rf /= ITER_MAX;
+	double rf = 4.0 * (double)hits / ((double)DATA_SIZE * ITER_MAX);
 
 	//cleanup - release OpenCL ressources
-	clReleaseMemObject(input);
-	clReleaseMemObject(output);
+	clReleaseEvent(first_event);
+	clReleaseEvent(last_event);
+	clReleaseMemObject(partial);
+	clReleaseMemObject(total);
 	clReleaseProgram(program);
 	clReleaseKernel(kernel);
+	clReleaseKernel(kernel_reduce);
 	clReleaseCommandQueue(command_queue);
 	clReleaseContext(context);
 
 	t2 = clock();
 	printf("\n ==== PAR MODE ==== \n");
 	printf("For %d iterations :\n", DATA_SIZE * ITER_MAX);
-	printf("Pi final : %g\n ", rf);
+	printf("Pi final : %g (%llu hits)\n ", rf, (unsigned long long)hits);
 	printf("Total Time OpenCL %.3lfms\n", ((double)(t2 - t1) / (double)CLOCKS_PER_SEC)*1000);
+	printf("Device time %.3lfms || %.2lf Msamples/s\n", device_ms, (double)DATA_SIZE * ITER_MAX / (device_ms * 1.0e3));
 
-	//seq mode
+	//seq mode, on the same counters so the hit counts must match
 	t1 = clock();
 
-	rf = 0;
-	for (iter = 0; iter < ITER_MAX; iter++) {
-
-		for (i = 0; i < DATA_SIZE * 2; i++) {
-			inputData[i] = ((double)rand()) / RAND_MAX;
+	cl_ulong seq_hits = 0;
+	for (i = 0; i < DATA_SIZE / 2 * ITER_MAX; i++) {
+		unsigned int ctr[4] = { (unsigned int)i, 0, 0, 0 };
+		unsigned int key[2] = { seed, 0 };
+		unsigned int r[4];
+		philox4x32_10(ctr, key, r);
+
+		double x0 = philox_u01(r[0]), y0 = philox_u01(r[1]);
+		double x1 = philox_u01(r[2]), y1 = philox_u01(r[3]);
+		if (x0 * x0 + y0 * y0 < 1) {
+			seq_hits++;
 		}
-
-		double inc = 0;
-		for (i = 0; i < DATA_SIZE; i++) {
-			double temp0 = inputData[2 * i] * inputData[2 * i] + inputData[2 * i + 1] * inputData[2 * i + 1];
-			if (temp0 < 1) {
-				inc += 1;
-			}
+		if (x1 * x1 + y1 * y1 < 1) {
+			seq_hits++;
 		}
-
-		//compute the results
-		r2[iter] = 4 * inc / DATA_SIZE;
-		rf += r2[iter];
-
-
 	}
 
-	//average the results
-	rf /= ITER_MAX;
+	rf = 4.0 * (double)seq_hits / ((double)DATA_SIZE * ITER_MAX);
 
 	t2 = clock();
 	printf("\n ==== SEQ MODE ==== \n");
 	printf("For %d iterations :\n", DATA_SIZE * ITER_MAX);
-	printf("Pi final : %g\n ", rf);
+	printf("Pi final : %g (%llu hits)\n ", rf, (unsigned long long)seq_hits);
 	printf("Total Time Seq %.3lfms\n", ((double)(t2 - t1) / (double)CLOCKS_PER_SEC)*1000);
 
+	if (seq_hits != hits)
+		printf("Error: device and host hit counts differ!\n");
+
 	return 0;
-}
\ No newline at end of file
+}
@@ -1,185 +1,2166 @@
-// DetectionContourImage.cpp : Ce fichier contient la fonction 'main'. L'exécution du programme commence et se termine à cet endroit.
+//------------------------------------------------------------------------------
 //
+// Name:       DetectionContourImage.cpp
+//
+// Purpose:    Canny edge detection on the device : grayscale conversion,
+//             Gaussian blur, Sobel gradients, non-maximum suppression and
+//             hysteresis thresholding, chained on device buffers. The only
+//             reads during the run are the 4 byte "changed" flag of the
+//             hysteresis, checked every HYST_BATCH propagation steps.
+//
+//             Every stage is timed with its events, and the edge map is
+//             checked against the same pipeline run on the CPU. The edges are
+//             then split in connected components on the device and their
+//             contours traced as point lists (-contours saves them).
+//
+//             Without an input image, the Mandelbrot set is rendered on the
+//             device (and saved to test3.bmp) and used as the input.
+//
+//             -stream writes the gradient magnitude of an image of any size,
+//             read and written band by band through mapped files. -batch
+//             runs a whole directory through one context, decoding and
+//             encoding on worker threads around the device.
+//
+//             The blur goes through the convolution module of Common, which
+//             runs the Gaussian as two 1-D passes ; -bench compares its naive,
+//             tiled and separable kernels on the gray image, then labels a
+//             large binary image made of copies of the edge map.
+//
+//             -multiscale builds a Gaussian / Laplacian pyramid of the gray
+//             image, finds the edges on its coarsest level and refines them
+//             level by level, running the blur, Sobel and suppression only on
+//             the tiles near an edge of the level below ; the edges saved and
+//             traced are then these ones.
+//
+//             -images, in any mode, hands the gray and blurred images to the
+//             blur and Sobel as image objects read through a clamp to edge
+//             sampler, instead of buffers ; -bench then also times the image
+//             path of every convolution and of the Sobel stage. The blur and
+//             magnitude of that path are checked against the buffer path, the
+//             edges of the buffer path against the CPU.
+//
+//             -auto chooses the thresholds on the device from the histogram
+//             of the suppressed magnitudes : Otsu's split, or the magnitude
+//             under which the given fraction of the candidates fall, as the
+//             high one and AUTO_LOW_RATIO of it as the low one. They stay in
+//             a device buffer the hysteresis reads, with no round trip.
+//
+//             -morph cleans the edge map by an erosion, a dilation, an
+//             opening or a closing by a square, van Herk / Gil-Werman on the
+//             device at the same cost for any radius, and on the host with
+//             SSE2 for the reference ; -bench times both for growing radii.
+//
+//             -distance adds an exact Euclidean distance transform of the
+//             edge map, still on the device, and saves the distance of every
+//             pixel to the nearest edge as a gray image, clamped to 255.
+//
+// Usage:      DetectionContourImage [-cpu] [-images] [-bench] [image.bmp] [-o edges.bmp]
+//                                   [-contours file.txt] [-sigma s] [-low t] [-high t]
+//                                   [-auto otsu|fraction] [-multiscale levels]
+//                                   [-morph erode|dilate|open|close radius] [-distance dist.bmp]
+//             DetectionContourImage [-cpu] [-images] -stream image.bmp [-band rows]
+//                                   [-o gradient.bmp] [-sigma s]
+//             DetectionContourImage [-cpu] [-images] -batch dir|list.txt [-threads n]
+//                                   [-o out_dir] [-sigma s] [-low t] [-high t]
+//                                   [-auto otsu|fraction] [-morph erode|dilate|open|close radius]
+//
+//------------------------------------------------------------------------------
+
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
 #include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <filesystem>
 #include "CL/cl.h"
+#include "../Common/Bmp.h"
+#include "../Common/Convolution.h"
+#include "../Common/Labeling.h"
+#include "../Common/Pyramid.h"
+#include "../Common/Histogram.h"
+#include "../Common/Morphology.h"
+#include "../Common/Distance.h"
+#include "../Common/WorkQueue.h"
+
+#define IMG_WIDTH 1000          // synthetic input size
+#define IMG_HEIGHT 1000
+#define MAX_ITER 255
+#define LOCAL_SIDE CV_TILE      // work-groups of LOCAL_SIDE x LOCAL_SIDE, the tiles of the masks
+#define GAUSS_SIGMA 1.4f
+#define MAX_RADIUS 8
+#define LOW_THRESHOLD 20.0f     // gradient magnitude, gray levels 0..255
+#define HIGH_THRESHOLD 50.0f
+#define MAG_MAX 1443.0f         // bound of the Sobel magnitude, 4 * 255 * sqrt(2)
+#define AUTO_LOW_RATIO 0.4f     // -auto : low threshold, times the high one
+#define HYST_BATCH 8            // propagation steps between two reads of the changed flag
+#define MATCH_TOL 0.001         // fraction of edge pixels allowed to differ from the CPU
+#define BENCH_CASES 8           // -bench : 5 Gaussians, Sobel x, 2 discs
+#define BENCH_REPEAT 5          // -bench : best of, after one warm up run
+#define BENCH_IMAGE CV_MODES    // -bench : the image path, after the convolution modes of buffers
+#define BENCH_LABEL_SIDE 4096   // -bench : side of the labelling image
+#define BENCH_MORPH_RADII 6     // -bench : closings of radius 1 to 32
+#define BENCH_MORPH_CHECK 4     // -bench : largest radius checked against the direct min / max
+#define STREAM_ROWS 256         // -stream : rows per band
+#define BATCH_THREADS 2         // -batch : decoder threads, and as many encoders
+#define BATCH_QUEUE 4           // -batch : images waiting between two stages
+#define PYR_TOL 0.01f           // -multiscale : gray levels the pyramid may differ from the host by
+#define ROI_MARGIN 2            // -multiscale : coarse pixels around an edge refined at the next level
+#define DIST_TOL 1.0e-3f        // -distance : pixels the device may differ from the host by
+#define ROI_DETAIL 0.25f        // -multiscale : Laplacian band refined too, times the low threshold
+#define IMAGE_TOL 1.0e-3f       // -images : gray levels the blur and magnitude may differ from the buffers by
+
+enum { ST_GRAY, ST_BLUR, ST_SOBEL, ST_NMS, ST_THRESH, ST_HYST, ST_MORPH, ST_DIST, ST_COUNT };
+static const char* StageName[ST_COUNT] = { "gray", "blur", "sobel", "nms", "threshold", "hysteresis", "morphology", "distance" };
+
+//------------------------------------------------------------------------------
+//
+// Kernels. Images are row major, width x height, borders clamp to the edge.
+//
+
+const char* KernelSource =                                             "\n" \
+"__constant uint palette[16] = {                                        \n" \
+"   0x421E0F, 0x19071A, 0x09012F, 0x040449, 0x000764, 0x0C2C8A,         \n" \
+"   0x1852B1, 0x397DD1, 0x86B5E5, 0xD3ECF8, 0xF1E9BF, 0xF8C95F,         \n" \
+"   0xFEAA00, 0xCC8000, 0x995700, 0x6A3403 };                           \n" \
+"                                                                       \n" \
+"__kernel void mandel(                                                  \n" \
+"   const double x0,                                                    \n" \
+"   const double y0,                                                    \n" \
+"   const double stepsize,                                              \n" \
+"   const unsigned int maxIter,                                         \n" \
+"   __global unsigned int *restrict framebuffer,                        \n" \
+"   const unsigned int windowWidth                                      \n" \
+"   )                                                                   \n" \
+"{// WORK ITEM POSITION                                                 \n" \
+"   const size_t windowPosX = get_global_id(0);                         \n" \
+"   const size_t windowPosY = get_global_id(1);                         \n" \
+"   const double stepPosX = x0 + (windowPosX * stepsize);               \n" \
+"   const double stepPosY = y0 - (windowPosY * stepsize);               \n" \
+"                                                                       \n" \
+"   double x = 0.0;                                                     \n" \
+"   double y = 0.0;                                                     \n" \
+"   double x2 = 0.0;                                                    \n" \
+"   double y2 = 0.0;                                                    \n" \
+"   unsigned int i = 0;                                                 \n" \
+"                                                                       \n" \
+"   while(x2 + y2 < 4.0 && i < maxIter){                                \n" \
+"        x2 = x*x;                                                      \n" \
+"        y2 = y*y;                                                      \n" \
+"        y = 2*x*y + stepPosY;                                          \n" \
+"        x = x2 - y2 + stepPosX;                                        \n" \
+"        i++;                          }                                \n" \
+"                                                                       \n" \
+"   // packed 0xRRGGBB, the set itself in black                         \n" \
+"   framebuffer[windowWidth * windowPosY + windowPosX] =                \n" \
+"       i >= maxIter ? 0 : palette[i%16];                               \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"#define PIX(img, x, y) img[clamp(y, 0, height-1)*width + clamp(x, 0, width-1)]\n" \
+"// active : one uchar per work-group, NULL for all of them             \n" \
+"#define SKIP(active) (active && !active[get_group_id(1)*get_num_groups(0) + get_group_id(0)])\n" \
+"                                                                       \n" \
+"__kernel void gray(__global const uint* rgb, __global float* out,      \n" \
+"   const int width, const int height)                                  \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   uint p = rgb[y*width + x];                                          \n" \
+"   out[y*width + x] = 0.299f*((p >> 16) & 0xff)                        \n" \
+"       + 0.587f*((p >> 8) & 0xff) + 0.114f*(p & 0xff);                 \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// Sobel of the 3 x 3 neighbourhood n, row major : magnitude and direction\n" \
+"// quantised to 0 (horizontal gradient), 1 (down right diagonal),      \n" \
+"// 2 (vertical) and 3 (up right diagonal)                              \n" \
+"void gradient(const float* n, __global float* mag, __global uchar* dir, int k)\n" \
+"{                                                                      \n" \
+"   float gx = (n[2] + 2.0f*n[5] + n[8]) - (n[0] + 2.0f*n[3] + n[6]);   \n" \
+"   float gy = (n[6] + 2.0f*n[7] + n[8]) - (n[0] + 2.0f*n[1] + n[2]);   \n" \
+"   float ax = fabs(gx), ay = fabs(gy);                                 \n" \
+"   uchar d;                                                            \n" \
+"   if(ay <= ax*0.41421356f) d = 0;                                     \n" \
+"   else if(ay >= ax*2.41421356f) d = 2;                                \n" \
+"   else d = (gx*gy > 0.0f) ? 1 : 3;                                    \n" \
+"   mag[k] = sqrt(gx*gx + gy*gy);                                       \n" \
+"   dir[k] = d;                                                         \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void sobel(__global const float* in, __global float* mag,     \n" \
+"   __global uchar* dir, const int width, const int height,             \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i, j;                                                           \n" \
+"   float n[9];                                                         \n" \
+"   if(SKIP(active) || x >= width || y >= height) return;               \n" \
+"   for(j = 0; j < 3; j++)                                              \n" \
+"       for(i = 0; i < 3; i++)                                          \n" \
+"           n[j*3 + i] = PIX(in, x+i-1, y+j-1);                         \n" \
+"   gradient(n, mag, dir, y*width + x);                                 \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// keeps the local maxima across the edge, ties go to the first pixel ;\n" \
+"// the inactive tiles have no edge                                     \n" \
+"__kernel void nms(__global const float* mag, __global const uchar* dir,\n" \
+"   __global float* out, const int width, const int height,             \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int dx, dy;                                                         \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   if(SKIP(active) || x == 0 || y == 0 || x == width-1 || y == height-1){\n" \
+"       out[y*width + x] = 0.0f; return; }                              \n" \
+"   switch(dir[y*width + x]){                                           \n" \
+"       case 0: dx = 1; dy = 0; break;                                  \n" \
+"       case 1: dx = 1; dy = 1; break;                                  \n" \
+"       case 2: dx = 0; dy = 1; break;                                  \n" \
+"       default: dx = 1; dy = -1; break; }                              \n" \
+"   float m = mag[y*width + x];                                         \n" \
+"   float m1 = mag[(y-dy)*width + x-dx];                                \n" \
+"   float m2 = mag[(y+dy)*width + x+dx];                                \n" \
+"   out[y*width + x] = (m >= m1 && m > m2) ? m : 0.0f;                  \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// 2 strong, 1 weak, 0 no edge ; thresh is { low, high }, written by  \n" \
+"// the host or chosen on the device                                    \n" \
+"__kernel void hyst_init(__global const float* in, __global uchar* edge,\n" \
+"   __global const float* thresh, const int width, const int height)    \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   float m = in[y*width + x];                                          \n" \
+"   edge[y*width + x] = m >= thresh[1] ? 2 : (m >= thresh[0] ? 1 : 0);  \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// a weak pixel touching a strong one becomes strong ; the updates only\n" \
+"// go one way, so the races between work-items do not change the result\n" \
+"__kernel void hyst_grow(__global uchar* edge, __global int* changed,   \n" \
+"   const int width, const int height)                                  \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i, j;                                                           \n" \
+"   if(x >= width || y >= height || edge[y*width + x] != 1) return;     \n" \
+"   for(j = -1; j <= 1; j++)                                            \n" \
+"       for(i = -1; i <= 1; i++)                                        \n" \
+"           if(PIX(edge, x+i, y+j) == 2){                               \n" \
+"               edge[y*width + x] = 2;                                  \n" \
+"               *changed = 1;                                           \n" \
+"               return; }                                               \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void hyst_final(__global const uchar* edge, __global uchar* out,\n" \
+"   const int width, const int height)                                  \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   out[y*width + x] = edge[y*width + x] == 2 ? 255 : 0;                \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// tiles of the finer level width x height, tile x tile pixels, with an \n" \
+"// edge candidate (strong or weak) of the coarser level within margin  \n" \
+"// coarse pixels, or with detail the coarser level lost : a Laplacian  \n" \
+"// band of lap_min or more                                             \n" \
+"__kernel void roi_tiles(__global const uchar* coarse, __global const float* lap,\n" \
+"   __global uchar* active, const float lap_min, const int tile,        \n" \
+"   const int margin, const int tiles_x, const int tiles_y,             \n" \
+"   const int width, const int height)                                  \n" \
+"{                                                                      \n" \
+"   int tx = get_global_id(0), ty = get_global_id(1);                   \n" \
+"   int cw = (width + 1)/2, ch = (height + 1)/2;                        \n" \
+"   int x, y, found = 0;                                                \n" \
+"   if(tx >= tiles_x || ty >= tiles_y) return;                          \n" \
+"   int x0 = max(tx*tile/2 - margin, 0), x1 = min((tx+1)*tile/2 + margin, cw);\n" \
+"   int y0 = max(ty*tile/2 - margin, 0), y1 = min((ty+1)*tile/2 + margin, ch);\n" \
+"   for(y = y0; y < y1 && !found; y++)                                  \n" \
+"       for(x = x0; x < x1 && !found; x++)                              \n" \
+"           found = coarse[y*cw + x] != 0;                              \n" \
+"   x1 = min((tx+1)*tile, width);                                       \n" \
+"   y1 = min((ty+1)*tile, height);                                      \n" \
+"   for(y = ty*tile; y < y1 && !found; y++)                             \n" \
+"       for(x = tx*tile; x < x1 && !found; x++)                         \n" \
+"           found = fabs(lap[y*width + x]) >= lap_min;                  \n" \
+"   active[ty*tiles_x + tx] = found;                                    \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"#ifdef IMAGES                                                          \n" \
+"__constant sampler_t CLAMP = CLK_NORMALIZED_COORDS_FALSE               \n" \
+"   | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;                   \n" \
+"                                                                       \n" \
+"// gray to the buffer, for the stages that read buffers, and to the image\n" \
+"__kernel void gray_image(__global const uint* rgb, __global float* out,\n" \
+"   __write_only image2d_t out_image, const int width, const int height)\n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   if(x >= width || y >= height) return;                               \n" \
+"   uint p = rgb[y*width + x];                                          \n" \
+"   float g = 0.299f*((p >> 16) & 0xff)                                 \n" \
+"       + 0.587f*((p >> 8) & 0xff) + 0.114f*(p & 0xff);                 \n" \
+"   out[y*width + x] = g;                                               \n" \
+"   write_imagef(out_image, (int2)(x, y), (float4)(g, 0.0f, 0.0f, 1.0f));\n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"// sobel with the clamping done by the sampler                         \n" \
+"__kernel void sobel_image(__read_only image2d_t in, __global float* mag,\n" \
+"   __global uchar* dir, const int width, const int height,             \n" \
+"   __global const uchar* active)                                       \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i, j;                                                           \n" \
+"   float n[9];                                                         \n" \
+"   if(SKIP(active) || x >= width || y >= height) return;               \n" \
+"   for(j = 0; j < 3; j++)                                              \n" \
+"       for(i = 0; i < 3; i++)                                          \n" \
+"           n[j*3 + i] = read_imagef(in, CLAMP, (int2)(x+i-1, y+j-1)).x;\n" \
+"   gradient(n, mag, dir, y*width + x);                                 \n" \
+"}                                                                      \n" \
+"#endif                                                                 \n" \
+"                                                                       \n" \
+"// the active tiles and their 8 neighbours                             \n" \
+"__kernel void roi_dilate(__global const uchar* in, __global uchar* out,\n" \
+"   const int tiles_x, const int tiles_y)                               \n" \
+"{                                                                      \n" \
+"   int x = get_global_id(0), y = get_global_id(1);                     \n" \
+"   int i, j, found = 0;                                                \n" \
+"   if(x >= tiles_x || y >= tiles_y) return;                            \n" \
+"   for(j = max(y-1, 0); j <= min(y+1, tiles_y-1); j++)                 \n" \
+"       for(i = max(x-1, 0); i <= min(x+1, tiles_x-1); i++)             \n" \
+"           found |= in[j*tiles_x + i];                                 \n" \
+"   out[y*tiles_x + x] = found != 0;                                    \n" \
+"}                                                                      \n" \
+"\n";
+
+//------------------------------------------------------------------------------
+//
+// Pixels packed as 0xRRGGBB, first row at the top, to a 24 bit BMP file
+//
+
+int saveImage(const char* name, int width, int height, const unsigned int* data)
+{
+    bmImage img;
+    if (bmCreate(img, name, width, height, 24))
+        return 1;
+    bmWriteBand(img, 0, height, data);
+    bmClose(img);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//
+// Gaussian weights, (2 radius + 1)^2 outer product of the normalised 1-D kernel
+//
+
+int gaussWeights(float sigma, std::vector<float>& weights)
+{
+    int radius = (int)ceil(2.5f * sigma);
+    int i, j, side;
+    std::vector<float> w1;
+    float sum = 0.0f;
+
+    if (radius < 1)
+        radius = 1;
+    if (radius > MAX_RADIUS)
+        radius = MAX_RADIUS;
+    side = 2 * radius + 1;
+    w1.resize(side);
+    for (i = 0; i < side; i++) {
+        w1[i] = expf(-(float)((i - radius) * (i - radius)) / (2.0f * sigma * sigma));
+        sum += w1[i];
+    }
+    weights.resize(side * side);
+    for (j = 0; j < side; j++)
+        for (i = 0; i < side; i++)
+            weights[j * side + i] = (w1[j] / sum) * (w1[i] / sum);
+    return radius;
+}
+
+//------------------------------------------------------------------------------
+//
+// Device pipeline
+//
+
+struct Pipeline {
+    cl_context context;
+    cl_device_id device;
+    cl_command_queue commands;
+    cl_program program;
+    cl_kernel k_gray, k_sobel, k_nms, k_hyst_init, k_hyst_grow, k_hyst_final;
+    cl_kernel k_gray_image, k_sobel_image;  // NULL without image support
+    Pipeline* base;             // owner of the kernels and the blur when shared, see pipeShare
+
+    int width, height;
+    float sigma;                // of the blur weights
+    cvConv conv;                // Gaussian blur, separable
+    lbLabeler lb;               // components and contours of the edge map
+    cl_mem rgb;                 // input, packed 0xRRGGBB
+    cl_mem gray, blur, mag, thin;
+    cl_mem dir, edge, out;      // uchar images, out is the 0 / 255 edge map
+    cl_mem changed;
+    cl_mem thresh;                      // { low, high } of the hysteresis
+    int auto_method;                    // HG_OTSU or HG_PERCENTILE of the nms candidates, -1 for fixed
+    float auto_param;                   // the percentile
+    hgHistogram hist;
+    int morph_op;                       // MO_ERODE... on the edge map, -1 for none
+    int morph_radius;
+    moMorph morph;
+    int distance;                       // distance map of the edges to dist
+    dtTransform dt;
+    cl_mem dist;                        // float, allocated by the first distance stage
+    cl_mem roi, roi_sobel, roi_blur;    // tile masks of nms, sobel and blur, NULL for the whole image
+    int images;                         // blur and Sobel read image objects, set before pipeAlloc
+    cl_mem gray_img, blur_img;
+
+    double stage_ms[ST_COUNT];
+    int hyst_steps;
+};
+
+static cl_kernel createKernel(cl_program program, const char* name)
+{
+    int err;
+    cl_kernel kernel = clCreateKernel(program, name, &err);
+    if (!kernel || err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create compute kernel %s!\n", name);
+        exit(1);
+    }
+    return kernel;
+}
+
+// no images nor stages set up yet
+static void pipeClear(Pipeline& p)
+{
+    p.width = p.height = 0;
+    p.images = 0;
+    p.gray_img = p.blur_img = NULL;
+    p.thresh = NULL;
+    p.auto_method = -1;
+    p.auto_param = 0.0f;
+    p.hist.program = NULL;      // set up by the first automatic threshold
+    p.morph_op = -1;
+    p.morph_radius = 0;
+    p.morph.program = NULL;     // set up by the first morphology stage
+    p.distance = 0;
+    p.dt.program = NULL;        // set up by the first distance stage
+    p.dist = NULL;
+    p.sigma = 0.0f;
+    p.rgb = p.gray = p.blur = p.mag = p.thin = p.dir = p.edge = p.out = p.changed = NULL;
+    p.roi = p.roi_sobel = p.roi_blur = NULL;
+    p.lb.program = NULL;        // set up by the first runContours
+}
+
+void pipeInit(Pipeline& p, cl_context context, cl_device_id device, cl_command_queue commands, cl_program program)
+{
+    p.context = context;
+    p.device = device;
+    p.commands = commands;
+    p.program = program;
+    p.k_gray = createKernel(program, "gray");
+    p.k_sobel = createKernel(program, "sobel");
+    p.k_nms = createKernel(program, "nms");
+    p.k_hyst_init = createKernel(program, "hyst_init");
+    p.k_hyst_grow = createKernel(program, "hyst_grow");
+    p.k_hyst_final = createKernel(program, "hyst_final");
+    p.base = NULL;
+    pipeClear(p);
+    cvInit(p.conv, context, device);
+    p.k_gray_image = p.k_sobel_image = NULL;
+    if (p.conv.images)
+    {
+        // the program is built with -DIMAGES on such devices
+        p.k_gray_image = createKernel(program, "gray_image");
+        p.k_sobel_image = createKernel(program, "sobel_image");
+    }
+}
+
+// q with the program, kernels and blur of p, whose weights it keeps, for
+// images of other sizes ; the kernel arguments are set at each run, so both
+// can run one after the other. q is released before p.
+static void pipeShare(Pipeline& q, Pipeline& p)
+{
+    q.context = p.context;
+    q.device = p.device;
+    q.commands = p.commands;
+    q.program = p.program;
+    q.k_gray = p.k_gray;
+    q.k_sobel = p.k_sobel;
+    q.k_nms = p.k_nms;
+    q.k_hyst_init = p.k_hyst_init;
+    q.k_hyst_grow = p.k_hyst_grow;
+    q.k_hyst_final = p.k_hyst_final;
+    q.k_gray_image = p.k_gray_image;
+    q.k_sobel_image = p.k_sobel_image;
+    q.base = &p;
+    pipeClear(q);
+    q.images = p.images;
+    q.sigma = p.sigma;
+}
+
+static void releaseImages(Pipeline& p)
+{
+    cl_mem* mems[] = { &p.rgb, &p.gray, &p.blur, &p.mag, &p.thin, &p.dir, &p.edge, &p.out,
+        &p.roi, &p.roi_sobel, &p.roi_blur, &p.gray_img, &p.blur_img, &p.dist };
+    size_t i;
+    for (i = 0; i < sizeof(mems) / sizeof(mems[0]); i++) {
+        if (*mems[i])
+            clReleaseMemObject(*mems[i]);
+        *mems[i] = NULL;
+    }
+}
+
+// images for width x height, kept while the size does not change
+int pipeAlloc(Pipeline& p, int width, int height, float sigma)
+{
+    std::vector<float> weights;
+    size_t npix = (size_t)width * height;
+    int err;
+
+    if (p.width != width || p.height != height)
+    {
+        releaseImages(p);
+        p.rgb = clCreateBuffer(p.context, CL_MEM_READ_ONLY, sizeof(cl_uint) * npix, NULL, &err);
+        p.gray = clCreateBuffer(p.context, CL_MEM_READ_WRITE, sizeof(cl_float) * npix, NULL, &err);
+        p.blur = clCreateBuffer(p.context, CL_MEM_READ_WRITE, sizeof(cl_float) * npix, NULL, &err);
+        p.mag = clCreateBuffer(p.context, CL_MEM_READ_WRITE, sizeof(cl_float) * npix, NULL, &err);
+        p.thin = clCreateBuffer(p.context, CL_MEM_READ_WRITE, sizeof(cl_float) * npix, NULL, &err);
+        p.dir = clCreateBuffer(p.context, CL_MEM_READ_WRITE, npix, NULL, &err);
+        p.edge = clCreateBuffer(p.context, CL_MEM_READ_WRITE, npix, NULL, &err);
+        p.out = clCreateBuffer(p.context, CL_MEM_READ_WRITE, npix, NULL, &err);
+        if (!p.rgb || !p.gray || !p.blur || !p.mag || !p.thin || !p.dir || !p.edge || !p.out)
+        {
+            printf("Error: Failed to allocate device memory!\n");
+            return 1;
+        }
+        p.width = width;
+        p.height = height;
+    }
+    if (p.images && !p.gray_img)
+    {
+        p.gray_img = cvImage2D(p.context, width, height, CL_MEM_READ_WRITE, &err);
+        p.blur_img = cvImage2D(p.context, width, height, CL_MEM_READ_WRITE, &err);
+        if (!p.gray_img || !p.blur_img)
+        {
+            printf("Error: Failed to allocate the images! %d\n", err);
+            return 1;
+        }
+    }
+    if (!p.changed)
+        p.changed = clCreateBuffer(p.context, CL_MEM_READ_WRITE, sizeof(cl_int), NULL, &err);
+    if (!p.thresh)
+        p.thresh = clCreateBuffer(p.context, CL_MEM_READ_WRITE, 2 * sizeof(cl_float), NULL, &err);
+
+    if (!p.changed || !p.thresh)
+    {
+        printf("Error: Failed to allocate device memory!\n");
+        return 1;
+    }
+
+    if (!p.base && p.sigma != sigma)
+    {
+        int radius = gaussWeights(sigma, weights);
+        err = cvSetWeights(p.conv, &weights[0], radius);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to set the blur weights! %d\n", err);
+            return 1;
+        }
+        p.sigma = sigma;
+    }
+    return 0;
+}
+
+void pipeRelease(Pipeline& p)
+{
+    releaseImages(p);
+    if (p.lb.program)
+        lbRelease(p.lb);
+    if (p.changed)
+        clReleaseMemObject(p.changed);
+    if (p.thresh)
+        clReleaseMemObject(p.thresh);
+    if (p.hist.program)
+        hgRelease(p.hist);
+    if (p.morph.program)
+        moRelease(p.morph);
+    if (p.dt.program)
+        dtRelease(p.dt);
+    if (p.base)
+        return;
+    cvRelease(p.conv);
+    clReleaseKernel(p.k_gray);
+    clReleaseKernel(p.k_sobel);
+    clReleaseKernel(p.k_nms);
+    clReleaseKernel(p.k_hyst_init);
+    clReleaseKernel(p.k_hyst_grow);
+    clReleaseKernel(p.k_hyst_final);
+    if (p.k_gray_image)
+    {
+        clReleaseKernel(p.k_gray_image);
+        clReleaseKernel(p.k_sobel_image);
+    }
+}
+
+struct StageEvent {
+    int stage;
+    cl_event event;
+};
+
+static void enqueue2D(Pipeline& p, cl_kernel kernel, int stage, std::vector<StageEvent>& events)
+{
+    size_t local[2] = { LOCAL_SIDE, LOCAL_SIDE };
+    size_t global[2] = {
+        ((size_t)p.width + LOCAL_SIDE - 1) / LOCAL_SIDE * LOCAL_SIDE,
+        ((size_t)p.height + LOCAL_SIDE - 1) / LOCAL_SIDE * LOCAL_SIDE };
+    StageEvent se;
+    int err;
+
+    se.stage = stage;
+    err = clEnqueueNDRangeKernel(p.commands, kernel, 2, NULL, global, local, 0, NULL, &se.event);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to execute kernel of stage %s! %d\n", StageName[stage], err);
+        exit(1);
+    }
+    events.push_back(se);
+}
+
+// kernel time of the events by stage into p.stage_ms, releases the events
+void stageTimes(Pipeline& p, std::vector<StageEvent>& events)
+{
+    size_t i;
+    for (i = 0; i < ST_COUNT; i++)
+        p.stage_ms[i] = 0.0;
+    for (i = 0; i < events.size(); i++) {
+        cl_ulong ev_start_time = (cl_ulong)0;
+        cl_ulong ev_end_time = (cl_ulong)0;
+        clGetEventProfilingInfo(events[i].event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+        clGetEventProfilingInfo(events[i].event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+        p.stage_ms[events[i].stage] += (double)(ev_end_time - ev_start_time) * 1.0e-6;
+        clReleaseEvent(events[i].event);
+    }
+    events.clear();
+}
+
+// p.rgb to p.gray, and to p.gray_img with images
+int pipeGray(Pipeline& p, std::vector<StageEvent>& events)
+{
+    cl_kernel kernel = p.images ? p.k_gray_image : p.k_gray;
+    int err, arg = 0;
+
+    err = clSetKernelArg(kernel, arg++, sizeof(cl_mem), &p.rgb);
+    err |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &p.gray);
+    if (p.images)
+        err |= clSetKernelArg(kernel, arg++, sizeof(cl_mem), &p.gray_img);
+    err |= clSetKernelArg(kernel, arg++, sizeof(int), &p.width);
+    err |= clSetKernelArg(kernel, arg++, sizeof(int), &p.height);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to set kernel arguments! %d\n", err);
+        return 1;
+    }
+    enqueue2D(p, kernel, ST_GRAY, events);
+    return 0;
+}
+
+// sobel or sobel_image from in to p.mag and p.dir
+static int setSobel(Pipeline& p, cl_kernel kernel, cl_mem in, cl_mem active)
+{
+    int err;
+
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &in);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &p.mag);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &p.dir);
+    err |= clSetKernelArg(kernel, 3, sizeof(int), &p.width);
+    err |= clSetKernelArg(kernel, 4, sizeof(int), &p.height);
+    err |= clSetKernelArg(kernel, 5, sizeof(cl_mem), active ? &active : NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to set kernel arguments! %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+// p.gray to p.mag and p.dir : blur and Sobel, on the tiles of the masks if set,
+// through p.gray_img and p.blur_img with images
+int pipeGradient(Pipeline& p, std::vector<StageEvent>& events)
+{
+    std::vector<cl_event> blur_events;
+    cvConv& conv = p.base ? p.base->conv : p.conv;
+    cl_kernel sobel = p.images ? p.k_sobel_image : p.k_sobel;
+    int err;
+    size_t i;
+
+    if (setSobel(p, sobel, p.images ? p.blur_img : p.blur, p.roi_sobel))
+        return 1;
+    if (p.images)
+        err = cvRunImage(conv, p.commands, p.gray_img, p.blur_img, p.width, p.height, p.roi_blur, &blur_events);
+    else
+        err = cvRun(conv, p.commands, CV_AUTO, p.gray, p.blur, p.width, p.height, p.roi_blur, &blur_events);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to execute the blur! %d\n", err);
+        return 1;
+    }
+    for (i = 0; i < blur_events.size(); i++) {
+        StageEvent se = { ST_BLUR, blur_events[i] };
+        events.push_back(se);
+    }
+    enqueue2D(p, sobel, ST_SOBEL, events);
+    return 0;
+}
+
+// p.thresh from the histogram of the nms candidates (non zero p.thin)
+static int pipeThresholds(Pipeline& p, std::vector<StageEvent>& events)
+{
+    std::vector<cl_event> hist_events;
+    size_t i;
+    int err;
+
+    if (!p.hist.program && hgInit(p.hist, p.context, p.device) != CL_SUCCESS)
+    {
+        printf("Error: Failed to set up the histogram!\n");
+        exit(1);
+    }
+    err = hgCount(p.hist, p.commands, p.thin, (size_t)p.width * p.height, 1, MAG_MAX, &hist_events);
+    if (err == CL_SUCCESS)
+        err = hgThreshold(p.hist, p.commands, p.auto_method, p.auto_param, MAG_MAX, AUTO_LOW_RATIO, p.thresh, &hist_events);
+    for (i = 0; i < hist_events.size(); i++) {
+        StageEvent se = { ST_THRESH, hist_events[i] };
+        events.push_back(se);
+    }
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to select the thresholds! %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+// p.morph_op of p.out, in place
+static int pipeMorph(Pipeline& p, std::vector<StageEvent>& events)
+{
+    std::vector<cl_event> morph_events;
+    size_t i;
+    int err;
+
+    if (!p.morph.program && moInit(p.morph, p.context, p.device) != CL_SUCCESS)
+    {
+        printf("Error: Failed to set up the morphology!\n");
+        exit(1);
+    }
+    err = moRun(p.morph, p.commands, p.morph_op, p.out, p.out, p.width, p.height,
+        p.morph_radius, p.morph_radius, &morph_events);
+    for (i = 0; i < morph_events.size(); i++) {
+        StageEvent se = { ST_MORPH, morph_events[i] };
+        events.push_back(se);
+    }
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to run the morphology! %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+// p.dist, distance of every pixel to the nearest edge of p.out
+static int pipeDistance(Pipeline& p, std::vector<StageEvent>& events)
+{
+    std::vector<cl_event> dist_events;
+    size_t i;
+    int err = CL_SUCCESS;
+
+    if (!p.dt.program && dtInit(p.dt, p.context, p.device) != CL_SUCCESS)
+    {
+        printf("Error: Failed to set up the distance transform!\n");
+        exit(1);
+    }
+    if (!p.dist)
+        p.dist = clCreateBuffer(p.context, CL_MEM_READ_WRITE, sizeof(cl_float) * p.width * p.height, NULL, &err);
+    if (p.dist)
+        err = dtRun(p.dt, p.commands, p.out, p.dist, p.width, p.height, &dist_events);
+    for (i = 0; i < dist_events.size(); i++) {
+        StageEvent se = { ST_DIST, dist_events[i] };
+        events.push_back(se);
+    }
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to run the distance transform! %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+// p.gray to p.out, the events of the earlier stages already in events ; low
+// and high unless p.auto_method is set
+int pipeCanny(Pipeline& p, float low, float high, std::vector<StageEvent>& events)
+{
+    const float thresh[2] = { low, high };
+    const cl_int zero = 0;
+    cl_int changed = 1;
+    int err;
+    size_t i;
+
+    if (pipeGradient(p, events))
+        return 1;
+
+    err = clSetKernelArg(p.k_nms, 0, sizeof(cl_mem), &p.mag);
+    err |= clSetKernelArg(p.k_nms, 1, sizeof(cl_mem), &p.dir);
+    err |= clSetKernelArg(p.k_nms, 2, sizeof(cl_mem), &p.thin);
+    err |= clSetKernelArg(p.k_nms, 3, sizeof(int), &p.width);
+    err |= clSetKernelArg(p.k_nms, 4, sizeof(int), &p.height);
+    err |= clSetKernelArg(p.k_nms, 5, sizeof(cl_mem), p.roi ? &p.roi : NULL);
+
+    err |= clSetKernelArg(p.k_hyst_init, 0, sizeof(cl_mem), &p.thin);
+    err |= clSetKernelArg(p.k_hyst_init, 1, sizeof(cl_mem), &p.edge);
+    err |= clSetKernelArg(p.k_hyst_init, 2, sizeof(cl_mem), &p.thresh);
+    err |= clSetKernelArg(p.k_hyst_init, 3, sizeof(int), &p.width);
+    err |= clSetKernelArg(p.k_hyst_init, 4, sizeof(int), &p.height);
+
+    err |= clSetKernelArg(p.k_hyst_grow, 0, sizeof(cl_mem), &p.edge);
+    err |= clSetKernelArg(p.k_hyst_grow, 1, sizeof(cl_mem), &p.changed);
+    err |= clSetKernelArg(p.k_hyst_grow, 2, sizeof(int), &p.width);
+    err |= clSetKernelArg(p.k_hyst_grow, 3, sizeof(int), &p.height);
+
+    err |= clSetKernelArg(p.k_hyst_final, 0, sizeof(cl_mem), &p.edge);
+    err |= clSetKernelArg(p.k_hyst_final, 1, sizeof(cl_mem), &p.out);
+    err |= clSetKernelArg(p.k_hyst_final, 2, sizeof(int), &p.width);
+    err |= clSetKernelArg(p.k_hyst_final, 3, sizeof(int), &p.height);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to set kernel arguments! %d\n", err);
+        return 1;
+    }
+
+    enqueue2D(p, p.k_nms, ST_NMS, events);
+    if (p.auto_method < 0)
+        err = clEnqueueWriteBuffer(p.commands, p.thresh, CL_FALSE, 0, sizeof(thresh), thresh, 0, NULL, NULL);
+    else if (pipeThresholds(p, events))
+        return 1;
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to write the thresholds! %d\n", err);
+        return 1;
+    }
+    enqueue2D(p, p.k_hyst_init, ST_HYST, events);
+
+    // propagation until a batch changes nothing
+    p.hyst_steps = 0;
+    while (changed)
+    {
+        clEnqueueWriteBuffer(p.commands, p.changed, CL_FALSE, 0, sizeof(cl_int), &zero, 0, NULL, NULL);
+        for (i = 0; i < HYST_BATCH; i++)
+            enqueue2D(p, p.k_hyst_grow, ST_HYST, events);
+        p.hyst_steps += HYST_BATCH;
+        err = clEnqueueReadBuffer(p.commands, p.changed, CL_TRUE, 0, sizeof(cl_int), &changed, 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to read the hysteresis flag! %d\n", err);
+            return 1;
+        }
+    }
+    enqueue2D(p, p.k_hyst_final, ST_HYST, events);
+    if (p.morph_op >= 0 && pipeMorph(p, events))
+        return 1;
+    if (p.distance && pipeDistance(p, events))
+        return 1;
+    clFinish(p.commands);
+
+    stageTimes(p, events);
+    return 0;
+}
+
+// p.rgb to p.out, every stage on the device
+int pipeRun(Pipeline& p, float low, float high)
+{
+    std::vector<StageEvent> events;
+    if (pipeGray(p, events))
+        return 1;
+    return pipeCanny(p, low, high, events);
+}
+
+//------------------------------------------------------------------------------
+//
+// Contours of the edge map : connected components labelled on the device, the
+// outer contour of each traced as a list of points, both checked against the
+// host. With a path, the contours are written one per line, "x,y x,y ...".
+//
+
+static double eventsMs(std::vector<cl_event>& events)
+{
+    double ms = 0.0;
+    size_t i;
+    for (i = 0; i < events.size(); i++) {
+        cl_ulong ev_start_time = (cl_ulong)0;
+        cl_ulong ev_end_time = (cl_ulong)0;
+        clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+        clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+        ms += (double)(ev_end_time - ev_start_time) * 1.0e-6;
+        clReleaseEvent(events[i]);
+    }
+    events.clear();
+    return ms;
+}
+
+// labels and traces mask (uchar on the device), 0 when the host agrees
+int runContours(Pipeline& p, cl_mem mask, const unsigned char* host_mask, int width, int height, const char* path)
+{
+    std::vector<cl_event> events;
+    std::vector<cl_uint> roots, offsets, ref_roots, ref_offsets;
+    std::vector<cl_ushort2> points, ref_points;
+    std::vector<int> labels((size_t)width * height), ref_labels;
+    size_t c, k;
+    int err;
+
+    if (width > 65535 || height > 65535)
+    {
+        printf("Error: Contour points are 16 bit, %d x %d is too large!\n", width, height);
+        return 1;
+    }
+    if ((size_t)width * height > INT_MAX)
+    {
+        printf("Error: Labels are int, %d x %d has too many pixels!\n", width, height);
+        return 1;
+    }
+    if (!p.lb.program && lbInit(p.lb, p.context, p.device) != CL_SUCCESS)
+    {
+        printf("Error: Failed to set up the labelling!\n");
+        exit(1);
+    }
+    err = lbLabel(p.lb, p.commands, mask, width, height, &events);
+    clFinish(p.commands);
+    double label_ms = eventsMs(events);
+    if (err == CL_SUCCESS)
+        err = lbTrace(p.lb, p.commands, &events);
+    clFinish(p.commands);
+    double trace_ms = eventsMs(events);
+    if (err == CL_SUCCESS)
+        err = clEnqueueReadBuffer(p.commands, p.lb.label, CL_TRUE, 0, sizeof(cl_int) * labels.size(), &labels[0], 0, NULL, NULL);
+    if (err == CL_SUCCESS)
+        err = lbRead(p.lb, p.commands, roots, offsets, points);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to extract the contours! %d\n", err);
+        return 1;
+    }
+
+    double rtime = clock();
+    lbReference(host_mask, width, height, ref_labels, ref_roots, ref_offsets, ref_points);
+    rtime = clock() - rtime;
+
+    int same = labels == ref_labels && roots == ref_roots && offsets == ref_offsets && points.size() == ref_points.size();
+    for (k = 0; same && k < points.size(); k++)
+        same = points[k].s[0] == ref_points[k].s[0] && points[k].s[1] == ref_points[k].s[1];
+
+    printf("Contours : %u components, %u points || labelling %.3f ms (%d passes), tracing %.3f ms, cpu %.3f ms\n",
+        p.lb.components, p.lb.points, label_ms, p.lb.passes, trace_ms, rtime * 1000 / CLOCKS_PER_SEC);
+    printf("%.1f Mpixels/s on the device || CPU reference -> %s\n",
+        (double)width * height * 1.0e-3 / (label_ms + trace_ms), same ? "ok" : "MISMATCH");
+
+    if (path)
+    {
+        FILE* f = fopen(path, "w");
+        if (!f)
+        {
+            printf("Error: Failed to open %s!\n", path);
+            return 1;
+        }
+        for (c = 0; c < roots.size(); c++) {
+            for (k = offsets[c]; k < offsets[c + 1]; k++)
+                fprintf(f, k == offsets[c] ? "%u,%u" : " %u,%u", points[k].s[0], points[k].s[1]);
+            fprintf(f, "\n");
+        }
+        fclose(f);
+    }
+    return !same;
+}
+
+// -bench : the same on the edge map repeated to a large image, BENCH_LABEL_SIDE
+// pixels wide at least
+int runLabelBench(Pipeline& p, const std::vector<unsigned char>& edges, int width, int height)
+{
+    int tiles = (BENCH_LABEL_SIDE + width - 1) / width;
+    int x, y, err;
+
+    // contour points are 16 bit
+    while (tiles > 1 && (width * tiles > 65535 || height * tiles > 65535))
+        tiles--;
+    int big_width = width * tiles, big_height = height * tiles;
+    std::vector<unsigned char> big((size_t)big_width * big_height);
+    for (y = 0; y < big_height; y++)
+        for (x = 0; x < big_width; x++)
+            big[(size_t)y * big_width + x] = edges[(size_t)(y % height) * width + x % width];
+    cl_mem mask = clCreateBuffer(p.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, big.size(), &big[0], &err);
+    if (!mask)
+    {
+        printf("Error: Failed to allocate device memory!\n");
+        return 1;
+    }
+    printf("\nLabelling %d x %d (edge map repeated %d x %d)\n", big_width, big_height, tiles, tiles);
+    err = runContours(p, mask, &big[0], big_width, big_height, NULL);
+    clReleaseMemObject(mask);
+    return err;
+}
+
+// -bench : closings of the edge map by squares of growing radius, on the device
+// and with SSE2 on the host ; both should cost the same whatever the radius
+int runMorphBench(Pipeline& p, const std::vector<unsigned char>& edges, int width, int height)
+{
+    std::vector<unsigned char> result(edges.size()), cpu(edges.size()), ref(edges.size());
+    std::vector<cl_event> events;
+    moMorph mo;
+    size_t k;
+    int c, n, err;
+
+    cl_mem in = clCreateBuffer(p.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, edges.size(), (void*)&edges[0], &err);
+    cl_mem out = clCreateBuffer(p.context, CL_MEM_READ_WRITE, edges.size(), NULL, &err);
+    if (!in || !out || moInit(mo, p.context, p.device) != CL_SUCCESS)
+    {
+        printf("Error: Failed to set up the morphology!\n");
+        return 1;
+    }
+
+    printf("\n%-10s %6s %12s %12s %10s %10s\n", "close", "radius", "device ms", "sse2 ms", "differ", "reference");
+    for (c = 0; c < BENCH_MORPH_RADII; c++) {
+        int radius = 1 << c;
+        double device_ms = 0.0;
+        for (n = 0; n <= BENCH_REPEAT; n++) {
+            err = moRun(mo, p.commands, MO_CLOSE, in, out, width, height, radius, radius, &events);
+            clFinish(p.commands);
+            double ms = eventsMs(events);
+            if (err != CL_SUCCESS)
+                break;
+            if (n == 1 || (n > 1 && ms < device_ms))
+                device_ms = ms;
+        }
+        if (err == CL_SUCCESS)
+            err = clEnqueueReadBuffer(p.commands, out, CL_TRUE, 0, result.size(), &result[0], 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to run the morphology! %d\n", err);
+            break;
+        }
+
+        double t = clock();
+        moCPU(&edges[0], &cpu[0], width, height, MO_CLOSE, radius, radius);
+        double cpu_ms = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
+
+        size_t differ = 0, ref_differ = 0;
+        for (k = 0; k < edges.size(); k++)
+            if (result[k] != cpu[k])
+                differ++;
+        if (radius <= BENCH_MORPH_CHECK)
+        {
+            moReference(&edges[0], &ref[0], width, height, MO_CLOSE, radius, radius);
+            for (k = 0; k < edges.size(); k++)
+                if (cpu[k] != ref[k])
+                    ref_differ++;
+        }
+        printf("%-10s %6d %12.3f %12.3f %10lu %10s\n", "square", radius, device_ms, cpu_ms, (unsigned long)differ,
+            radius > BENCH_MORPH_CHECK ? "-" : (ref_differ ? "MISMATCH" : "ok"));
+        if (differ || ref_differ)
+            err = 1;
+    }
+
+    moRelease(mo);
+    clReleaseMemObject(in);
+    clReleaseMemObject(out);
+    return err != CL_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//
+// -stream : gradient magnitude of a BMP file of any size, by bands of rows
+// read from and written to the mapped files ; each band carries radius + 1
+// rows of halo, so the result is the one of the whole image
+//
+
+struct StreamState {
+    Pipeline* pipe;
+    std::vector<float> mag;
+    double device_ms;
+    int bands;
+};
+
+static int gradientBand(void* user, const unsigned int* in, int in_y0, int in_rows,
+    unsigned int* out, int y0, int rows, int width)
+{
+    StreamState* st = (StreamState*)user;
+    Pipeline& p = *st->pipe;
+    std::vector<StageEvent> events;
+    size_t k, npix = (size_t)width * rows;
+    int err, i;
+
+    if (pipeAlloc(p, width, in_rows, p.sigma))
+        return 1;
+    err = clEnqueueWriteBuffer(p.commands, p.rgb, CL_FALSE, 0, sizeof(cl_uint) * width * in_rows, in, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to write band %d! %d\n", st->bands, err);
+        return 1;
+    }
+    if (pipeGray(p, events) || pipeGradient(p, events))
+        return 1;
+    st->mag.resize(npix);
+    err = clEnqueueReadBuffer(p.commands, p.mag, CL_TRUE, sizeof(cl_float) * width * (y0 - in_y0),
+        sizeof(cl_float) * npix, &st->mag[0], 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to read band %d! %d\n", st->bands, err);
+        return 1;
+    }
+    stageTimes(p, events);
+    for (i = ST_GRAY; i <= ST_SOBEL; i++)
+        st->device_ms += p.stage_ms[i];
+
+    for (k = 0; k < npix; k++) {
+        float m = st->mag[k];
+        out[k] = (m >= 255.0f ? 255u : (unsigned int)(m + 0.5f)) * 0x010101u;
+    }
+    st->bands++;
+    return 0;
+}
+
+int runStream(Pipeline& p, const char* in_path, const char* out_path, int band_rows, float sigma)
+{
+    bmImage in, out;
+    StreamState st;
+    int err;
+
+    if (bmOpen(in, in_path))
+        return 1;
+    if (bmCreate(out, out_path, in.width, in.height, 24))
+    {
+        bmClose(in);
+        return 1;
+    }
+    if (pipeAlloc(p, in.width, band_rows < in.height ? band_rows : in.height, sigma))
+        return 1;
+    int halo = p.conv.radius + 1;
+
+    st.pipe = &p;
+    st.device_ms = 0.0;
+    st.bands = 0;
+    double rtime = clock();
+    err = bmStream(in, out, band_rows, halo, gradientBand, &st);
+    rtime = clock() - rtime;
+
+    printf("Stream : %d x %d, %d bands of %d rows + %d rows of halo -> %s\n",
+        in.width, in.height, st.bands, band_rows, halo, out_path);
+    printf("Device %.3f ms || host %.3f ms || %.1f Mpixels/s\n",
+        st.device_ms, rtime * 1000 / CLOCKS_PER_SEC, (double)in.width * in.height * 1.0e-3 / (rtime * 1000 / CLOCKS_PER_SEC));
+    bmClose(out);
+    bmClose(in);
+    return err;
+}
+
+//------------------------------------------------------------------------------
+//
+// -batch : edge maps of every BMP file of a directory (or of a list file, one
+// path per line) with one context and program. Decoder threads, the device
+// thread (upload, pipeline, read back) and encoder threads are chained by
+// bounded queues, so loading and saving overlap the device work. The device
+// thread has two slots of input and output buffers and a second queue for the
+// transfers : the next image uploads and the previous edges read back while
+// the pipeline runs on the current one.
+//
+
+struct BatchJob {
+    std::string path;
+    int width, height;
+    std::vector<unsigned int> image;        // input, then the edge map as gray
+    std::vector<unsigned char> edges;
+};
+
+struct BatchState {
+    std::vector<std::string> paths;
+    std::string out_dir;
+    std::atomic<size_t> next;               // next path to decode
+    std::atomic<int> failed;
+    wqQueue<BatchJob*> decoded, computed;
+    std::vector<double> decode_busy, encode_busy;
+};
+
+static double nowMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void decodeWorker(BatchState* st, int id)
+{
+    size_t k;
+    while ((k = st->next++) < st->paths.size()) {
+        double t = nowMs();
+        bmImage img;
+        if (bmOpen(img, st->paths[k].c_str()))
+        {
+            st->failed++;
+            continue;
+        }
+        BatchJob* job = new BatchJob;
+        job->path = st->paths[k];
+        job->width = img.width;
+        job->height = img.height;
+        job->image.resize((size_t)img.width * img.height);
+        bmReadBand(img, 0, img.height, &job->image[0]);
+        bmClose(img);
+        st->decode_busy[id] += nowMs() - t;
+        wqPush(st->decoded, job);
+    }
+    wqDone(st->decoded);
+}
+
+static void encodeWorker(BatchState* st, int id)
+{
+    BatchJob* job;
+    while (wqPop(st->computed, job)) {
+        double t = nowMs();
+        std::filesystem::path out = std::filesystem::path(st->out_dir) /
+            (std::filesystem::path(job->path).stem().string() + "_edges.bmp");
+        for (size_t k = 0; k < job->edges.size(); k++)
+            job->image[k] = job->edges[k] * 0x010101u;
+        if (saveImage(out.string().c_str(), job->width, job->height, &job->image[0]))
+            st->failed++;
+        delete job;
+        st->encode_busy[id] += nowMs() - t;
+    }
+}
+
+// buffers of every other image on the device : rgb is uploaded for the next
+// image while out still reads back the edges of the previous one
+struct BatchSlot {
+    BatchJob* next;                         // uploaded, not run yet
+    BatchJob* ran;                          // run, its edges read back
+    cl_mem rgb, out;
+    size_t rgb_npix, out_npix;              // capacities
+    cl_event uploaded, read;                // on the transfer queue
+};
+
+// buf reallocated with size bytes when its capacity cap, in pixels, is under npix
+static int batchBuffer(cl_context context, cl_mem& buf, size_t& cap, size_t npix, size_t size, cl_mem_flags flags)
+{
+    int err = CL_SUCCESS;
+
+    if (npix <= cap)
+        return CL_SUCCESS;
+    if (buf)
+        clReleaseMemObject(buf);
+    buf = clCreateBuffer(context, flags, size, NULL, &err);
+    cap = buf ? npix : 0;
+    return buf ? CL_SUCCESS : err;
+}
+
+// the next decoded image uploaded into s.rgb, 0 when there is none left
+static int batchUpload(BatchState* st, Pipeline& p, cl_command_queue transfers, BatchSlot& s, double& busy)
+{
+    BatchJob* job;
+    while (wqPop(st->decoded, job)) {
+        double t = nowMs();
+        size_t npix = (size_t)job->width * job->height;
+        int err = batchBuffer(p.context, s.rgb, s.rgb_npix, npix, sizeof(cl_uint) * npix, CL_MEM_READ_ONLY);
+        if (err == CL_SUCCESS)
+            err = clEnqueueWriteBuffer(transfers, s.rgb, CL_FALSE, 0, sizeof(cl_uint) * npix, &job->image[0], 0, NULL, &s.uploaded);
+        busy += nowMs() - t;
+        if (err == CL_SUCCESS)
+        {
+            s.next = job;
+            return 1;
+        }
+        printf("Error: Failed to upload %s! %d\n", job->path.c_str(), err);
+        st->failed++;
+        delete job;
+    }
+    return 0;
+}
+
+// the edges of s.ran on to the encoders once read back
+static void batchFinish(BatchState* st, BatchSlot& s)
+{
+    if (!s.ran)
+        return;
+    if (clWaitForEvents(1, &s.read) == CL_SUCCESS)
+        wqPush(st->computed, s.ran);
+    else
+    {
+        printf("Error: Failed to read back %s!\n", s.ran->path.c_str());
+        st->failed++;
+        delete s.ran;
+    }
+    clReleaseEvent(s.read);
+    s.ran = NULL;
+    s.read = NULL;
+}
+
+// BMP files of a directory, sorted, or the lines of a list file
+static int batchPaths(const char* source, std::vector<std::string>& paths)
+{
+    std::error_code ec;
+    if (std::filesystem::is_directory(source, ec))
+    {
+        for (const auto& entry : std::filesystem::directory_iterator(source, ec)) {
+            std::string ext = entry.path().extension().string();
+            for (size_t k = 0; k < ext.size(); k++)
+                ext[k] = (char)tolower((unsigned char)ext[k]);
+            if (entry.is_regular_file(ec) && ext == ".bmp")
+                paths.push_back(entry.path().string());
+        }
+        std::sort(paths.begin(), paths.end());
+        return 0;
+    }
+    FILE* f = fopen(source, "r");
+    char line[4096];
+    if (!f)
+    {
+        printf("Error: Failed to open %s!\n", source);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        size_t n = strlen(line);
+        while (n && (line[n - 1] == '\n' || line[n - 1] == '\r' || line[n - 1] == ' '))
+            line[--n] = 0;
+        if (n)
+            paths.push_back(line);
+    }
+    fclose(f);
+    return 0;
+}
 
-const char* KernelSource =                                             "\n" \
-"__kernel void mandel(                                                    \n" \
-"   const double x0,                                                    \n" \
-"   const double y0,                                                    \n" \
-"   const double stepsize,                                                    \n" \
-"   const unsigned int maxIter,                                         \n" \
-"   __global unsigned int *restrict framebuffer,                        \n" \
-"   const unsigned int windowWidth                                      \n" \
-"   )                                                                   \n" \
-"{// WORK ITEM POSITION                                                                      \n" \
-"   const size_t windowPosX = get_global_id(0);                                          \n" \
-"   const size_t windowPosY = get_global_id(1);                                            \n" \
-"   const double stepPosX = x0 + (windowPosX * stepsize);                                           \n" \
-"   const double stepPosY = y0 - (windowPosY * stepsize);                                           \n" \
-"                                              \n" \
-"   double x = 0.0;                                          \n" \
-"   double y = 0.0;                                      \n" \
-"   double x2 = 0.0;                                        \n" \
-"   double y2 = 0.0;                                        \n" \
-"   unsigned int i = 0;                                           \n" \
-"                                              \n" \
-"   while(x2 + y2 < 4.0 && i < maxIter){                                           \n" \
-"        x2 = x*x;                                      \n" \
-"        y2 = y*y;                                      \n" \
-"        y = 2*x*y + stepPosY;                                      \n" \
-"        x = x2 - y2 + stepPosX;                                      \n" \
-"        i++;                          }            \n" \
-"                    \n" \
-"   framebuffer[windowWidth * windowPosY + windowPosX] = i%16;                                           \n" \
-"}                                                                      \n" \
-"\n";
+int runBatch(Pipeline& p, const char* source, const char* out_dir, int threads, float sigma, float low, float high)
+{
+    BatchState st;
+    BatchSlot slots[2] = {};
+    std::vector<std::thread> decoders, encoders;
+    std::error_code ec;
+    cl_command_queue transfers;
+    double device_busy = 0.0, kernel_ms = 0.0;
+    size_t done = 0;
+    int i, cur = 0, err;
 
+    if (batchPaths(source, st.paths))
+        return 1;
+    if (st.paths.empty())
+    {
+        printf("Error: No BMP file in %s!\n", source);
+        return 1;
+    }
+    transfers = clCreateCommandQueue(p.context, p.device, 0, &err);
+    if (!transfers)
+    {
+        printf("Error: Failed to create the transfer queue! %d\n", err);
+        return 1;
+    }
+    std::filesystem::create_directories(out_dir, ec);
+    st.out_dir = out_dir;
+    st.next = 0;
+    st.failed = 0;
+    st.decode_busy.assign(threads, 0.0);
+    st.encode_busy.assign(threads, 0.0);
+    wqInit(st.decoded, BATCH_QUEUE, threads);
+    wqInit(st.computed, BATCH_QUEUE, 1);
 
+    double start = nowMs();
+    for (i = 0; i < threads; i++) {
+        decoders.push_back(std::thread(decodeWorker, &st, i));
+        encoders.push_back(std::thread(encodeWorker, &st, i));
+    }
 
+    // this thread drives the device : the image of slots[cur] runs while the
+    // next one uploads to the other slot, whose edges are still read back
+    batchUpload(&st, p, transfers, slots[cur], device_busy);
+    while (slots[cur].next) {
+        BatchSlot& s = slots[cur];
+        BatchJob* job = s.next;
+        size_t npix = (size_t)job->width * job->height;
 
-void saveBMP(const char* name, int width, int height, unsigned int* data, int maxIter) {
-    FILE* f;
-    
-    unsigned int headers[13];
-    int extrabytes = 4 - ((width*3)%4);
-    if (extrabytes == 4)
-        extrabytes = 0;
-    int paddedsize = ((width*3) + extrabytes) * height;
+        batchUpload(&st, p, transfers, slots[cur ^ 1], device_busy);
 
-    headers[0] = paddedsize + 54;
-    headers[1] = 0;
-    headers[2] = 54;
-    headers[3] = 40;
-    headers[4] = width;
-    headers[5] = height;
+        double t = nowMs();
+        err = batchBuffer(p.context, s.out, s.out_npix, npix, npix, CL_MEM_READ_WRITE);
+        if (!err)
+            err = pipeAlloc(p, job->width, job->height, sigma);
+        if (!err)
+        {
+            // the slots hold the input and output of the batch
+            if (p.rgb)
+                clReleaseMemObject(p.rgb);
+            if (p.out)
+                clReleaseMemObject(p.out);
+            p.rgb = s.rgb;
+            p.out = s.out;
+            err = clEnqueueBarrierWithWaitList(p.commands, 1, &s.uploaded, NULL);
+            if (!err)
+                err = pipeRun(p, low, high);
+            p.rgb = p.out = NULL;
+        }
+        clReleaseEvent(s.uploaded);
+        s.uploaded = NULL;
+        s.next = NULL;
+        if (!err)
+        {
+            job->edges.resize(npix);
+            err = clEnqueueReadBuffer(transfers, s.out, CL_FALSE, 0, npix, &job->edges[0], 0, NULL, &s.read);
+        }
+        if (err)
+        {
+            printf("Error: Failed to process %s!\n", job->path.c_str());
+            st.failed++;
+            delete job;
+        }
+        else
+        {
+            s.ran = job;
+            for (i = 0; i < ST_COUNT; i++)
+                kernel_ms += p.stage_ms[i];
+            done++;
+        }
+        batchFinish(&st, slots[cur ^ 1]);
+        device_busy += nowMs() - t;
+        cur ^= 1;
+    }
+    for (i = 0; i < 2; i++) {
+        batchFinish(&st, slots[i]);
+        if (slots[i].rgb)
+            clReleaseMemObject(slots[i].rgb);
+        if (slots[i].out)
+            clReleaseMemObject(slots[i].out);
+    }
+    clReleaseCommandQueue(transfers);
+    wqDone(st.computed);
+    for (i = 0; i < threads; i++) {
+        decoders[i].join();
+        encoders[i].join();
+    }
+    double wall = nowMs() - start;
 
-    headers[7] = 0;
-    headers[8] = paddedsize;
-    headers[9] = 0;
-    headers[10] = 0;
-    headers[11] = 0;
-    headers[12] = 0;
+    double decode_busy = 0.0, encode_busy = 0.0;
+    for (i = 0; i < threads; i++) {
+        decode_busy += st.decode_busy[i];
+        encode_busy += st.encode_busy[i];
+    }
+    printf("Batch : %lu images (%d failed) -> %s, %d decoder and %d encoder threads\n",
+        (unsigned long)done, (int)st.failed, out_dir, threads, threads);
+    printf("Wall %.3f ms || %.2f images/s\n", wall, done * 1000.0 / wall);
+    printf("Utilisation : decode %.0f%% || device thread %.0f%% (kernels %.0f%%) || encode %.0f%%\n",
+        100.0 * decode_busy / (wall * threads), 100.0 * device_busy / wall, 100.0 * kernel_ms / wall,
+        100.0 * encode_busy / (wall * threads));
+    return st.failed != 0;
+}
 
-    fopen_s(&f, name, "wb");
+//------------------------------------------------------------------------------
+//
+// -multiscale : coarse to fine edges. The gray image of p goes through a
+// Gaussian pyramid ; the whole Canny pipeline runs on the coarsest level, then
+// each finer level only runs blur, Sobel and nms on the tiles within
+// ROI_MARGIN coarse pixels of an edge candidate of the level below (dilated by
+// a tile for Sobel and once more for the blur, whose outputs the next stage
+// reads around its tile). The result is compared with the full resolution
+// edges of p.out.
+//
 
-    int n;
-    fprintf(f, "BM");
-    for (n = 0; n <= 5; n++) {
-        fprintf(f, "%c", headers[n] & 0x000000FF);
-        fprintf(f, "%c", (headers[n] & 0x0000FF00)>>8);
-        fprintf(f, "%c", (headers[n] & 0x00FF0000)>>16);
-        fprintf(f, "%c", (headers[n] & (unsigned int) 0xFF000000)>>24);
+static int enqueueTiles(Pipeline& p, cl_kernel kernel, int tiles_x, int tiles_y, std::vector<cl_event>& events)
+{
+    size_t global[2] = { (size_t)tiles_x, (size_t)tiles_y };
+    cl_event event;
+    int err = clEnqueueNDRangeKernel(p.commands, kernel, 2, NULL, global, NULL, 0, NULL, &event);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to build the tile masks! %d\n", err);
+        return 1;
     }
+    events.push_back(event);
+    return 0;
+}
 
-    fprintf(f, "%c", 1);
-    fprintf(f, "%c", 0);
-    fprintf(f, "%c", 24);
-    fprintf(f, "%c", 0);
+// masks of q from the edge candidates (c.edge) of the coarser level c and the
+// Laplacian band lap of q
+static int roiMasks(Pipeline& q, Pipeline& c, cl_mem lap, float lap_min, cl_kernel k_tiles, cl_kernel k_dilate,
+    std::vector<cl_event>& events)
+{
+    int tiles_x = (q.width + LOCAL_SIDE - 1) / LOCAL_SIDE;
+    int tiles_y = (q.height + LOCAL_SIDE - 1) / LOCAL_SIDE;
+    size_t ntiles = (size_t)tiles_x * tiles_y;
+    int tile = LOCAL_SIDE, margin = ROI_MARGIN;
+    int err = CL_SUCCESS;
 
-    for (n = 7; n <= 12; n++) {
-        fprintf(f, "%c", headers[n] & 0x000000FF);
-        fprintf(f, "%c", (headers[n] & 0x0000FF00) >> 8);
-        fprintf(f, "%c", (headers[n] & 0x00FF0000) >> 16);
-        fprintf(f, "%c", (headers[n] & (unsigned int)0xFF000000) >> 24);
+    if (!q.roi)
+    {
+        q.roi = clCreateBuffer(q.context, CL_MEM_READ_WRITE, ntiles, NULL, &err);
+        q.roi_sobel = clCreateBuffer(q.context, CL_MEM_READ_WRITE, ntiles, NULL, &err);
+        q.roi_blur = clCreateBuffer(q.context, CL_MEM_READ_WRITE, ntiles, NULL, &err);
+        if (!q.roi || !q.roi_sobel || !q.roi_blur)
+        {
+            printf("Error: Failed to allocate device memory!\n");
+            return 1;
+        }
+    }
+    err = clSetKernelArg(k_tiles, 0, sizeof(cl_mem), &c.edge);
+    err |= clSetKernelArg(k_tiles, 1, sizeof(cl_mem), &lap);
+    err |= clSetKernelArg(k_tiles, 2, sizeof(cl_mem), &q.roi);
+    err |= clSetKernelArg(k_tiles, 3, sizeof(float), &lap_min);
+    err |= clSetKernelArg(k_tiles, 4, sizeof(int), &tile);
+    err |= clSetKernelArg(k_tiles, 5, sizeof(int), &margin);
+    err |= clSetKernelArg(k_tiles, 6, sizeof(int), &tiles_x);
+    err |= clSetKernelArg(k_tiles, 7, sizeof(int), &tiles_y);
+    err |= clSetKernelArg(k_tiles, 8, sizeof(int), &q.width);
+    err |= clSetKernelArg(k_tiles, 9, sizeof(int), &q.height);
+    err |= clSetKernelArg(k_dilate, 2, sizeof(int), &tiles_x);
+    err |= clSetKernelArg(k_dilate, 3, sizeof(int), &tiles_y);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to set kernel arguments! %d\n", err);
+        return 1;
     }
+    if (enqueueTiles(q, k_tiles, tiles_x, tiles_y, events))
+        return 1;
 
-    int iter = -1;
-    int x, y;
+    clSetKernelArg(k_dilate, 0, sizeof(cl_mem), &q.roi);
+    clSetKernelArg(k_dilate, 1, sizeof(cl_mem), &q.roi_sobel);
+    if (enqueueTiles(q, k_dilate, tiles_x, tiles_y, events))
+        return 1;
+    clSetKernelArg(k_dilate, 0, sizeof(cl_mem), &q.roi_sobel);
+    clSetKernelArg(k_dilate, 1, sizeof(cl_mem), &q.roi_blur);
+    return enqueueTiles(q, k_dilate, tiles_x, tiles_y, events);
+}
 
-    for (y = height-1; y >= 0; y--) {
-        for (x = 0; x < width; x++) {
-            iter++;
-            int mod = (unsigned char)*(data + iter);
-            int r, g, b = 0;
-            switch (mod)
+// largest difference between the float image buf and ref
+static float maxError(Pipeline& p, cl_mem buf, const std::vector<float>& ref)
+{
+    std::vector<float> img(ref.size());
+    float max_err = 0.0f;
+    size_t k;
+    clEnqueueReadBuffer(p.commands, buf, CL_TRUE, 0, sizeof(float) * img.size(), &img[0], 0, NULL, NULL);
+    for (k = 0; k < img.size(); k++)
+        max_err = fabsf(img[k] - ref[k]) > max_err ? fabsf(img[k] - ref[k]) : max_err;
+    return max_err;
+}
+
+static size_t countActive(Pipeline& q, size_t ntiles)
+{
+    std::vector<unsigned char> mask(ntiles);
+    size_t k, n = 0;
+    clEnqueueReadBuffer(q.commands, q.roi, CL_TRUE, 0, ntiles, &mask[0], 0, NULL, NULL);
+    for (k = 0; k < ntiles; k++)
+        n += mask[k] != 0;
+    return n;
+}
+
+int runMultiscale(Pipeline& p, int levels, float low, float high, std::vector<unsigned char>& edges)
+{
+    std::vector<unsigned char> full((size_t)p.width * p.height);
+    std::vector<std::vector<float> > ref_gauss, ref_lap;
+    std::vector<cl_event> events;
+    std::vector<StageEvent> stage_events;
+    pyPyramid pyr;
+    double single_ms = 0.0, pyr_ms, roi_ms = 0.0, total_ms;
+    float max_err = 0.0f;
+    size_t k;
+    int l, i, err;
+
+    for (i = 0; i < ST_COUNT; i++)
+        single_ms += p.stage_ms[i];
+    double gray_ms = p.stage_ms[ST_GRAY];
+    err = clEnqueueReadBuffer(p.commands, p.out, CL_TRUE, 0, full.size(), &full[0], 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to read output array! %d\n", err);
+        return 1;
+    }
+
+    // pyramids of the gray image, checked against the host
+    if (pyInit(pyr, p.context, p.device) != CL_SUCCESS)
+    {
+        printf("Error: Failed to set up the pyramid!\n");
+        return 1;
+    }
+    err = pyBuild(pyr, p.commands, p.gray, p.width, p.height, levels, &events);
+    clFinish(p.commands);
+    pyr_ms = eventsMs(events);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to build the pyramid! %d\n", err);
+        pyRelease(pyr);
+        return 1;
+    }
+    levels = pyr.levels;
+    std::vector<float> gray((size_t)p.width * p.height);
+    clEnqueueReadBuffer(p.commands, p.gray, CL_TRUE, 0, sizeof(float) * gray.size(), &gray[0], 0, NULL, NULL);
+    pyReference(&gray[0], p.width, p.height, levels, ref_gauss, ref_lap);
+    for (l = 0; l < levels; l++) {
+        float e = maxError(p, pyr.gauss[l], ref_gauss[l]);
+        max_err = e > max_err ? e : max_err;
+        if (l + 1 < levels)
+        {
+            e = maxError(p, pyr.lap[l], ref_lap[l]);
+            max_err = e > max_err ? e : max_err;
+        }
+    }
+    printf("\nPyramid : %d levels, %d x %d to %d x %d || %.3f ms || max error %.2e -> %s\n",
+        levels, pyr.width[0], pyr.height[0], pyr.width[levels - 1], pyr.height[levels - 1],
+        pyr_ms, max_err, max_err <= PYR_TOL ? "ok" : "MISMATCH");
+
+    // one pipeline per level, p is level 0 ; the others only have their images
+    std::vector<Pipeline> extra(levels - 1);
+    std::vector<Pipeline*> lp(levels);
+    lp[0] = &p;
+    for (l = 1; l < levels; l++) {
+        lp[l] = &extra[l - 1];
+        pipeShare(*lp[l], p);
+        if (pipeAlloc(*lp[l], pyr.width[l], pyr.height[l], p.sigma))
+            return 1;
+    }
+    cl_kernel k_tiles = createKernel(p.program, "roi_tiles");
+    cl_kernel k_dilate = createKernel(p.program, "roi_dilate");
+
+    printf("\n%-6s %12s %14s %12s\n", "level", "size", "active tiles", "device ms");
+    total_ms = pyr_ms + gray_ms;
+    for (l = levels - 1; l >= 0 && !err; l--) {
+        Pipeline& q = *lp[l];
+        int tiles_x = (q.width + LOCAL_SIDE - 1) / LOCAL_SIDE;
+        int tiles_y = (q.height + LOCAL_SIDE - 1) / LOCAL_SIDE;
+        size_t ntiles = (size_t)tiles_x * tiles_y, active = ntiles;
+        double level_ms = 0.0;
+
+        // level 0 is p.gray already
+        if (l > 0)
+        {
+            size_t origin[3] = { 0, 0, 0 }, region[3] = { (size_t)q.width, (size_t)q.height, 1 };
+            err = clEnqueueCopyBuffer(p.commands, pyr.gauss[l], q.gray, 0, 0, sizeof(cl_float) * q.width * q.height, 0, NULL, NULL);
+            if (!err && q.images)
+                err = clEnqueueCopyBufferToImage(p.commands, pyr.gauss[l], q.gray_img, 0, origin, region, 0, NULL, NULL);
+        }
+        if (!err && l < levels - 1)
+        {
+            err = roiMasks(q, *lp[l + 1], pyr.lap[l], low * ROI_DETAIL, k_tiles, k_dilate, events);
+            clFinish(p.commands);
+            roi_ms += eventsMs(events);
+            if (!err)
+                active = countActive(q, ntiles);
+        }
+        if (!err)
+            err = pipeCanny(q, low, high, stage_events);
+        if (err)
+            break;
+        for (i = 0; i < ST_COUNT; i++)
+            level_ms += q.stage_ms[i];
+        total_ms += level_ms;
+
+        char size[32];
+        sprintf(size, "%dx%d", q.width, q.height);
+        printf("%-6d %12s %13.1f%% %12.3f\n", l, size, 100.0 * active / ntiles, level_ms);
+    }
+    total_ms += roi_ms;
+    clReleaseKernel(k_tiles);
+    clReleaseKernel(k_dilate);
+    for (l = 1; l < levels; l++)
+        pipeRelease(*lp[l]);
+    pyRelease(pyr);
+
+    // p back to whole images
+    cl_mem* masks[] = { &p.roi, &p.roi_sobel, &p.roi_blur };
+    for (i = 0; i < 3; i++) {
+        if (*masks[i])
+            clReleaseMemObject(*masks[i]);
+        *masks[i] = NULL;
+    }
+    if (err)
+        return 1;
+
+    edges.resize(full.size());
+    err = clEnqueueReadBuffer(p.commands, p.out, CL_TRUE, 0, edges.size(), &edges[0], 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to read output array! %d\n", err);
+        return 1;
+    }
+    size_t nfull = 0, nms = 0, common = 0;
+    for (k = 0; k < full.size(); k++) {
+        nfull += full[k] != 0;
+        nms += edges[k] != 0;
+        common += full[k] && edges[k];
+    }
+    printf("Multi-scale %.3f ms (pyramid %.3f, masks %.3f) || single scale %.3f ms || %.2fx\n",
+        total_ms, pyr_ms, roi_ms, single_ms, single_ms / total_ms);
+    printf("Edges : %lu pixels, %.2f%% of the full resolution edges found, %.2f%% of them in it\n",
+        (unsigned long)nms, 100.0 * common / (nfull ? nfull : 1), 100.0 * common / (nms ? nms : 1));
+    return max_err > PYR_TOL;
+}
+
+//------------------------------------------------------------------------------
+//
+// Convolution benchmark on the gray image : every mode of the convolution
+// module for Gaussians of growing radius, the Sobel x derivative (rank 1 too)
+// and discs, which are not separable and fall back to the tiled kernel
+//
+
+int runConvBench(Pipeline& p)
+{
+    size_t npix = (size_t)p.width * p.height;
+    std::vector<float> gray(npix), ref(npix), result(npix), weights;
+    std::vector<cl_event> events;
+    size_t origin[3] = { 0, 0, 0 }, region[3] = { (size_t)p.width, (size_t)p.height, 1 };
+    cvConv conv;
+    cl_mem out, in_img = NULL, out_img = NULL;
+    int err, c, mode, k;
+
+    err = clEnqueueReadBuffer(p.commands, p.gray, CL_TRUE, 0, sizeof(float) * npix, &gray[0], 0, NULL, NULL);
+    out = clCreateBuffer(p.context, CL_MEM_READ_WRITE, sizeof(float) * npix, NULL, &err);
+    if (!out)
+    {
+        printf("Error: Failed to allocate device memory!\n");
+        return 1;
+    }
+    cvInit(conv, p.context, p.device);
+    if (conv.images)
+    {
+        in_img = cvImage2D(p.context, p.width, p.height, CL_MEM_READ_ONLY, &err);
+        out_img = cvImage2D(p.context, p.width, p.height, CL_MEM_READ_WRITE, &err);
+        if (!in_img || !out_img)
+        {
+            printf("Error: Failed to allocate the images! %d\n", err);
+            return 1;
+        }
+        clEnqueueCopyBufferToImage(p.commands, p.gray, in_img, 0, origin, region, 0, NULL, NULL);
+    }
+
+    printf("\n%-10s %6s %6s  %-10s %10s %10s %8s %10s\n", "weights", "radius", "rank1", "mode", "ms", "MPix/s", "speedup", "max err");
+    for (c = 0; c < BENCH_CASES; c++) {
+        const char* name;
+        int radius, x, y, side;
+        if (c < 5)
+        {
+            name = "gaussian";
+            radius = 1 << c;                    // 1 to 16
+            float sigma = radius / 2.5f;
+            float sum = 0.0f;
+            std::vector<float> w1(2 * radius + 1);
+            for (x = 0; x <= 2 * radius; x++) {
+                w1[x] = expf(-(float)((x - radius) * (x - radius)) / (2.0f * sigma * sigma));
+                sum += w1[x];
+            }
+            weights.resize(w1.size() * w1.size());
+            for (y = 0; y <= 2 * radius; y++)
+                for (x = 0; x <= 2 * radius; x++)
+                    weights[y * w1.size() + x] = (w1[y] / sum) * (w1[x] / sum);
+        }
+        else if (c == 5)
+        {
+            static const float sobel_x[9] = { -1, 0, 1, -2, 0, 2, -1, 0, 1 };
+            name = "sobel x";
+            radius = 1;
+            weights.assign(sobel_x, sobel_x + 9);
+        }
+        else
+        {
+            name = "disc";
+            radius = c == 6 ? 4 : 8;
+            side = 2 * radius + 1;
+            weights.assign(side * side, 0.0f);
+            int count = 0;
+            for (y = -radius; y <= radius; y++)
+                for (x = -radius; x <= radius; x++)
+                    if (x * x + y * y <= radius * radius)
+                        count++;
+            for (y = -radius; y <= radius; y++)
+                for (x = -radius; x <= radius; x++)
+                    if (x * x + y * y <= radius * radius)
+                        weights[(y + radius) * side + x + radius] = 1.0f / count;
+        }
+
+        err = cvSetWeights(conv, &weights[0], radius);
+        if (err != CL_SUCCESS)
+            break;
+        cvReference(&gray[0], &ref[0], p.width, p.height, &weights[0], radius);
+        float scale = 1.0e-6f;
+        for (size_t n = 0; n < npix; n++)
+            scale = fabsf(ref[n]) > scale ? fabsf(ref[n]) : scale;
+
+        double naive_ms = 0.0;
+        for (mode = CV_NAIVE; mode <= BENCH_IMAGE; mode++) {
+            if ((mode == CV_SEPARABLE && !conv.separable) || (mode == BENCH_IMAGE && !conv.images))
+                continue;
+            const char* mode_name = mode == BENCH_IMAGE ? "image" : cvModeName(mode);
+            double best = 0.0;
+            for (k = 0; k <= BENCH_REPEAT; k++) {
+                if (mode == BENCH_IMAGE)
+                    err = cvRunImage(conv, p.commands, in_img, out_img, p.width, p.height, NULL, &events);
+                else
+                    err = cvRun(conv, p.commands, mode, p.gray, out, p.width, p.height, NULL, &events);
+                if (err != CL_SUCCESS)
+                    break;
+                clFinish(p.commands);
+                double ms = eventsMs(events);
+                if (k == 1 || (k > 1 && ms < best))   // the first run is the warm up
+                    best = ms;
+            }
+            if (err != CL_SUCCESS)
+            {
+                printf("Error: Failed to run the %s convolution! %d\n", mode_name, err);
+                break;
+            }
+            if (mode == CV_NAIVE)
+                naive_ms = best;
+
+            if (mode == BENCH_IMAGE)
+                clEnqueueReadImage(p.commands, out_img, CL_TRUE, origin, region, 0, 0, &result[0], 0, NULL, NULL);
+            else
+                clEnqueueReadBuffer(p.commands, out, CL_TRUE, 0, sizeof(float) * npix, &result[0], 0, NULL, NULL);
+            float max_err = 0.0f;
+            for (size_t n = 0; n < npix; n++)
+                max_err = fabsf(result[n] - ref[n]) > max_err ? fabsf(result[n] - ref[n]) : max_err;
+
+            printf("%-10s %6d %6s  %-10s %10.3f %10.1f %7.2fx %10.2e\n", name, radius, conv.separable ? "yes" : "no",
+                mode_name, best, npix * 1.0e-3 / best, naive_ms / best, max_err / scale);
+        }
+        if (err != CL_SUCCESS)
+            break;
+    }
+
+    // the Sobel stage of the pipeline on the gray image, buffer against image
+    if (err == CL_SUCCESS && p.k_sobel_image)
+    {
+        std::vector<float> mag(npix);
+        std::vector<unsigned char> dir(npix), ref_dir(npix);
+        double buffer_ms = 0.0;
+        for (mode = 0; mode < 2 && err == CL_SUCCESS; mode++) {
+            cl_kernel kernel = mode ? p.k_sobel_image : p.k_sobel;
+            std::vector<StageEvent> stage_events;
+            double best = 0.0;
+            if (setSobel(p, kernel, mode ? in_img : p.gray, NULL))
             {
-            case 0: r = 66; g = 30; b = 15; break;
-            case 1: r = 25; g = 7; b = 26; break;
-            case 2: r = 9; g = 1; b = 47; break;
-            case 3: r = 4; g = 4; b = 73; break;
-            case 4: r = 0; g = 7; b = 100; break;
-            case 5: r = 12; g = 44; b = 138; break;
-            case 6: r = 24; g = 82; b = 177; break;
-            case 7: r = 57; g = 125; b = 209; break;
-            case 8: r = 134; g = 181; b = 229; break;
-            case 9: r = 211; g = 236; b = 248; break;
-            case 10: r = 241; g = 233; b = 191; break;
-            case 11: r = 248; g = 201; b = 95; break;
-            case 12: r = 254; g = 170; b = 0; break;
-            case 13: r = 204; g = 128; b = 0; break;
-            case 14: r = 153; g = 87; b = 0; break;
-            case 15: r = 106; g = 52; b = 3; break;
+                err = CL_INVALID_KERNEL_ARGS;
+                break;
+            }
+            for (k = 0; k <= BENCH_REPEAT; k++) {
+                enqueue2D(p, kernel, ST_SOBEL, stage_events);
+                clFinish(p.commands);
+                stageTimes(p, stage_events);
+                if (k == 1 || (k > 1 && p.stage_ms[ST_SOBEL] < best))
+                    best = p.stage_ms[ST_SOBEL];
             }
+            clEnqueueReadBuffer(p.commands, p.mag, CL_TRUE, 0, sizeof(float) * npix, mode ? &mag[0] : &ref[0], 0, NULL, NULL);
+            clEnqueueReadBuffer(p.commands, p.dir, CL_TRUE, 0, npix, mode ? &dir[0] : &ref_dir[0], 0, NULL, NULL);
+            if (mode == 0)
+                buffer_ms = best;
+
+            float max_err = 0.0f, scale = 1.0e-6f;
+            size_t dir_diff = 0;
+            for (size_t n = 0; mode && n < npix; n++) {
+                scale = ref[n] > scale ? ref[n] : scale;
+                max_err = fabsf(mag[n] - ref[n]) > max_err ? fabsf(mag[n] - ref[n]) : max_err;
+                dir_diff += dir[n] != ref_dir[n];
+            }
+            printf("%-10s %6d %6s  %-10s %10.3f %10.1f %7.2fx %10.2e\n", "sobel", 1, "-",
+                mode ? "image" : "buffer", best, npix * 1.0e-3 / best, buffer_ms / best, max_err / scale);
+            if (dir_diff)
+                printf("Error: %lu gradient directions differ between the buffer and the image!\n", (unsigned long)dir_diff);
+        }
+    }
 
-            if (r < 0 || r> 255)
-                r = 0;
+    cvRelease(conv);
+    clReleaseMemObject(out);
+    if (in_img)
+    {
+        clReleaseMemObject(in_img);
+        clReleaseMemObject(out_img);
+    }
+    return err != CL_SUCCESS;
+}
+
+//------------------------------------------------------------------------------
+//
+// CPU reference, same operations in the same order as the kernels
+//
+
+static inline float pix(const float* img, int x, int y, int width, int height)
+{
+    x = x < 0 ? 0 : (x > width - 1 ? width - 1 : x);
+    y = y < 0 ? 0 : (y > height - 1 ? height - 1 : y);
+    return img[y * width + x];
+}
+
+// method is HG_OTSU or HG_PERCENTILE to choose low and high from the nms
+// candidates as the device does, -1 to keep them
+void cannyCPU(const unsigned int* rgb, int width, int height, float sigma, int method, float param,
+    float& low, float& high, std::vector<unsigned char>& out, double* stage_ms)
+{
+    size_t npix = (size_t)width * height;
+    std::vector<float> gray(npix), blur(npix), mag(npix), thin(npix), weights;
+    std::vector<unsigned char> dir(npix), edge(npix);
+    std::vector<int> stack;
+    int radius = gaussWeights(sigma, weights);
+    int x, y, i, j;
+    double t;
 
-            if (g < 0 || g> 255)
-                g = 0;
+    t = clock();
+    for (i = 0; i < (int)npix; i++) {
+        unsigned int p = rgb[i];
+        gray[i] = 0.299f * ((p >> 16) & 0xff) + 0.587f * ((p >> 8) & 0xff) + 0.114f * (p & 0xff);
+    }
+    stage_ms[ST_GRAY] = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
 
-            if (b < 0 || b> 255)
-                b = 0;
+    t = clock();
+    cvReference(&gray[0], &blur[0], width, height, &weights[0], radius);
+    stage_ms[ST_BLUR] = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
 
-            fprintf(f, "%c", b);
-            fprintf(f, "%c", g);
-            fprintf(f, "%c", r);
+    t = clock();
+    const float* b = &blur[0];
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++) {
+            float gx = (pix(b, x + 1, y - 1, width, height) + 2.0f * pix(b, x + 1, y, width, height) + pix(b, x + 1, y + 1, width, height))
+                - (pix(b, x - 1, y - 1, width, height) + 2.0f * pix(b, x - 1, y, width, height) + pix(b, x - 1, y + 1, width, height));
+            float gy = (pix(b, x - 1, y + 1, width, height) + 2.0f * pix(b, x, y + 1, width, height) + pix(b, x + 1, y + 1, width, height))
+                - (pix(b, x - 1, y - 1, width, height) + 2.0f * pix(b, x, y - 1, width, height) + pix(b, x + 1, y - 1, width, height));
+            float ax = fabsf(gx), ay = fabsf(gy);
+            unsigned char d;
+            if (ay <= ax * 0.41421356f) d = 0;
+            else if (ay >= ax * 2.41421356f) d = 2;
+            else d = (gx * gy > 0.0f) ? 1 : 3;
+            mag[y * width + x] = sqrtf(gx * gx + gy * gy);
+            dir[y * width + x] = d;
         }
-        if (extrabytes) {
-            for (n = 1; n <= extrabytes; n++) {
-                fprintf(f, "%c", 0);
+    stage_ms[ST_SOBEL] = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
+
+    t = clock();
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++) {
+            int dx, dy;
+            if (x == 0 || y == 0 || x == width - 1 || y == height - 1) {
+                thin[y * width + x] = 0.0f;
+                continue;
+            }
+            switch (dir[y * width + x]) {
+            case 0: dx = 1; dy = 0; break;
+            case 1: dx = 1; dy = 1; break;
+            case 2: dx = 0; dy = 1; break;
+            default: dx = 1; dy = -1; break;
             }
+            float m = mag[y * width + x];
+            float m1 = mag[(y - dy) * width + x - dx];
+            float m2 = mag[(y + dy) * width + x + dx];
+            thin[y * width + x] = (m >= m1 && m > m2) ? m : 0.0f;
         }
+    stage_ms[ST_NMS] = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
+
+    t = clock();
+    if (method >= 0)
+    {
+        std::vector<cl_uint> bins;
+        hgReference(&thin[0], npix, 1, MAG_MAX, bins);
+        high = hgSelect(bins, method, param, MAG_MAX);
+        low = AUTO_LOW_RATIO * high;
     }
-    printf("DONE \n");
-    fclose(f);
+    stage_ms[ST_THRESH] = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
+
+    // flood fill from the strong pixels through the weak ones
+    t = clock();
+    for (i = 0; i < (int)npix; i++) {
+        edge[i] = thin[i] >= high ? 2 : (thin[i] >= low ? 1 : 0);
+        if (edge[i] == 2)
+            stack.push_back(i);
+    }
+    while (!stack.empty()) {
+        int k = stack.back();
+        stack.pop_back();
+        x = k % width;
+        y = k / width;
+        for (j = -1; j <= 1; j++)
+            for (i = -1; i <= 1; i++) {
+                int xx = x + i, yy = y + j;
+                if (xx < 0 || yy < 0 || xx >= width || yy >= height || edge[yy * width + xx] != 1)
+                    continue;
+                edge[yy * width + xx] = 2;
+                stack.push_back(yy * width + xx);
+            }
+    }
+    out.resize(npix);
+    for (i = 0; i < (int)npix; i++)
+        out[i] = edge[i] == 2 ? 255 : 0;
+    stage_ms[ST_HYST] = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
+    stage_ms[ST_MORPH] = stage_ms[ST_DIST] = 0.0;
 }
 
-//unsigned char x2ycolor(float a, float b)
+//------------------------------------------------------------------------------
+//
+// The image path of the blur sums the same products as the buffer one but may
+// round them a ulp apart, and on flat regions the suppression then breaks the
+// ties between neighbours the other way : its edges cannot be compared with the
+// CPU pixel for pixel. Its blur and magnitude are checked against the buffer
+// path instead, within IMAGE_TOL, and edges gets the edges of the buffer path,
+// which the CPU reference checks as usual. The stage times stay those of the
+// image path.
+//
 
+static float maxDiff(const std::vector<float>& a, const std::vector<float>& b)
+{
+    float max_err = 0.0f;
+    size_t k;
+    for (k = 0; k < a.size(); k++) {
+        float d = a[k] == b[k] ? 0.0f : fabsf(a[k] - b[k]);
+        if (!(d <= max_err))
+            max_err = d;                // NaN too
+    }
+    return max_err;
+}
 
-int main()
+int checkImages(Pipeline& p, float low, float high, std::vector<unsigned char>& edges)
 {
-    int err;                   // error code returned from OpenCL calls
+    size_t npix = (size_t)p.width * p.height;
+    size_t origin[3] = { 0, 0, 0 };
+    size_t region[3] = { (size_t)p.width, (size_t)p.height, 1 };
+    std::vector<float> img_blur(npix), img_mag(npix), blur(npix), mag(npix);
+    std::vector<unsigned char> buf_edges(npix);
+    double stage_ms[ST_COUNT];
+    int hyst_steps = p.hyst_steps;
+    size_t k, flipped = 0;
+    int err;
+
+    err = clEnqueueReadImage(p.commands, p.blur_img, CL_TRUE, origin, region, 0, 0, &img_blur[0], 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(p.commands, p.mag, CL_TRUE, 0, sizeof(float) * npix, &img_mag[0], 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to read the image path! %d\n", err);
+        return 1;
+    }
+    memcpy(stage_ms, p.stage_ms, sizeof(stage_ms));
+
+    p.images = 0;
+    err = pipeRun(p, low, high);
+    p.images = 1;
+    if (err)
+        return 1;
+    err = clEnqueueReadBuffer(p.commands, p.blur, CL_TRUE, 0, sizeof(float) * npix, &blur[0], 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(p.commands, p.mag, CL_TRUE, 0, sizeof(float) * npix, &mag[0], 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(p.commands, p.out, CL_TRUE, 0, npix, &buf_edges[0], 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to read the buffer path! %d\n", err);
+        return 1;
+    }
+    memcpy(p.stage_ms, stage_ms, sizeof(stage_ms));
+    p.hyst_steps = hyst_steps;
+
+    for (k = 0; k < npix; k++)
+        if (edges[k] != buf_edges[k])
+            flipped++;
+    edges.swap(buf_edges);
+
+    float blur_err = maxDiff(img_blur, blur), mag_err = maxDiff(img_mag, mag);
+    int ok = blur_err <= IMAGE_TOL && mag_err <= IMAGE_TOL;
+    printf("Images : blur %.2e and magnitude %.2e from the buffer path, %lu edge pixels on near ties -> %s\n",
+        blur_err, mag_err, (unsigned long)flipped, ok ? "ok" : "MISMATCH");
+    return ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
 
-    size_t global;                      // global domain size  
-    size_t local;                       // local  domain size  
 
-    double step;
-    int max_size, workgroup_size = 32;
-    int nworkgroup;
+int main(int argc, char** argv)
+{
+    int err;                   // error code returned from OpenCL calls
     int i;
 
-    cl_device_id     device_id;         // compute device id 
+    cl_device_id     device_id;         // compute device id
     cl_context       context;           // compute context
     cl_command_queue commands;          // compute command queue
     cl_program       program;           // compute program
-    cl_kernel        kernel;            // compute kernel
-
-    cl_mem y_out;                       // device memory used for the output c vector
     cl_uint numPlatforms;
     cl_platform_id firstPlatformId;
 
-    int imgWIDTH = 1000;
-    int imgHEIGHT = 1000;
-    int ntotal_iter = imgHEIGHT*imgWIDTH;
-    int nwork_iter = 1;
-    float xmax = 1.5;
-    float xmin = -2;
-    float ymax = 1.75f;
-    float ymin = -1.75f;
-
-    double startX = -2;
-    double startY = 1.75;
-    int maxIter = 255;
-    //double scale = 0.1f; step
-
-    unsigned int* grid;
-    grid = (unsigned int*)malloc(imgWIDTH * imgHEIGHT * sizeof(unsigned int));
-
+    cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+    const char* input_path = NULL;
+    const char* output_path = NULL;
+    float sigma = GAUSS_SIGMA;
+    float low = LOW_THRESHOLD, high = HIGH_THRESHOLD;
+    int auto_method = -1;
+    float auto_param = 0.0f;
+    int morph_op = -1, morph_radius = 0;
+    const char* distance_path = NULL;
+    int bench = 0;
+    const char* contour_path = NULL;
+    int stream = 0, band_rows = STREAM_ROWS;
+    const char* batch = NULL;
+    int threads = BATCH_THREADS;
+    int levels = 1;
+    int images = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-cpu") == 0) device_type = CL_DEVICE_TYPE_CPU;
+        else if (strcmp(argv[i], "-bench") == 0) bench = 1;
+        else if (strcmp(argv[i], "-stream") == 0) stream = 1;
+        else if (strcmp(argv[i], "-band") == 0 && i + 1 < argc) band_rows = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc) batch = argv[++i];
+        else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-images") == 0) images = 1;
+        else if (strcmp(argv[i], "-multiscale") == 0 && i + 1 < argc) levels = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-contours") == 0 && i + 1 < argc) contour_path = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output_path = argv[++i];
+        else if (strcmp(argv[i], "-sigma") == 0 && i + 1 < argc) sigma = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "-low") == 0 && i + 1 < argc) low = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "-high") == 0 && i + 1 < argc) high = (float)atof(argv[++i]);
+        else if (strcmp(argv[i], "-auto") == 0 && i + 1 < argc)
+        {
+            i++;
+            auto_method = strcmp(argv[i], "otsu") == 0 ? HG_OTSU : HG_PERCENTILE;
+            auto_param = (float)atof(argv[i]);
+        }
+        else if (strcmp(argv[i], "-distance") == 0 && i + 1 < argc) distance_path = argv[++i];
+        else if (strcmp(argv[i], "-morph") == 0 && i + 2 < argc)
+        {
+            for (morph_op = MO_OPS - 1; morph_op >= 0 && strcmp(argv[i + 1], moOpName(morph_op)); morph_op--)
+                ;
+            morph_radius = atoi(argv[i + 2]);
+            i += 2;
+        }
+        else if (argv[i][0] != '-') input_path = argv[i];
+        else
+        {
+            printf("Usage: DetectionContourImage [-cpu] [-images] [-bench] [image.bmp] [-o edges.bmp] [-contours file.txt] [-sigma s] [-low t] [-high t]\n");
+            printf("                                 [-auto otsu|fraction] [-multiscale levels]\n");
+            printf("                                 [-morph erode|dilate|open|close radius] [-distance dist.bmp]\n");
+            printf("       DetectionContourImage [-cpu] [-images] -stream image.bmp [-band rows] [-o gradient.bmp] [-sigma s]\n");
+            printf("       DetectionContourImage [-cpu] [-images] -batch dir|list.txt [-threads n] [-o out_dir] [-sigma s] [-low t] [-high t]\n");
+            printf("                                 [-auto otsu|fraction] [-morph erode|dilate|open|close radius]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (stream && (!input_path || band_rows <= 0))
+    {
+        printf("Error: -stream needs an input image and a positive band height!\n");
+        return EXIT_FAILURE;
+    }
+    if (levels < 1)
+    {
+        printf("Error: -multiscale needs a positive level count!\n");
+        return EXIT_FAILURE;
+    }
+    if (!(sigma > 0.0f))
+    {
+        printf("Error: -sigma needs a positive value!\n");
+        return EXIT_FAILURE;
+    }
+    if (auto_method == HG_PERCENTILE && (auto_param <= 0.0f || auto_param >= 1.0f))
+    {
+        printf("Error: -auto needs otsu or a fraction between 0 and 1!\n");
+        return EXIT_FAILURE;
+    }
+    if (morph_radius < 0 || (morph_op < 0 && morph_radius > 0))
+    {
+        printf("Error: -morph needs erode, dilate, open or close and a radius!\n");
+        return EXIT_FAILURE;
+    }
+    if (batch && threads <= 0)
+    {
+        printf("Error: -threads needs a positive count!\n");
+        return EXIT_FAILURE;
+    }
+    if (!output_path)
+        output_path = stream ? "gradient.bmp" : (batch ? "edges" : "edges.bmp");
 
     err = clGetPlatformIDs(1, &firstPlatformId, &numPlatforms);
     if (err != CL_SUCCESS || numPlatforms <= 0)
@@ -187,7 +2168,7 @@ int main()
         printf("Error: Failed to find the platform!\n");
         return EXIT_FAILURE;
     }
-    err = clGetDeviceIDs(firstPlatformId, CL_DEVICE_TYPE_GPU, 1, &device_id, NULL);
+    err = clGetDeviceIDs(firstPlatformId, device_type, 1, &device_id, NULL);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to create a device group!\n");
@@ -211,7 +2192,9 @@ int main()
         printf("Error: Failed to create compute program!\n");
         return EXIT_FAILURE;
     }
-    err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
+    // the image kernels only where they can run
+    int image_support = cvImages(context, device_id);
+    err = clBuildProgram(program, 0, NULL, image_support ? "-DIMAGES" : NULL, NULL, NULL);
     if (err != CL_SUCCESS)
     {
         size_t len;
@@ -223,136 +2206,223 @@ int main()
         exit(1);
     }
 
-    // Create the compute kernel from the program 
-    kernel = clCreateKernel(program, "mandel", &err);
-    if (!kernel || err != CL_SUCCESS)
+    Pipeline pipe;
+    pipeInit(pipe, context, device_id, commands, program);
+    if (images && !pipe.k_sobel_image)
     {
-        printf("Error: Failed to create compute kernel!\n");
-        exit(1);
+        printf("-images : the device has no CL_R / CL_FLOAT images, buffers are used instead\n");
+        images = 0;
     }
+    pipe.images = images;
+    pipe.auto_method = auto_method;
+    pipe.auto_param = auto_param;
+    pipe.morph_op = morph_op;
+    pipe.morph_radius = morph_radius;
 
-    // Get the maximum work group size for executing the kernel on the device
-    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE,
-        sizeof(max_size), &max_size, NULL);
-    if (err != CL_SUCCESS)
+    if (stream || batch)
     {
-        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
-        exit(1);
+        if (stream)
+            err = runStream(pipe, input_path, output_path, band_rows, sigma);
+        else
+            err = runBatch(pipe, batch, output_path, threads, sigma, low, high);
+        pipeRelease(pipe);
+        clReleaseProgram(program);
+        clReleaseCommandQueue(commands);
+        clReleaseContext(context);
+        return err ? EXIT_FAILURE : 0;
     }
-    if (max_size > workgroup_size) workgroup_size = max_size;
+    pipe.distance = distance_path != NULL;
 
-    // Now that we know the size of the work_groups, we can set the number of work
-    // groups, the actual number of steps, and the step size
-    nworkgroup = ntotal_iter / (workgroup_size * nwork_iter);
-
-    if (nworkgroup < 1)
+    int width, height;
+    std::vector<unsigned int> image;
+    if (input_path)
     {
-        int comp_units;
-        err = clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &comp_units, NULL);
+        bmImage img;
+        if (bmOpen(img, input_path))
+            return EXIT_FAILURE;
+        width = img.width;
+        height = img.height;
+        image.resize((size_t)width * height);
+        bmReadBand(img, 0, height, &image[0]);
+        bmClose(img);
+        if (pipeAlloc(pipe, width, height, sigma))
+            return EXIT_FAILURE;
+        err = clEnqueueWriteBuffer(commands, pipe.rgb, CL_TRUE, 0, sizeof(cl_uint) * image.size(), &image[0], 0, NULL, NULL);
         if (err != CL_SUCCESS)
         {
-            printf("Error: Failed to access device number of compute units !\n");
+            printf("Error: Failed to write the image! %d\n", err);
             return EXIT_FAILURE;
         }
-        nworkgroup = comp_units;
-        workgroup_size = ntotal_iter / (nworkgroup * nwork_iter);
     }
-    int nsteps = workgroup_size * nwork_iter * nworkgroup;
-    step = 1.0 / (double)nsteps;
-    step = 0.0025;
-    printf("Total iter : %d || Nstep : %d\n", ntotal_iter, nsteps);
+    else
+    {
+        // synthetic input : the Mandelbrot set rendered straight into the input buffer
+        double startX = -2;
+        double startY = 1.75;
+        double step = 0.0035;
+        unsigned int maxIter = MAX_ITER;
+        unsigned int imgWIDTH = IMG_WIDTH;
+        width = IMG_WIDTH;
+        height = IMG_HEIGHT;
+        if (pipeAlloc(pipe, width, height, sigma))
+            return EXIT_FAILURE;
 
+        cl_kernel kernel = createKernel(program, "mandel");
+        err = clSetKernelArg(kernel, 0, sizeof(cl_double), &startX);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_double), &startY);
+        err |= clSetKernelArg(kernel, 2, sizeof(cl_double), &step);
+        err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &maxIter);
+        err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &pipe.rgb);
+        err |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &imgWIDTH);
+        size_t ggg[2] = { IMG_WIDTH, IMG_HEIGHT };
+        if (err == CL_SUCCESS)
+            err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, ggg, NULL, 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to render the synthetic input! %d\n", err);
+            return EXIT_FAILURE;
+        }
+        image.resize((size_t)width * height);
+        err = clEnqueueReadBuffer(commands, pipe.rgb, CL_TRUE, 0, sizeof(cl_uint) * image.size(), &image[0], 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to read output array! %d\n", err);
+            exit(1);
+        }
+        saveImage("test3.bmp", width, height, &image[0]);
+        clReleaseKernel(kernel);
+    }
+    if (auto_method < 0)
+        printf("Image %d x %d, sigma %.2f (radius %d), thresholds %.1f / %.1f, %s\n",
+            width, height, sigma, pipe.conv.radius, low, high, images ? "image objects" : "buffers");
+    else
+        printf("Image %d x %d, sigma %.2f (radius %d), thresholds %s, %s\n",
+            width, height, sigma, pipe.conv.radius, auto_method == HG_OTSU ? "Otsu" : "percentile",
+            images ? "image objects" : "buffers");
 
-    printf(" %d work groups of size %d.  %d Integration steps\n",
-        (int)nworkgroup, (int)workgroup_size, nsteps);
+    double rtime = clock();
+    if (pipeRun(pipe, low, high))
+        return EXIT_FAILURE;
+    rtime = clock() - rtime;
 
-    // Create the input (a, b) and output (c) arrays in device memory  
-    y_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(unsigned int) * imgHEIGHT*imgWIDTH, NULL, NULL);
-    if (!y_out)
+    std::vector<unsigned char> edges((size_t)width * height);
+    err = clEnqueueReadBuffer(commands, pipe.out, CL_TRUE, 0, edges.size(), &edges[0], 0, NULL, NULL);
+    if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to allocate device memory!\n");
+        printf("Error: Failed to read output array! %d\n", err);
         exit(1);
     }
+    // from here on the checks and outputs go on from the buffer path
+    int images_ok = !images || checkImages(pipe, low, high, edges) == 0;
 
-    // Set the arguments to our compute kernel
-    err = 0;
-    err = clSetKernelArg(kernel, 0, sizeof(cl_double), &startX);
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_double), &startY);
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_double), &step);
-    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &maxIter);
-    err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &y_out);
-    err |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &imgWIDTH);
-    if (err != CL_SUCCESS)
+    // CPU reference
+    std::vector<unsigned char> ref;
+    double cpu_ms[ST_COUNT];
+    float cpu_low = low, cpu_high = high;
+    cannyCPU(&image[0], width, height, sigma, auto_method, auto_param, cpu_low, cpu_high, ref, cpu_ms);
+    if (morph_op >= 0)
     {
-        printf("Error: Failed to set kernel arguments! %d\n", err);
-        exit(1);
+        double t = clock();
+        moCPU(&ref[0], &ref[0], width, height, morph_op, morph_radius, morph_radius);
+        cpu_ms[ST_MORPH] = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
     }
-
-    // Get the maximum work group size for executing the kernel on the device
-    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
-    if (err != CL_SUCCESS)
+    // on the device edges, to check the transform alone
+    std::vector<float> dist, ref_dist;
+    if (distance_path)
     {
-        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
-        exit(1);
+        double t = clock();
+        ref_dist.resize(edges.size());
+        dtReference(&edges[0], &ref_dist[0], width, height);
+        cpu_ms[ST_DIST] = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
     }
-    double rtime;
-    rtime = clock();
-
-    // Execute the kernel over the entire range of our 1d input data set
-    // using the maximum number of work group items for this device
-    cl_event prof_event;
-    global = nworkgroup * workgroup_size;
-    local = workgroup_size;
-    size_t ggg[2] = { imgWIDTH, imgHEIGHT };
-    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, ggg, NULL, 0, NULL, &prof_event);
-    if (err)
+    int thresh_ok = 1;
+    if (auto_method >= 0)
     {
-        printf("Error: Failed to execute kernel!\n");
-        return EXIT_FAILURE;
+        float thresh[2];
+        err = clEnqueueReadBuffer(commands, pipe.thresh, CL_TRUE, 0, sizeof(thresh), thresh, 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to read the thresholds! %d\n", err);
+            exit(1);
+        }
+        // the selection is in integers on both sides, see Histogram.cpp
+        thresh_ok = thresh[0] == cpu_low && thresh[1] == cpu_high;
+        printf("Thresholds : %.1f / %.1f on the device, %.1f / %.1f on the CPU -> %s\n",
+            thresh[0], thresh[1], cpu_low, cpu_high, thresh_ok ? "ok" : "MISMATCH");
+        // the coarse to fine levels are too small for their own histogram
+        low = thresh[0];
+        high = thresh[1];
+        pipe.auto_method = -1;
     }
 
-    // Wait for the commands to complete before reading back results
-    clFinish(commands);
+    double device_total = 0.0, cpu_total = 0.0;
+    printf("\n%-12s %12s %12s\n", "stage", "device ms", "cpu ms");
+    for (i = 0; i < ST_COUNT; i++) {
+        printf("%-12s %12.3f %12.3f\n", StageName[i], pipe.stage_ms[i], cpu_ms[i]);
+        device_total += pipe.stage_ms[i];
+        cpu_total += cpu_ms[i];
+    }
+    printf("%-12s %12.3f %12.3f\n", "total", device_total, cpu_total);
+    printf("Hysteresis : %d propagation steps || host time %.3f ms || %.1f Mpixels/s on the device\n",
+        pipe.hyst_steps, rtime * 1000 / CLOCKS_PER_SEC, (double)width * height * 1.0e-3 / device_total);
 
+    size_t mismatch = 0, nedges = 0;
+    for (size_t k = 0; k < edges.size(); k++) {
+        if (edges[k] != ref[k])
+            mismatch++;
+        if (ref[k])
+            nedges++;
+    }
+    printf("Edges : %lu pixels, %lu differ from the CPU reference (%.4f%%) -> %s\n",
+        (unsigned long)nedges, (unsigned long)mismatch, 100.0 * mismatch / edges.size(),
+        mismatch <= MATCH_TOL * (nedges ? nedges : 1) ? "ok" : "MISMATCH");
 
-    // Read back the results from the compute device
-    err = clEnqueueReadBuffer(commands, y_out, CL_TRUE, 0, sizeof(unsigned int) * imgHEIGHT * imgWIDTH, grid, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
+    // distance map as a gray image, 1 level per pixel up to 255
+    int distance_ok = 1;
+    if (distance_path)
     {
-        printf("Error: Failed to read output array! %d\n", err);
-        exit(1);
+        float max_err = 0.0f, max_dist = 0.0f;
+        dist.resize(edges.size());
+        err = clEnqueueReadBuffer(commands, pipe.dist, CL_TRUE, 0, sizeof(float) * dist.size(), &dist[0], 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to read the distance map! %d\n", err);
+            exit(1);
+        }
+        for (size_t k = 0; k < dist.size(); k++) {
+            float d = dist[k] == ref_dist[k] ? 0.0f : fabsf(dist[k] - ref_dist[k]);
+            if (!(d <= max_err))
+                max_err = d;            // NaN too
+            if (dist[k] > max_dist && !isinf(dist[k]))
+                max_dist = dist[k];
+            image[k] = (dist[k] < 255.0f ? (unsigned int)dist[k] : 255u) * 0x010101u;
+        }
+        distance_ok = max_err <= DIST_TOL;
+        printf("Distance : %.1f pixels at most from an edge, max error %.2e -> %s\n",
+            max_dist, max_err, distance_ok ? "ok" : "MISMATCH");
+        saveImage(distance_path, width, height, &image[0]);
+        pipe.distance = 0;
     }
 
-    saveBMP("test3.bmp", imgWIDTH, imgHEIGHT, grid, maxIter);
-
-
-
+    // from here on the edges are the coarse to fine ones
+    int multiscale_ok = levels < 2 || runMultiscale(pipe, levels, low, high, edges) == 0;
 
-    rtime = clock() - rtime;
-
-    printf("\nThe kernel ran in %lf ms\n", rtime * 1000 / CLOCKS_PER_SEC);
-
-    // extract timing data from the event, prof_event
-    err = clWaitForEvents(1, &prof_event);
-    cl_ulong ev_start_time = (cl_ulong)0;
-    cl_ulong ev_end_time = (cl_ulong)0;
-    err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_START,
-        sizeof(cl_ulong), &ev_start_time, NULL);
-    err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_END,
-        sizeof(cl_ulong), &ev_end_time, NULL);
-    printf("prof says %f ms \n", (double)(ev_end_time - ev_start_time) * 1.0e-6);
+    // edge map as a gray image
+    for (size_t k = 0; k < edges.size(); k++)
+        image[k] = edges[k] * 0x010101u;
+    saveImage(output_path, width, height, &image[0]);
 
+    int contours_ok = runContours(pipe, pipe.out, &edges[0], width, height, contour_path) == 0;
 
+    if (bench && (runConvBench(pipe) || runLabelBench(pipe, edges, width, height)
+        || runMorphBench(pipe, edges, width, height)))
+        return EXIT_FAILURE;
 
     // cleanup then shutdown
-    clReleaseMemObject(y_out);
+    pipeRelease(pipe);
     clReleaseProgram(program);
-    clReleaseKernel(kernel);
     clReleaseCommandQueue(commands);
     clReleaseContext(context);
 
-    return 0;
-
-
-
+    return mismatch <= MATCH_TOL * (nedges ? nedges : 1) && thresh_ok && images_ok && contours_ok && multiscale_ok && distance_ok ? 0 : EXIT_FAILURE;
 }
@@ -0,0 +1,492 @@
+//------------------------------------------------------------------------------
+//
+// Name:       Integration.cpp
+//
+// Purpose:    Adaptive 1-D / 2-D numerical integration of a user supplied
+//             integrand, generalising the pi_inte kernel of PI_Integral.
+//
+//             The integrand is compiled into the kernel (integrand(x, y) is
+//             prepended to the kernel source), the quadrature rule and the
+//             dimension are build options. Every level evaluates each cell
+//             with the rule on the cell and on its children, cells whose
+//             error estimate is above their share of the tolerance are split
+//             on the device into the next list through an atomic counter,
+//             the others are accumulated into per work group partial sums.
+//
+// Usage:      Integration [-f "expr of x, y"] [-x a b] [-y c d]
+//                         [-rule midpoint|simpson|gauss3|gauss5] [-tol t]
+//                         [-ref exact value]
+//             without -y the integral is 1-D. The default reproduces pi_inte,
+//             4/(1+x*x) over [0,1].
+//
+//------------------------------------------------------------------------------
+
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef APPLE
+#include <OpenCL/opencl.h>
+#include <unistd.h>
+#else
+#include "CL/cl.h"
+#endif
+
+//------------------------------------------------------------------------------
+
+#define INIT_CELLS 64          // initial cells per dimension
+#define MAX_CELLS (1 << 20)    // capacity of the cell lists
+#define MAX_LEVEL 30           // last refinement level, every cell is accepted there
+#define WORKGROUP_SIZE 64      // power of two, the partial sums use a tree reduction
+#define DEFAULT_TOL 1e-10
+
+// quadrature rules, selected at build time with -DRULE=n
+#define RULE_MIDPOINT 0
+#define RULE_SIMPSON 1
+#define RULE_GAUSS3 2
+#define RULE_GAUSS5 3
+#define RULE_COUNT 4
+
+static const char* RuleName[RULE_COUNT] = { "midpoint", "simpson", "gauss3", "gauss5" };
+static const int RulePoints[RULE_COUNT] = { 1, 3, 3, 5 };
+
+//------------------------------------------------------------------------------
+//
+// kernel:  refine
+//
+// Purpose: Evaluate one cell per work item and split it when needed
+//
+// input: cells (x0, x1, y0, y1) of length ncells, tol over the whole domain of
+//        size area, last set on the final level
+//
+// output: next, nnext the children of the split cells
+//         partial (value, error) of the accepted cells, accumulated per work group
+//
+
+const char* KernelSource = "\n" \
+"#pragma OPENCL EXTENSION cl_khr_fp64 : enable                          \n" \
+"#ifndef DIM                                                            \n" \
+"#define DIM 1                                                          \n" \
+"#endif                                                                 \n" \
+"                                                                       \n" \
+"#if RULE == 0                                                          \n" \
+"#define NPTS 1                                                         \n" \
+"__constant double node[1] = { 0.0 };                                   \n" \
+"__constant double weight[1] = { 2.0 };                                 \n" \
+"#elif RULE == 1                                                        \n" \
+"#define NPTS 3                                                         \n" \
+"__constant double node[3] = { -1.0, 0.0, 1.0 };                        \n" \
+"__constant double weight[3] = { 1.0/3.0, 4.0/3.0, 1.0/3.0 };           \n" \
+"#elif RULE == 2                                                        \n" \
+"#define NPTS 3                                                         \n" \
+"__constant double node[3] = { -0.7745966692414834, 0.0,                \n" \
+"                               0.7745966692414834 };                   \n" \
+"__constant double weight[3] = { 5.0/9.0, 8.0/9.0, 5.0/9.0 };           \n" \
+"#else                                                                  \n" \
+"#define NPTS 5                                                         \n" \
+"__constant double node[5] = { -0.9061798459386640, -0.5384693101056831,\n" \
+"                               0.0, 0.5384693101056831,                \n" \
+"                               0.9061798459386640 };                   \n" \
+"__constant double weight[5] = { 0.2369268850561891, 0.4786286704993665,\n" \
+"                                 0.5688888888888889, 0.4786286704993665,\n" \
+"                                 0.2369268850561891 };                 \n" \
+"#endif                                                                 \n" \
+"                                                                       \n" \
+"#if DIM == 2                                                           \n" \
+"#define NCHILD 4                                                       \n" \
+"#else                                                                  \n" \
+"#define NCHILD 2                                                       \n" \
+"#endif                                                                 \n" \
+"                                                                       \n" \
+"double rule(double4 c)                                                 \n" \
+"{                                                                      \n" \
+"   double hx = 0.5*(c.y - c.x), mx = 0.5*(c.y + c.x);                  \n" \
+"   double s = 0;                                                       \n" \
+"   int i;                                                              \n" \
+"#if DIM == 2                                                           \n" \
+"   double hy = 0.5*(c.w - c.z), my = 0.5*(c.w + c.z);                  \n" \
+"   int j;                                                              \n" \
+"   for(i=0; i<NPTS; i++)                                               \n" \
+"       for(j=0; j<NPTS; j++)                                           \n" \
+"           s += weight[i]*weight[j]*integrand(mx + hx*node[i], my + hy*node[j]);\n" \
+"   return s*hx*hy;                                                     \n" \
+"#else                                                                  \n" \
+"   for(i=0; i<NPTS; i++)                                               \n" \
+"       s += weight[i]*integrand(mx + hx*node[i], 0.0);                 \n" \
+"   return s*hx;                                                        \n" \
+"#endif                                                                 \n" \
+"}                                                                      \n" \
+"                                                                       \n" \
+"__kernel void refine(                                                  \n" \
+"   __global const double4* cells,                                      \n" \
+"   const unsigned int ncells,                                          \n" \
+"   __global double4* next,                                             \n" \
+"   __global unsigned int* nnext,                                       \n" \
+"   const unsigned int capacity,                                        \n" \
+"   const double tol,                                                   \n" \
+"   const double area,                                                  \n" \
+"   const unsigned int last,                                            \n" \
+"   __global double* partial,                                           \n" \
+"   __local double* scratch)                                            \n" \
+"{                                                                      \n" \
+"   int id = get_global_id(0);                                          \n" \
+"   int localID = get_local_id(0);                                      \n" \
+"   double value = 0, err = 0;                                          \n" \
+"   int k, stride;                                                      \n" \
+"   if(id < ncells){                                                    \n" \
+"       double4 c = cells[id];                                          \n" \
+"       double4 child[NCHILD];                                          \n" \
+"       double xm = 0.5*(c.x + c.y);                                    \n" \
+"#if DIM == 2                                                           \n" \
+"       double ym = 0.5*(c.z + c.w);                                    \n" \
+"       double size = (c.y - c.x)*(c.w - c.z);                          \n" \
+"       child[0] = (double4)(c.x, xm, c.z, ym);                         \n" \
+"       child[1] = (double4)(xm, c.y, c.z, ym);                         \n" \
+"       child[2] = (double4)(c.x, xm, ym, c.w);                         \n" \
+"       child[3] = (double4)(xm, c.y, ym, c.w);                         \n" \
+"#else                                                                  \n" \
+"       double size = c.y - c.x;                                        \n" \
+"       child[0] = (double4)(c.x, xm, 0.0, 0.0);                        \n" \
+"       child[1] = (double4)(xm, c.y, 0.0, 0.0);                        \n" \
+"#endif                                                                 \n" \
+"       double coarse = rule(c);                                        \n" \
+"       double fine = 0;                                                \n" \
+"       for(k=0; k<NCHILD; k++)                                         \n" \
+"           fine += rule(child[k]);                                     \n" \
+"       double e = fabs(fine - coarse);                                 \n" \
+"       int split = !last && e > tol*size/area;                         \n" \
+"       if(split){                                                      \n" \
+"           unsigned int idx = atomic_add(nnext, NCHILD);               \n" \
+"           if(idx + NCHILD <= capacity){                               \n" \
+"               for(k=0; k<NCHILD; k++)                                 \n" \
+"                   next[idx+k] = child[k]; }                           \n" \
+"           else split = 0;                                             \n" \
+"       }                                                               \n" \
+"       if(!split){                                                     \n" \
+"           value = fine;                                               \n" \
+"           err = e; }                                                  \n" \
+"   }                                                                   \n" \
+"   scratch[2*localID] = value;                                         \n" \
+"   scratch[2*localID+1] = err;                                         \n" \
+"   for(stride=get_local_size(0)/2; stride>0; stride/=2){               \n" \
+"       barrier(CLK_LOCAL_MEM_FENCE);                                   \n" \
+"       if(localID < stride){                                           \n" \
+"           scratch[2*localID] += scratch[2*(localID+stride)];          \n" \
+"           scratch[2*localID+1] += scratch[2*(localID+stride)+1]; }    \n" \
+"   }                                                                   \n" \
+"   if(localID == 0){                                                   \n" \
+"       partial[2*get_group_id(0)] += scratch[0];                       \n" \
+"       partial[2*get_group_id(0)+1] += scratch[1];                     \n" \
+"   }                                                                   \n" \
+"}                                                                      \n" \
+"\n";
+
+//------------------------------------------------------------------------------
+
+
+int main(int argc, char** argv)
+{
+    int          err;                   // error code returned from OpenCL calls
+
+    size_t global;                      // global domain size
+    size_t local;                       // local  domain size
+    size_t max_size;
+
+    const char* expr = "4.0/(1.0+x*x)";
+    double x0 = 0.0, x1 = 1.0, y0 = 0.0, y1 = 1.0;
+    int dim = 1;
+    int rule = RULE_SIMPSON;
+    double tol = DEFAULT_TOL;
+    double ref = 3.14159265358979323846;
+    int has_ref = 1;
+    int i, j;
+
+    cl_device_id     device_id;         // compute device id
+    cl_context       context;           // compute context
+    cl_command_queue commands;          // compute command queue
+    cl_program       program;           // compute program
+    cl_kernel        kernel;            // compute kernel
+
+    cl_mem cells[2];                    // current and next cell lists
+    cl_mem nnext;                       // number of cells written to the next list
+    cl_mem partial;                     // (value, error) per work group
+
+    // parse the command line
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            expr = argv[++i];
+            has_ref = 0;
+        }
+        else if (!strcmp(argv[i], "-x") && i + 2 < argc) {
+            x0 = atof(argv[++i]);
+            x1 = atof(argv[++i]);
+            has_ref = 0;
+        }
+        else if (!strcmp(argv[i], "-y") && i + 2 < argc) {
+            y0 = atof(argv[++i]);
+            y1 = atof(argv[++i]);
+            dim = 2;
+            has_ref = 0;
+        }
+        else if (!strcmp(argv[i], "-rule") && i + 1 < argc) {
+            i++;
+            for (rule = 0; rule < RULE_COUNT && strcmp(argv[i], RuleName[rule]); rule++);
+            if (rule == RULE_COUNT)
+            {
+                printf("Error: unknown rule %s (midpoint, simpson, gauss3, gauss5)\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp(argv[i], "-tol") && i + 1 < argc) {
+            tol = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-ref") && i + 1 < argc) {
+            ref = atof(argv[++i]);
+            has_ref = 1;
+        }
+        else
+        {
+            printf("Usage: %s [-f expr] [-x a b] [-y c d] [-rule midpoint|simpson|gauss3|gauss5] [-tol t] [-ref value]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("Integrand : %s over [%g, %g]", expr, x0, x1);
+    if (dim == 2) printf(" x [%g, %g]", y0, y1);
+    printf(" || rule %s || tol %g\n", RuleName[rule], tol);
+
+    // use whichever one is "first"
+    cl_uint numPlatforms;
+    cl_platform_id firstPlatformId;
+
+    err = clGetPlatformIDs(1, &firstPlatformId, &numPlatforms);
+    if (err != CL_SUCCESS || numPlatforms <= 0)
+    {
+        printf("Error: Failed to find the platform!\n");
+        return EXIT_FAILURE;
+    }
+
+    err = clGetDeviceIDs(firstPlatformId, CL_DEVICE_TYPE_GPU, 1, &device_id, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create a device group!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Create a compute context
+    context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
+    if (!context)
+    {
+        printf("Error: Failed to create a compute context!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Create a command queue ... enable profiling
+    commands = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (!commands)
+    {
+        printf("Error: Failed to create a command commands!\n");
+        return EXIT_FAILURE;
+    }
+
+    // The integrand goes in front of the kernel source, the rule and dimension are build options
+    char* integrand = (char*)malloc(strlen(expr) + 80);
+    sprintf(integrand, "double integrand(double x, double y) { return (double)(%s); }\n", expr);
+    const char* sources[2] = { integrand, KernelSource };
+
+    program = clCreateProgramWithSource(context, 2, sources, NULL, &err);
+    if (!program)
+    {
+        printf("Error: Failed to create compute program!\n");
+        return EXIT_FAILURE;
+    }
+
+    char options[64];
+    sprintf(options, "-DRULE=%d -DDIM=%d", rule, dim);
+    err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build program executable, check the integrand expression!\n");
+        clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        exit(1);
+    }
+
+    kernel = clCreateKernel(program, "refine", &err);
+    if (!kernel || err != CL_SUCCESS)
+    {
+        printf("Error: Failed to create compute kernel!\n");
+        exit(1);
+    }
+
+    // Work group size : power of two that fits the kernel
+    local = WORKGROUP_SIZE;
+    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
+        exit(1);
+    }
+    while (local > max_size) local /= 2;
+
+    // Initial grid, built on the host once
+    unsigned int ncells = dim == 2 ? INIT_CELLS * INIT_CELLS : INIT_CELLS;
+    cl_double4* init = (cl_double4*)malloc(sizeof(cl_double4) * ncells);
+    for (i = 0; i < (dim == 2 ? INIT_CELLS : 1); i++)
+    {
+        for (j = 0; j < INIT_CELLS; j++)
+        {
+            cl_double4* c = &init[i * INIT_CELLS + j];
+            c->s[0] = x0 + (x1 - x0) * j / INIT_CELLS;
+            c->s[1] = x0 + (x1 - x0) * (j + 1) / INIT_CELLS;
+            c->s[2] = dim == 2 ? y0 + (y1 - y0) * i / INIT_CELLS : 0.0;
+            c->s[3] = dim == 2 ? y0 + (y1 - y0) * (i + 1) / INIT_CELLS : 0.0;
+        }
+    }
+    double area = dim == 2 ? (x1 - x0) * (y1 - y0) : (x1 - x0);
+    unsigned int capacity = MAX_CELLS;
+    unsigned int npartial = (unsigned int)((capacity + local - 1) / local);
+
+    // Create the cell lists, the counter and the partial sums in device memory
+    cells[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_double4) * capacity, NULL, NULL);
+    cells[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_double4) * capacity, NULL, NULL);
+    nnext = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+    partial = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(double) * 2 * npartial, NULL, NULL);
+    double* psum_data = (double*)calloc(2 * npartial, sizeof(double));
+    if (!cells[0] || !cells[1] || !nnext || !partial || !psum_data)
+    {
+        printf("Error: Failed to allocate device memory!\n");
+        exit(1);
+    }
+
+    err = clEnqueueWriteBuffer(commands, cells[0], CL_FALSE, 0, sizeof(cl_double4) * ncells, init, 0, NULL, NULL);
+    err |= clEnqueueWriteBuffer(commands, partial, CL_FALSE, 0, sizeof(double) * 2 * npartial, psum_data, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to write to source array!\n");
+        exit(1);
+    }
+
+    // Refinement levels : only the size of the next list comes back to the host
+    double rtime = clock();
+    double device_ms = 0.0;
+    double cells_done = 0.0;
+    const cl_uint zero = 0;
+    int level, cur = 0, overflow = 0;
+    for (level = 0; level <= MAX_LEVEL && ncells > 0; level++)
+    {
+        cl_uint last = level == MAX_LEVEL;
+        cl_uint count;
+        cl_event prof_event;
+
+        err = clEnqueueWriteBuffer(commands, nnext, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+        err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &cells[cur]);
+        err |= clSetKernelArg(kernel, 1, sizeof(unsigned int), &ncells);
+        err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &cells[1 - cur]);
+        err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &nnext);
+        err |= clSetKernelArg(kernel, 4, sizeof(unsigned int), &capacity);
+        err |= clSetKernelArg(kernel, 5, sizeof(double), &tol);
+        err |= clSetKernelArg(kernel, 6, sizeof(double), &area);
+        err |= clSetKernelArg(kernel, 7, sizeof(unsigned int), &last);
+        err |= clSetKernelArg(kernel, 8, sizeof(cl_mem), &partial);
+        err |= clSetKernelArg(kernel, 9, sizeof(double) * 2 * local, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to set kernel arguments! %d\n", err);
+            exit(1);
+        }
+
+        global = ((ncells + local - 1) / local) * local;
+        err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, &prof_event);
+        if (err)
+        {
+            printf("Error: Failed to execute kernel!\n");
+            return EXIT_FAILURE;
+        }
+
+        err = clEnqueueReadBuffer(commands, nnext, CL_TRUE, 0, sizeof(cl_uint), &count, 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to read the cell count! %d\n", err);
+            exit(1);
+        }
+
+        cl_ulong ev_start_time = (cl_ulong)0;
+        cl_ulong ev_end_time = (cl_ulong)0;
+        clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+        clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+        device_ms += (double)(ev_end_time - ev_start_time) * 1.0e-6;
+        clReleaseEvent(prof_event);
+
+        printf(" level %2d : %9u cells, %9u split into the next level\n", level, ncells, (count < capacity ? count : capacity) / (dim == 2 ? 4 : 2));
+        cells_done += ncells;
+
+        // cells that did not fit were accepted as they were
+        if (count > capacity)
+        {
+            overflow = 1;
+            count = capacity;
+        }
+        ncells = count;
+        cur = 1 - cur;
+    }
+
+    // Read back the partial sums, the only large transfer of the run
+    err = clEnqueueReadBuffer(commands, partial, CL_TRUE, 0, sizeof(double) * 2 * npartial, psum_data, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to read output array! %d\n", err);
+        exit(1);
+    }
+
+    // Neumaier sum of the partials
+    double res = 0.0, comp = 0.0, errest = 0.0;
+    for (i = 0; i < (int)npartial; i++)
+    {
+        double v = psum_data[2 * i];
+        double t = res + v;
+        if (fabs(res) >= fabs(v)) comp += (res - t) + v;
+        else comp += (v - t) + res;
+        res = t;
+        errest += psum_data[2 * i + 1];
+    }
+    res += comp;
+
+    rtime = clock() - rtime;
+
+    // evaluations per cell : the cell and its children, NPTS^dim points each
+    int npts = RulePoints[rule];
+    double evals = cells_done * (dim == 2 ? 5.0 * npts * npts : 3.0 * npts);
+
+    printf("\nIntegral = %.16g || error estimate %.3e\n", res, errest);
+    if (has_ref)
+        printf("Reference = %.16g || error %.3e\n", ref, fabs(res - ref));
+    if (overflow)
+        printf("Warning: cell list capacity reached, some cells were not refined\n");
+    if (ncells > 0)
+        printf("Warning: %u cells left after level %d\n", ncells, MAX_LEVEL);
+    printf("%d levels, %.0f cells, %.3e evaluations\n", level, cells_done, evals);
+    printf("Device time %.3lf ms || %.2lf Mevals/s || Total time %.3lf ms\n",
+        device_ms, evals / (device_ms * 1.0e3), rtime * 1000 / CLOCKS_PER_SEC);
+
+    // cleanup then shutdown
+    clReleaseMemObject(cells[0]);
+    clReleaseMemObject(cells[1]);
+    clReleaseMemObject(nnext);
+    clReleaseMemObject(partial);
+    clReleaseProgram(program);
+    clReleaseKernel(kernel);
+    clReleaseCommandQueue(commands);
+    clReleaseContext(context);
+    free(init);
+    free(integrand);
+    free(psum_data);
+
+    return 0;
+}
@@ -6,66 +6,13 @@
 #include <CL/opencl.h>
 #include <iostream>
 #include <time.h>
+#include "../Common/HostBuffer.h"
+#include "../Common/MandelKernel.h"
 
 #define MAX_LOADSTRING 100
 #define BT_NDRANGE 4
 #define BT_SAVE 3
 
-const char* KernelSource = "\n" \
-"__kernel void mandel(                                                                          \n" \
-"   const double x0,                                                                            \n" \
-"   const double y0,                                                                            \n" \
-"   const double stepsize,                                                                      \n" \
-"   const unsigned int maxIter,                                                                 \n" \
-"   __global unsigned int *restrict framebuffer,                                                \n" \
-"   const unsigned int windowWidth                                                              \n" \
-"   )                                                                                           \n" \
-"{// WORK ITEM POSITION                                                                         \n" \
-"   const size_t windowPosX = get_global_id(0);                                                 \n" \
-"   const size_t windowPosY = get_global_id(1);                                                 \n" \
-"   const double stepPosX = x0 + (windowPosX * stepsize);                                       \n" \
-"   const double stepPosY = y0 - (windowPosY * stepsize);                                       \n" \
-"                                                                                               \n" \
-"   double x = 0.0;                                                                             \n" \
-"   double y = 0.0;                                                                             \n" \
-"   double x2 = 0.0;                                                                            \n" \
-"   double y2 = 0.0;                                                                            \n" \
-"   unsigned int i = 0;                                                                         \n" \
-"                                                                                               \n" \
-"   while(x2 + y2 < 4.0 && i < maxIter){                                                        \n" \
-"        x2 = x*x;                                                                              \n" \
-"        y2 = y*y;                                                                              \n" \
-"        y = 2*x*y + stepPosY;                                                                  \n" \
-"        x = x2 - y2 + stepPosX;                                                                \n" \
-"        i++;                          }                                                        \n" \
-"                                                                                               \n" \
-"    if(i >= maxIter) {framebuffer[windowWidth * windowPosY + windowPosX] = 0;return;}          \n" \
-"                                                                                               \n" \
-"    int mod = i%16;                                                                            \n" \
-"    char r, g, b = 0;                                                                          \n" \
-"    switch (mod)                                                                               \n" \
-"    {                                                                                          \n" \
-"        case 0: r = 66; g = 30; b = 15; break;                                                 \n" \
-"        case 1: r = 25; g = 7; b = 26; break;                                                  \n" \
-"        case 2: r = 9; g = 1; b = 47; break;                                                   \n" \
-"        case 3: r = 4; g = 4; b = 73; break;                                                   \n" \
-"        case 4: r = 0; g = 7; b = 100; break;                                                  \n" \
-"        case 5: r = 12; g = 44; b = 138; break;                                                \n" \
-"        case 6: r = 24; g = 82; b = 177; break;                                                \n" \
-"        case 7: r = 57; g = 125; b = 209; break;                                               \n" \
-"        case 8: r = 134; g = 181; b = 229; break;                                              \n" \
-"        case 9: r = 211; g = 236; b = 248; break;                                              \n" \
-"        case 10: r = 241; g = 233; b = 191; break;                                             \n" \
-"        case 11: r = 248; g = 201; b = 95; break;                                              \n" \
-"        case 12: r = 254; g = 170; b = 0; break;                                               \n" \
-"        case 13: r = 204; g = 128; b = 0; break;                                               \n" \
-"        case 14: r = 153; g = 87; b = 0; break;                                                \n" \
-"        case 15: r = 106; g = 52; b = 3; break;                                                \n" \
-"    }                                                                                          \n" \
-"   framebuffer[windowWidth*windowPosY + windowPosX] = (unsigned int)(0 + (r<<16) + (g<<8) + b);\n" \
-"}                                                                                              \n" \
-"\n";
-
 // Variables globales :
 HINSTANCE hInst;                                // instance actuelle
 WCHAR szTitle[MAX_LOADSTRING];                  // Texte de la barre de titre
@@ -93,7 +40,7 @@ cl_kernel kernel;
 cl_command_queue commands;
 cl_program program;
 cl_context context;
-cl_mem y_out;
+hbBuffer y_out;     // framebuffer, mapped into grid between two launches
 cl_ulong ev_start_time = (cl_ulong)0;
 cl_ulong ev_end_time = (cl_ulong)0;
 
@@ -198,14 +145,16 @@ int sendKernel(int useParams) {
     err |= clSetKernelArg(kernel, 1, sizeof(cl_double), &startY);
     err |= clSetKernelArg(kernel, 2, sizeof(cl_double), &step);
     err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &maxIter);
-    err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &y_out);
+    err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &y_out.mem);
     err |= clSetKernelArg(kernel, 5, sizeof(unsigned int), &imgWIDTH);
+    err |= clSetKernelArg(kernel, 6, sizeof(unsigned int), &imgHEIGHT);
 
-    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, dim, NULL, 0, NULL, &prof_event);
-    
-    clFinish(commands);
+    // the device gets the framebuffer back for the launch, then the host maps it again :
+    // no copy at all when the device shares the host memory
+    err |= hbUnmap(commands, y_out, NULL);
+    err |= clEnqueueNDRangeKernel(commands, kernel, 2, NULL, dim, NULL, 0, NULL, &prof_event);
 
-    err = clEnqueueReadBuffer(commands, y_out, CL_TRUE, 0, sizeof(unsigned int) * imgHEIGHT * imgWIDTH, grid, 0, NULL, NULL);
+    grid = (unsigned int*)hbMap(commands, y_out, CL_MAP_READ, NULL);
 
     return err;
 }
@@ -216,7 +165,6 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                      _In_ int       nCmdShow)
 {
     UNREFERENCED_PARAMETER(hPrevInstance);
-    UNREFERENCED_PARAMETER(lpCmdLine);
 
     bitmap_info.bmiHeader.biSize = sizeof(bitmap_info.bmiHeader);
     bitmap_info.bmiHeader.biWidth = imgWIDTH;
@@ -237,10 +185,11 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     cl_device_id device_id;
     cl_uint num_of_devices = 0;
 
-    grid = (unsigned int*)malloc(imgWIDTH * imgHEIGHT * sizeof(unsigned int));
+    // -cpu on the command line runs the kernel on the CPU device
+    cl_device_type device_type = wcsstr(lpCmdLine, L"-cpu") ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU;
 
     clGetPlatformIDs(1, &platform_id, &num_of_platform);
-    clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_GPU, 1, &device_id, &num_of_devices);
+    clGetDeviceIDs(platform_id, device_type, 1, &device_id, &num_of_devices);
 
     properties[0] = CL_CONTEXT_PLATFORM;
     properties[1] = (cl_context_properties)platform_id;
@@ -248,13 +197,13 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
     context = clCreateContext(properties, 1, &device_id, NULL, NULL, &err);
     commands = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
-    program = clCreateProgramWithSource(context, 1, (const char**)&KernelSource, NULL, &err);
+    program = clCreateProgramWithSource(context, 1, &MandelSource, NULL, &err);
     clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
     kernel = clCreateKernel(program, "mandel", &err);
 
     step = 0.0025;
 
-    y_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(unsigned int) * imgHEIGHT * imgWIDTH, NULL, NULL);
+    hbCreate(y_out, context, CL_MEM_WRITE_ONLY, sizeof(unsigned int) * imgHEIGHT * imgWIDTH, hbUnifiedMemory(device_id));
 
     sendKernel(0);
 
@@ -513,13 +462,12 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         }
         break;
     case WM_DESTROY:
-        clReleaseMemObject(y_out);
+        hbRelease(commands, y_out);
         clReleaseProgram(program);
         clReleaseKernel(kernel);
         clReleaseCommandQueue(commands);
         clReleaseContext(context);
         PostQuitMessage(0);
-        free(grid);
         break;
     default:
         return DefWindowProc(hWnd, message, wParam, lParam);
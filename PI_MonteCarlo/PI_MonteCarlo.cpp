@@ -4,37 +4,179 @@
 #include <iostream>
 #include <CL/opencl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <time.h>
+#include "../Common/Philox.h"
+#include "../Common/MonteCarloKernel.h"
 
-#define DATA_SIZE 12800
+#define DATA_SIZE 12800	// points per iteration, two per work-item
 #define ITERMAX 20
+#define SEED 20210323u
 
-const char* KernelSource =
-"__kernel void hello(__global double *input, __global double *output, __local double *localB)\n"\
-"{\n"\
-"	size_t lid = get_local_id(0);\n"\
-"	size_t gid = get_group_id(0);\n"\
-"	size_t gsize = get_local_size(0);\n"\
-"	size_t id = lid+gid*gsize;\n"\
-"	double temp = input[2*id]*input[2*id]+input[2*id+1]*input[2*id+1];\n"\
-"	if(temp < 1){\n"\
-"	localB[lid] = 1;}else{\n"\
-"	localB[lid] = 0;}\n"\
-"	\n"\
-"   int i;                                          \n" \
-"   double x, accu, sum;                                  \n" \
-"   barrier(CLK_LOCAL_MEM_FENCE);                                 \n" \
-"   sum = 0;                                                 \n" \
-"   if(lid == 0){\n" \
-"       for(i=0; i<gsize; i++)                                        \n" \
-"           sum+=localB[i];                                             \n" \
-"       output[gid] =sum;}                                             \n" \
-"}\n"\
-"\n";
+// streaming mode : each work-item loops over STREAM_BLOCKS Philox blocks (two points each) per batch,
+// STREAM_DEPTH batches stay queued on the device while the host consumes the oldest one
+#define STREAM_BLOCKS 256
+#define STREAM_GROUPS_PER_CU 16
+#define STREAM_DEPTH 3
+#define STREAM_REPORT 16
+#define STREAM_TARGET_SE 1e-5
+#define STREAM_MAX_SAMPLES 1e10
 
 clock_t t1, t2;
 
-int main()
+// Streaming estimation : keeps launching batches until the standard error of pi drops
+// under target_se or max_samples are drawn. Batch results come back through non-blocking
+// reads, the host only waits on the read of the oldest batch while the next ones run.
+int runStream(cl_context context, cl_command_queue command_queue, cl_program program, cl_device_id device_id,
+	cl_uint seed, double target_se, double max_samples)
+{
+	cl_int err;
+	cl_kernel kernel;
+	cl_mem output;
+	cl_uint comp_units;
+	size_t max_size, local, global;
+	cl_uint nblocks = STREAM_BLOCKS;
+	int k;
+
+	kernel = clCreateKernel(program, "hello_stream", &err);
+	if (!kernel || err != CL_SUCCESS)
+	{
+		printf("Error: Failed to create compute kernel!\n");
+		return EXIT_FAILURE;
+	}
+
+	//power of two work-group size for the tree reduction, a few groups per compute unit
+	err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, NULL);
+	err |= clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &comp_units, NULL);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to query device limits! %d\n", err);
+		return EXIT_FAILURE;
+	}
+	local = 1;
+	while (local * 2 <= max_size && local < 256)
+		local *= 2;
+	cl_uint ngroups = comp_units * STREAM_GROUPS_PER_CU;
+	global = local * ngroups;
+	double batch_samples = (double)global * nblocks * 2;
+
+	printf(" STREAM : %u work groups of size %d, %.3e samples per batch\n", ngroups, (int)local, batch_samples);
+	printf(" target standard error %g, budget %.3e samples\n\n", target_se, max_samples);
+
+	output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * ngroups * STREAM_DEPTH, NULL, NULL);
+	cl_uint* ring = (cl_uint*)malloc(sizeof(cl_uint) * ngroups * STREAM_DEPTH);
+	if (!output || !ring)
+	{
+		printf("Error: Failed to allocate memory!\n");
+		return EXIT_FAILURE;
+	}
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_uint) * local, NULL);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &seed);
+	err |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &nblocks);
+	if (err != CL_SUCCESS)
+	{
+		printf("Error: Failed to set kernel arguments! %d\n", err);
+		return EXIT_FAILURE;
+	}
+
+	cl_event kernel_event[STREAM_DEPTH], read_event[STREAM_DEPTH];
+	cl_ulong first_start = 0, last_end = 0;
+	cl_ulong hits = 0;
+	double samples = 0, queued_samples = 0;
+	double pi = 0, se = 0, rate = 0;
+	cl_uint batch = 0, done = 0;
+	int stop = 0;
+
+	t1 = clock();
+
+	//enqueue one batch and the non-blocking read of its partials into the host ring
+	for (k = 0; k < STREAM_DEPTH && queued_samples < max_samples; k++) {
+		cl_uint slot = batch % STREAM_DEPTH;
+		err = clSetKernelArg(kernel, 3, sizeof(cl_uint), &batch);
+		err |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &slot);
+		err |= clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global, &local, 0, NULL, &kernel_event[slot]);
+		err |= clEnqueueReadBuffer(command_queue, output, CL_FALSE, sizeof(cl_uint) * ngroups * slot, sizeof(cl_uint) * ngroups,
+			ring + ngroups * slot, 0, NULL, &read_event[slot]);
+		if (err != CL_SUCCESS)
+		{
+			printf("Error: Failed to enqueue batch! %d\n", err);
+			return EXIT_FAILURE;
+		}
+		batch++;
+		queued_samples += batch_samples;
+	}
+	clFlush(command_queue);
+
+	while (done < batch) {
+		cl_uint slot = done % STREAM_DEPTH;
+		cl_ulong ev_start_time = (cl_ulong)0;
+		cl_ulong ev_end_time = (cl_ulong)0;
+
+		//only the oldest batch is waited for, the others keep the device busy
+		clWaitForEvents(1, &read_event[slot]);
+		for (k = 0; k < (int)ngroups; k++)
+			hits += ring[ngroups * slot + k];
+		samples += batch_samples;
+
+		clGetEventProfilingInfo(kernel_event[slot], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+		clGetEventProfilingInfo(kernel_event[slot], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+		if (done == 0)
+			first_start = ev_start_time;
+		last_end = ev_end_time;
+		clReleaseEvent(kernel_event[slot]);
+		clReleaseEvent(read_event[slot]);
+		done++;
+
+		//binomial standard error of 4*p
+		double p = (double)hits / samples;
+		pi = 4.0 * p;
+		se = 4.0 * sqrt(p * (1.0 - p) / samples);
+		rate = samples / ((double)(last_end - first_start) * 1.0e-9);
+		if (se <= target_se || queued_samples >= max_samples)
+			stop = 1;
+
+		if (done % STREAM_REPORT == 0 || (stop && done == batch))
+			printf(" batch %6u  n=%.4e  pi=%.10f  95%% CI [%.10f, %.10f]  %.1f Msamples/s\n",
+				done, samples, pi, pi - 1.96 * se, pi + 1.96 * se, rate * 1.0e-6);
+
+		//refill the freed slot unless the estimate is good enough, in flight batches are still counted
+		if (!stop) {
+			err = clSetKernelArg(kernel, 3, sizeof(cl_uint), &batch);
+			err |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &slot);
+			err |= clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global, &local, 0, NULL, &kernel_event[slot]);
+			err |= clEnqueueReadBuffer(command_queue, output, CL_FALSE, sizeof(cl_uint) * ngroups * slot, sizeof(cl_uint) * ngroups,
+				ring + ngroups * slot, 0, NULL, &read_event[slot]);
+			if (err != CL_SUCCESS)
+			{
+				printf("Error: Failed to enqueue batch! %d\n", err);
+				return EXIT_FAILURE;
+			}
+			clFlush(command_queue);
+			batch++;
+			queued_samples += batch_samples;
+		}
+	}
+
+	t2 = clock();
+	printf("\n ==== STREAM MODE ==== \n");
+	printf("For %.4e samples in %u batches (seed %u) :\n", samples, done, seed);
+	printf("Pi final : %.10f +- %.3e (95%% CI [%.10f, %.10f])\n", pi, 1.96 * se, pi - 1.96 * se, pi + 1.96 * se);
+	printf("Error vs pi : %.3e || target SE %s\n", fabs(pi - 3.14159265358979323846), se <= target_se ? "reached" : "not reached (budget spent)");
+	printf("Device time %.3lfms || %.1f Msamples/s || Total Time %.3lfms\n",
+		(double)(last_end - first_start) * 1.0e-6, rate * 1.0e-6, (((double)t2 - t1) / (double)CLOCKS_PER_SEC) * 1000);
+
+	clReleaseMemObject(output);
+	clReleaseKernel(kernel);
+	free(ring);
+
+	return 0;
+}
+
+int main(int argc, char** argv)
 {
 	t1 = clock();
 
@@ -48,19 +190,27 @@ int main()
 	cl_uint num_of_platform = 0;
 	cl_device_id device_id;
 	cl_uint num_of_devices = 0;
-	cl_mem input, output;
+	cl_mem output;
 	size_t global;
-
-	double inputData[DATA_SIZE * 2] = { 0 };
-	double results[DATA_SIZE] = { 0 };
-	double* psum_data;
+	cl_uint* psum_data;
+	cl_uint seed = SEED;
+	int stream = 0;
+	double target_se = STREAM_TARGET_SE;
+	double max_samples = STREAM_MAX_SAMPLES;
 
 	int i;
 
-	//Init random memory, cannot be done on the GPU
-	for (i = 0; i < DATA_SIZE * 2; i++) {
-		inputData[i] = ((double)rand()) / RAND_MAX;
+	//usage : PI_MonteCarlo [seed]
+	//        PI_MonteCarlo stream [target_se] [max_samples] [seed]
+	//the seed fixes the whole stream, same seed gives the same estimate
+	if (argc > 1 && strcmp(argv[1], "stream") == 0) {
+		stream = 1;
+		if (argc > 2) target_se = atof(argv[2]);
+		if (argc > 3) max_samples = atof(argv[3]);
+		if (argc > 4) seed = (cl_uint)strtoul(argv[4], NULL, 0);
 	}
+	else if (argc > 1)
+		seed = (cl_uint)strtoul(argv[1], NULL, 0);
 
 	//retrieves a list of platforms available
 	if (clGetPlatformIDs(1, &platform_id, &num_of_platform) != CL_SUCCESS)
@@ -87,8 +237,9 @@ int main()
 	//create a command queue using the context and device
 	command_queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
 
-	//create a program from the kernel source code
-	program = clCreateProgramWithSource(context, 1, (const char**)&KernelSource, NULL, &err);
+	//create a program from the generator and kernel source code
+	const char* sources[2] = { PhiloxSource, MonteCarloSource };
+	program = clCreateProgramWithSource(context, 2, sources, NULL, &err);
 
 	//compile the program
 	if (clBuildProgram(program, 0, NULL, NULL, NULL, NULL) != CL_SUCCESS)
@@ -102,10 +253,19 @@ int main()
         exit(1);
     }
 
+	if (stream) {
+		err = runStream(context, command_queue, program, device_id, seed, target_se, max_samples);
+		clReleaseProgram(program);
+		clReleaseCommandQueue(command_queue);
+		clReleaseContext(context);
+		return err;
+	}
+
 	//specify which kernel from the program to execute
 	kernel = clCreateKernel(program, "hello", &err);
 
-	int nworkgroup, max_size, workgroup_size = 32;
+	size_t max_size, workgroup_size = 32;
+	int nworkgroup;
 	// Get the maximum work group size for executing the kernel on the device
 	err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE,
 		sizeof(max_size), &max_size, NULL);
@@ -117,137 +277,120 @@ int main()
 	if (max_size > workgroup_size) workgroup_size = max_size;
 
 	// Now that we know the size of the work_groups, we can set the number of work
-	// groups, the actual number of steps, and the step size
-	nworkgroup = DATA_SIZE / (workgroup_size * 1);
+	// groups, the work group size has to divide the number of work-items
+	global = DATA_SIZE / 2;
+	while (global % workgroup_size)
+		workgroup_size /= 2;
+	nworkgroup = (int)(global / workgroup_size);
 
-	if (nworkgroup < 1)
-	{
-		int comp_units;
-		err = clGetDeviceInfo(device_id, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &comp_units, NULL);
-		if (err != CL_SUCCESS)
-		{
-			printf("Error: Failed to access device number of compute units !\n");
-			return EXIT_FAILURE;
-		}
-		nworkgroup = comp_units;
-		workgroup_size = DATA_SIZE / (nworkgroup * 1);
-	}
-
-	psum_data = (double*)malloc(sizeof(double) * nworkgroup);
+	psum_data = (cl_uint*)malloc(sizeof(cl_uint) * nworkgroup * ITERMAX);
 
-	printf(" %d work groups of size %d.  %d Integration steps\n",
+	printf(" %d work groups of size %d.  %d points per iteration\n",
 		(int)nworkgroup, (int)workgroup_size, DATA_SIZE);
 
-	//create buffers for the input and output
-	input = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(double) * DATA_SIZE * 2, NULL, NULL);
-	output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(double) * nworkgroup, NULL, NULL);
-
-	//load data into the input buffer
-	clEnqueueWriteBuffer(command_queue, input, CL_TRUE, 0, sizeof(double) * DATA_SIZE * 2, inputData, 0, NULL, NULL);
-
+	//one partial count per group and per iteration, nothing is uploaded
+	output = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_uint) * nworkgroup * ITERMAX, NULL, NULL);
+	if (!output)
+	{
+		printf("Error: Failed to allocate device memory!\n");
+		exit(1);
+	}
 
 	//set the argument list for the kernel command
-	clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
-	clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
-	clSetKernelArg(kernel, 2, sizeof(double)* workgroup_size, NULL);
-	global = DATA_SIZE;
+	clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+	clSetKernelArg(kernel, 1, sizeof(cl_uint) * workgroup_size, NULL);
+	clSetKernelArg(kernel, 2, sizeof(cl_uint), &seed);
 	size_t local = workgroup_size;
 
 	int j;
-	double rf = 0;
 	double piFinal = 0;
 	double otimeSum = 0;
-	cl_event prof_event;
+	cl_event prof_event[ITERMAX];
 	for (j = 0; j < ITERMAX; j++) {
-		//Init random memory, cannot be done on the GPU
-		for (i = 0; i < DATA_SIZE * 2; i++) {
-			inputData[i] = ((double)rand()) / RAND_MAX;
-		}
-
-		//enqueue the kernel command for execution
-		clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global, &local, 0, NULL, &prof_event);
+		cl_uint iter = j;
 
-		//wait for queue to empty
-		clFinish(command_queue);
-
-		//copy the result from out of the output buffer
-		clEnqueueReadBuffer(command_queue, output, CL_TRUE, 0, sizeof(double) * nworkgroup, psum_data, 0, NULL, NULL);
-
-		for (i = 0;i < nworkgroup;i++) {
-			rf += psum_data[i];
+		//enqueue the kernel command for execution, the iteration selects the random stream
+		clSetKernelArg(kernel, 3, sizeof(cl_uint), &iter);
+		err = clEnqueueNDRangeKernel(command_queue, kernel, 1, NULL, &global, &local, 0, NULL, &prof_event[j]);
+		if (err != CL_SUCCESS)
+		{
+			printf("Error: Failed to execute kernel! %d\n", err);
+			return EXIT_FAILURE;
 		}
-		rf /= DATA_SIZE;
-		rf *= 4;
+	}
+
+	//copy all the partial counts at once, blocking on the end of the queue
+	clEnqueueReadBuffer(command_queue, output, CL_TRUE, 0, sizeof(cl_uint) * nworkgroup * ITERMAX, psum_data, 0, NULL, NULL);
 
-		piFinal += rf;
+	cl_ulong hits = 0;
+	for (i = 0; i < nworkgroup * ITERMAX; i++) {
+		hits += psum_data[i];
+	}
+	piFinal = 4.0 * (double)hits / ((double)DATA_SIZE * ITERMAX);
 
+	for (j = 0; j < ITERMAX; j++) {
 		// extract timing data from the event, prof_event
-		err = clWaitForEvents(1, &prof_event);
 		cl_ulong ev_start_time = (cl_ulong)0;
 		cl_ulong ev_end_time = (cl_ulong)0;
-		err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_START,
+		err = clGetEventProfilingInfo(prof_event[j], CL_PROFILING_COMMAND_START,
 			sizeof(cl_ulong), &ev_start_time, NULL);
-		err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_END,
+		err = clGetEventProfilingInfo(prof_event[j], CL_PROFILING_COMMAND_END,
 			sizeof(cl_ulong), &ev_end_time, NULL);
 		otimeSum += (double)(ev_end_time - ev_start_time) * 1.0e-6;
+		clReleaseEvent(prof_event[j]);
 	}
 
-	piFinal /= ITERMAX;
-		
-	
-
-	
-
 	//cleanup - release OpenCL ressources
-	clReleaseMemObject(input);
 	clReleaseMemObject(output);
 	clReleaseProgram(program);
 	clReleaseKernel(kernel);
 	clReleaseCommandQueue(command_queue);
 	clReleaseContext(context);
-
-
-	
+	free(psum_data);
 
 
 	t2 = clock();
 	printf("\n ==== PAR MODE ==== \n");
-	printf("For %d iterations :\n", DATA_SIZE* ITERMAX);
-	printf("Pi final : %g\n ", piFinal);
+	printf("For %d iterations (seed %u) :\n", DATA_SIZE* ITERMAX, seed);
+	printf("Pi final : %g (%llu hits)\n ", piFinal, (unsigned long long)hits);
 	printf("Total Time OpenCL %.3lfms\n", (((double)t2 - t1) / (double)CLOCKS_PER_SEC) * 1000);
 
 	printf("prof says %f ms \n", otimeSum);
 
-	//seq mode
+	//seq mode, same counters and key so the hit count must be identical
 	t1 = clock();
 
-	rf = 0;
+	cl_ulong seq_hits = 0;
 	int jseq;
 
 	for (jseq = 0; jseq < ITERMAX; jseq++) {
-		for (i = 0; i < DATA_SIZE * 2; i++) {
-			inputData[i] = ((double)rand()) / RAND_MAX;
-		}
-
-		double inc = 0;
-		for (i = 0; i < DATA_SIZE; i++) {
-			double temp0 = inputData[2 * i] * inputData[2 * i] + inputData[2 * i + 1] * inputData[2 * i + 1];
-			if (temp0 < 1) {
-				inc += 1;
+		for (i = 0; i < DATA_SIZE / 2; i++) {
+			unsigned int ctr[4] = { (unsigned int)i, (unsigned int)jseq, 0, 0 };
+			unsigned int key[2] = { seed, 0 };
+			unsigned int r[4];
+			philox4x32_10(ctr, key, r);
+
+			double x0 = philox_u01(r[0]), y0 = philox_u01(r[1]);
+			double x1 = philox_u01(r[2]), y1 = philox_u01(r[3]);
+			if (x0 * x0 + y0 * y0 < 1) {
+				seq_hits++;
+			}
+			if (x1 * x1 + y1 * y1 < 1) {
+				seq_hits++;
 			}
 		}
-
-		//compute the results
-		rf += 4 * inc / DATA_SIZE;
 	}
 
-	rf /= ITERMAX;
+	double rf = 4.0 * (double)seq_hits / ((double)DATA_SIZE * ITERMAX);
 
 	t2 = clock();
 	printf("\n ==== SEQ MODE ==== \n");
-	printf("For %d iterations :\n", DATA_SIZE* ITERMAX);
-	printf("Pi final : %g\n ", rf);
+	printf("For %d iterations (seed %u) :\n", DATA_SIZE* ITERMAX, seed);
+	printf("Pi final : %g (%llu hits)\n ", rf, (unsigned long long)seq_hits);
 	printf("Total Time Seq %.3lfms\n", (((double)t2 - t1) / (double)CLOCKS_PER_SEC) * 1000);
 
+	if (seq_hits != hits)
+		printf("Error: device and host hit counts differ!\n");
+
 	return 0;
-}
\ No newline at end of file
+}
@@ -23,11 +23,15 @@
 #else
 #include "CL/cl.h"
 #endif
+#include "../Common/HostBuffer.h"
+#include "../Common/Trace.h"
 
 //------------------------------------------------------------------------------
 
 #define TOL    (0.001)   // tolerance used in floating point comparisons
 #define LENGTH (1024)    // length of vectors a, b, and c
+#define BENCH_LENGTH (1 << 22)    // default length of the copy / zero copy benchmark
+#define BENCH_REPEAT 10
 
 //------------------------------------------------------------------------------
 //
@@ -55,13 +59,145 @@ const char* KernelSource = "\n" \
 
 //------------------------------------------------------------------------------
 
+// duration of a profiled command in ms, 0 when no command was enqueued, releases the event
+static double eventMs(cl_event ev)
+{
+    cl_ulong ev_start_time = (cl_ulong)0;
+    cl_ulong ev_end_time = (cl_ulong)0;
+
+    if (!ev)
+        return 0.0;
+    clWaitForEvents(1, &ev);
+    clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+    clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+    clReleaseEvent(ev);
+    return (double)(ev_end_time - ev_start_time) * 1.0e-6;
+}
+
+//------------------------------------------------------------------------------
+//
+// Benchmark : the same vadd with device copies (write / read) and with zero copy
+// buffers (map / unmap over CL_MEM_USE_HOST_PTR), timed per phase with events.
+// On a CPU or integrated device the transfer phases should vanish in zero copy mode.
+//
+
+int runBench(cl_context context, cl_command_queue commands, cl_kernel kernel, size_t local, unsigned int count)
+{
+    int err;
+    unsigned int i;
+    int mode, r;
+    double in_ms[2], run_ms[2], out_ms[2], host_ms[2];
+    size_t global = ((count + local - 1) / local) * local;
+    size_t bytes = sizeof(float) * count;
+
+    float* a_data = (float*)malloc(bytes);
+    float* b_data = (float*)malloc(bytes);
+    if (!a_data || !b_data)
+    {
+        printf("Error: Failed to allocate host memory!\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < count; i++) {
+        a_data[i] = rand() / (float)RAND_MAX;
+        b_data[i] = rand() / (float)RAND_MAX;
+    }
+
+    for (mode = 0; mode < 2; mode++)
+    {
+        hbBuffer a_in, b_in, c_out;
+        err = hbCreate(a_in, context, CL_MEM_READ_ONLY, bytes, mode);
+        err |= hbCreate(b_in, context, CL_MEM_READ_ONLY, bytes, mode);
+        err |= hbCreate(c_out, context, CL_MEM_WRITE_ONLY, bytes, mode);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to allocate device memory!\n");
+            return EXIT_FAILURE;
+        }
+        err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_in.mem);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in.mem);
+        err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_out.mem);
+        err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &count);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to set kernel arguments! %d\n", err);
+            return EXIT_FAILURE;
+        }
+
+        in_ms[mode] = run_ms[mode] = out_ms[mode] = 0.0;
+        unsigned int correct = 0;
+        double rtime = clock();
+        for (r = 0; r < BENCH_REPEAT; r++)
+        {
+            cl_event ev[6];
+
+            // the host fills the buffers in place in both modes
+            float* a_map = (float*)hbMap(commands, a_in, CL_MAP_WRITE, &ev[0]);
+            float* b_map = (float*)hbMap(commands, b_in, CL_MAP_WRITE, &ev[1]);
+            memcpy(a_map, a_data, bytes);
+            memcpy(b_map, b_data, bytes);
+            hbUnmap(commands, a_in, &ev[2]);
+            hbUnmap(commands, b_in, &ev[3]);
+
+            err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, &ev[4]);
+            if (err)
+            {
+                printf("Error: Failed to execute kernel!\n");
+                return EXIT_FAILURE;
+            }
+
+            float* c_res = (float*)hbMap(commands, c_out, CL_MAP_READ, &ev[5]);
+            if (r == BENCH_REPEAT - 1)
+                for (i = 0; i < count; i++)
+                {
+                    float tmp = a_data[i] + b_data[i] - c_res[i];
+                    if (tmp * tmp < TOL * TOL)
+                        correct++;
+                }
+            hbUnmap(commands, c_out, NULL);
+
+            in_ms[mode] += eventMs(ev[0]) + eventMs(ev[1]) + eventMs(ev[2]) + eventMs(ev[3]);
+            run_ms[mode] += eventMs(ev[4]);
+            out_ms[mode] += eventMs(ev[5]);
+        }
+        clFinish(commands);
+        host_ms[mode] = (clock() - rtime) * 1000 / CLOCKS_PER_SEC;
+
+        printf("%-10s : in %8.3f ms || kernel %8.3f ms || out %8.3f ms || host total %8.3f ms || %u / %u correct\n",
+            mode ? "zero copy" : "copy", in_ms[mode] / BENCH_REPEAT, run_ms[mode] / BENCH_REPEAT, out_ms[mode] / BENCH_REPEAT,
+            host_ms[mode] / BENCH_REPEAT, correct, count);
+
+        hbRelease(commands, a_in);
+        hbRelease(commands, b_in);
+        hbRelease(commands, c_out);
+    }
+
+    printf("Transfer time removed : %.3f ms per run (%.1f%% of the copy mode host time)\n",
+        (in_ms[0] + out_ms[0] - in_ms[1] - out_ms[1]) / BENCH_REPEAT,
+        100.0 * (host_ms[0] - host_ms[1]) / host_ms[0]);
+
+    free(a_data);
+    free(b_data);
+    return 0;
+}
+
+// adds a command to the trace and drops our reference to its event
+static void traceEvent(trTrace& trace, const char* name, cl_event ev)
+{
+    if (!ev)
+        return;
+    trAdd(trace, name, 1, ev);
+    clReleaseEvent(ev);
+}
+
+//------------------------------------------------------------------------------
+
 
 int main(int argc, char** argv)
 {
     int          err;                   // error code returned from OpenCL calls
     float        a_data[LENGTH];        // a vector 
     float        b_data[LENGTH];        // b vector 
-    float        c_res[LENGTH];        // c vector (a+b) returned from the compute device
+    float*       c_res;                 // c vector (a+b) mapped from the compute device
     unsigned int correct;               // number of correct results  
 
     size_t global;                      // global domain size  
@@ -73,17 +209,37 @@ int main(int argc, char** argv)
     cl_program       program;           // compute program
     cl_kernel        kernel;            // compute kernel
 
-    cl_mem a_in;                        // device memory used for the input  a vector
-    cl_mem b_in;                        // device memory used for the input  b vector
-    cl_mem c_out;                       // device memory used for the output c vector
+    hbBuffer a_in;                      // memory used for the input  a vector
+    hbBuffer b_in;                      // memory used for the input  b vector
+    hbBuffer c_out;                     // memory used for the output c vector
 
-    // Fill vectors a and b with random float values
+    // usage : Profiling [-cpu] [-copy] [-trace file.json] [bench [length]]
+    cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+    const char* trace_path = NULL;
+    int force_copy = 0;
+    int bench = 0;
+    unsigned int bench_length = BENCH_LENGTH;
     int i = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-cpu") == 0) device_type = CL_DEVICE_TYPE_CPU;
+        else if (strcmp(argv[i], "-copy") == 0) force_copy = 1;
+        else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) trace_path = argv[++i];
+        else if (strcmp(argv[i], "bench") == 0) bench = 1;
+        else if (bench) bench_length = (unsigned int)atof(argv[i]);
+    }
+
+    trTrace trace;
+    trInit(trace);
+    trLane(trace, 1, "commands");
+
+    // Fill vectors a and b with random float values
+    int span = trBegin(trace, "fill");
     int count = LENGTH;
     for (i = 0; i < count; i++) {
         a_data[i] = rand() / (float)RAND_MAX;
         b_data[i] = rand() / (float)RAND_MAX;
     }
+    trEnd(trace, span);
 
     // use whichever one is "first"
     cl_uint numPlatforms;
@@ -96,7 +252,7 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    err = clGetDeviceIDs(firstPlatformId, CL_DEVICE_TYPE_GPU, 1, &device_id, NULL);
+    err = clGetDeviceIDs(firstPlatformId, device_type, 1, &device_id, NULL);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to create a device group!\n");
@@ -104,6 +260,7 @@ int main(int argc, char** argv)
     }
 
     // Create a compute context 
+    span = trBegin(trace, "setup");
     context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
     if (!context)
     {
@@ -148,51 +305,76 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    // Create the input (a, b) and output (c) arrays in device memory  
-    a_in = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, NULL);
-    b_in = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, NULL);
-    c_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * count, NULL, NULL);
-    if (!a_in || !b_in || !c_out)
+    // Get the maximum work group size for executing the kernel on the device
+    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
+    if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to allocate device memory!\n");
+        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
         exit(1);
     }
+    trEnd(trace, span);
 
-    // Write a and b vectors into compute device memory 
-    err = clEnqueueWriteBuffer(commands, a_in, CL_TRUE, 0, sizeof(float) * count, a_data, 0, NULL, NULL);
+    if (bench)
+    {
+        printf("Device %s host unified memory\n", hbUnifiedMemory(device_id) ? "shares the" : "does not share the");
+        err = runBench(context, commands, kernel, local, bench_length);
+        clReleaseProgram(program);
+        clReleaseKernel(kernel);
+        clReleaseCommandQueue(commands);
+        clReleaseContext(context);
+        return err;
+    }
+
+    // Create the input (a, b) and output (c) arrays, shared with the host when the device allows it
+    int zero_copy = !force_copy && hbUnifiedMemory(device_id);
+    err = hbCreate(a_in, context, CL_MEM_READ_ONLY, sizeof(float) * count, zero_copy);
+    err |= hbCreate(b_in, context, CL_MEM_READ_ONLY, sizeof(float) * count, zero_copy);
+    err |= hbCreate(c_out, context, CL_MEM_WRITE_ONLY, sizeof(float) * count, zero_copy);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to write a_data to source array!\n");
+        printf("Error: Failed to allocate device memory!\n");
+        exit(1);
+    }
+
+    // Write a and b vectors into the buffers, unmapping hands them to the device
+    cl_event map_event[4];
+    span = trBegin(trace, "upload");
+    float* a_map = (float*)hbMap(commands, a_in, CL_MAP_WRITE, &map_event[0]);
+    float* b_map = (float*)hbMap(commands, b_in, CL_MAP_WRITE, &map_event[1]);
+    if (!a_map || !b_map)
+    {
+        printf("Error: Failed to map the source arrays!\n");
         exit(1);
     }
-    err = clEnqueueWriteBuffer(commands, b_in, CL_TRUE, 0, sizeof(float) * count, b_data, 0, NULL, NULL);
+    memcpy(a_map, a_data, sizeof(float) * count);
+    memcpy(b_map, b_data, sizeof(float) * count);
+    err = hbUnmap(commands, a_in, &map_event[2]);
+    err |= hbUnmap(commands, b_in, &map_event[3]);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to write b_data to source array!\n");
+        printf("Error: Failed to write a_data to source array!\n");
         exit(1);
     }
+    traceEvent(trace, "map a", map_event[0]);
+    traceEvent(trace, "map b", map_event[1]);
+    traceEvent(trace, "unmap a", map_event[2]);
+    traceEvent(trace, "unmap b", map_event[3]);
+    trEnd(trace, span);
 
     // Set the arguments to our compute kernel
     err = 0;
-    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_in);
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in);
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_out);
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_in.mem);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in.mem);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_out.mem);
     err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &count);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to set kernel arguments! %d\n", err);
         exit(1);
     }
-
-    // Get the maximum work group size for executing the kernel on the device
-    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
-        exit(1);
-    }
     double rtime;
     rtime = clock();
+    span = trBegin(trace, "kernel");
 
     // Execute the kernel over the entire range of our 1d input data set
     // using the maximum number of work group items for this device
@@ -204,12 +386,14 @@ int main(int argc, char** argv)
         printf("Error: Failed to execute kernel!\n");
         return EXIT_FAILURE;
     }
+    trAdd(trace, "vadd", 1, prof_event);
 
     // Wait for the commands to complete before reading back results
     clFinish(commands);
     rtime = clock() - rtime;
+    trEnd(trace, span);
 
-    printf("\nThe kernel ran in %lf seconds\n", rtime);
+    printf("\nThe kernel ran in %lf seconds\n", rtime / CLOCKS_PER_SEC);
 
     // extract timing data from the event, prof_event
     err = clWaitForEvents(1, &prof_event);
@@ -220,18 +404,23 @@ int main(int argc, char** argv)
     err = clGetEventProfilingInfo(prof_event, CL_PROFILING_COMMAND_END,
         sizeof(cl_ulong), &ev_end_time, NULL);
     printf("prof says %f secs \n", (double)(ev_end_time - ev_start_time) * 1.0e-9);
+    clReleaseEvent(prof_event);
 
 
 
-    // Read back the results from the compute device
-    err = clEnqueueReadBuffer(commands, c_out, CL_TRUE, 0, sizeof(float) * count, c_res, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
+    // Map the results, a read back only when the device has its own memory
+    span = trBegin(trace, "download");
+    c_res = (float*)hbMap(commands, c_out, CL_MAP_READ, &map_event[0]);
+    if (!c_res)
     {
-        printf("Error: Failed to read output array! %d\n", err);
+        printf("Error: Failed to read output array!\n");
         exit(1);
     }
+    traceEvent(trace, "map c", map_event[0]);
+    trEnd(trace, span);
 
     // Test the results
+    span = trBegin(trace, "verify");
     correct = 0;
     float tmp;
     for (i = 0; i < count; i++)
@@ -246,13 +435,18 @@ int main(int argc, char** argv)
 
     }
 
+    trEnd(trace, span);
+
     // summarize results
     printf("C = A+B:  %d out of %d results were correct.\n", correct, count);
+    if (trace_path)
+        trWrite(trace, trace_path);
+    trRelease(trace);
 
     // cleanup then shutdown
-    clReleaseMemObject(a_in);
-    clReleaseMemObject(b_in);
-    clReleaseMemObject(c_out);
+    hbRelease(commands, a_in);
+    hbRelease(commands, b_in);
+    hbRelease(commands, c_out);
     clReleaseProgram(program);
     clReleaseKernel(kernel);
     clReleaseCommandQueue(commands);
@@ -17,37 +17,1003 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "CL/cl.h"
+#include "../Common/HostBuffer.h"
+#include "../Common/BufferPool.h"
+#include "../Common/Blas1.h"
+#include "../Common/Trace.h"
+#include "../Common/VaddKernel.h"
 
 
 //------------------------------------------------------------------------------
 
 #define TOL    (0.001)   // tolerance used in floating point comparisons
 #define LENGTH (1024)    // length of vectors a, b, and c
+#define STREAM_LENGTH (1 << 26)    // default length in streaming mode
+#define STREAM_CHUNK (1 << 20)     // elements per chunk in streaming mode
+#define STREAM_SLOTS 2             // chunks in flight, double buffering
+#define JOBS 2000                  // default number of jobs in jobs mode
+#define JOB_MIN 64                 // smallest job, in elements
+#define JOB_MAX (1 << 14)          // largest job, in elements : BP_SLAB_MAX bytes, all carved from slabs
+#define TUNE_LENGTH (1 << 24)      // default length in tuning mode
+#define TUNE_REPEAT 5              // runs per configuration, the fastest is kept
+#define BLAS_LENGTH (1 << 22)      // default length in BLAS benchmark mode
+#define BLAS_ALPHA 0.5
+#define TUNE_FILE "VectorAdd.tune" // choice of the tuner per device
 
 //------------------------------------------------------------------------------
 //
-// kernel:  vadd  
+// kernel:  vadd_vec
 //
-// Purpose: Compute the elementwise sum c = a+b
-// 
-// input: a and b float vectors of length count
-//
-// output: c float vector of length count holding the sum a + b
+// Purpose: Same sum, built with -DVEC=n (1, 2, 4, 8 or 16) floats per load and
+//          -DCOARSEN=k vectors per work-item and loop trip. The work-items walk
+//          the vectors with a grid-stride loop, so any global size covers the
+//          whole range and consecutive work-items stay on consecutive vectors.
+//          The count % VEC last floats are added by the first work-items.
 //
 
-const char* KernelSource = "\n" \
-"__kernel void vadd(                                                    \n" \
-"   __global float* a,                                                  \n" \
-"   __global float* b,                                                  \n" \
+const char* VecKernelSource = "\n" \
+"#ifndef VEC                                                            \n" \
+"#define VEC 4                                                          \n" \
+"#endif                                                                 \n" \
+"#ifndef COARSEN                                                        \n" \
+"#define COARSEN 1                                                      \n" \
+"#endif                                                                 \n" \
+"#define CAT(a, b) a##b                                                 \n" \
+"#define XCAT(a, b) CAT(a, b)                                           \n" \
+"#if VEC == 1                                                           \n" \
+"#define VLOAD(i, p) (p)[i]                                             \n" \
+"#define VSTORE(v, i, p) (p)[i] = (v)                                   \n" \
+"#else                                                                  \n" \
+"#define VLOAD(i, p) XCAT(vload, VEC)(i, p)                             \n" \
+"#define VSTORE(v, i, p) XCAT(vstore, VEC)(v, i, p)                     \n" \
+"#endif                                                                 \n" \
+"__kernel void vadd_vec(                                                \n" \
+"   __global const float* a,                                            \n" \
+"   __global const float* b,                                            \n" \
 "   __global float* c,                                                  \n" \
 "   const unsigned int count)                                           \n" \
 "{                                                                      \n" \
-"   int i = get_global_id(0);                                           \n" \
-"   if(i < count)                                                       \n" \
-"       c[i] = a[i] + b[i];                                             \n" \
+"   size_t nvec = count / VEC;                                          \n" \
+"   size_t stride = get_global_size(0);                                 \n" \
+"   size_t i, j;                                                        \n" \
+"   int k;                                                              \n" \
+"   for (i = get_global_id(0); i < nvec; i += stride * COARSEN)         \n" \
+"       for (k = 0; k < COARSEN; k++) {                                 \n" \
+"           j = i + k * stride;                                         \n" \
+"           if (j < nvec)                                               \n" \
+"               VSTORE(VLOAD(j, a) + VLOAD(j, b), j, c);                \n" \
+"       }                                                               \n" \
+"   j = nvec * VEC + get_global_id(0);                                  \n" \
+"   if (j < count)                                                      \n" \
+"       c[j] = a[j] + b[j];                                             \n" \
 "}                                                                      \n" \
 "\n";
 
+static const int tune_vec[] = { 1, 2, 4, 8, 16 };
+static const int tune_coarsen[] = { 1, 2, 4, 8 };
+static const size_t tune_local[] = { 32, 64, 128, 256, 512, 1024 };
+
+// adds the command to the trace when there is one, then releases the event
+static void traceCommand(trTrace* trace, const char* name, int lane, cl_event event)
+{
+    if (trace)
+        trAdd(*trace, name, lane, event);
+    if (event)
+        clReleaseEvent(event);
+}
+
+// fastest of TUNE_REPEAT runs of the kernel, in ms from the profiling events,
+// every run traced as name
+double timeKernel(cl_command_queue queue, cl_kernel kernel, size_t global, size_t local, trTrace* trace, const char* name)
+{
+    double best = -1.0;
+    int r;
+    for (r = 0; r < TUNE_REPEAT; r++)
+    {
+        cl_event event;
+        cl_ulong ev_start_time = (cl_ulong)0;
+        cl_ulong ev_end_time = (cl_ulong)0;
+        if (clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, &local, 0, NULL, &event) != CL_SUCCESS)
+            return -1.0;
+        clWaitForEvents(1, &event);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+        traceCommand(trace, name, 1, event);
+        double ms = (double)(ev_end_time - ev_start_time) * 1.0e-6;
+        if (best < 0.0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+//------------------------------------------------------------------------------
+//
+// The tuner keeps its choice per device name in TUNE_FILE, one line each :
+// name <tab> VEC COARSEN local copy-peak-GB/s. The default run and stream then
+// build vadd_vec with it, VEC 0 standing for the plain vadd.
+//
+
+struct vaddTuned {
+    int vec, coarsen;           // 0 for the plain vadd
+    size_t local;               // 0 for the largest the kernel takes
+    double peak;                // copy peak of the device in GB/s, 0 if unknown
+};
+
+static void deviceName(cl_device_id device_id, char* name, size_t size)
+{
+    name[0] = 0;
+    clGetDeviceInfo(device_id, CL_DEVICE_NAME, size, name, NULL);
+    name[size - 1] = 0;
+}
+
+// the choice of the tuner for this device, 0 if it never ran on it
+static int loadTuned(cl_device_id device_id, vaddTuned& vt)
+{
+    char name[256], line[512];
+    int found = 0;
+    FILE* f = fopen(TUNE_FILE, "r");
+    if (!f)
+        return 0;
+    deviceName(device_id, name, sizeof(name));
+    while (!found && fgets(line, sizeof(line), f)) {
+        char* tab = strchr(line, '\t');
+        unsigned long local;
+        if (!tab || (size_t)(tab - line) != strlen(name) || strncmp(line, name, tab - line) != 0)
+            continue;
+        if (sscanf(tab + 1, "%d %d %lu %lf", &vt.vec, &vt.coarsen, &local, &vt.peak) == 4) {
+            vt.local = local;
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// replaces the line of this device in TUNE_FILE, the other devices are kept
+static void saveTuned(cl_device_id device_id, const vaddTuned& vt)
+{
+    char name[256], line[512];
+    char* kept = NULL;
+    size_t kept_len = 0;
+    FILE* f = fopen(TUNE_FILE, "r");
+    deviceName(device_id, name, sizeof(name));
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            size_t n = strlen(line);
+            if (strncmp(line, name, strlen(name)) == 0 && line[strlen(name)] == '\t')
+                continue;
+            char* grown = (char*)realloc(kept, kept_len + n + 1);
+            if (!grown)
+                break;
+            kept = grown;
+            memcpy(kept + kept_len, line, n + 1);
+            kept_len += n;
+        }
+        fclose(f);
+    }
+    f = fopen(TUNE_FILE, "w");
+    if (!f) {
+        printf("Error: Failed to write %s!\n", TUNE_FILE);
+        free(kept);
+        return;
+    }
+    if (kept)
+        fputs(kept, f);
+    fprintf(f, "%s\t%d %d %lu %.3lf\n", name, vt.vec, vt.coarsen, (unsigned long)vt.local, vt.peak);
+    fclose(f);
+    free(kept);
+}
+
+// vadd_vec built as tuned, NULL when the plain vadd was the best or on failure
+static cl_kernel buildTuned(cl_context context, cl_device_id device_id, const vaddTuned& vt, cl_program* program)
+{
+    char options[64];
+    cl_int err;
+    cl_kernel kernel;
+
+    *program = NULL;
+    if (vt.vec == 0)
+        return NULL;
+    sprintf(options, "-DVEC=%d -DCOARSEN=%d", vt.vec, vt.coarsen);
+    *program = clCreateProgramWithSource(context, 1, (const char**)&VecKernelSource, NULL, &err);
+    if (!*program)
+        return NULL;
+    err = clBuildProgram(*program, 1, &device_id, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        size_t len;
+        char buffer[2048];
+
+        printf("Error: Failed to build the tuned vadd_vec %s!\n", options);
+        clGetProgramBuildInfo(*program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        clReleaseProgram(*program);
+        *program = NULL;
+        return NULL;
+    }
+    kernel = clCreateKernel(*program, "vadd_vec", &err);
+    if (!kernel)
+    {
+        printf("Error: Failed to create the tuned vadd_vec %s! %d\n", options, err);
+        clReleaseProgram(*program);
+        *program = NULL;
+    }
+    return kernel;
+}
+
+// work-items over count elements for the tuned kernel, a multiple of local
+static size_t tunedGlobal(const vaddTuned& vt, size_t count, size_t local)
+{
+    size_t items = count;
+    if (vt.vec > 0) {
+        // one per COARSEN vectors, at least enough for the count % VEC tail
+        items = (count / vt.vec + vt.coarsen - 1) / vt.coarsen;
+        if (items < (size_t)vt.vec)
+            items = vt.vec;
+    }
+    return ((items + local - 1) / local) * local;
+}
+
+static void printTuned(const vaddTuned& vt, size_t local)
+{
+    if (vt.vec == 0)
+        printf("Kernel : vadd local %lu\n", (unsigned long)local);
+    else
+        printf("Kernel : vadd_vec -DVEC=%d -DCOARSEN=%d local %lu, from %s\n",
+            vt.vec, vt.coarsen, (unsigned long)local, TUNE_FILE);
+}
+
+//------------------------------------------------------------------------------
+//
+// Autotuner : every vadd_vec build (VEC, COARSEN) is timed with every local size
+// the device accepts, and checked once against the host sum. The reference peak
+// is a device to device clEnqueueCopyBuffer of the same size, OpenCL giving no
+// theoretical memory bandwidth. With a trace, every run shows on one lane.
+// The best build is saved in TUNE_FILE for the device.
+//
+
+int runTune(cl_context context, cl_device_id device_id, cl_kernel kernel, size_t length, trTrace* trace)
+{
+    int err;
+    size_t i, v, c, l;
+    size_t bytes = sizeof(float) * length;
+    unsigned int count = (unsigned int)length;
+    cl_command_queue queue;
+    cl_mem a_in, b_in, c_out;
+    size_t max_local;
+
+    float* a_data = (float*)malloc(bytes);
+    float* b_data = (float*)malloc(bytes);
+    float* c_res = (float*)malloc(bytes);
+    if (!a_data || !b_data || !c_res)
+    {
+        printf("Error: Failed to allocate host memory!\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < length; i++) {
+        a_data[i] = rand() / (float)RAND_MAX;
+        b_data[i] = rand() / (float)RAND_MAX;
+    }
+
+    queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    a_in = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, a_data, &err);
+    b_in = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, b_data, &err);
+    c_out = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+    if (!queue || !a_in || !b_in || !c_out)
+    {
+        printf("Error: Failed to allocate device memory!\n");
+        return EXIT_FAILURE;
+    }
+    clGetDeviceInfo(device_id, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &max_local, NULL);
+    if (trace)
+        trLane(*trace, 1, "tune");
+
+    // copy peak : read and write of bytes
+    double copy_ms = -1.0;
+    int r;
+    for (r = 0; r < TUNE_REPEAT; r++)
+    {
+        cl_event event;
+        cl_ulong ev_start_time = (cl_ulong)0;
+        cl_ulong ev_end_time = (cl_ulong)0;
+        err = clEnqueueCopyBuffer(queue, a_in, c_out, 0, 0, bytes, 0, NULL, &event);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to copy buffer! %d\n", err);
+            return EXIT_FAILURE;
+        }
+        clWaitForEvents(1, &event);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+        traceCommand(trace, "copy", 1, event);
+        double ms = (double)(ev_end_time - ev_start_time) * 1.0e-6;
+        if (copy_ms < 0.0 || ms < copy_ms)
+            copy_ms = ms;
+    }
+    double peak = 2.0 * bytes * 1.0e-6 / copy_ms;
+
+    // a and b read, c written
+    double gbytes = 3.0 * bytes * 1.0e-9;
+    printf("TUNE : %lu elements, copy peak %.2lf GB/s\n", (unsigned long)length, peak);
+
+    // the one float per work-item kernel as the baseline
+    size_t local;
+    clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
+    size_t global = ((length + local - 1) / local) * local;
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_in);
+    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in);
+    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_out);
+    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &count);
+    double base_ms = err == CL_SUCCESS ? timeKernel(queue, kernel, global, local, trace, "vadd") : -1.0;
+    if (base_ms < 0.0)
+    {
+        printf("Error: Failed to run vadd!\n");
+        return EXIT_FAILURE;
+    }
+    printf("vadd                  local %4lu : %8.3lf ms || %7.2lf GB/s  %5.1lf%% of peak\n",
+        (unsigned long)local, base_ms, gbytes / (base_ms * 1.0e-3), 100.0 * gbytes / (base_ms * 1.0e-3) / peak);
+
+    double best_ms = base_ms;
+    int best_vec = 0, best_coarsen = 0;
+    size_t best_local = local;
+    int wrong_variants = 0;
+
+    for (v = 0; v < sizeof(tune_vec) / sizeof(tune_vec[0]); v++)
+        for (c = 0; c < sizeof(tune_coarsen) / sizeof(tune_coarsen[0]); c++)
+        {
+            char options[64];
+            cl_program program;
+            cl_kernel vkernel;
+            size_t kernel_local;
+            size_t nvec = length / tune_vec[v];
+            size_t items = (nvec + tune_coarsen[c] - 1) / tune_coarsen[c];
+            double variant_ms = -1.0;
+            size_t variant_local = 0;
+
+            sprintf(options, "-DVEC=%d -DCOARSEN=%d", tune_vec[v], tune_coarsen[c]);
+            program = clCreateProgramWithSource(context, 1, (const char**)&VecKernelSource, NULL, &err);
+            err = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+            if (err != CL_SUCCESS)
+            {
+                size_t len;
+                char buffer[2048];
+
+                printf("Error: Failed to build vadd_vec %s!\n", options);
+                clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+                printf("%s\n", buffer);
+                return EXIT_FAILURE;
+            }
+            vkernel = clCreateKernel(program, "vadd_vec", &err);
+            err |= clSetKernelArg(vkernel, 0, sizeof(cl_mem), &a_in);
+            err |= clSetKernelArg(vkernel, 1, sizeof(cl_mem), &b_in);
+            err |= clSetKernelArg(vkernel, 2, sizeof(cl_mem), &c_out);
+            err |= clSetKernelArg(vkernel, 3, sizeof(unsigned int), &count);
+            err |= clGetKernelWorkGroupInfo(vkernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_local), &kernel_local, NULL);
+            if (err != CL_SUCCESS)
+            {
+                printf("Error: Failed to create vadd_vec %s! %d\n", options, err);
+                return EXIT_FAILURE;
+            }
+
+            // c starts as a sentinel no sum of a and b can give, so that the
+            // check sees the elements the variant leaves out
+            const float sentinel = -1.0f;
+            cl_event fill_event = NULL;
+            err = clEnqueueFillBuffer(queue, c_out, &sentinel, sizeof(sentinel), 0, bytes, 0, NULL, trace ? &fill_event : NULL);
+            if (err != CL_SUCCESS)
+            {
+                printf("Error: Failed to clear c for vadd_vec %s! %d\n", options, err);
+                return EXIT_FAILURE;
+            }
+            traceCommand(trace, "fill c", 1, fill_event);
+
+            for (l = 0; l < sizeof(tune_local) / sizeof(tune_local[0]); l++)
+            {
+                size_t vlocal = tune_local[l];
+                if (vlocal > kernel_local || vlocal > max_local)
+                    break;
+                // at least enough work-items for the count % VEC tail
+                size_t vglobal = items > (size_t)tune_vec[v] ? items : (size_t)tune_vec[v];
+                vglobal = ((vglobal + vlocal - 1) / vlocal) * vlocal;
+
+                char name[64];
+                sprintf(name, "vadd_vec VEC %d x %d local %lu", tune_vec[v], tune_coarsen[c], (unsigned long)vlocal);
+                double ms = timeKernel(queue, vkernel, vglobal, vlocal, trace, name);
+                if (ms < 0.0)
+                    continue;
+                if (variant_ms < 0.0 || ms < variant_ms) {
+                    variant_ms = ms;
+                    variant_local = vlocal;
+                }
+
+                // checked with the first local size only, the others compute the same
+                if (l == 0)
+                {
+                    cl_event event = NULL;
+                    if (clEnqueueReadBuffer(queue, c_out, CL_TRUE, 0, bytes, c_res, 0, NULL, trace ? &event : NULL) == CL_SUCCESS)
+                        traceCommand(trace, "read c", 1, event);
+                    for (i = 0; i < length; i++) {
+                        float tmp = a_data[i] + b_data[i] - c_res[i];
+                        if (tmp * tmp >= TOL * TOL)
+                            break;
+                    }
+                    if (i < length) {
+                        printf("Error: vadd_vec %s wrong at element %lu!\n", options, (unsigned long)i);
+                        wrong_variants++;
+                        variant_ms = -1.0;
+                        break;
+                    }
+                }
+            }
+
+            if (variant_ms > 0.0)
+            {
+                printf("vadd_vec VEC %2d x %d  local %4lu : %8.3lf ms || %7.2lf GB/s  %5.1lf%% of peak\n",
+                    tune_vec[v], tune_coarsen[c], (unsigned long)variant_local, variant_ms,
+                    gbytes / (variant_ms * 1.0e-3), 100.0 * gbytes / (variant_ms * 1.0e-3) / peak);
+                if (variant_ms < best_ms) {
+                    best_ms = variant_ms;
+                    best_vec = tune_vec[v];
+                    best_coarsen = tune_coarsen[c];
+                    best_local = variant_local;
+                }
+            }
+            clReleaseKernel(vkernel);
+            clReleaseProgram(program);
+        }
+
+    if (best_vec == 0)
+        printf("Best : vadd local %lu", (unsigned long)best_local);
+    else
+        printf("Best : vadd_vec -DVEC=%d -DCOARSEN=%d local %lu", best_vec, best_coarsen, (unsigned long)best_local);
+    printf(" || %.2lf GB/s, %.1lf%% of peak, %.2lfx vadd\n",
+        gbytes / (best_ms * 1.0e-3), 100.0 * gbytes / (best_ms * 1.0e-3) / peak, base_ms / best_ms);
+    vaddTuned vt = { best_vec, best_coarsen, best_local, peak };
+    saveTuned(device_id, vt);
+    printf("Saved in %s, the default run and stream use it on this device\n", TUNE_FILE);
+
+    clReleaseMemObject(a_in);
+    clReleaseMemObject(b_in);
+    clReleaseMemObject(c_out);
+    clReleaseCommandQueue(queue);
+    free(a_data);
+    free(b_data);
+    free(c_res);
+
+    return wrong_variants == 0 ? 0 : EXIT_FAILURE;
+}
+
+//------------------------------------------------------------------------------
+//
+// BLAS level 1 benchmark : every operation of Common/Blas1 over float and
+// double (when the device has it), checked once against the host in double,
+// then timed with the profiling events. With a trace, every command shows on
+// one lane.
+//
+
+static double blasGet(const void* p, int type, size_t i)
+{
+    return type == BL_DOUBLE ? ((const double*)p)[i] : ((const float*)p)[i];
+}
+
+static void blasSet(void* p, int type, size_t i, double v)
+{
+    if (type == BL_DOUBLE)
+        ((double*)p)[i] = v;
+    else
+        ((float*)p)[i] = (float)v;
+}
+
+int runBlas(cl_context context, cl_device_id device_id, size_t length, trTrace* trace)
+{
+    int err;
+    int type, op, r;
+    size_t i;
+    unsigned int count = (unsigned int)length;
+    int failed = 0;
+    blLib lib;
+    cl_command_queue queue;
+
+    queue = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (!queue)
+    {
+        printf("Error: Failed to create a command commands!\n");
+        return EXIT_FAILURE;
+    }
+    err = blInit(lib, context, device_id);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to build the BLAS library! %d\n", err);
+        return EXIT_FAILURE;
+    }
+    printf("BLAS : %lu elements, %lu work-groups\n", (unsigned long)length, (unsigned long)lib.groups);
+    if (trace)
+        trLane(*trace, 1, "blas");
+
+    for (type = 0; type < BL_TYPES; type++)
+    {
+        if (!blHasType(lib, type))
+        {
+            printf("%s : not supported by the device\n", blTypeName(type));
+            continue;
+        }
+        size_t bytes = blTypeSize(type) * length;
+        void* x_data = malloc(bytes);
+        void* y_data = malloc(bytes);
+        void* w_data = malloc(bytes);
+        void* z_res = malloc(bytes);
+        cl_mem x_in = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        cl_mem y_in = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        cl_mem w_in = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        cl_mem z_out = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+        if (!x_data || !y_data || !w_data || !z_res || !x_in || !y_in || !w_in || !z_out)
+        {
+            printf("Error: Failed to allocate memory!\n");
+            return EXIT_FAILURE;
+        }
+        for (i = 0; i < length; i++) {
+            blasSet(x_data, type, i, rand() / (double)RAND_MAX);
+            blasSet(y_data, type, i, rand() / (double)RAND_MAX);
+            blasSet(w_data, type, i, rand() / (double)RAND_MAX);
+        }
+        double tol = type == BL_DOUBLE ? 1.0e-12 : 1.0e-5;
+
+        for (op = 0; op < BL_OPS; op++)
+        {
+            double expected = 0.0, result = 0.0;
+            double ms = -1.0;
+            cl_mem out = op == BL_AXPY ? y_in : op == BL_SCAL ? x_in : z_out;
+            size_t wrong = 0;
+            char name[32];
+            cl_event write_event[3] = { NULL, NULL, NULL };
+
+            // fresh inputs, axpy and scal work in place
+            err = clEnqueueWriteBuffer(queue, x_in, CL_TRUE, 0, bytes, x_data, 0, NULL, trace ? &write_event[0] : NULL);
+            err |= clEnqueueWriteBuffer(queue, y_in, CL_TRUE, 0, bytes, y_data, 0, NULL, trace ? &write_event[1] : NULL);
+            err |= clEnqueueWriteBuffer(queue, w_in, CL_TRUE, 0, bytes, w_data, 0, NULL, trace ? &write_event[2] : NULL);
+            traceCommand(trace, "write x", 1, write_event[0]);
+            traceCommand(trace, "write y", 1, write_event[1]);
+            traceCommand(trace, "write w", 1, write_event[2]);
+            sprintf(name, "%s %s", blTypeName(type), blOpName(op));
+
+            for (r = 0; r <= TUNE_REPEAT && err == CL_SUCCESS; r++)
+            {
+                cl_event event;
+                cl_ulong ev_start_time = (cl_ulong)0;
+                cl_ulong ev_end_time = (cl_ulong)0;
+
+                switch (op) {
+                case BL_AXPY: err = blAxpy(lib, queue, type, BLAS_ALPHA, x_in, y_in, count, &event); break;
+                case BL_SCAL: err = blScal(lib, queue, type, BLAS_ALPHA, x_in, count, &event); break;
+                case BL_MUL: err = blMul(lib, queue, type, x_in, y_in, z_out, count, &event); break;
+                case BL_FMA: err = blFma(lib, queue, type, x_in, y_in, w_in, z_out, count, &event); break;
+                case BL_DOT: err = blDot(lib, queue, type, x_in, y_in, count, &result, &event); break;
+                default: err = blNrm2(lib, queue, type, x_in, count, &result, &event); break;
+                }
+                if (err != CL_SUCCESS)
+                    break;
+                clWaitForEvents(1, &event);
+                clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+                clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+                traceCommand(trace, name, 1, event);
+
+                // the first run is checked, the others timed
+                if (r == 0 && op < BL_DOT)
+                {
+                    cl_event read_event = NULL;
+                    err = clEnqueueReadBuffer(queue, out, CL_TRUE, 0, bytes, z_res, 0, NULL, trace ? &read_event : NULL);
+                    traceCommand(trace, "read", 1, read_event);
+                    for (i = 0; i < length; i++) {
+                        double x = blasGet(x_data, type, i), y = blasGet(y_data, type, i), w = blasGet(w_data, type, i);
+                        double v = op == BL_AXPY ? BLAS_ALPHA * x + y : op == BL_SCAL ? BLAS_ALPHA * x : op == BL_MUL ? x * y : x * y + w;
+                        if (fabs(blasGet(z_res, type, i) - v) > tol * (fabs(v) + 1.0))
+                            wrong++;
+                    }
+                }
+                else if (r == 0)
+                {
+                    for (i = 0; i < length; i++)
+                        expected += blasGet(x_data, type, i) * blasGet(op == BL_DOT ? y_data : x_data, type, i);
+                    if (op == BL_NRM2)
+                        expected = sqrt(expected);
+                    // the float sums are accumulated in float on the device
+                    if (fabs(result - expected) > (type == BL_DOUBLE ? 1.0e-10 : 1.0e-4) * fabs(expected))
+                        wrong++;
+                }
+                else {
+                    double t = (double)(ev_end_time - ev_start_time) * 1.0e-6;
+                    if (ms < 0.0 || t < ms)
+                        ms = t;
+                }
+            }
+            if (err != CL_SUCCESS)
+            {
+                printf("Error: Failed to run %s %s! %d\n", blTypeName(type), blOpName(op), err);
+                return EXIT_FAILURE;
+            }
+
+            printf("%-6s %-4s : %8.3lf ms || %7.2lf GB/s  %s\n", blTypeName(type), blOpName(op), ms,
+                blBytes(op, type, count) * 1.0e-6 / ms, wrong ? "WRONG" : "ok");
+            if (wrong)
+                failed++;
+        }
+
+        clReleaseMemObject(x_in);
+        clReleaseMemObject(y_in);
+        clReleaseMemObject(w_in);
+        clReleaseMemObject(z_out);
+        free(x_data);
+        free(y_data);
+        free(w_data);
+        free(z_res);
+    }
+
+    blRelease(lib);
+    clReleaseCommandQueue(queue);
+    return failed == 0 ? 0 : EXIT_FAILURE;
+}
+
+//------------------------------------------------------------------------------
+//
+// Streaming vadd for vectors larger than the device memory : the host data goes
+// through pinned (CL_MEM_ALLOC_HOST_PTR) staging buffers chunk by chunk, uploads,
+// kernels and downloads run on three queues so chunk k+1 is sent while chunk k is
+// computed and chunk k-1 comes back. With a trace, the three queues show as lanes.
+//
+
+int runStream(cl_context context, cl_device_id device_id, cl_kernel kernel, const vaddTuned& vt,
+    size_t length, size_t chunk, trTrace* trace)
+{
+    int err;
+    size_t i, k;
+    size_t nchunks = (length + chunk - 1) / chunk;
+    size_t bytes = sizeof(float) * chunk;
+    size_t local;
+    int s;
+
+    cl_command_queue upload, compute, download;
+    cl_mem a_pin[STREAM_SLOTS], b_pin[STREAM_SLOTS], c_pin[STREAM_SLOTS];    // pinned staging buffers
+    float *a_map[STREAM_SLOTS], *b_map[STREAM_SLOTS], *c_map[STREAM_SLOTS]; // and their host pointers
+    cl_mem a_dev[STREAM_SLOTS], b_dev[STREAM_SLOTS], c_dev[STREAM_SLOTS];
+    cl_event up_event[STREAM_SLOTS], run_event[STREAM_SLOTS], down_event[STREAM_SLOTS];
+    cl_event map_event[3 * STREAM_SLOTS] = { NULL };                       // a, b and c of each slot, with a trace
+    size_t slot_chunk[STREAM_SLOTS];
+
+    // the vectors stay in ordinary pageable memory, as they would in an application
+    float* a_data = (float*)malloc(sizeof(float) * length);
+    float* b_data = (float*)malloc(sizeof(float) * length);
+    float* c_data = (float*)malloc(sizeof(float) * length);
+    if (!a_data || !b_data || !c_data)
+    {
+        printf("Error: Failed to allocate host memory!\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < length; i++) {
+        a_data[i] = rand() / (float)RAND_MAX;
+        b_data[i] = rand() / (float)RAND_MAX;
+    }
+
+    upload = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    compute = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    download = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (!upload || !compute || !download)
+    {
+        printf("Error: Failed to create the streaming queues!\n");
+        return EXIT_FAILURE;
+    }
+
+    for (s = 0; s < STREAM_SLOTS; s++)
+    {
+        a_pin[s] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, NULL);
+        b_pin[s] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, NULL);
+        c_pin[s] = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, bytes, NULL, NULL);
+        a_dev[s] = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, NULL);
+        b_dev[s] = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, NULL);
+        c_dev[s] = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bytes, NULL, NULL);
+        if (!a_pin[s] || !b_pin[s] || !c_pin[s] || !a_dev[s] || !b_dev[s] || !c_dev[s])
+        {
+            printf("Error: Failed to allocate device memory!\n");
+            return EXIT_FAILURE;
+        }
+
+        // mapped once, the pointers stay valid for the whole run
+        a_map[s] = (float*)clEnqueueMapBuffer(upload, a_pin[s], CL_TRUE, CL_MAP_WRITE, 0, bytes, 0, NULL, trace ? &map_event[3 * s] : NULL, &err);
+        b_map[s] = (float*)clEnqueueMapBuffer(upload, b_pin[s], CL_TRUE, CL_MAP_WRITE, 0, bytes, 0, NULL, trace ? &map_event[3 * s + 1] : NULL, &err);
+        c_map[s] = (float*)clEnqueueMapBuffer(download, c_pin[s], CL_TRUE, CL_MAP_READ, 0, bytes, 0, NULL, trace ? &map_event[3 * s + 2] : NULL, &err);
+        if (!a_map[s] || !b_map[s] || !c_map[s])
+        {
+            printf("Error: Failed to map the staging buffers! %d\n", err);
+            return EXIT_FAILURE;
+        }
+    }
+
+    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
+        return EXIT_FAILURE;
+    }
+    if (vt.local > 0 && vt.local < local)
+        local = vt.local;
+
+    printf("STREAM : %lu elements in %lu chunks of %lu, %d slots\n",
+        (unsigned long)length, (unsigned long)nchunks, (unsigned long)chunk, STREAM_SLOTS);
+    printTuned(vt, local);
+
+    if (trace) {
+        trLane(*trace, 1, "upload");
+        trLane(*trace, 2, "compute");
+        trLane(*trace, 3, "download");
+    }
+    for (s = 0; s < STREAM_SLOTS; s++)
+    {
+        traceCommand(trace, "map a", 1, map_event[3 * s]);
+        traceCommand(trace, "map b", 1, map_event[3 * s + 1]);
+        traceCommand(trace, "map c", 3, map_event[3 * s + 2]);
+    }
+
+    cl_ulong first_start = 0, last_end = 0;
+    double kernel_ms = 0.0;
+    double rtime = clock();
+
+    // k runs past the last chunk to drain the slots still in flight
+    for (k = 0; k < nchunks + STREAM_SLOTS; k++)
+    {
+        s = (int)(k % STREAM_SLOTS);
+
+        // the slot is free once the chunk it held is back, copy that chunk out
+        if (k >= STREAM_SLOTS)
+        {
+            size_t done = k - STREAM_SLOTS;
+            size_t n = slot_chunk[s];
+            cl_ulong ev_start_time = (cl_ulong)0;
+            cl_ulong ev_end_time = (cl_ulong)0;
+
+            clWaitForEvents(1, &down_event[s]);
+            int span = trace ? trBegin(*trace, "collect") : 0;
+            memcpy(c_data + done * chunk, c_map[s], sizeof(float) * n);
+            if (trace)
+                trEnd(*trace, span);
+
+            if (done == 0)
+                clGetEventProfilingInfo(up_event[s], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &first_start, NULL);
+            if (done == nchunks - 1)
+                clGetEventProfilingInfo(down_event[s], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &last_end, NULL);
+            clGetEventProfilingInfo(run_event[s], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+            clGetEventProfilingInfo(run_event[s], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+            kernel_ms += (double)(ev_end_time - ev_start_time) * 1.0e-6;
+
+            clReleaseEvent(up_event[s]);
+            clReleaseEvent(run_event[s]);
+            clReleaseEvent(down_event[s]);
+        }
+        if (k >= nchunks)
+            continue;
+
+        // stage chunk k, then upload -> vadd -> download, each waiting on the previous step only
+        size_t first = k * chunk;
+        unsigned int n = (unsigned int)(length - first < chunk ? length - first : chunk);
+        size_t global = tunedGlobal(vt, n, local);
+        cl_event a_event = NULL;
+        slot_chunk[s] = n;
+        int span = trace ? trBegin(*trace, "stage") : 0;
+        memcpy(a_map[s], a_data + first, sizeof(float) * n);
+        memcpy(b_map[s], b_data + first, sizeof(float) * n);
+        if (trace)
+            trEnd(*trace, span);
+
+        err = clEnqueueWriteBuffer(upload, a_dev[s], CL_FALSE, 0, sizeof(float) * n, a_map[s], 0, NULL, trace ? &a_event : NULL);
+        err |= clEnqueueWriteBuffer(upload, b_dev[s], CL_FALSE, 0, sizeof(float) * n, b_map[s], 0, NULL, &up_event[s]);
+        traceCommand(trace, "write a", 1, a_event);
+        if (trace)
+            trAdd(*trace, "write b", 1, up_event[s]);
+
+        err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_dev[s]);
+        err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_dev[s]);
+        err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_dev[s]);
+        err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &n);
+        err |= clEnqueueNDRangeKernel(compute, kernel, 1, NULL, &global, &local, 1, &up_event[s], &run_event[s]);
+
+        err |= clEnqueueReadBuffer(download, c_dev[s], CL_FALSE, 0, sizeof(float) * n, c_map[s], 1, &run_event[s], &down_event[s]);
+        if (err != CL_SUCCESS)
+        {
+            printf("Error: Failed to enqueue chunk %lu! %d\n", (unsigned long)k, err);
+            return EXIT_FAILURE;
+        }
+        if (trace) {
+            trAdd(*trace, "vadd", 2, run_event[s]);
+            trAdd(*trace, "read c", 3, down_event[s]);
+        }
+        clFlush(upload);
+        clFlush(compute);
+        clFlush(download);
+    }
+
+    rtime = clock() - rtime;
+
+    // Test the results
+    size_t correct = 0;
+    float tmp;
+    for (i = 0; i < length; i++)
+    {
+        tmp = a_data[i] + b_data[i] - c_data[i];
+        if (tmp * tmp < TOL * TOL)
+            correct++;
+    }
+
+    // a and b go up, c comes back
+    double gbytes = 3.0 * sizeof(float) * length * 1.0e-9;
+    double device_s = (double)(last_end - first_start) * 1.0e-9;
+    double host_s = rtime / CLOCKS_PER_SEC;
+    printf("C = A+B:  %lu out of %lu results were correct.\n", (unsigned long)correct, (unsigned long)length);
+    printf("Device timeline %.3lf ms (kernels %.3lf ms) || %.2lf GB/s\n", device_s * 1000, kernel_ms, gbytes / device_s);
+    printf("Host time %.3lf ms || %.2lf GB/s including staging copies\n", host_s * 1000, gbytes / host_s);
+    if (vt.peak > 0.0 && kernel_ms > 0.0)
+        printf("Kernels %.2lf GB/s, %.1lf%% of the copy peak\n",
+            gbytes / (kernel_ms * 1.0e-3), 100.0 * gbytes / (kernel_ms * 1.0e-3) / vt.peak);
+
+    for (s = 0; s < STREAM_SLOTS; s++)
+    {
+        clEnqueueUnmapMemObject(upload, a_pin[s], a_map[s], 0, NULL, trace ? &map_event[3 * s] : NULL);
+        clEnqueueUnmapMemObject(upload, b_pin[s], b_map[s], 0, NULL, trace ? &map_event[3 * s + 1] : NULL);
+        clEnqueueUnmapMemObject(download, c_pin[s], c_map[s], 0, NULL, trace ? &map_event[3 * s + 2] : NULL);
+    }
+    clFinish(upload);
+    clFinish(download);
+    for (s = 0; s < STREAM_SLOTS; s++)
+    {
+        traceCommand(trace, "unmap a", 1, map_event[3 * s]);
+        traceCommand(trace, "unmap b", 1, map_event[3 * s + 1]);
+        traceCommand(trace, "unmap c", 3, map_event[3 * s + 2]);
+    }
+    for (s = 0; s < STREAM_SLOTS; s++)
+    {
+        clReleaseMemObject(a_pin[s]);
+        clReleaseMemObject(b_pin[s]);
+        clReleaseMemObject(c_pin[s]);
+        clReleaseMemObject(a_dev[s]);
+        clReleaseMemObject(b_dev[s]);
+        clReleaseMemObject(c_dev[s]);
+    }
+    clReleaseCommandQueue(upload);
+    clReleaseCommandQueue(compute);
+    clReleaseCommandQueue(download);
+    free(a_data);
+    free(b_data);
+    free(c_data);
+
+    return correct == length ? 0 : EXIT_FAILURE;
+}
+
+//------------------------------------------------------------------------------
+//
+// Many small vadd jobs of random sizes, as a server would run them : each job
+// allocates its a, b and c buffers, runs and gives them back. The jobs run once
+// with a clCreateBuffer / clReleaseMemObject per buffer, then once with the
+// buffers taken from a pool. With a trace, each pass is a span over its
+// commands.
+//
+
+int runJobs(cl_context context, cl_device_id device_id, cl_command_queue commands, cl_kernel kernel, int njobs, trTrace* trace)
+{
+    int err;
+    int j, pass;
+    size_t i, local;
+    unsigned int* sizes = (unsigned int*)malloc(sizeof(unsigned int) * njobs);
+    float* a_data = (float*)malloc(sizeof(float) * JOB_MAX);
+    float* b_data = (float*)malloc(sizeof(float) * JOB_MAX);
+    float* c_res = (float*)malloc(sizeof(float) * JOB_MAX);
+    if (!sizes || !a_data || !b_data || !c_res)
+    {
+        printf("Error: Failed to allocate host memory!\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < JOB_MAX; i++) {
+        a_data[i] = rand() / (float)RAND_MAX;
+        b_data[i] = rand() / (float)RAND_MAX;
+    }
+    for (j = 0; j < njobs; j++)
+        sizes[j] = JOB_MIN + (unsigned int)(rand() % (JOB_MAX - JOB_MIN + 1));
+
+    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
+    if (err != CL_SUCCESS)
+    {
+        printf("Error: Failed to retrieve kernel work group info! %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    bpPool pool;
+    bpInit(pool, context, device_id);
+    printf("JOBS : %d jobs of %d to %d elements\n", njobs, JOB_MIN, JOB_MAX);
+
+    double rtime[2];
+    unsigned long wrong = 0;
+    if (trace)
+        trLane(*trace, 1, "commands");
+    for (pass = 0; pass < 2; pass++)
+    {
+        int span = trace ? trBegin(*trace, pass == 0 ? "create / release" : "buffer pool") : 0;
+        rtime[pass] = clock();
+        for (j = 0; j < njobs; j++)
+        {
+            unsigned int n = sizes[j];
+            size_t bytes = sizeof(float) * n;
+            size_t global = ((n + local - 1) / local) * local;
+            cl_mem a_in, b_in, c_out;
+
+            if (pass == 0) {
+                a_in = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &err);
+                b_in = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &err);
+                c_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+            }
+            else {
+                a_in = bpAlloc(pool, bytes, &err);
+                b_in = bpAlloc(pool, bytes, &err);
+                c_out = bpAlloc(pool, bytes, &err);
+            }
+            if (!a_in || !b_in || !c_out)
+            {
+                printf("Error: Failed to allocate device memory! %d\n", err);
+                return EXIT_FAILURE;
+            }
+
+            cl_event event[4] = { NULL, NULL, NULL, NULL };
+            err = clEnqueueWriteBuffer(commands, a_in, CL_FALSE, 0, bytes, a_data, 0, NULL, trace ? &event[0] : NULL);
+            err |= clEnqueueWriteBuffer(commands, b_in, CL_FALSE, 0, bytes, b_data, 0, NULL, trace ? &event[1] : NULL);
+            err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_in);
+            err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in);
+            err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_out);
+            err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &n);
+            err |= clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, trace ? &event[2] : NULL);
+            err |= clEnqueueReadBuffer(commands, c_out, CL_TRUE, 0, bytes, c_res, 0, NULL, trace ? &event[3] : NULL);
+            traceCommand(trace, "write a", 1, event[0]);
+            traceCommand(trace, "write b", 1, event[1]);
+            traceCommand(trace, "vadd", 1, event[2]);
+            traceCommand(trace, "read c", 1, event[3]);
+            if (err != CL_SUCCESS)
+            {
+                printf("Error: Failed to run job %d! %d\n", j, err);
+                return EXIT_FAILURE;
+            }
+
+            for (i = 0; i < n; i++) {
+                float tmp = a_data[i] + b_data[i] - c_res[i];
+                if (tmp * tmp >= TOL * TOL)
+                    wrong++;
+            }
+
+            if (pass == 0) {
+                clReleaseMemObject(a_in);
+                clReleaseMemObject(b_in);
+                clReleaseMemObject(c_out);
+            }
+            else {
+                bpFree(pool, a_in);
+                bpFree(pool, b_in);
+                bpFree(pool, c_out);
+            }
+        }
+        rtime[pass] = clock() - rtime[pass];
+        if (trace)
+            trEnd(*trace, span);
+    }
+
+    printf("C = A+B:  %lu wrong results over both passes.\n", wrong);
+    printf("clCreateBuffer per job : %.3lf ms || %.2lf jobs/s\n",
+        rtime[0] * 1000.0 / CLOCKS_PER_SEC, njobs * (double)CLOCKS_PER_SEC / (rtime[0] > 0 ? rtime[0] : 1));
+    printf("Buffer pool            : %.3lf ms || %.2lf jobs/s\n",
+        rtime[1] * 1000.0 / CLOCKS_PER_SEC, njobs * (double)CLOCKS_PER_SEC / (rtime[1] > 0 ? rtime[1] : 1));
+    bpPrintStats(pool);
+
+    bpRelease(pool);
+    free(sizes);
+    free(a_data);
+    free(b_data);
+    free(c_res);
+
+    return wrong == 0 ? 0 : EXIT_FAILURE;
+}
+
 //------------------------------------------------------------------------------
 
 
@@ -56,7 +1022,7 @@ int main(int argc, char** argv)
     int          err;                   // error code returned from OpenCL calls
     float        a_data[LENGTH];        // a vector 
     float        b_data[LENGTH];        // b vector 
-    float        c_res[LENGTH];        // c vector (a+b) returned from the compute device
+    float*       c_res;                 // c vector (a+b) mapped from the compute device
     unsigned int correct;               // number of correct results  
 
     size_t global;                      // global domain size  
@@ -68,12 +1034,29 @@ int main(int argc, char** argv)
     cl_program       program;           // compute program
     cl_kernel        kernel;            // compute kernel
 
-    cl_mem a_in;                        // device memory used for the input  a vector
-    cl_mem b_in;                        // device memory used for the input  b vector
-    cl_mem c_out;                       // device memory used for the output c vector
+    hbBuffer a_in;                      // memory used for the input  a vector
+    hbBuffer b_in;                      // memory used for the input  b vector
+    hbBuffer c_out;                     // memory used for the output c vector
 
-    // Fill vectors a and b with random float values
+    // usage : VectorAdd [-cpu] [-copy] [-trace file.json] [stream [length] [chunk] | jobs [count] | tune [length] | blas [length]]
+    cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+    const char* trace_path = NULL;
+    int force_copy = 0;
+    int nargs = 0;
+    char* args[8];
     int i = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-cpu") == 0) device_type = CL_DEVICE_TYPE_CPU;
+        else if (strcmp(argv[i], "-copy") == 0) force_copy = 1;
+        else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) trace_path = argv[++i];
+        else if (nargs < 8) args[nargs++] = argv[i];
+    }
+
+    trTrace trace;
+    trInit(trace);
+    trTrace* tracing = trace_path ? &trace : NULL;     // events are only created for it
+
+    // Fill vectors a and b with random float values
     int count = LENGTH;
     for (i = 0; i < count; i++) {
         a_data[i] = rand() / (float)RAND_MAX;
@@ -91,7 +1074,7 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    err = clGetDeviceIDs(firstPlatformId, CL_DEVICE_TYPE_GPU, 1, &device_id, NULL);
+    err = clGetDeviceIDs(firstPlatformId, device_type, 1, &device_id, NULL);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to create a device group!\n");
@@ -109,8 +1092,8 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    // Create a command queue
-    commands = clCreateCommandQueue(context, device_id, 0, &err);
+    // Create a command queue, profiled when tracing
+    commands = clCreateCommandQueue(context, device_id, trace_path ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
     if (!commands)
     {
         printf("Error: Failed to create a command commands!\n");
@@ -118,7 +1101,7 @@ int main(int argc, char** argv)
     }
 
     // Create the compute program from the source buffer
-    program = clCreateProgramWithSource(context, 1, (const char**)&KernelSource, NULL, &err);
+    program = clCreateProgramWithSource(context, 1, &VaddSource, NULL, &err);
     if (!program)
     {
         printf("Error: Failed to create compute program!\n");
@@ -146,75 +1129,176 @@ int main(int argc, char** argv)
         exit(1);
     }
 
-    // Create the input (a, b) and output (c) arrays in device memory  
-    a_in = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, NULL);
-    b_in = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * count, NULL, NULL);
-    c_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * count, NULL, NULL);
-    if (!a_in || !b_in || !c_out)
+    if (nargs > 0 && strcmp(args[0], "blas") == 0)
+    {
+        err = runBlas(context, device_id, nargs > 1 ? (size_t)atof(args[1]) : BLAS_LENGTH, tracing);
+        if (trace_path)
+            trWrite(trace, trace_path);
+        trRelease(trace);
+        clReleaseProgram(program);
+        clReleaseKernel(kernel);
+        clReleaseCommandQueue(commands);
+        clReleaseContext(context);
+        return err;
+    }
+
+    if (nargs > 0 && strcmp(args[0], "tune") == 0)
+    {
+        err = runTune(context, device_id, kernel, nargs > 1 ? (size_t)atof(args[1]) : TUNE_LENGTH, tracing);
+        if (trace_path)
+            trWrite(trace, trace_path);
+        trRelease(trace);
+        clReleaseProgram(program);
+        clReleaseKernel(kernel);
+        clReleaseCommandQueue(commands);
+        clReleaseContext(context);
+        return err;
+    }
+
+    if (nargs > 0 && strcmp(args[0], "jobs") == 0)
+    {
+        err = runJobs(context, device_id, commands, kernel, nargs > 1 ? atoi(args[1]) : JOBS, tracing);
+        if (trace_path)
+            trWrite(trace, trace_path);
+        trRelease(trace);
+        clReleaseProgram(program);
+        clReleaseKernel(kernel);
+        clReleaseCommandQueue(commands);
+        clReleaseContext(context);
+        return err;
+    }
+
+    // the vadd_vec build the tuner chose for this device, the plain vadd otherwise
+    vaddTuned tuned = { 0, 0, 0, 0.0 };
+    cl_program tuned_program = NULL;
+    cl_kernel tuned_kernel = NULL;
+    if (loadTuned(device_id, tuned))
+        tuned_kernel = buildTuned(context, device_id, tuned, &tuned_program);
+    if (!tuned_kernel)
+        tuned.vec = 0;
+    cl_kernel run_kernel = tuned_kernel ? tuned_kernel : kernel;
+
+    if (nargs > 0 && strcmp(args[0], "stream") == 0)
+    {
+        size_t length = nargs > 1 ? (size_t)atof(args[1]) : STREAM_LENGTH;
+        size_t chunk = nargs > 2 ? (size_t)atof(args[2]) : STREAM_CHUNK;
+        if (length == 0 || chunk == 0)
+        {
+            printf("Error: The stream length and chunk must be at least 1!\n");
+            return EXIT_FAILURE;
+        }
+        err = runStream(context, device_id, run_kernel, tuned, length, chunk < length ? chunk : length, tracing);
+        if (trace_path)
+            trWrite(trace, trace_path);
+        trRelease(trace);
+        if (tuned_kernel) {
+            clReleaseKernel(tuned_kernel);
+            clReleaseProgram(tuned_program);
+        }
+        clReleaseProgram(program);
+        clReleaseKernel(kernel);
+        clReleaseCommandQueue(commands);
+        clReleaseContext(context);
+        return err;
+    }
+
+    // Create the input (a, b) and output (c) arrays, shared with the host when the device allows it
+    int zero_copy = !force_copy && hbUnifiedMemory(device_id);
+    printf("Buffers : %s\n", zero_copy ? "zero copy (CL_MEM_USE_HOST_PTR)" : "device copies");
+    err = hbCreate(a_in, context, CL_MEM_READ_ONLY, sizeof(float) * count, zero_copy);
+    err |= hbCreate(b_in, context, CL_MEM_READ_ONLY, sizeof(float) * count, zero_copy);
+    err |= hbCreate(c_out, context, CL_MEM_WRITE_ONLY, sizeof(float) * count, zero_copy);
+    if (err != CL_SUCCESS)
     {
         printf("Error: Failed to allocate device memory!\n");
         exit(1);
     }
 
-    // Write a and b vectors into compute device memory 
-    err = clEnqueueWriteBuffer(commands, a_in, CL_TRUE, 0, sizeof(float) * count, a_data, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
+    // Write a and b vectors into the buffers, unmapping hands them to the device
+    cl_event map_event[4] = { NULL, NULL, NULL, NULL };
+    if (tracing)
+        trLane(trace, 1, "commands");
+    float* a_map = (float*)hbMap(commands, a_in, CL_MAP_WRITE, tracing ? &map_event[0] : NULL);
+    float* b_map = (float*)hbMap(commands, b_in, CL_MAP_WRITE, tracing ? &map_event[1] : NULL);
+    if (!a_map || !b_map)
     {
-        printf("Error: Failed to write a_data to source array!\n");
+        printf("Error: Failed to map the source arrays!\n");
         exit(1);
     }
-    err = clEnqueueWriteBuffer(commands, b_in, CL_TRUE, 0, sizeof(float) * count, b_data, 0, NULL, NULL);
+    memcpy(a_map, a_data, sizeof(float) * count);
+    memcpy(b_map, b_data, sizeof(float) * count);
+    err = hbUnmap(commands, a_in, tracing ? &map_event[2] : NULL);
+    err |= hbUnmap(commands, b_in, tracing ? &map_event[3] : NULL);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to write b_data to source array!\n");
+        printf("Error: Failed to write a_data to source array!\n");
         exit(1);
     }
+    traceCommand(tracing, "map a", 1, map_event[0]);
+    traceCommand(tracing, "map b", 1, map_event[1]);
+    traceCommand(tracing, "unmap a", 1, map_event[2]);
+    traceCommand(tracing, "unmap b", 1, map_event[3]);
 
     // Set the arguments to our compute kernel
     err = 0;
-    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_in);
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in);
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_out);
-    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &count);
+    err = clSetKernelArg(run_kernel, 0, sizeof(cl_mem), &a_in.mem);
+    err |= clSetKernelArg(run_kernel, 1, sizeof(cl_mem), &b_in.mem);
+    err |= clSetKernelArg(run_kernel, 2, sizeof(cl_mem), &c_out.mem);
+    err |= clSetKernelArg(run_kernel, 3, sizeof(unsigned int), &count);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to set kernel arguments! %d\n", err);
         exit(1);
     }
 
-    // Get the maximum work group size for executing the kernel on the device
-    err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
+    // Get the maximum work group size for executing the kernel on the device, the tuned one if smaller
+    err = clGetKernelWorkGroupInfo(run_kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
     if (err != CL_SUCCESS)
     {
         printf("Error: Failed to retrieve kernel work group info! %d\n", err);
         exit(1);
     }
+    if (tuned.local > 0 && tuned.local < local)
+        local = tuned.local;
+    printTuned(tuned, local);
     double rtime;
     rtime = clock();
+    int span = tracing ? trBegin(trace, "vadd") : 0;
 
     // Execute the kernel over the entire range of our 1d input data set
     // using the maximum number of work group items for this device
-    global = count;
-    printf("Global : %d | Local : %d\n", global, local);
-    err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, NULL);
+    cl_event run_event = NULL;
+    global = tunedGlobal(tuned, count, local);
+    printf("Global : %d | Local : %d\n", (int)global, (int)local);
+    err = clEnqueueNDRangeKernel(commands, run_kernel, 1, NULL, &global, &local, 0, NULL, tracing ? &run_event : NULL);
     if (err)
     {
         printf("Error: Failed to execute kernel!\n");
         return EXIT_FAILURE;
     }
+    traceCommand(tracing, "vadd", 1, run_event);
 
     // Wait for the commands to complete before reading back results
     clFinish(commands);
     rtime = clock() - rtime;
-    printf("\nThe kernel ran in %lf seconds\n", rtime);
+    if (tracing)
+        trEnd(trace, span);
+    printf("\nThe kernel ran in %lf seconds\n", rtime / CLOCKS_PER_SEC);
+    if (tuned.peak > 0.0 && rtime > 0.0)
+    {
+        double gbytes = 3.0 * sizeof(float) * count * 1.0e-9;
+        printf("%.2lf GB/s, %.1lf%% of the copy peak\n",
+            gbytes / (rtime / CLOCKS_PER_SEC), 100.0 * gbytes / (rtime / CLOCKS_PER_SEC) / tuned.peak);
+    }
 
-    // Read back the results from the compute device
-    err = clEnqueueReadBuffer(commands, c_out, CL_TRUE, 0, sizeof(float) * count, c_res, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
+    // Map the results, a read back only when the device has its own memory
+    c_res = (float*)hbMap(commands, c_out, CL_MAP_READ, tracing ? &map_event[0] : NULL);
+    if (!c_res)
     {
-        printf("Error: Failed to read output array! %d\n", err);
+        printf("Error: Failed to read output array!\n");
         exit(1);
     }
+    traceCommand(tracing, "map c", 1, map_event[0]);
 
     // Test the results
     correct = 0;
@@ -233,11 +1317,18 @@ int main(int argc, char** argv)
 
     // summarize results
     printf("C = A+B:  %d out of %d results were correct.\n", correct, count);
+    if (trace_path)
+        trWrite(trace, trace_path);
+    trRelease(trace);
 
     // cleanup then shutdown
-    clReleaseMemObject(a_in);
-    clReleaseMemObject(b_in);
-    clReleaseMemObject(c_out);
+    hbRelease(commands, a_in);
+    hbRelease(commands, b_in);
+    hbRelease(commands, c_out);
+    if (tuned_kernel) {
+        clReleaseKernel(tuned_kernel);
+        clReleaseProgram(tuned_program);
+    }
     clReleaseProgram(program);
     clReleaseKernel(kernel);
     clReleaseCommandQueue(commands);
@@ -17,12 +17,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "CL/cl.h"
+#include "../Common/ElementWise.h"
+#include "../Common/TaskGraph.h"
 
 
 //------------------------------------------------------------------------------
 
 #define TOL    (0.001)   // tolerance used in floating point comparisons
-#define LENGTH (1024)    // length of vectors a, b, and c
+#define LENGTH (1024)    // default length of vectors a, b, and c
 
 //------------------------------------------------------------------------------
 //
@@ -54,12 +56,10 @@ const char* KernelSource = "\n" \
 int main(int argc, char** argv)
 {
     int          err;                   // error code returned from OpenCL calls
-    float        a_data[LENGTH];        // a vector 
-    float        b_data[LENGTH];        // b vector 
-    float        c_data[LENGTH];        // b vector 
-    float        d_data[LENGTH];        // b vector 
-    float        e_data[LENGTH];        // b vector 
-    float        e_res[LENGTH];        // c vector (a+b) returned from the compute device
+    float*       a_data;                // a vector 
+    float*       b_data;                // b vector 
+    float*       e_res;                 // e vector returned from the compute device
+    float*       f_res;                 // e vector returned by the fused kernel
     unsigned int correct;               // number of correct results  
 
     size_t global;                      // global domain size  
@@ -68,6 +68,7 @@ int main(int argc, char** argv)
     cl_device_id     device_id;         // compute device id 
     cl_context       context;           // compute context
     cl_command_queue commands;          // compute command queue
+    cl_command_queue commands2;         // second queue for independent commands
     cl_program       program;           // compute program
     cl_kernel        kernel;            // compute kernel
 
@@ -76,10 +77,24 @@ int main(int argc, char** argv)
     cl_mem c_inout;                       // device memory used for the output c vector
     cl_mem d_inout;                       // device memory used for the output c vector
     cl_mem e_out;                       // device memory used for the output c vector
+    cl_mem f_out;                       // device memory used for the fused output
 
-    // Fill vectors a and b with random float values
+    // usage : VectorAddMultiple [length]
     int i = 0;
     int count = LENGTH;
+    if (argc > 1) count = atoi(argv[1]);
+
+    a_data = (float*)malloc(sizeof(float) * count);
+    b_data = (float*)malloc(sizeof(float) * count);
+    e_res = (float*)malloc(sizeof(float) * count);
+    f_res = (float*)malloc(sizeof(float) * count);
+    if (!a_data || !b_data || !e_res || !f_res)
+    {
+        printf("Error: Failed to allocate host memory!\n");
+        return EXIT_FAILURE;
+    }
+
+    // Fill vectors a and b with random float values
     for (i = 0; i < count; i++) {
         a_data[i] = rand() / (float)RAND_MAX;
         b_data[i] = rand() / (float)RAND_MAX;
@@ -114,9 +129,10 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
-    // Create a command queue
-    commands = clCreateCommandQueue(context, device_id, 0, &err);
-    if (!commands)
+    // Create a command queue ... enable profiling
+    commands = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    commands2 = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (!commands || !commands2)
     {
         printf("Error: Failed to create a command commands!\n");
         return EXIT_FAILURE;
@@ -157,38 +173,13 @@ int main(int argc, char** argv)
     c_inout = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * count, NULL, NULL);
     d_inout = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float) * count, NULL, NULL);
     e_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * count, NULL, NULL);
-    if (!a_in || !b_in || !c_inout || !d_inout || !e_out)
+    f_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * count, NULL, NULL);
+    if (!a_in || !b_in || !c_inout || !d_inout || !e_out || !f_out)
     {
         printf("Error: Failed to allocate device memory!\n");
         exit(1);
     }
 
-    // Write a and b vectors into compute device memory 
-    err = clEnqueueWriteBuffer(commands, a_in, CL_TRUE, 0, sizeof(float) * count, a_data, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to write a_data to source array!\n");
-        exit(1);
-    }
-    err = clEnqueueWriteBuffer(commands, b_in, CL_TRUE, 0, sizeof(float) * count, b_data, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to write b_data to source array!\n");
-        exit(1);
-    }
-
-    // Set the arguments to our compute kernel C = A + B
-    err = 0;
-    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &a_in);
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in);
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &c_inout);
-    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &count);
-    if (err != CL_SUCCESS)
-    {
-        printf("Error: Failed to set kernel arguments! %d\n", err);
-        exit(1);
-    }
-
     // Get the maximum work group size for executing the kernel on the device
     err = clGetKernelWorkGroupInfo(kernel, device_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(local), &local, NULL);
     if (err != CL_SUCCESS)
@@ -196,73 +187,102 @@ int main(int argc, char** argv)
         printf("Error: Failed to retrieve kernel work group info! %d\n", err);
         exit(1);
     }
+    global = ((count + local - 1) / local) * local;
+    printf("Global : %d | Local : %d\n", (int)global, (int)local);
+
+    // C = A + B, D = C + A, E = D + B as a command graph : the dependencies come from
+    // the buffers each command reads and writes, the uploads of a and b are independent
+    // and go on two queues, the host only waits for the final read
+    tgGraph tg;
+    int t_kernel[3];
+    tgWrite(tg, a_in, sizeof(float) * count, a_data);
+    tgWrite(tg, b_in, sizeof(float) * count, b_data);
+
+    t_kernel[0] = tgKernel(tg, kernel, global, local);
+    tgArgIn(tg, t_kernel[0], a_in);
+    tgArgIn(tg, t_kernel[0], b_in);
+    tgArgOut(tg, t_kernel[0], c_inout);
+    tgArg(tg, t_kernel[0], sizeof(unsigned int), &count);
+
+    t_kernel[1] = tgKernel(tg, kernel, global, local);
+    tgArgIn(tg, t_kernel[1], c_inout);
+    tgArgIn(tg, t_kernel[1], a_in);
+    tgArgOut(tg, t_kernel[1], d_inout);
+    tgArg(tg, t_kernel[1], sizeof(unsigned int), &count);
+
+    t_kernel[2] = tgKernel(tg, kernel, global, local);
+    tgArgIn(tg, t_kernel[2], d_inout);
+    tgArgIn(tg, t_kernel[2], b_in);
+    tgArgOut(tg, t_kernel[2], e_out);
+    tgArg(tg, t_kernel[2], sizeof(unsigned int), &count);
+
+    tgRead(tg, e_out, sizeof(float) * count, e_res);
+
     double rtime;
     rtime = clock();
 
-    // Execute the kernel over the entire range of our 1d input data set
-    // using the maximum number of work group items for this device
-    global = count;
-    printf("Global : %d | Local : %d\n", global, local);
-    err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, NULL);
-    if (err)
-    {
-        printf("Error: Failed to execute kernel!\n");
-        return EXIT_FAILURE;
-    }
-
-    // Wait for the commands to complete before reading back results
-    clFinish(commands);
-
-    err = 0; // D = C + A
-    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &c_inout);
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &a_in);
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_inout);
-    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &count);
+    cl_command_queue queues[2] = { commands, commands2 };
+    err = tgRun(tg, queues, 2);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to set kernel arguments! %d\n", err);
+        printf("Error: Failed to run the command graph! %d\n", err);
         exit(1);
     }
 
-    err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, NULL);
-    if (err)
-    {
-        printf("Error: Failed to execute kernel!\n");
-        return EXIT_FAILURE;
-    }
-
-    // Wait for the commands to complete before reading back results
-    clFinish(commands);
+    rtime = clock() - rtime;
+    printf("\nThe graph ran in %lf ms\n", rtime * 1000 / CLOCKS_PER_SEC);
 
-    err = 0; // E = D + B
-    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_inout);
-    err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &b_in);
-    err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &e_out);
-    err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &count);
-    if (err != CL_SUCCESS)
+    // device time of the three launches
+    double unfused_ms = 0.0;
+    for (i = 0; i < 3; i++)
     {
-        printf("Error: Failed to set kernel arguments! %d\n", err);
-        exit(1);
+        cl_ulong ev_start_time = (cl_ulong)0;
+        cl_ulong ev_end_time = (cl_ulong)0;
+        clGetEventProfilingInfo(tgEvent(tg, t_kernel[i]), CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+        clGetEventProfilingInfo(tgEvent(tg, t_kernel[i]), CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+        unfused_ms += (double)(ev_end_time - ev_start_time) * 1.0e-6;
     }
-
-    err = clEnqueueNDRangeKernel(commands, kernel, 1, NULL, &global, &local, 0, NULL, NULL);
-    if (err)
+    tgRelease(tg);
+
+    // Same chain as one fused kernel : E = ((A + B) + A) + B, intermediates stay in registers
+    ewCache cache;
+    ewCacheInit(cache, context, device_id);
+
+    ewGraph g;
+    int na = ewInput(g, a_in), nb = ewInput(g, b_in);
+    int nc = ewOp(g, '+', na, nb);
+    int nd = ewOp(g, '+', nc, na);
+    ewOutput(g, ewOp(g, '+', nd, nb), f_out);
+
+    // first launch builds the program, the second one hits the cache
+    cl_event fused_event;
+    err = ewEnqueue(cache, g, commands, count, 0, NULL, NULL);
+    err |= ewEnqueue(cache, g, commands, count, 0, NULL, &fused_event);
+    if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to execute kernel!\n");
+        printf("Error: Failed to execute fused kernel! %d\n", err);
         return EXIT_FAILURE;
     }
-
-    clFinish(commands);
-
-    err = clEnqueueReadBuffer(commands, e_out, CL_TRUE, 0, sizeof(float) * count, e_res, 0, NULL, NULL);
+    err = clEnqueueReadBuffer(commands, f_out, CL_TRUE, 0, sizeof(float) * count, f_res, 0, NULL, NULL);
     if (err != CL_SUCCESS)
     {
-        printf("Error: Failed to read output array! %d\n", err);
+        printf("Error: Failed to read fused output array! %d\n", err);
         exit(1);
     }
 
-    rtime = clock() - rtime;
-    printf("\nThe kernel ran in %lf seconds\n", rtime);
+    cl_ulong ev_start_time = (cl_ulong)0;
+    cl_ulong ev_end_time = (cl_ulong)0;
+    clGetEventProfilingInfo(fused_event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &ev_start_time, NULL);
+    clGetEventProfilingInfo(fused_event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &ev_end_time, NULL);
+    double fused_ms = (double)(ev_end_time - ev_start_time) * 1.0e-6;
+    clReleaseEvent(fused_event);
+
+    size_t unfused_bytes = ewBytesUnfused(g, count);
+    size_t fused_bytes = ewBytesFused(g, count);
+    printf("\nShape %s || cache %d hits %d misses\n", ewShape(g).c_str(), cache.hits, cache.misses);
+    printf("Unfused : 3 launches, %.3lf ms, %.2lf MB moved\n", unfused_ms, unfused_bytes * 1.0e-6);
+    printf("Fused   : 1 launch,  %.3lf ms, %.2lf MB moved\n", fused_ms, fused_bytes * 1.0e-6);
+    printf("Traffic / %.2lf || time / %.2lf\n", (double)unfused_bytes / fused_bytes, unfused_ms / fused_ms);
 
     // Test the results
     correct = 0;
@@ -271,10 +291,10 @@ int main(int argc, char** argv)
     {
         tmp = 2 * a_data[i] + 2 * b_data[i]; // assign element i of a+b to tmp
         tmp -= e_res[i];             // compute deviation of expected and output result
-        if (tmp * tmp < TOL * TOL)        // correct if square deviation is less than tolerance squared
+        if (tmp * tmp < TOL * TOL && e_res[i] == f_res[i])        // correct if square deviation is less than tolerance squared, fused result must be identical
             correct++;
         else {
-            printf(" tmp %f a_data %f b_data %f c_res %f \n", tmp, a_data[i], b_data[i], e_res[i]);
+            printf(" tmp %f a_data %f b_data %f e_res %f f_res %f \n", tmp, a_data[i], b_data[i], e_res[i], f_res[i]);
         }
 
     }
@@ -288,10 +308,17 @@ int main(int argc, char** argv)
     clReleaseMemObject(c_inout);
     clReleaseMemObject(d_inout);
     clReleaseMemObject(e_out);
+    clReleaseMemObject(f_out);
+    ewCacheRelease(cache);
     clReleaseProgram(program);
     clReleaseKernel(kernel);
     clReleaseCommandQueue(commands);
+    clReleaseCommandQueue(commands2);
     clReleaseContext(context);
+    free(a_data);
+    free(b_data);
+    free(e_res);
+    free(f_res);
 
     return 0;
 }